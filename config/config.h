@@ -9,4 +9,66 @@
 
 #define ARCH          ARCH_X86_64
 
+/*
+ * 自旋锁实现
+ * SPINLOCK_TAS     测试并设置，最简单，不公平
+ * SPINLOCK_TICKET  排号锁，先到先得
+ * SPINLOCK_QUEUED  MCS队列锁，每个等待者在自己的节点上自旋
+ */
+#define SPINLOCK_TAS      0
+#define SPINLOCK_TICKET   1
+#define SPINLOCK_QUEUED   2
+
+#ifndef SPINLOCK_TYPE
+#define SPINLOCK_TYPE     SPINLOCK_QUEUED
+#endif
+
+/*
+ * 锁统计
+ * 打开后记录每个自旋锁的获取、竞争和等待周期
+ * 通过lock_stat_dump输出到串口
+ */
+#ifndef LOCK_STAT
+#define LOCK_STAT         0
+#endif
+
+/*
+ * 跟踪点
+ * 打开后伙伴系统和内核堆的事件写入每个核心的环形缓冲区
+ * 通过trace_dump输出到串口，用tools/trace_decode.py解码
+ */
+#ifndef TRACE
+#define TRACE             0
+#endif
+
+/*
+ * 透明大页
+ * 打开后匿名内存在2MB对齐的区域中缺页时直接分配2MB页
+ * 空闲时把填满4KB页的区域合并成2MB页
+ */
+#ifndef THP
+#define THP               1
+#endif
+
+/*
+ * 日志级别
+ * 级别数值大于LOG_LEVEL的kprintf在编译时被去掉，参数也不会被求值
+ */
+#define LOG_EMERG         0
+#define LOG_ERR           3
+#define LOG_WARN          4
+#define LOG_INFO          6
+#define LOG_DEBUG         7
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL         LOG_INFO
+#endif
+
+/*
+ * 每个核心LAPIC定时器每秒的中断次数
+ */
+#ifndef TIMER_HZ
+#define TIMER_HZ          100
+#endif
+
 #endif // CONFIG_H 
\ No newline at end of file
@@ -0,0 +1,197 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <io.h>
+#include <serial.h>
+#include <printk.h>
+#include <mm/bootmem/linear_map.h>
+#include "cpu.h"
+#include "idt.h"
+#include "apic.h"
+
+// PIT输入时钟频率
+#define PIT_FREQUENCY       1193182
+#define PIT_CH2_DATA        0x42
+#define PIT_COMMAND         0x43
+#define PIT_CH2_GATE        0x61
+
+// 校准时长(ms)
+#define CALIBRATE_MS        10
+
+static bool x2apic = false;
+static volatile uint32_t *xapic_regs = NULL;
+
+// 分频16时定时器每秒的计数，0表示还没有校准
+static uint32_t timer_frequency = 0;
+
+static DEFINE_PER_CPU(uint64_t, timer_ticks);
+
+static inline uint32_t lapic_read(uint32_t reg) {
+    if (x2apic) {
+        uint32_t lo, hi;
+        rdmsr(MSR_X2APIC_BASE + (reg >> 4), &lo, &hi);
+        return lo;
+    }
+
+    return xapic_regs[reg >> 2];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value) {
+    if (x2apic) {
+        wrmsr(MSR_X2APIC_BASE + (reg >> 4), value, 0);
+        return;
+    }
+
+    xapic_regs[reg >> 2] = value;
+}
+
+/*
+ * ICR
+ * x2APIC模式下是一个64位MSR，高32位是目标APIC ID
+ * xAPIC模式下先写目标再写低32位，写低32位时发送
+ */
+static void lapic_write_icr(uint32_t dest, uint32_t low) {
+    if (x2apic) {
+        wrmsr(MSR_X2APIC_BASE + (LAPIC_ICR_LOW >> 4), low, dest);
+        return;
+    }
+
+    while (lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING) {
+        __asm__ __volatile__("pause");
+    }
+
+    lapic_write(LAPIC_ICR_HIGH, dest << 24);
+    lapic_write(LAPIC_ICR_LOW, low);
+}
+
+static bool cpu_has_x2apic(void) {
+    uint32_t eax = 1, ebx, ecx = 0, edx;
+    __asm__ __volatile__("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+    return (ecx & (1 << 21)) != 0;
+}
+
+/*
+ * 用PIT通道2计时CALIBRATE_MS毫秒
+ * 期间LAPIC定时器从最大值开始倒数，差值就是这段时间的计数
+ */
+static uint32_t lapic_timer_calibrate(void) {
+    uint16_t latch = PIT_FREQUENCY / (1000 / CALIBRATE_MS);
+    uint8_t gate = inb(PIT_CH2_GATE);
+
+    // 打开通道2的门，关闭扬声器
+    outb(PIT_CH2_GATE, (gate & ~0x02) | 0x01);
+
+    // 通道2，先低后高，模式0
+    outb(PIT_COMMAND, 0xB0);
+    outb(PIT_CH2_DATA, latch & 0xFF);
+
+    lapic_write(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+
+    // 写入高字节后开始计数
+    outb(PIT_CH2_DATA, latch >> 8);
+
+    // 计数结束时OUT2变为高电平
+    while ((inb(PIT_CH2_GATE) & 0x20) == 0) {
+        __asm__ __volatile__("pause");
+    }
+
+    uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT);
+
+    lapic_write(LAPIC_TIMER_INIT, 0);
+    outb(PIT_CH2_GATE, gate);
+
+    return elapsed * (1000 / CALIBRATE_MS);
+}
+
+static void lapic_timer_handler(interrupt_frame_t *frame) {
+    this_cpu_inc(timer_ticks);
+}
+
+static void lapic_error_handler(interrupt_frame_t *frame) {
+    // 读之前先写，ESR才会更新
+    lapic_write(LAPIC_ESR, 0);
+    uint32_t esr = lapic_read(LAPIC_ESR);
+
+    pr_err("[APIC] ERROR: ESR %x on core %u\n", esr, cpu_id());
+}
+
+void lapic_init(void) {
+    uint32_t lo, hi;
+    rdmsr(MSR_APIC_BASE, &lo, &hi);
+
+    lo |= APIC_BASE_ENABLE;
+
+    if (cpu_has_x2apic()) {
+        lo |= APIC_BASE_X2APIC;
+        x2apic = true;
+    } else if (xapic_regs == NULL) {
+        uint64_t base = ((uint64_t)hi << 32) | (lo & ~0xFFFU);
+        xapic_regs = (volatile uint32_t *)PHYS_TO_LINEAR(base);
+    }
+
+    wrmsr(MSR_APIC_BASE, lo, hi);
+
+    // 接收所有优先级的中断
+    lapic_write(LAPIC_TPR, 0);
+
+    // LINT0由8259使用，已经被屏蔽；LINT1接NMI
+    lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_LINT1, LAPIC_LVT_NMI);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_ERROR, VECTOR_APIC_ERROR);
+
+    // 清除之前的错误
+    lapic_write(LAPIC_ESR, 0);
+    lapic_write(LAPIC_ESR, 0);
+
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | VECTOR_SPURIOUS);
+
+    if (timer_frequency == 0) {
+        interrupt_register(VECTOR_TIMER, lapic_timer_handler);
+        interrupt_register(VECTOR_APIC_ERROR, lapic_error_handler);
+
+        timer_frequency = lapic_timer_calibrate();
+
+        pr_info("[APIC] %s mode, timer %u Hz\n", x2apic ? "x2APIC" : "xAPIC", timer_frequency);
+    }
+}
+
+uint32_t lapic_id(void) {
+    uint32_t id = lapic_read(LAPIC_ID);
+    return x2apic ? id : id >> 24;
+}
+
+bool lapic_x2apic(void) {
+    return x2apic;
+}
+
+void lapic_eoi(void) {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector) {
+    lapic_write_icr(apic_id, LAPIC_ICR_ASSERT | vector);
+}
+
+void lapic_send_ipi_all_but_self(uint8_t vector) {
+    lapic_write_icr(0, LAPIC_ICR_ALL_BUT_SELF | LAPIC_ICR_ASSERT | vector);
+}
+
+void lapic_timer_start(uint32_t hz) {
+    uint32_t count = timer_frequency / hz;
+
+    lapic_write(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_PERIODIC | VECTOR_TIMER);
+    lapic_write(LAPIC_TIMER_INIT, count ? count : 1);
+}
+
+void lapic_timer_stop(void) {
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+}
+
+uint64_t lapic_timer_ticks(void) {
+    return this_cpu_read(timer_ticks);
+}
@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef _APIC_H
+#define _APIC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MSR_APIC_BASE           0x1B
+#define APIC_BASE_X2APIC        (1 << 10)
+#define APIC_BASE_ENABLE        (1 << 11)
+
+// x2APIC的寄存器MSR = 0x800 + xAPIC偏移 / 16
+#define MSR_X2APIC_BASE         0x800
+
+// LAPIC寄存器，xAPIC模式下的MMIO偏移
+#define LAPIC_ID                0x020
+#define LAPIC_VERSION           0x030
+#define LAPIC_TPR               0x080
+#define LAPIC_EOI               0x0B0
+#define LAPIC_SVR               0x0F0
+#define LAPIC_ESR               0x280
+#define LAPIC_ICR_LOW           0x300
+#define LAPIC_ICR_HIGH          0x310
+#define LAPIC_LVT_TIMER         0x320
+#define LAPIC_LVT_LINT0         0x350
+#define LAPIC_LVT_LINT1         0x360
+#define LAPIC_LVT_ERROR         0x370
+#define LAPIC_TIMER_INIT        0x380
+#define LAPIC_TIMER_CURRENT     0x390
+#define LAPIC_TIMER_DIV         0x3E0
+
+#define LAPIC_SVR_ENABLE        (1 << 8)
+#define LAPIC_LVT_MASKED        (1 << 16)
+#define LAPIC_LVT_NMI           (4 << 8)
+#define LAPIC_TIMER_PERIODIC    (1 << 17)
+#define LAPIC_TIMER_DIV_16      0x3
+
+// ICR
+#define LAPIC_ICR_PENDING       (1 << 12)
+#define LAPIC_ICR_ASSERT        (1 << 14)
+#define LAPIC_ICR_ALL_BUT_SELF  (3 << 18)
+
+/*
+ * 初始化当前核心的LAPIC
+ * CPU支持时切换到x2APIC模式，否则通过线性映射访问xAPIC寄存器
+ * 第一次调用时用PIT校准定时器频率，所以BSP必须先调用
+ */
+void lapic_init(void);
+
+// 当前核心的APIC ID
+uint32_t lapic_id(void);
+
+// 是否工作在x2APIC模式
+bool lapic_x2apic(void);
+
+// 结束当前中断
+void lapic_eoi(void);
+
+/**
+ * 发送IPI
+ *
+ * @param apic_id 目标核心的APIC ID
+ * @param vector  向量号
+ */
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector);
+
+/**
+ * 向除自己以外的所有核心发送IPI
+ *
+ * @param vector 向量号
+ */
+void lapic_send_ipi_all_but_self(uint8_t vector);
+
+/**
+ * 启动当前核心的周期定时器
+ * 每次到期产生VECTOR_TIMER中断
+ *
+ * @param hz 每秒中断次数
+ */
+void lapic_timer_start(uint32_t hz);
+
+// 停止当前核心的定时器
+void lapic_timer_stop(void);
+
+// 当前核心收到的定时器中断次数
+uint64_t lapic_timer_ticks(void);
+
+#endif // _APIC_H
@@ -0,0 +1,52 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef _CPU_H
+#define _CPU_H
+
+#include <stdint.h>
+#include <bootboot.h>
+#include "tss.h"
+#include "percpu.h"
+
+#define MAX_CPUS 507
+
+// MSR
+#define MSR_GS_BASE         0xC0000101
+#define MSR_KERNEL_GS_BASE  0xC0000102
+
+// 每个核心的私有结构，是per-CPU变量cpu_info
+typedef struct cpu {
+    uint32_t id;            // 核心编号
+    uint32_t apic_id;
+    uint64_t stack_top;     // 内核栈顶
+    tss_t tss;
+} cpu_t;
+
+DECLARE_PER_CPU(cpu_t, cpu_info);
+
+/*
+ * 获取当前核心编号
+ * 从per-CPU变量读取，percpu_init之前BSP读到的是模板中的0
+ */
+static inline uint32_t cpu_id(void) {
+    return this_cpu_read(cpu_number);
+}
+
+// BOOTBOOT报告的核心数
+static inline uint32_t cpu_count(void) {
+    uint32_t count = ((BOOTBOOT*)BOOTBOOT_INFO)->numcores;
+    return count ? count : 1;
+}
+
+// 获取当前核心的cpu_t
+static inline cpu_t *this_cpu(void) {
+    return this_cpu_ptr(&cpu_info);
+}
+
+/*
+ * 初始化当前核心
+ * 加载GDT、本核心的TSS和IDT，GS基址指向本核心的per-CPU副本
+ */
+void cpu_init(cpu_t *cpu);
+
+#endif // _CPU_H
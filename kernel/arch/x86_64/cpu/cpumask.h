@@ -0,0 +1,60 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef _CPUMASK_H
+#define _CPUMASK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "cpu.h"
+
+#define CPUMASK_WORDS ((MAX_CPUS + 63) / 64)
+
+// 核心集合，第n位表示核心n
+typedef struct {
+    uint64_t bits[CPUMASK_WORDS];
+} cpumask_t;
+
+static inline void cpumask_clear_all(cpumask_t *mask) {
+    for (uint32_t i = 0; i < CPUMASK_WORDS; i++) {
+        mask->bits[i] = 0;
+    }
+}
+
+// 原子地加入和移出，可以和其他核心并发修改
+static inline void cpumask_set(cpumask_t *mask, uint32_t cpu) {
+    __atomic_fetch_or(&mask->bits[cpu / 64], 1ULL << (cpu % 64), __ATOMIC_SEQ_CST);
+}
+
+static inline void cpumask_clear(cpumask_t *mask, uint32_t cpu) {
+    __atomic_fetch_and(&mask->bits[cpu / 64], ~(1ULL << (cpu % 64)), __ATOMIC_SEQ_CST);
+}
+
+static inline bool cpumask_test(const cpumask_t *mask, uint32_t cpu) {
+    return (__atomic_load_n(&mask->bits[cpu / 64], __ATOMIC_ACQUIRE) >> (cpu % 64)) & 1;
+}
+
+// 取一份快照
+static inline void cpumask_copy(cpumask_t *dst, const cpumask_t *src) {
+    for (uint32_t i = 0; i < CPUMASK_WORDS; i++) {
+        dst->bits[i] = __atomic_load_n(&src->bits[i], __ATOMIC_ACQUIRE);
+    }
+}
+
+// 从start开始的下一个核心，没有返回MAX_CPUS
+static inline uint32_t cpumask_next(const cpumask_t *mask, uint32_t start) {
+    for (uint32_t cpu = start; cpu < MAX_CPUS; ) {
+        uint64_t word = mask->bits[cpu / 64] >> (cpu % 64);
+
+        if (word != 0) {
+            return cpu + __builtin_ctzll(word);
+        }
+        cpu = (cpu / 64 + 1) * 64;
+    }
+
+    return MAX_CPUS;
+}
+
+#define for_each_cpu(cpu, mask) \
+    for ((cpu) = cpumask_next((mask), 0); (cpu) < MAX_CPUS; (cpu) = cpumask_next((mask), (cpu) + 1))
+
+#endif // _CPUMASK_H
@@ -4,17 +4,36 @@
 #define _GDT_H
 
 #include <stdint.h>
+#include "cpu.h"
 
-#define MAX_CPUS 507
 typedef uint64_t gdt_descriptor;
 
+// 64位TSS描述符占两个GDT项
+typedef struct {
+    uint64_t low;
+    uint64_t high;
+} __attribute__((packed)) tss_descriptor;
+
 typedef struct {
     gdt_descriptor null;
     gdt_descriptor kernel_code;
     gdt_descriptor kernel_data;
     gdt_descriptor user_code;
     gdt_descriptor user_data;
-    gdt_descriptor tss[max_cpus];
+    tss_descriptor tss[MAX_CPUS];
 } __attribute__((aligned(4096))) gdt_t;
 
+// 段选择子
+#define GDT_KERNEL_CODE   0x08
+#define GDT_KERNEL_DATA   0x10
+#define GDT_USER_CODE     0x18
+#define GDT_USER_DATA     0x20
+#define GDT_TSS(cpu)      (0x28 + (cpu) * sizeof(tss_descriptor))
+
+// 段描述符
+#define GDT_KERNEL_CODE_DESC  0x00AF9A000000FFFFULL
+#define GDT_KERNEL_DATA_DESC  0x00CF92000000FFFFULL
+#define GDT_USER_CODE_DESC    0x00AFFA000000FFFFULL
+#define GDT_USER_DATA_DESC    0x00CFF2000000FFFFULL
+
 #endif // _GDT_H
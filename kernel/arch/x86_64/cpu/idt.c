@@ -0,0 +1,129 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <serial.h>
+#include "cpu.h"
+#include "gdt.h"
+#include "idt.h"
+#include "apic.h"
+
+// isr.asm中每个向量的入口
+extern uint64_t isr_stubs[IDT_ENTRIES];
+
+static idt_entry_t idt[IDT_ENTRIES] __attribute__((aligned(16)));
+static interrupt_handler_t handlers[IDT_ENTRIES];
+
+// 中断门，present，DPL0
+#define IDT_INTERRUPT_GATE 0x8E
+
+static const char *exception_names[VECTOR_EXCEPTIONS] = {
+    "Divide Error", "Debug", "NMI", "Breakpoint",
+    "Overflow", "BOUND Range Exceeded", "Invalid Opcode", "Device Not Available",
+    "Double Fault", "Coprocessor Segment Overrun", "Invalid TSS", "Segment Not Present",
+    "Stack-Segment Fault", "General Protection", "Page Fault", "Reserved",
+    "x87 Floating-Point", "Alignment Check", "Machine Check", "SIMD Floating-Point",
+    "Virtualization", "Control Protection", "Reserved", "Reserved",
+    "Reserved", "Reserved", "Reserved", "Reserved",
+    "Hypervisor Injection", "VMM Communication", "Security", "Reserved",
+};
+
+static void idt_set_gate(uint8_t vector, uint64_t handler, uint8_t ist) {
+    idt[vector].offset_low = handler & 0xFFFF;
+    idt[vector].selector = GDT_KERNEL_CODE;
+    idt[vector].ist = ist;
+    idt[vector].type_attr = IDT_INTERRUPT_GATE;
+    idt[vector].offset_mid = (handler >> 16) & 0xFFFF;
+    idt[vector].offset_high = handler >> 32;
+    idt[vector].reserved = 0;
+}
+
+void idt_init(void) {
+    for (uint32_t vector = 0; vector < IDT_ENTRIES; vector++) {
+        idt_set_gate(vector, isr_stubs[vector], 0);
+        handlers[vector] = NULL;
+    }
+
+    idt[EXCEPTION_DF].ist = IST_DF;
+    idt[EXCEPTION_NMI].ist = IST_NMI;
+    idt[EXCEPTION_MC].ist = IST_MC;
+}
+
+void idt_load(void) {
+    struct {
+        uint16_t limit;
+        uint64_t base;
+    } __attribute__((packed)) idtr = { sizeof(idt) - 1, (uint64_t)idt };
+
+    __asm__ __volatile__("lidt %0" : : "m"(idtr) : "memory");
+}
+
+void interrupt_register(uint8_t vector, interrupt_handler_t handler) {
+    __atomic_store_n(&handlers[vector], handler, __ATOMIC_RELEASE);
+}
+
+void exception_panic(interrupt_frame_t *frame) {
+    serial_puts("\n[EXCEPTION] ");
+    serial_puts(exception_names[frame->vector]);
+    serial_puts(" on core ");
+    serial_put_dec(cpu_id());
+    serial_puts("\n  vector ");
+    serial_put_dec(frame->vector);
+    serial_puts(" error ");
+    serial_put_hex(frame->error_code);
+
+    if (frame->vector == EXCEPTION_PF) {
+        uint64_t cr2;
+        __asm__ __volatile__("mov %%cr2, %0" : "=r"(cr2));
+        serial_puts(" cr2 ");
+        serial_put_hex(cr2);
+    }
+
+    serial_puts("\n  rip ");
+    serial_put_hex(frame->rip);
+    serial_puts(" rsp ");
+    serial_put_hex(frame->rsp);
+    serial_puts(" rflags ");
+    serial_put_hex(frame->rflags);
+    serial_puts("\n  rax ");
+    serial_put_hex(frame->rax);
+    serial_puts(" rbx ");
+    serial_put_hex(frame->rbx);
+    serial_puts(" rcx ");
+    serial_put_hex(frame->rcx);
+    serial_puts(" rdx ");
+    serial_put_hex(frame->rdx);
+    serial_puts("\n  rsi ");
+    serial_put_hex(frame->rsi);
+    serial_puts(" rdi ");
+    serial_put_hex(frame->rdi);
+    serial_puts(" rbp ");
+    serial_put_hex(frame->rbp);
+    serial_puts("\n");
+
+    panic("[EXCEPTION] Halted\n");
+}
+
+/*
+ * 所有中断的C入口
+ * 由isr.asm在保存现场后调用
+ */
+void interrupt_dispatch(interrupt_frame_t *frame) {
+    uint8_t vector = (uint8_t)frame->vector;
+    interrupt_handler_t handler = __atomic_load_n(&handlers[vector], __ATOMIC_ACQUIRE);
+
+    if (handler != NULL) {
+        handler(frame);
+    } else if (vector < VECTOR_EXCEPTIONS) {
+        exception_panic(frame);
+    } else if (vector != VECTOR_SPURIOUS) {
+        serial_puts("[IDT] WARNING: Unhandled vector ");
+        serial_put_dec(vector);
+        serial_puts("\n");
+    }
+
+    // 伪中断不需要EOI
+    if (vector >= VECTOR_EXCEPTIONS && vector != VECTOR_SPURIOUS) {
+        lapic_eoi();
+    }
+}
@@ -0,0 +1,125 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef _IDT_H
+#define _IDT_H
+
+#include <stdint.h>
+
+#define IDT_ENTRIES 256
+
+/*
+ * 向量分配
+ * 0-31     CPU异常
+ * 32-47    ISA中断，经IOAPIC路由
+ * 0xEF     LAPIC定时器
+ * 0xF0-    IPI，0xF0为TLB shootdown，0xF1为smp_call_function
+ * 0xFE     LAPIC错误
+ * 0xFF     伪中断
+ */
+#define VECTOR_EXCEPTIONS   32
+#define VECTOR_IRQ_BASE     0x20
+#define VECTOR_TIMER        0xEF
+#define VECTOR_IPI_BASE     0xF0
+#define VECTOR_IPI_TLB      (VECTOR_IPI_BASE + 0)
+#define VECTOR_IPI_CALL     (VECTOR_IPI_BASE + 1)
+#define VECTOR_APIC_ERROR   0xFE
+#define VECTOR_SPURIOUS     0xFF
+
+// 常用异常
+#define EXCEPTION_NMI       2
+#define EXCEPTION_DF        8
+#define EXCEPTION_GP        13
+#define EXCEPTION_PF        14
+#define EXCEPTION_MC        18
+
+/*
+ * TSS中的IST栈
+ * 双重错误、NMI和机器检查可能发生在内核栈已经损坏的时候
+ * 使用独立的栈
+ */
+#define IST_DF          1
+#define IST_NMI         2
+#define IST_MC          3
+#define IST_COUNT       3
+#define IST_STACK_SIZE  (4 * 1024)
+
+/*
+ * isr.asm保存的现场
+ * 从低地址到高地址依次是通用寄存器、向量号、错误码和CPU压入的中断帧
+ */
+typedef struct {
+    uint64_t r15, r14, r13, r12, r11, r10, r9, r8;
+    uint64_t rbp, rdi, rsi, rdx, rcx, rbx, rax;
+    uint64_t vector;
+    uint64_t error_code;        // 没有错误码的异常为0
+    uint64_t rip;
+    uint64_t cs;
+    uint64_t rflags;
+    uint64_t rsp;
+    uint64_t ss;
+} interrupt_frame_t;
+
+typedef void (*interrupt_handler_t)(interrupt_frame_t *frame);
+
+// 64位中断门
+typedef struct {
+    uint16_t offset_low;
+    uint16_t selector;
+    uint8_t ist;
+    uint8_t type_attr;
+    uint16_t offset_mid;
+    uint32_t offset_high;
+    uint32_t reserved;
+} __attribute__((packed)) idt_entry_t;
+
+/*
+ * 建立IDT
+ * 所有向量指向isr.asm中的入口，异常默认输出现场后停机
+ * 只在BSP上调用一次
+ */
+void idt_init(void);
+
+// 在当前核心加载IDT，由cpu_init调用
+void idt_load(void);
+
+/**
+ * 注册中断处理函数
+ * 向量号不小于32时，处理函数返回后自动发送EOI
+ *
+ * @param vector  向量号
+ * @param handler 处理函数，NULL表示取消注册
+ */
+void interrupt_register(uint8_t vector, interrupt_handler_t handler);
+
+/**
+ * 输出异常现场后停机
+ * 没有处理函数的异常调用，异常处理函数无法处理时也可以调用
+ *
+ * @param frame 异常现场
+ */
+void exception_panic(interrupt_frame_t *frame);
+
+// 开关当前核心的中断
+static inline void interrupts_enable(void) {
+    __asm__ __volatile__("sti" : : : "memory");
+}
+
+static inline void interrupts_disable(void) {
+    __asm__ __volatile__("cli" : : : "memory");
+}
+
+// 关中断并返回之前的RFLAGS
+static inline uint64_t interrupts_save(void) {
+    uint64_t flags;
+    __asm__ __volatile__("pushfq; popq %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+// 恢复interrupts_save之前的中断状态
+static inline void interrupts_restore(uint64_t flags) {
+    if (flags & (1 << 9)) {
+        interrupts_enable();
+    }
+}
+
+#endif // _IDT_H
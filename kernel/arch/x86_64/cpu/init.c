@@ -1,2 +1,85 @@
 /* SPDX-License-Identifier: Apache-2.0 */
- 
\ No newline at end of file
+
+#include <stdint.h>
+#include <io.h>
+#include "cpu.h"
+#include "gdt.h"
+#include "tss.h"
+#include "idt.h"
+
+/*
+ * 全局GDT
+ * 所有核心共用代码段和数据段
+ * 每个核心在tss[]中有自己的TSS描述符
+ */
+static gdt_t gdt = {
+    .null        = 0,
+    .kernel_code = GDT_KERNEL_CODE_DESC,
+    .kernel_data = GDT_KERNEL_DATA_DESC,
+    .user_code   = GDT_USER_CODE_DESC,
+    .user_data   = GDT_USER_DATA_DESC,
+};
+
+// 可用的64位TSS，present，DPL0
+#define TSS_DESC_TYPE 0x89ULL
+
+static void tss_desc_set(uint32_t index, tss_t *tss) {
+    uint64_t base = (uint64_t)tss;
+    uint64_t limit = sizeof(tss_t) - 1;
+
+    gdt.tss[index].low = (limit & 0xFFFF) |
+                         ((base & 0xFFFFFF) << 16) |
+                         (TSS_DESC_TYPE << 40) |
+                         (((limit >> 16) & 0xF) << 48) |
+                         (((base >> 24) & 0xFF) << 56);
+    gdt.tss[index].high = base >> 32;
+}
+
+/*
+ * 加载GDT并重新加载段寄存器
+ * CS需要通过远返回重新加载
+ * 写GS选择子会清零GS基址，所以GS基址要在之后设置
+ */
+static void gdt_load(void) {
+    struct {
+        uint16_t limit;
+        uint64_t base;
+    } __attribute__((packed)) gdtr = { sizeof(gdt_t) - 1, (uint64_t)&gdt };
+
+    __asm__ __volatile__(
+        "lgdt %0\n"
+        "pushq %1\n"
+        "leaq 1f(%%rip), %%rax\n"
+        "pushq %%rax\n"
+        "lretq\n"
+        "1:\n"
+        "movw %w2, %%ds\n"
+        "movw %w2, %%es\n"
+        "movw %w2, %%ss\n"
+        "movw %w3, %%fs\n"
+        "movw %w3, %%gs\n"
+        :
+        : "m"(gdtr), "i"(GDT_KERNEL_CODE), "r"(GDT_KERNEL_DATA), "r"(0)
+        : "rax", "memory");
+}
+
+DEFINE_PER_CPU(cpu_t, cpu_info);
+
+void cpu_init(cpu_t *cpu) {
+    // 没有IO位图
+    cpu->tss.iomap_base = sizeof(tss_t);
+    cpu->tss.rsp0 = cpu->stack_top;
+
+    tss_desc_set(cpu->id, &cpu->tss);
+
+    gdt_load();
+
+    uint16_t selector = GDT_TSS(cpu->id);
+    __asm__ __volatile__("ltr %0" : : "r"(selector) : "memory");
+
+    idt_load();
+
+    // 重新加载GS选择子清零了GS基址
+    percpu_load(cpu->id);
+    wrmsr(MSR_KERNEL_GS_BASE, 0, 0);
+}
@@ -0,0 +1,75 @@
+; SPDX-License-Identifier: Apache-2.0
+
+section .text
+extern interrupt_dispatch
+
+; 会压入错误码的异常
+%define HAS_ERROR_CODE(v) ((v) == 8 || ((v) >= 10 && (v) <= 14) || (v) == 17 || (v) == 21 || (v) == 29 || (v) == 30)
+
+; 每个向量一个入口
+; 没有错误码的向量压入0，使栈上的布局一致，然后压入向量号
+%assign i 0
+%rep 256
+isr_stub_%+i:
+%if HAS_ERROR_CODE(i) == 0
+    push qword 0
+%endif
+    push qword i
+    jmp isr_common
+%assign i i+1
+%endrep
+
+; 保存通用寄存器，布局与idt.h中的interrupt_frame_t一致
+; CPU压入中断帧前已经把栈对齐到16字节
+; 中断帧、错误码、向量号和15个寄存器共22项，调用时栈仍然对齐
+isr_common:
+    cld
+    push rax
+    push rbx
+    push rcx
+    push rdx
+    push rsi
+    push rdi
+    push rbp
+    push r8
+    push r9
+    push r10
+    push r11
+    push r12
+    push r13
+    push r14
+    push r15
+
+    mov rdi, rsp
+    call interrupt_dispatch
+
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rbp
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rbx
+    pop rax
+
+    ; 跳过向量号和错误码
+    add rsp, 16
+    iretq
+
+section .rodata
+global isr_stubs
+
+; idt_init使用的入口地址表
+isr_stubs:
+%assign i 0
+%rep 256
+    dq isr_stub_%+i
+%assign i i+1
+%endrep
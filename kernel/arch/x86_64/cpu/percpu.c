@@ -0,0 +1,73 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <io.h>
+#include <serial.h>
+#include <printk.h>
+#include <mm/bootmem/boot_allot.h>
+#include <mm/pmm/pmm.h>
+#include "cpu.h"
+#include "percpu.h"
+
+// linker.ld中.percpu节的范围
+extern char __per_cpu_start[];
+extern char __per_cpu_end[];
+
+DEFINE_PER_CPU(uint64_t, this_cpu_off) = 0;
+DEFINE_PER_CPU(uint32_t, cpu_number) = 0;
+
+uint64_t per_cpu_offset[MAX_CPUS];
+static uint32_t per_cpu_count = 0;
+
+void percpu_load(uint32_t cpu) {
+    uint64_t base = per_cpu_offset[cpu];
+    wrmsr(MSR_GS_BASE, (uint32_t)base, (uint32_t)(base >> 32));
+}
+
+/*
+ * 所有副本放在一块连续内存中，每份按缓存行对齐
+ * 副本从模板复制，所以带初始值的per-CPU变量在每个核心上都有同样的初始值
+ */
+void percpu_init(void) {
+    BOOTBOOT *bootboot = (BOOTBOOT *)BOOTBOOT_INFO;
+    uint32_t count = cpu_count();
+
+    if (count > MAX_CPUS) {
+        count = MAX_CPUS;
+    }
+
+    uint64_t size = (uint64_t)(__per_cpu_end - __per_cpu_start);
+    uint64_t stride = (size + CACHE_LINE_SIZE - 1) & ~(uint64_t)(CACHE_LINE_SIZE - 1);
+    uint64_t pages = (stride * count + PAGE_SIZE - 1) / PAGE_SIZE;
+
+    uint8_t *area = pages ? (uint8_t *)boot_alloc(pages) : NULL;
+    if (pages != 0 && area == NULL) {
+        panic("[PERCPU] ERROR: Cannot allocate per-CPU area\n");
+    }
+
+    for (uint32_t cpu = 0; cpu < count; cpu++) {
+        uint8_t *copy = area + stride * cpu;
+
+        for (uint64_t i = 0; i < size; i++) {
+            copy[i] = (uint8_t)__per_cpu_start[i];
+        }
+
+        per_cpu_offset[cpu] = (uint64_t)copy - (uint64_t)__per_cpu_start;
+        *per_cpu_ptr(&this_cpu_off, cpu) = per_cpu_offset[cpu];
+        *per_cpu_ptr(&cpu_number, cpu) = cpu;
+    }
+
+    per_cpu_count = count;
+
+    // BSP从模板切换到自己的副本
+    if (bootboot->bspid < count) {
+        percpu_load(bootboot->bspid);
+    }
+
+    pr_info("[PERCPU] %u copies of %lu bytes\n", count, size);
+}
+
+uint32_t percpu_count(void) {
+    return per_cpu_count;
+}
@@ -0,0 +1,85 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef _PERCPU_H
+#define _PERCPU_H
+
+#include <stdint.h>
+
+/*
+ * per-CPU变量
+ *
+ * 用DEFINE_PER_CPU定义的变量放在.percpu节中，链接后的这一节只是模板
+ * percpu_init为每个核心复制一份，GS基址 = 副本地址 - __per_cpu_start
+ * 所以 gs:变量地址 就是当前核心副本中的这个变量
+ *
+ * percpu_init之前BSP的GS基址为0，访问的就是模板本身
+ */
+#define DEFINE_PER_CPU(type, name) \
+    __attribute__((section(".percpu"))) __typeof__(type) name
+
+#define DECLARE_PER_CPU(type, name) \
+    extern __attribute__((section(".percpu"))) __typeof__(type) name
+
+// 各核心副本相对模板的偏移，按核心编号索引
+extern uint64_t per_cpu_offset[];
+
+// 当前核心的偏移，即GS基址
+DECLARE_PER_CPU(uint64_t, this_cpu_off);
+
+// 当前核心编号
+DECLARE_PER_CPU(uint32_t, cpu_number);
+
+/*
+ * 读写当前核心的per-CPU变量
+ * 只支持1、2、4、8字节的整数和指针
+ * 每个访问都是一条带gs前缀的指令，中途被中断也不会读写到其他核心的副本
+ */
+#define this_cpu_read(var) ({                                       \
+    __typeof__(var) __val;                                          \
+    __asm__ __volatile__("mov %%gs:%1, %0"                          \
+                         : "=r"(__val) : "m"(var));                 \
+    __val;                                                          \
+})
+
+#define this_cpu_write(var, val) do {                               \
+    __typeof__(var) __val = (val);                                  \
+    __asm__ __volatile__("mov %1, %%gs:%0"                          \
+                         : "=m"(var) : "r"(__val));                 \
+} while (0)
+
+#define this_cpu_add(var, val) do {                                 \
+    __typeof__(var) __val = (val);                                  \
+    __asm__ __volatile__("add %1, %%gs:%0"                          \
+                         : "+m"(var) : "r"(__val));                 \
+} while (0)
+
+#define this_cpu_inc(var) this_cpu_add(var, 1)
+#define this_cpu_dec(var) this_cpu_add(var, -1)
+
+// 当前核心副本中变量的地址，可以交给其他核心访问
+#define this_cpu_ptr(ptr) \
+    ((__typeof__(ptr))((uint64_t)(ptr) + this_cpu_read(this_cpu_off)))
+
+// 指定核心副本中变量的地址
+#define per_cpu_ptr(ptr, cpu) \
+    ((__typeof__(ptr))((uint64_t)(ptr) + per_cpu_offset[cpu]))
+
+/*
+ * 为每个核心分配per-CPU副本
+ * 副本数取BOOTBOOT报告的numcores
+ * 完成后BSP的GS基址切换到自己的副本
+ * 必须在boot_alloc_init之后、任何per-CPU变量被修改之前调用
+ */
+void percpu_init(void);
+
+// 已分配副本的核心数
+uint32_t percpu_count(void);
+
+/**
+ * 把当前核心的GS基址指向它的副本
+ *
+ * @param cpu 核心编号，必须小于percpu_count()
+ */
+void percpu_load(uint32_t cpu);
+
+#endif // _PERCPU_H
@@ -0,0 +1,216 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <config.h>
+#include <bootboot.h>
+#include <serial.h>
+#include <printk.h>
+#include <mm/bootmem/linear_map.h>
+#include <mm/pmm/pmm.h>
+#include <mm/pmm/buddy.h>
+#include <mm/heap.h>
+#include <spinlock.h>
+#include "cpu.h"
+#include "smp.h"
+#include "idt.h"
+#include "apic.h"
+#include <mm/tlb.h>
+
+/*
+ * kernel.asm中等待的AP使用
+ * ap_stacks按APIC ID索引，为0表示没有栈，AP保持停机
+ * ap_release置1后AP切换到自己的栈进入ap_main
+ */
+uint64_t ap_stacks[MAX_CPUS];
+volatile uint32_t ap_release = 0;
+
+// linker.ld中BSP的内核栈
+extern char kernel_stack_top[];
+
+static uint32_t cpus_online = 0;
+static cpumask_t cpu_online_mask;
+
+// 等待AP上线的最大轮数
+#define AP_WAIT_LOOPS 100000000ULL
+
+/*
+ * smp_call_function的调用
+ * call_lock在整个调用期间持有，IPI处理函数执行完后递减call_pending
+ */
+static spinlock_t call_lock = SPIN_LOCK_INIT;
+static smp_call_func_t call_func = NULL;
+static void *call_arg = NULL;
+static uint32_t call_pending = 0;
+
+/*
+ * 为核心分配IST栈
+ * 所有IST栈在同一块内存中，IST n使用第n个
+ */
+static bool ist_alloc(cpu_t *cpu) {
+    uint64_t pfn = _kheap_alloc(IST_COUNT * IST_STACK_SIZE, ZONE_NORMAL);
+
+    if (pfn == 0) {
+        return false;
+    }
+
+    uint64_t base = (uint64_t)PHYS_TO_LINEAR(pfn * PAGE_SIZE);
+
+    for (uint32_t ist = 1; ist <= IST_COUNT; ist++) {
+        cpu->tss.ist[ist - 1] = base + ist * IST_STACK_SIZE;
+    }
+
+    return true;
+}
+
+/*
+ * AP入口
+ * 由kernel.asm在切换到分配好的栈后调用
+ */
+void ap_main(uint32_t apic_id) {
+    cpu_init(per_cpu_ptr(&cpu_info, apic_id));
+    lapic_init();
+    lapic_timer_start(TIMER_HZ);
+    tlb_cpu_init();
+
+    cpumask_set(&cpu_online_mask, apic_id);
+    __atomic_fetch_add(&cpus_online, 1, __ATOMIC_RELEASE);
+
+    // 目前还没有任务，初始化剩余的内存后在hlt中等待中断
+    interrupts_enable();
+    while (1) {
+        while (pmm_init_work()) {
+        }
+        __asm__ __volatile__("hlt");
+    }
+}
+
+static void call_ipi_handler(interrupt_frame_t *frame) {
+    smp_call_func_t func = __atomic_load_n(&call_func, __ATOMIC_ACQUIRE);
+    void *arg = call_arg;
+
+    func(arg);
+
+    __atomic_fetch_sub(&call_pending, 1, __ATOMIC_RELEASE);
+}
+
+void smp_init(void) {
+    BOOTBOOT *bootboot = (BOOTBOOT *)BOOTBOOT_INFO;
+    uint32_t count = percpu_count();
+    uint32_t bsp = bootboot->bspid;
+
+    pr_info("[SMP] Starting %u cores\n", count);
+
+    interrupt_register(VECTOR_IPI_CALL, call_ipi_handler);
+
+    /*
+     * BOOTBOOT在QEMU和大多数平台上APIC ID从0连续分配
+     * 核心编号直接使用APIC ID
+     */
+    for (uint32_t id = 0; id < count; id++) {
+        cpu_t *cpu = per_cpu_ptr(&cpu_info, id);
+
+        cpu->id = id;
+        cpu->apic_id = id;
+
+        bool has_ist = ist_alloc(cpu);
+
+        if (id == bsp) {
+            if (!has_ist) {
+                panic("[SMP] ERROR: Cannot allocate IST stacks\n");
+            }
+            continue;
+        }
+
+        uint64_t pfn = has_ist ? _kheap_alloc(SMP_STACK_SIZE, ZONE_NORMAL) : 0;
+        if (pfn == 0) {
+            pr_warn("[SMP] WARNING: No stack for core %u\n", id);
+            continue;
+        }
+
+        cpu->stack_top = (uint64_t)PHYS_TO_LINEAR(pfn * PAGE_SIZE + SMP_STACK_SIZE);
+        ap_stacks[id] = cpu->stack_top;
+    }
+
+    if (bsp < count) {
+        cpu_t *cpu = per_cpu_ptr(&cpu_info, bsp);
+
+        cpu->stack_top = (uint64_t)kernel_stack_top;
+        cpu_init(cpu);
+        lapic_init();
+        lapic_timer_start(TIMER_HZ);
+        cpumask_set(&cpu_online_mask, bsp);
+        cpus_online = 1;
+    }
+
+    // 释放AP
+    __atomic_store_n(&ap_release, 1, __ATOMIC_RELEASE);
+
+    for (uint64_t i = 0; i < AP_WAIT_LOOPS; i++) {
+        if (__atomic_load_n(&cpus_online, __ATOMIC_ACQUIRE) >= count) {
+            break;
+        }
+        __asm__ __volatile__("pause");
+    }
+
+    pr_info("[SMP] %u cores online\n", smp_num_online());
+}
+
+uint32_t smp_num_online(void) {
+    return __atomic_load_n(&cpus_online, __ATOMIC_ACQUIRE);
+}
+
+const cpumask_t *smp_online_mask(void) {
+    return &cpu_online_mask;
+}
+
+cpu_t *smp_cpu(uint32_t id) {
+    if (id >= percpu_count()) {
+        return NULL;
+    }
+
+    return per_cpu_ptr(&cpu_info, id);
+}
+
+/*
+ * 发起者持有call_lock，不能在IPI处理中调用
+ * 不等待时下一个调用者在取得call_lock后等待上一个调用完成
+ */
+uint32_t smp_call_function(smp_call_func_t func, void *arg, bool wait) {
+    spin_lock(&call_lock);
+
+    while (__atomic_load_n(&call_pending, __ATOMIC_ACQUIRE) != 0) {
+        __asm__ __volatile__("pause");
+    }
+
+    uint32_t self = cpu_id();
+    uint32_t targets = 0;
+    uint32_t cpu;
+
+    for_each_cpu(cpu, &cpu_online_mask) {
+        if (cpu != self) {
+            targets++;
+        }
+    }
+
+    if (targets != 0) {
+        call_arg = arg;
+        __atomic_store_n(&call_pending, targets, __ATOMIC_RELAXED);
+        __atomic_store_n(&call_func, func, __ATOMIC_RELEASE);
+
+        for_each_cpu(cpu, &cpu_online_mask) {
+            if (cpu != self) {
+                lapic_send_ipi(per_cpu_ptr(&cpu_info, cpu)->apic_id, VECTOR_IPI_CALL);
+            }
+        }
+
+        while (wait && __atomic_load_n(&call_pending, __ATOMIC_ACQUIRE) != 0) {
+            __asm__ __volatile__("pause");
+        }
+    }
+
+    spin_unlock(&call_lock);
+
+    return targets;
+}
@@ -0,0 +1,46 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef _SMP_H
+#define _SMP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "cpu.h"
+#include "cpumask.h"
+
+// AP内核栈大小
+#define SMP_STACK_SIZE (16 * 1024)
+
+/*
+ * 启动所有核心
+ * 为每个有per-CPU副本的核心填写cpu_t并分配内核栈和IST栈
+ * 初始化BSP和它的LAPIC后释放在kernel.asm中等待的AP
+ * 每个核心启动TIMER_HZ的LAPIC定时器
+ * 必须在memory_init和idt_init之后调用
+ */
+void smp_init(void);
+
+// 已经完成初始化的核心数
+uint32_t smp_num_online(void);
+
+// 已经完成初始化的核心集合
+const cpumask_t *smp_online_mask(void);
+
+// 按核心编号获取cpu_t，没有返回NULL
+cpu_t *smp_cpu(uint32_t id);
+
+typedef void (*smp_call_func_t)(void *arg);
+
+/**
+ * 在除当前核心以外的所有在线核心上执行func
+ * func在IPI中执行，执行期间中断是关闭的
+ * 同一时刻只有一个调用在进行，后来的调用者等待前一个调用完成
+ *
+ * @param func 要执行的函数
+ * @param arg  传给func的参数
+ * @param wait 为true时等待所有核心执行完再返回
+ * @return 执行func的核心数
+ */
+uint32_t smp_call_function(smp_call_func_t func, void *arg, bool wait);
+
+#endif // _SMP_H
@@ -11,10 +11,10 @@ typedef struct {
     uint64_t rsp1;     
     uint64_t rsp2;     
     uint64_t reserved1;
-    uint64_t ist[8];   
+    uint64_t ist[7];        // IST1-IST7
     uint64_t reserved2;
     uint16_t reserved3;
     uint16_t iomap_base;
 } __attribute__((packed)) tss_t;  
 
-#endif // _TSS_H
\ No newline at end of file
+#endif // _TSS_H
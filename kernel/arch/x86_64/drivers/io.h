@@ -26,4 +26,9 @@ void wrmsr(uint32_t msr, uint32_t lo, uint32_t hi);
 uint64_t rdtsc(void);
 uint64_t rdtscp(void);
 
+// 自旋等待时调用，降低功耗并让出流水线给超线程
+static inline void cpu_relax(void) {
+    __asm__ __volatile__("pause");
+}
+
 #endif
\ No newline at end of file
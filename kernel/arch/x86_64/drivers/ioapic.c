@@ -0,0 +1,298 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <bootboot.h>
+#include <spinlock.h>
+#include <io.h>
+#include <serial.h>
+#include <printk.h>
+#include <mm/bootmem/linear_map.h>
+#include "ioapic.h"
+
+// 8259 PIC
+#define PIC1_COMMAND    0x20
+#define PIC1_DATA       0x21
+#define PIC2_COMMAND    0xA0
+#define PIC2_DATA       0xA1
+
+// ACPI表头
+typedef struct {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_sdt_header_t;
+
+typedef struct {
+    acpi_sdt_header_t header;
+    uint32_t lapic_addr;
+    uint32_t flags;
+} __attribute__((packed)) acpi_madt_t;
+
+// MADT项
+#define MADT_IOAPIC     1
+#define MADT_ISO        2
+
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+} __attribute__((packed)) madt_entry_t;
+
+typedef struct {
+    madt_entry_t entry;
+    uint8_t id;
+    uint8_t reserved;
+    uint32_t addr;
+    uint32_t gsi_base;
+} __attribute__((packed)) madt_ioapic_t;
+
+typedef struct {
+    madt_entry_t entry;
+    uint8_t bus;
+    uint8_t source;
+    uint32_t gsi;
+    uint16_t flags;
+} __attribute__((packed)) madt_iso_t;
+
+// 中断覆盖的flags
+#define ISO_POLARITY_MASK   0x3
+#define ISO_POLARITY_LOW    0x3
+#define ISO_TRIGGER_MASK    0xC
+#define ISO_TRIGGER_LEVEL   0xC
+
+typedef struct {
+    volatile uint32_t *regs;
+    uint32_t gsi_base;
+    uint32_t gsi_count;
+} ioapic_t;
+
+// ISA中断到GSI的映射
+typedef struct {
+    uint32_t gsi;
+    uint32_t flags;     // IOAPIC_ACTIVE_LOW | IOAPIC_LEVEL
+} isa_irq_t;
+
+static ioapic_t ioapics[IOAPIC_MAX];
+static uint32_t ioapic_count = 0;
+static isa_irq_t isa_irqs[ISA_IRQS];
+
+// IOREGSEL和IOWIN要成对访问
+static spinlock_t ioapic_lock = SPIN_LOCK_INIT;
+
+static uint32_t ioapic_read(ioapic_t *ioapic, uint32_t reg) {
+    ioapic->regs[IOAPIC_REGSEL / 4] = reg;
+    return ioapic->regs[IOAPIC_WINDOW / 4];
+}
+
+static void ioapic_write(ioapic_t *ioapic, uint32_t reg, uint32_t value) {
+    ioapic->regs[IOAPIC_REGSEL / 4] = reg;
+    ioapic->regs[IOAPIC_WINDOW / 4] = value;
+}
+
+// 重映射8259到0x20以上后屏蔽全部中断，避免伪中断落在异常向量上
+static void pic_disable(void) {
+    outb(PIC1_COMMAND, 0x11);
+    outb(PIC2_COMMAND, 0x11);
+    outb(PIC1_DATA, 0x20);
+    outb(PIC2_DATA, 0x28);
+    outb(PIC1_DATA, 0x04);
+    outb(PIC2_DATA, 0x02);
+    outb(PIC1_DATA, 0x01);
+    outb(PIC2_DATA, 0x01);
+    outb(PIC1_DATA, 0xFF);
+    outb(PIC2_DATA, 0xFF);
+}
+
+static bool signature_is(const char *signature, const char *name) {
+    for (int i = 0; i < 4; i++) {
+        if (signature[i] != name[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * 查找MADT
+ * BOOTBOOT的acpi_ptr指向RSDT或XSDT
+ */
+static acpi_madt_t *madt_find(void) {
+    BOOTBOOT *bootboot = (BOOTBOOT *)BOOTBOOT_INFO;
+
+    if (bootboot->arch.x86_64.acpi_ptr == 0) {
+        return NULL;
+    }
+
+    acpi_sdt_header_t *root = (acpi_sdt_header_t *)PHYS_TO_LINEAR(bootboot->arch.x86_64.acpi_ptr);
+    bool xsdt = signature_is(root->signature, "XSDT");
+
+    if (!xsdt && !signature_is(root->signature, "RSDT")) {
+        return NULL;
+    }
+
+    uint32_t entry_size = xsdt ? 8 : 4;
+    uint32_t count = (root->length - sizeof(acpi_sdt_header_t)) / entry_size;
+    uint8_t *entries = (uint8_t *)(root + 1);
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t addr = xsdt ? *(uint64_t *)(entries + i * 8)
+                             : *(uint32_t *)(entries + i * 4);
+        acpi_sdt_header_t *header = (acpi_sdt_header_t *)PHYS_TO_LINEAR(addr);
+
+        if (signature_is(header->signature, "APIC")) {
+            return (acpi_madt_t *)header;
+        }
+    }
+
+    return NULL;
+}
+
+static void ioapic_add(uint64_t addr, uint32_t gsi_base) {
+    if (ioapic_count >= IOAPIC_MAX) {
+        return;
+    }
+
+    ioapic_t *ioapic = &ioapics[ioapic_count++];
+    ioapic->regs = (volatile uint32_t *)PHYS_TO_LINEAR(addr);
+    ioapic->gsi_base = gsi_base;
+    ioapic->gsi_count = ((ioapic_read(ioapic, IOAPIC_REG_VERSION) >> 16) & 0xFF) + 1;
+
+    for (uint32_t i = 0; i < ioapic->gsi_count; i++) {
+        ioapic_write(ioapic, IOAPIC_REG_REDIR + i * 2, IOAPIC_MASKED);
+        ioapic_write(ioapic, IOAPIC_REG_REDIR + i * 2 + 1, 0);
+    }
+}
+
+static void madt_parse(acpi_madt_t *madt) {
+    uint8_t *p = (uint8_t *)(madt + 1);
+    uint8_t *end = (uint8_t *)madt + madt->header.length;
+
+    while (p + sizeof(madt_entry_t) <= end) {
+        madt_entry_t *entry = (madt_entry_t *)p;
+
+        if (entry->length < sizeof(madt_entry_t)) {
+            break;
+        }
+
+        if (entry->type == MADT_IOAPIC) {
+            madt_ioapic_t *io = (madt_ioapic_t *)entry;
+            ioapic_add(io->addr, io->gsi_base);
+        } else if (entry->type == MADT_ISO) {
+            madt_iso_t *iso = (madt_iso_t *)entry;
+
+            if (iso->bus == 0 && iso->source < ISA_IRQS) {
+                uint32_t flags = 0;
+
+                if ((iso->flags & ISO_POLARITY_MASK) == ISO_POLARITY_LOW) {
+                    flags |= IOAPIC_ACTIVE_LOW;
+                }
+                if ((iso->flags & ISO_TRIGGER_MASK) == ISO_TRIGGER_LEVEL) {
+                    flags |= IOAPIC_LEVEL;
+                }
+
+                isa_irqs[iso->source].gsi = iso->gsi;
+                isa_irqs[iso->source].flags = flags;
+            }
+        }
+
+        p += entry->length;
+    }
+}
+
+void ioapic_init(void) {
+    pic_disable();
+
+    // ISA中断默认一一对应GSI，高电平边沿触发
+    for (uint32_t irq = 0; irq < ISA_IRQS; irq++) {
+        isa_irqs[irq].gsi = irq;
+        isa_irqs[irq].flags = 0;
+    }
+
+    acpi_madt_t *madt = madt_find();
+
+    if (madt != NULL) {
+        madt_parse(madt);
+    }
+
+    if (ioapic_count == 0) {
+        pr_warn("[IOAPIC] WARNING: No MADT entry, using default address\n");
+        ioapic_add(IOAPIC_DEFAULT_ADDR, 0);
+    }
+
+    pr_info("[IOAPIC] %u IOAPIC(s)\n", ioapic_count);
+}
+
+// 查找负责gsi的IOAPIC
+static ioapic_t *ioapic_of(uint32_t gsi) {
+    for (uint32_t i = 0; i < ioapic_count; i++) {
+        ioapic_t *ioapic = &ioapics[i];
+
+        if (gsi >= ioapic->gsi_base && gsi < ioapic->gsi_base + ioapic->gsi_count) {
+            return ioapic;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * 物理目标模式下IOAPIC只能投递到8位APIC ID
+ * APIC ID更大的核心需要中断重映射
+ */
+bool ioapic_route(uint8_t irq, uint8_t vector, uint32_t apic_id) {
+    if (irq >= ISA_IRQS || apic_id > 0xFF) {
+        return false;
+    }
+
+    uint32_t gsi = isa_irqs[irq].gsi;
+    ioapic_t *ioapic = ioapic_of(gsi);
+
+    if (ioapic == NULL) {
+        return false;
+    }
+
+    uint32_t reg = IOAPIC_REG_REDIR + (gsi - ioapic->gsi_base) * 2;
+
+    spin_lock(&ioapic_lock);
+    ioapic_write(ioapic, reg + 1, apic_id << 24);
+    ioapic_write(ioapic, reg, vector | isa_irqs[irq].flags);
+    spin_unlock(&ioapic_lock);
+
+    return true;
+}
+
+static void ioapic_set_mask(uint8_t irq, bool masked) {
+    if (irq >= ISA_IRQS) {
+        return;
+    }
+
+    uint32_t gsi = isa_irqs[irq].gsi;
+    ioapic_t *ioapic = ioapic_of(gsi);
+
+    if (ioapic == NULL) {
+        return;
+    }
+
+    uint32_t reg = IOAPIC_REG_REDIR + (gsi - ioapic->gsi_base) * 2;
+
+    spin_lock(&ioapic_lock);
+    uint32_t low = ioapic_read(ioapic, reg);
+    low = masked ? (low | IOAPIC_MASKED) : (low & ~IOAPIC_MASKED);
+    ioapic_write(ioapic, reg, low);
+    spin_unlock(&ioapic_lock);
+}
+
+void ioapic_mask(uint8_t irq) {
+    ioapic_set_mask(irq, true);
+}
+
+void ioapic_unmask(uint8_t irq) {
+    ioapic_set_mask(irq, false);
+}
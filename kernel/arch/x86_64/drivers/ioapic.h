@@ -0,0 +1,52 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef IOAPIC_H
+#define IOAPIC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// 最多支持的IOAPIC数
+#define IOAPIC_MAX          8
+
+// ISA中断数
+#define ISA_IRQS            16
+
+// IOAPIC寄存器
+#define IOAPIC_REGSEL       0x00
+#define IOAPIC_WINDOW       0x10
+#define IOAPIC_REG_VERSION  0x01
+#define IOAPIC_REG_REDIR    0x10
+
+// 重定向表项
+#define IOAPIC_ACTIVE_LOW   (1 << 13)
+#define IOAPIC_LEVEL        (1 << 15)
+#define IOAPIC_MASKED       (1 << 16)
+
+// 没有找到MADT时使用的默认地址
+#define IOAPIC_DEFAULT_ADDR 0xFEC00000
+
+/*
+ * 初始化IOAPIC
+ * 屏蔽8259，从ACPI MADT中读取IOAPIC和ISA中断覆盖
+ * 屏蔽所有重定向表项
+ */
+void ioapic_init(void);
+
+/**
+ * 把ISA中断路由到指定核心
+ * 按MADT中的中断覆盖转换为GSI，并使用其中的极性和触发方式
+ *
+ * @param irq     ISA中断号
+ * @param vector  向量号
+ * @param apic_id 目标核心的APIC ID
+ *
+ * @return 没有IOAPIC负责这个中断返回false
+ */
+bool ioapic_route(uint8_t irq, uint8_t vector, uint32_t apic_id);
+
+// 屏蔽和打开ISA中断
+void ioapic_mask(uint8_t irq);
+void ioapic_unmask(uint8_t irq);
+
+#endif // IOAPIC_H
@@ -1,9 +1,36 @@
 /* SPDX-License-Identifier: Apache-2.0 */
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <io.h>
+#include <cpu/idt.h>
+#include <printk.h>
+#include "ioapic.h"
+#include "serial.h"
 
-#define SERIAL_PORT 0x3F8
+/*
+ * 发送缓冲区
+ *
+ * 多生产者单消费者的无锁环形缓冲区
+ * 生产者用CAS在head上预留一段连续空间，同一个字符串不会和其他核心的输出交错
+ * 每个槽的高8位是写入时所在圈数的标记，消费者看到标记和当前圈数一致才认为槽已写好
+ * 所以生产者之间不需要互相等待，预留后被打断的生产者只会让消费者暂停在它的位置
+ *
+ * 消费者由draining标志保证同一时刻只有一个
+ * THRE中断、生产者的顺手发送和panic都通过serial_drain发送
+ */
+static uint16_t tx_buf[SERIAL_BUF_SIZE];
+static uint64_t tx_head = 0;        // 下一个预留的位置
+static uint64_t tx_tail = 0;        // 下一个发送的位置
+static uint32_t draining = 0;
+
+// THRE中断是否已经打开
+static bool irq_ready = false;
+static uint32_t tx_irq_on = 0;
+
+static inline uint16_t slot_mark(uint64_t pos) {
+    return (uint16_t)((((pos / SERIAL_BUF_SIZE) & 0x7F) | 0x80) << 8);
+}
 
 void init_serial(void) {
     outb(SERIAL_PORT + 1, 0x00);
@@ -15,42 +42,214 @@ void init_serial(void) {
     outb(SERIAL_PORT + 4, 0x0B);
 }
 
+static inline bool tx_empty(void) {
+    return (inb(SERIAL_PORT + SERIAL_LSR) & SERIAL_LSR_THRE) != 0;
+}
+
+/*
+ * 从tail开始取出最多一个FIFO的已写好的字节
+ * 只由消费者调用
+ */
+static uint32_t tx_take(uint8_t *out) {
+    uint64_t tail = __atomic_load_n(&tx_tail, __ATOMIC_RELAXED);
+    uint32_t n = 0;
+
+    while (n < SERIAL_FIFO_SIZE) {
+        uint64_t pos = tail + n;
+        uint16_t slot = __atomic_load_n(&tx_buf[pos % SERIAL_BUF_SIZE], __ATOMIC_ACQUIRE);
+
+        if ((slot & 0xFF00) != slot_mark(pos)) {
+            break;
+        }
+
+        out[n++] = (uint8_t)slot;
+    }
+
+    return n;
+}
+
+static void tx_release(uint32_t n) {
+    __atomic_store_n(&tx_tail, tx_tail + n, __ATOMIC_RELEASE);
+}
+
+// 缓冲区中是否还有已写好的字节
+static inline bool tx_pending(void) {
+    uint64_t tail = __atomic_load_n(&tx_tail, __ATOMIC_ACQUIRE);
+    uint16_t slot = __atomic_load_n(&tx_buf[tail % SERIAL_BUF_SIZE], __ATOMIC_ACQUIRE);
+    return (slot & 0xFF00) == slot_mark(tail);
+}
+
+/*
+ * 发送缓冲区中的字节
+ * THR空时一次用outsb填满FIFO
+ * wait为false时只发送到FIFO满为止，为true时一直发送到缓冲区为空
+ */
+static void serial_drain(bool wait) {
+    uint8_t burst[SERIAL_FIFO_SIZE];
+
+    if (__atomic_exchange_n(&draining, 1, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    uint64_t flags = interrupts_save();
+
+    while (1) {
+        if (!tx_empty()) {
+            if (!wait) {
+                break;
+            }
+            __asm__ __volatile__("pause");
+            continue;
+        }
+
+        uint32_t n = tx_take(burst);
+        if (n == 0) {
+            break;
+        }
+
+        outsb(SERIAL_PORT, burst, n);
+        tx_release(n);
+    }
+
+    __atomic_store_n(&draining, 0, __ATOMIC_RELEASE);
+    interrupts_restore(flags);
+}
+
+// 打开THRE中断，FIFO空时由中断继续发送
+static void tx_irq_kick(void) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&tx_irq_on, __ATOMIC_ACQUIRE) == 0) {
+        __atomic_store_n(&tx_irq_on, 1, __ATOMIC_RELAXED);
+        outb(SERIAL_PORT + SERIAL_IER, SERIAL_IER_THRE);
+    }
+}
+
+/*
+ * 预留len个槽
+ * 缓冲区满时自己发送腾出空间，这是唯一会等待串口的情况
+ */
+static uint64_t tx_reserve(uint32_t len) {
+    uint64_t head = __atomic_load_n(&tx_head, __ATOMIC_RELAXED);
+
+    while (1) {
+        uint64_t tail = __atomic_load_n(&tx_tail, __ATOMIC_ACQUIRE);
+
+        if (head + len - tail > SERIAL_BUF_SIZE) {
+            serial_drain(true);
+            __asm__ __volatile__("pause");
+            head = __atomic_load_n(&tx_head, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        if (__atomic_compare_exchange_n(&tx_head, &head, head + len, true,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            return head;
+        }
+    }
+}
+
+static inline void tx_put(uint64_t pos, char c) {
+    __atomic_store_n(&tx_buf[pos % SERIAL_BUF_SIZE], slot_mark(pos) | (uint8_t)c, __ATOMIC_RELEASE);
+}
+
+// 写好之后顺手发送一个FIFO，中断打开后由中断发送剩下的
+static void tx_commit(void) {
+    if (irq_ready) {
+        tx_irq_kick();
+    } else {
+        serial_drain(false);
+    }
+}
+
 void serial_putchar(char c) {
-    while ((inb(SERIAL_PORT + 5) & 0x20) == 0);
-    outb(SERIAL_PORT, c);
+    if (c == '\n') {
+        uint64_t pos = tx_reserve(2);
+        tx_put(pos, '\r');
+        tx_put(pos + 1, '\n');
+    } else {
+        tx_put(tx_reserve(1), c);
+    }
+
+    tx_commit();
 }
 
 void serial_puts(const char* str) {
-    while (*str) {
+    uint32_t len = 0;
+
+    for (const char *p = str; *p; p++) {
+        len += (*p == '\n') ? 2 : 1;
+    }
+
+    if (len == 0) {
+        return;
+    }
+
+    // 超过缓冲区的字符串分段写入
+    if (len > SERIAL_BUF_SIZE / 2) {
+        while (*str) {
+            serial_putchar(*str++);
+        }
+        return;
+    }
+
+    uint64_t pos = tx_reserve(len);
+
+    for (; *str; str++) {
         if (*str == '\n') {
-            serial_putchar('\r');
-            serial_putchar('\n');
-        } else {
-            serial_putchar(*str);
+            tx_put(pos++, '\r');
         }
-        str++;
+        tx_put(pos++, *str);
+    }
+
+    tx_commit();
+}
+
+/*
+ * 原样写入len个字节，不转换换行
+ * 超过缓冲区一半时分段写入，段之间可能夹着其他核心的输出
+ */
+void serial_write(const void *data, uint32_t len) {
+    const uint8_t *p = (const uint8_t *)data;
+
+    while (len > 0) {
+        uint32_t n = len > SERIAL_BUF_SIZE / 2 ? SERIAL_BUF_SIZE / 2 : len;
+        uint64_t pos = tx_reserve(n);
+
+        for (uint32_t i = 0; i < n; i++) {
+            tx_put(pos + i, (char)p[i]);
+        }
+
+        tx_commit();
+        p += n;
+        len -= n;
     }
 }
 
 void serial_put_hex(uint64_t value) {
     const char* digits = "0123456789ABCDEF";
-    serial_puts("0x");
+    char buffer[19];
+
+    buffer[0] = '0';
+    buffer[1] = 'x';
     for (int i = 15; i >= 0; i--) {
         uint8_t nibble = (value >> (i * 4)) & 0xF;
-        serial_putchar(digits[nibble]);
+        buffer[17 - i] = digits[nibble];
     }
+    buffer[18] = '\0';
+
+    serial_puts(buffer);
 }
 
 void serial_put_dec(uint64_t value) {
     char buffer[32];
     char* p = buffer + 31;
     *p = '\0';
-    
+
     if (value == 0) {
-        serial_putchar('0');
-        return;
+        *--p = '0';
     }
-    
+
     while (value > 0) {
         *--p = '0' + (value % 10);
         value /= 10;
@@ -58,12 +257,74 @@ void serial_put_dec(uint64_t value) {
     serial_puts(p);
 }
 
+/*
+ * THRE中断
+ * FIFO已空，发送一个FIFO
+ * 缓冲区空了就关闭THRE中断，关闭后再检查一次，避免错过关闭前刚写入的字节
+ */
+static void serial_irq_handler(interrupt_frame_t *frame) {
+    inb(SERIAL_PORT + SERIAL_IIR);
+
+    serial_drain(false);
+
+    if (!tx_pending()) {
+        // 先关中断再清标志，看到标志为0的生产者打开中断一定在关闭之后
+        outb(SERIAL_PORT + SERIAL_IER, 0);
+        __atomic_store_n(&tx_irq_on, 0, __ATOMIC_RELEASE);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+        if (tx_pending()) {
+            tx_irq_kick();
+        }
+    }
+}
+
+void serial_irq_init(uint32_t apic_id) {
+    interrupt_register(VECTOR_IRQ_BASE + SERIAL_IRQ, serial_irq_handler);
+
+    if (!ioapic_route(SERIAL_IRQ, VECTOR_IRQ_BASE + SERIAL_IRQ, apic_id)) {
+        return;
+    }
+
+    irq_ready = true;
+
+    if (tx_pending()) {
+        tx_irq_kick();
+    }
+}
+
+void serial_flush(void) {
+    serial_drain(true);
+}
+
+// 忽略缓冲区直接发送，只在panic中使用
+static void serial_puts_sync(const char* str) {
+    for (; *str; str++) {
+        if (*str == '\n') {
+            while (!tx_empty());
+            outb(SERIAL_PORT, '\r');
+        }
+        while (!tx_empty());
+        outb(SERIAL_PORT, *str);
+    }
+}
+
 void panic(const char* msg) {
     // 关闭中断，避免打断
     __asm__ __volatile__("cli");
 
-    serial_puts(msg);
-    
+    // 还没格式化的日志也要输出
+    log_panic_drain();
+
+    /*
+     * 先发送缓冲区中已有的输出
+     * 如果被打断的核心正在发送，draining不会被释放，直接抢过来
+     */
+    __atomic_store_n(&draining, 0, __ATOMIC_RELEASE);
+    serial_drain(true);
+
+    serial_puts_sync(msg);
+
     // 死循环
     while (1) {
         __asm__ __volatile__("hlt");
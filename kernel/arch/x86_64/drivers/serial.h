@@ -7,12 +7,45 @@
 #include <io.h>
 
 #define SERIAL_PORT 0x3F8
+#define SERIAL_IRQ  4
 
+// 16550寄存器
+#define SERIAL_IER          1
+#define SERIAL_IIR          2
+#define SERIAL_LSR          5
+#define SERIAL_IER_THRE     0x02
+#define SERIAL_LSR_THRE     0x20
+
+// 发送FIFO大小
+#define SERIAL_FIFO_SIZE    16
+
+// 发送缓冲区的字节数，必须是2的幂
+#define SERIAL_BUF_SIZE     16384
+
+/*
+ * 串口输出先写入发送缓冲区，不等待串口
+ * 打开中断之前每次写入后顺手发送一个FIFO
+ * 只有缓冲区满时写入者才会等待串口
+ */
 void init_serial(void);
 void serial_putchar(char c);
 void serial_puts(const char* str);
+// 原样写入二进制数据
+void serial_write(const void *data, uint32_t len);
 void serial_put_hex(uint64_t value);
 void serial_put_dec(uint64_t value);
+/**
+ * 改为由THRE中断发送缓冲区
+ * 必须在ioapic_init之后调用
+ *
+ * @param apic_id 处理串口中断的核心
+ */
+void serial_irq_init(uint32_t apic_id);
+
+// 等待缓冲区中的输出全部发送
+void serial_flush(void);
+
+// 发送缓冲区中的输出和msg后停机
 void panic(const char* msg);
 
 #endif
\ No newline at end of file
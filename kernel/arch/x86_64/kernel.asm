@@ -3,20 +3,52 @@
 section .text
 global _start
 extern kernel_main
+extern ap_main
+extern ap_stacks
+extern ap_release
+extern kernel_stack_top
+extern bootboot
+
+; BOOTBOOT结构体中bspid的偏移
+BOOTBOOT_BSPID equ 0x0C
+
+MSR_GS_BASE equ 0xC0000101
 
 _start:
-    ; 核心0执行内核初始化，其他核心等待唤醒 
-    test rdi, rdi
-    jnz .ap_wait
+    ; 所有核心都从这里进入，通过APIC ID区分BSP和AP
+    mov eax, 1
+    cpuid
+    shr ebx, 24
+    cmp bx, word [bootboot + BOOTBOOT_BSPID]
+    jne .ap_wait
     
-    ; 核心0跳转到内核入口点
+    ; 核心0切换到内核栈，跳转到内核入口点
+    mov rsp, kernel_stack_top
+
+    ; GS基址清零，percpu_init之前per-CPU变量访问的是模板
+    mov ecx, MSR_GS_BASE
+    xor eax, eax
+    xor edx, edx
+    wrmsr
+
     call kernel_main
     jmp .halt
 
 .ap_wait:
+    ; 等待BSP完成内存初始化并分配好栈
     pause
-    jmp .ap_wait
+    cmp dword [ap_release], 0
+    je .ap_wait
+
+    ; rbx为APIC ID，切换到分配的栈
+    mov rsp, [ap_stacks + rbx * 8]
+    test rsp, rsp
+    jz .halt
+
+    mov edi, ebx
+    call ap_main
 
 .halt:
+    cli
     hlt
-    jmp .halt
\ No newline at end of file
+    jmp .halt
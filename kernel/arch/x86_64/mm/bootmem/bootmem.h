@@ -17,7 +17,16 @@
 // 页表标志位定义
 #define PAGE_PRESENT       (1ULL << 0)
 #define PAGE_WRITABLE      (1ULL << 1) 
+#define PAGE_USER          (1ULL << 2)  // 用户态可访问
+#define PAGE_PWT           (1ULL << 3)  // 写透
+#define PAGE_PCD           (1ULL << 4)  // 禁止缓存
+#define PAGE_ACCESSED      (1ULL << 5)
+#define PAGE_DIRTY         (1ULL << 6)
 #define PAGE_SIZE_BIT      (1ULL << 7)  // PS位
+#define PAGE_GLOBAL        (1ULL << 8)  // 切换CR3时不刷新
+
+// 表项中的物理地址
+#define PAGE_ADDR_MASK     0x000FFFFFFFFFF000ULL
 
 // 页大小定义
 #define PAGE_1GB_SIZE      (1ULL << 30)
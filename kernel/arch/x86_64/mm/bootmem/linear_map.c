@@ -2,6 +2,7 @@
  
 #include <bootboot.h>
 #include <serial.h>
+#include <printk.h>
 #include <mm/bootmem/linear_map.h>
 
 static temp_linear_map_t temp_map = {0};
@@ -74,20 +75,64 @@ static uint64_t physical_alloc_page(void) {
     return alloc_addr;
 }
 
+/* 2M页[start, start + 2M)中是否有可用内存或ACPI内存 */
+static int range_has_ram(uint64_t start) {
+    BOOTBOOT* bootboot = (BOOTBOOT*)BOOTBOOT_INFO;
+    MMapEnt* mmap = &bootboot->mmap;
+    uint64_t count = (bootboot->size - 128) / sizeof(MMapEnt);
+    uint64_t end = start + PAGE_2MB_SIZE;
+
+    for (uint64_t i = 0; i < count; i++) {
+        MMapEnt* entry = &mmap[i];
+        uint32_t type = MMapEnt_Type(entry);
+
+        if (type != MMAP_FREE && type != MMAP_ACPI) continue;
+
+        uint64_t entry_start = MMapEnt_Ptr(entry);
+        uint64_t entry_end = entry_start + MMapEnt_Size(entry);
+
+        if (entry_start < end && entry_end > start) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * 3G-4G是PCI空洞，LAPIC、IOAPIC等MMIO都在这里
+ * 把这1G拆成2M页，不含内存的2M页按不可缓存映射
+ */
+static void map_mmio_hole(uint64_t* pml4) {
+    uint64_t virt = LINEAR_MAP_START + MMIO_HOLE_START;
+    uint64_t* pdpt = (uint64_t*)(pml4[PML4_INDEX(virt)] & ~0xFFF);
+
+    uint64_t* pd = (uint64_t*)physical_alloc_page();
+
+    for (uint64_t i = 0; i < PAGE_TABLE_ENTRIES; i++) {
+        uint64_t phys = MMIO_HOLE_START + i * PAGE_2MB_SIZE;
+
+        pd[i] = phys | PAGE_2MB_FLAGS;
+        if (!range_has_ram(phys)) {
+            pd[i] |= PAGE_PCD | PAGE_PWT;
+        }
+    }
+
+    pdpt[PDPT_INDEX(virt)] = (uint64_t)pd | PAGE_PRESENT | PAGE_WRITABLE;
+}
+
 /*
  * 建立8TB线性映射
  * 物理0-8TB -> LINEAR_MAP_START开始
- * 用1GB大页
+ * 用1GB大页，MMIO空洞除外
  */
 void linear_map_setup(void) {
-    serial_puts("[linear_map] Setting up mapping\n");
+    pr_info("[linear_map] Setting up mapping\n");
     
     memory_base = find_memory(2 * 1024 * 1024);
     if (!memory_base) return;
     
-    serial_puts("[linear_map] Found: ");
-    serial_put_hex(memory_base);
-    serial_puts("\n");
+    pr_info("[linear_map] Found: %p\n", memory_base);
     
     uint64_t* pml4 = get_pml4();
     uint64_t pml4_idx = PML4_INDEX(LINEAR_MAP_START);
@@ -113,11 +158,13 @@ void linear_map_setup(void) {
         
         current_pdpt[pdpt_idx] = phys | PAGE_1GB_FLAGS;
     }
+
+    map_mmio_hole(pml4);
     
     /* 刷新TLB */
     __asm__ __volatile__("mov %%cr3, %%rax\nmov %%rax, %%cr3" : : : "rax", "memory");
     
-    serial_puts("[linear_map] Mapping done\n");
+    pr_info("[linear_map] Mapping done\n");
 }
 
 /* 获取分配记录 */
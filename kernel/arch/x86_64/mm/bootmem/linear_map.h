@@ -14,6 +14,9 @@
 /* 8TB需要的1GB页数 */
 #define LINEAR_MAP_PAGES   (8ULL * 1024ULL)
 
+/* 线性映射中按不可缓存映射的1G MMIO空洞 */
+#define MMIO_HOLE_START     0xC0000000ULL
+
 /* 线性映射地址转物理地址 */
 #define LINEAR_TO_PHYS(va) ((uintptr_t)(va) - LINEAR_MAP_START)
 
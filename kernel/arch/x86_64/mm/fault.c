@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <cpu/idt.h>
+#include <mm/vmm/vmm.h>
+#include <mm/vmm/vma.h>
+#include "tlb.h"
+#include "fault.h"
+
+// 缺页错误码
+#define PF_PRESENT  (1ULL << 0)     // 页存在，是权限错误
+#define PF_WRITE    (1ULL << 1)
+#define PF_USER     (1ULL << 2)
+#define PF_RSVD     (1ULL << 3)     // 页表中有保留位被置位
+
+#define RFLAGS_IF   (1ULL << 9)
+
+static void page_fault_handler(interrupt_frame_t *frame) {
+    uint64_t addr;
+    __asm__ __volatile__("mov %%cr2, %0" : "=r"(addr));
+
+    // 保留位错误说明页表损坏，不能通过映射解决
+    if (frame->error_code & PF_RSVD) {
+        exception_panic(frame);
+    }
+
+    /*
+     * 开中断后处理
+     * 修改区域的核心可能持有锁等待TLB shootdown，关着中断等锁会互相等死
+     * CR2已经读出，处理中再次缺页也没有关系
+     */
+    if (frame->rflags & RFLAGS_IF) {
+        interrupts_enable();
+    }
+
+    mm_t *mm = (addr >> 63) ? &kernel_mm : current_mm();
+    uint32_t access = 0;
+
+    if (frame->error_code & PF_WRITE) {
+        access |= VM_WRITE;
+    }
+
+    if (frame->error_code & PF_USER) {
+        access |= VM_USER;
+    }
+
+    bool handled = mm != NULL && vmm_fault(mm, addr, access);
+
+    interrupts_disable();
+
+    if (!handled) {
+        exception_panic(frame);
+    }
+}
+
+void page_fault_init(void) {
+    interrupt_register(EXCEPTION_PF, page_fault_handler);
+}
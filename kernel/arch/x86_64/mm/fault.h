@@ -0,0 +1,14 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef FAULT_H
+#define FAULT_H
+
+/*
+ * 注册缺页处理函数
+ * 高半部分的地址在内核地址空间的区域中查找，其余在当前地址空间中查找
+ * 不在任何区域中的缺页输出现场后停机
+ * 必须在tlb_init之后调用
+ */
+void page_fault_init(void);
+
+#endif // FAULT_H
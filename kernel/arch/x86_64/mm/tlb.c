@@ -0,0 +1,293 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <spinlock.h>
+#include <cpu/cpu.h>
+#include <cpu/cpumask.h>
+#include <cpu/idt.h>
+#include <cpu/apic.h>
+#include <cpu/smp.h>
+#include "tlb.h"
+
+#define CR4_PGE (1ULL << 7)
+#define TLB_PAGE_SIZE 4096
+
+mm_t kernel_mm;
+
+// 当前核心加载的地址空间
+static DEFINE_PER_CPU(mm_t *, active_mm);
+
+/*
+ * 每个核心的待处理队列
+ *
+ * 发起者把范围追加到目标核心的队列，再发送一个IPI
+ * ipi_pending表示已经有一个IPI在路上，后来的发起者只追加不再发送
+ * 目标核心取走队列时清除ipi_pending，之后追加的范围会触发新的IPI
+ *
+ * pending_gen在每次追加时递增，done_gen是目标核心处理完的位置
+ * 发起者等待done_gen追上自己追加之后的pending_gen
+ */
+typedef struct {
+    spinlock_t lock;
+    uint32_t count;
+    bool full;
+    bool ipi_pending;
+    uint64_t pending_gen;
+    uint64_t done_gen;
+    tlb_range_t ranges[TLB_INBOX_RANGES];
+} __attribute__((aligned(64))) tlb_inbox_t;
+
+static DEFINE_PER_CPU(tlb_inbox_t, tlb_inbox);
+
+static inline void invlpg(uint64_t addr) {
+    __asm__ __volatile__("invlpg (%0)" : : "r"(addr) : "memory");
+}
+
+/*
+ * 重新加载CR3不会刷新全局页
+ * 开启了PGE时通过切换CR4.PGE刷新
+ */
+void tlb_flush_all_local(void) {
+    uint64_t cr4;
+    __asm__ __volatile__("mov %%cr4, %0" : "=r"(cr4));
+
+    if (cr4 & CR4_PGE) {
+        __asm__ __volatile__("mov %0, %%cr4" : : "r"(cr4 & ~CR4_PGE) : "memory");
+        __asm__ __volatile__("mov %0, %%cr4" : : "r"(cr4) : "memory");
+    } else {
+        __asm__ __volatile__("mov %%cr3, %%rax\nmov %%rax, %%cr3" : : : "rax", "memory");
+    }
+}
+
+static void flush_ranges(const tlb_range_t *ranges, uint32_t count, bool full) {
+    if (full) {
+        tlb_flush_all_local();
+        return;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        for (uint64_t page = 0; page < ranges[i].pages; page++) {
+            invlpg(ranges[i].start + page * TLB_PAGE_SIZE);
+        }
+    }
+}
+
+/*
+ * 处理当前核心的待处理队列
+ * 由IPI调用，也由等待其他核心的发起者调用
+ * 两个核心同时向对方发起shootdown时不会互相等死
+ */
+static void tlb_process_inbox(void) {
+    tlb_inbox_t *inbox = this_cpu_ptr(&tlb_inbox);
+
+    if (__atomic_load_n(&inbox->pending_gen, __ATOMIC_ACQUIRE) ==
+        __atomic_load_n(&inbox->done_gen, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    tlb_range_t ranges[TLB_INBOX_RANGES];
+    uint64_t flags = interrupts_save();
+
+    spin_lock(&inbox->lock);
+
+    uint32_t count = inbox->count;
+    bool full = inbox->full;
+    uint64_t gen = inbox->pending_gen;
+
+    for (uint32_t i = 0; i < count; i++) {
+        ranges[i] = inbox->ranges[i];
+    }
+
+    inbox->count = 0;
+    inbox->full = false;
+    inbox->ipi_pending = false;
+
+    spin_unlock(&inbox->lock);
+
+    flush_ranges(ranges, count, full);
+
+    __atomic_store_n(&inbox->done_gen, gen, __ATOMIC_RELEASE);
+
+    interrupts_restore(flags);
+}
+
+static void tlb_ipi_handler(interrupt_frame_t *frame) {
+    tlb_process_inbox();
+}
+
+/*
+ * 把批次追加到cpu的队列
+ * 返回是否需要发送IPI
+ */
+static bool tlb_enqueue(uint32_t cpu, const tlb_batch_t *batch) {
+    tlb_inbox_t *inbox = per_cpu_ptr(&tlb_inbox, cpu);
+    uint64_t flags = interrupts_save();
+
+    spin_lock(&inbox->lock);
+
+    if (batch->full || inbox->full || inbox->count + batch->count > TLB_INBOX_RANGES) {
+        inbox->full = true;
+        inbox->count = 0;
+    } else {
+        for (uint32_t i = 0; i < batch->count; i++) {
+            inbox->ranges[inbox->count++] = batch->ranges[i];
+        }
+    }
+
+    __atomic_store_n(&inbox->pending_gen, inbox->pending_gen + 1, __ATOMIC_RELEASE);
+
+    bool send = !inbox->ipi_pending;
+    inbox->ipi_pending = true;
+
+    spin_unlock(&inbox->lock);
+    interrupts_restore(flags);
+
+    return send;
+}
+
+void tlb_batch_init(tlb_batch_t *batch, mm_t *mm) {
+    batch->mm = mm != NULL ? mm : &kernel_mm;
+    batch->count = 0;
+    batch->pages = 0;
+    batch->full = false;
+}
+
+void tlb_batch_add(tlb_batch_t *batch, uint64_t addr, uint64_t pages) {
+    if (batch->full || pages == 0) {
+        return;
+    }
+
+    addr &= ~(uint64_t)(TLB_PAGE_SIZE - 1);
+    batch->pages += pages;
+
+    if (batch->pages > TLB_FLUSH_THRESHOLD) {
+        batch->full = true;
+        batch->count = 0;
+        return;
+    }
+
+    // 和上一个范围相接时合并
+    if (batch->count > 0) {
+        tlb_range_t *last = &batch->ranges[batch->count - 1];
+
+        if (last->start + last->pages * TLB_PAGE_SIZE == addr) {
+            last->pages += pages;
+            return;
+        }
+    }
+
+    if (batch->count >= TLB_BATCH_RANGES) {
+        batch->full = true;
+        batch->count = 0;
+        return;
+    }
+
+    batch->ranges[batch->count].start = addr;
+    batch->ranges[batch->count].pages = pages;
+    batch->count++;
+}
+
+void tlb_batch_flush(tlb_batch_t *batch) {
+    if (!batch->full && batch->count == 0) {
+        return;
+    }
+
+    uint32_t self = cpu_id();
+    cpumask_t targets;
+
+    // 内核映射在所有地址空间中共享
+    if (batch->mm == &kernel_mm) {
+        cpumask_copy(&targets, smp_online_mask());
+    } else {
+        cpumask_copy(&targets, &batch->mm->cpus);
+    }
+
+    if (batch->mm == &kernel_mm || cpumask_test(&targets, self)) {
+        flush_ranges(batch->ranges, batch->count, batch->full);
+    }
+
+    uint32_t cpu;
+
+    for_each_cpu(cpu, &targets) {
+        if (cpu == self) {
+            continue;
+        }
+
+        if (tlb_enqueue(cpu, batch)) {
+            lapic_send_ipi(per_cpu_ptr(&cpu_info, cpu)->apic_id, VECTOR_IPI_TLB);
+        }
+    }
+
+    // 等待目标核心处理到当前为止入队的所有请求
+    for_each_cpu(cpu, &targets) {
+        if (cpu == self) {
+            continue;
+        }
+
+        tlb_inbox_t *inbox = per_cpu_ptr(&tlb_inbox, cpu);
+        uint64_t gen = __atomic_load_n(&inbox->pending_gen, __ATOMIC_ACQUIRE);
+
+        while (__atomic_load_n(&inbox->done_gen, __ATOMIC_ACQUIRE) < gen) {
+            tlb_process_inbox();
+            __asm__ __volatile__("pause");
+        }
+    }
+
+    batch->count = 0;
+    batch->pages = 0;
+    batch->full = false;
+}
+
+void tlb_flush_range(mm_t *mm, uint64_t addr, uint64_t pages) {
+    tlb_batch_t batch;
+
+    tlb_batch_init(&batch, mm);
+    tlb_batch_add(&batch, addr, pages);
+    tlb_batch_flush(&batch);
+}
+
+/*
+ * 先加入新地址空间的cpus再加载CR3
+ * 加载CR3之后再移出旧地址空间，这之前的shootdown仍会通知到这个核心
+ */
+void switch_mm(mm_t *next) {
+    uint32_t cpu = cpu_id();
+    mm_t *prev = this_cpu_read(active_mm);
+
+    if (prev == next) {
+        return;
+    }
+
+    cpumask_set(&next->cpus, cpu);
+    __asm__ __volatile__("mov %0, %%cr3" : : "r"(next->pgd) : "memory");
+    this_cpu_write(active_mm, next);
+
+    if (prev != NULL) {
+        cpumask_clear(&prev->cpus, cpu);
+    }
+}
+
+mm_t *current_mm(void) {
+    return this_cpu_read(active_mm);
+}
+
+void tlb_cpu_init(void) {
+    cpumask_set(&kernel_mm.cpus, cpu_id());
+    this_cpu_write(active_mm, &kernel_mm);
+}
+
+void tlb_init(void) {
+    uint64_t cr3;
+    __asm__ __volatile__("mov %%cr3, %0" : "=r"(cr3));
+
+    kernel_mm.pgd = cr3 & ~0xFFFULL;
+    cpumask_clear_all(&kernel_mm.cpus);
+    spinlock_init(&kernel_mm.lock);
+    rwlock_init(&kernel_mm.vma_lock);
+
+    interrupt_register(VECTOR_IPI_TLB, tlb_ipi_handler);
+
+    tlb_cpu_init();
+}
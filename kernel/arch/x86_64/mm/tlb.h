@@ -0,0 +1,97 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef TLB_H
+#define TLB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <mm/vmm/vmm_types.h>
+
+// 一个批次超过这么多页时改为整体刷新
+#define TLB_FLUSH_THRESHOLD 33
+
+// 每个批次和每个核心的待处理队列最多记录的范围数
+#define TLB_BATCH_RANGES    16
+#define TLB_INBOX_RANGES    32
+
+typedef struct {
+    uint64_t start;
+    uint64_t pages;
+} tlb_range_t;
+
+/*
+ * 一批待刷新的地址
+ * 修改页表时先累积在这里，最后用tlb_batch_flush一次性通知其他核心
+ */
+typedef struct {
+    mm_t *mm;
+    uint32_t count;
+    uint64_t pages;
+    bool full;                  // 需要整体刷新
+    tlb_range_t ranges[TLB_BATCH_RANGES];
+} tlb_batch_t;
+
+// 内核地址空间，所有地址空间共享它的映射
+extern mm_t kernel_mm;
+
+/*
+ * 初始化TLB shootdown
+ * 注册IPI处理函数，记录当前CR3为内核地址空间
+ * 必须在idt_init之后调用
+ */
+void tlb_init(void);
+
+// AP上线时调用，记录当前核心正在使用内核地址空间
+void tlb_cpu_init(void);
+
+/**
+ * 切换当前核心的地址空间
+ * 把当前核心移出旧地址空间的cpus，之后旧地址空间的shootdown不再通知这个核心
+ *
+ * @param next 新的地址空间
+ */
+void switch_mm(mm_t *next);
+
+// 当前核心加载的地址空间
+mm_t *current_mm(void);
+
+/**
+ * 开始一个批次
+ *
+ * @param batch 批次
+ * @param mm    被修改的地址空间，NULL表示内核地址空间
+ */
+void tlb_batch_init(tlb_batch_t *batch, mm_t *mm);
+
+/**
+ * 把一段地址加入批次
+ *
+ * @param batch 批次
+ * @param addr  起始虚拟地址
+ * @param pages 页数
+ */
+void tlb_batch_add(tlb_batch_t *batch, uint64_t addr, uint64_t pages);
+
+/**
+ * 刷新批次中的所有地址并等待其他核心完成
+ * 每个目标核心最多收到一个IPI
+ * 内核地址空间通知所有在线核心，其他地址空间只通知正在使用它的核心
+ *
+ * @param batch 批次，完成后清空
+ */
+void tlb_batch_flush(tlb_batch_t *batch);
+
+/**
+ * 刷新一段地址
+ * 等价于只有一个范围的批次
+ *
+ * @param mm    地址空间，NULL表示内核地址空间
+ * @param addr  起始虚拟地址
+ * @param pages 页数
+ */
+void tlb_flush_range(mm_t *mm, uint64_t addr, uint64_t pages);
+
+// 刷新当前核心的全部TLB，包括全局页
+void tlb_flush_all_local(void);
+
+#endif // TLB_H
@@ -0,0 +1,444 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <io.h>
+#include <serial.h>
+#include <spinlock.h>
+#include <bench.h>
+#include <cpu/cpu.h>
+#include <cpu/idt.h>
+#include <cpu/smp.h>
+#include <mm/bootmem/linear_map.h>
+#include <mm/pmm/pmm.h>
+#include <mm/pmm/buddy.h>
+#include <mm/heap.h>
+
+// pmm和kheap测试每轮分配的块数
+#define BENCH_ALLOC_BATCH   64
+
+// 带宽测试的内存，order 10的块数
+#define BENCH_BW_BLOCKS     8
+#define BENCH_BW_ORDER      10
+
+// 带宽测试每个样本的字节数
+#define BENCH_BW_CHUNK      (64 * 1024)
+
+// 一对rdtscp的开销
+static uint64_t overhead = 0;
+
+static inline uint64_t bench_elapsed(uint64_t start, uint64_t end) {
+    uint64_t cycles = end - start;
+    return cycles > overhead ? cycles - overhead : 0;
+}
+
+static void bench_calibrate(void) {
+    overhead = UINT64_MAX;
+
+    for (uint32_t i = 0; i < 1000; i++) {
+        uint64_t start = rdtscp();
+        uint64_t end = rdtscp();
+
+        if (end - start < overhead) {
+            overhead = end - start;
+        }
+    }
+}
+
+// 堆排序，样本数组不需要额外内存
+static void sift_down(uint64_t *a, uint32_t root, uint32_t n) {
+    while (root * 2 + 1 < n) {
+        uint32_t child = root * 2 + 1;
+
+        if (child + 1 < n && a[child + 1] > a[child]) {
+            child++;
+        }
+        if (a[root] >= a[child]) {
+            return;
+        }
+
+        uint64_t tmp = a[root];
+        a[root] = a[child];
+        a[child] = tmp;
+        root = child;
+    }
+}
+
+static void sort_samples(uint64_t *a, uint32_t n) {
+    for (uint32_t i = n / 2; i-- > 0;) {
+        sift_down(a, i, n);
+    }
+
+    for (uint32_t end = n; end-- > 1;) {
+        uint64_t tmp = a[0];
+        a[0] = a[end];
+        a[end] = tmp;
+        sift_down(a, 0, end);
+    }
+}
+
+static void put_field(const char *name, uint64_t value) {
+    serial_puts(" ");
+    serial_puts(name);
+    serial_puts("=");
+    serial_put_dec(value);
+}
+
+/*
+ * 输出一项结果
+ * 每个样本是ops次操作的周期数
+ */
+static void bench_report(const char *name, const char *key, uint64_t param,
+                         uint64_t *samples, uint32_t n, uint32_t ops) {
+    serial_puts("BENCH name=");
+    serial_puts(name);
+
+    if (key != NULL) {
+        put_field(key, param);
+    }
+
+    put_field("n", n);
+
+    if (n == 0) {
+        serial_puts("\n");
+        return;
+    }
+
+    sort_samples(samples, n);
+
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        sum += samples[i];
+    }
+
+    put_field("min", samples[0] / ops);
+    put_field("p50", samples[n / 2] / ops);
+    put_field("p90", samples[(uint64_t)n * 90 / 100] / ops);
+    put_field("p99", samples[(uint64_t)n * 99 / 100] / ops);
+    put_field("max", samples[n - 1] / ops);
+    put_field("mean", sum / n / ops);
+    serial_puts("\n");
+}
+
+static uint64_t *samples_alloc(uint32_t count) {
+    return (uint64_t *)kmalloc(count * sizeof(uint64_t));
+}
+
+/*
+ * 伙伴系统每个order的分配和释放
+ * 每轮连续分配一批再全部释放，per-CPU缓存的填充和回收也在样本中
+ * 计时期间关中断，分配失败不能直接压缩
+ */
+static void bench_pmm(uint64_t *alloc_samples, uint64_t *free_samples) {
+    uint64_t pfns[BENCH_ALLOC_BATCH];
+
+    for (uint8_t order = 0; order < MAX_ORDER; order++) {
+        uint32_t n = 0;
+
+        while (n < BENCH_SAMPLES) {
+            uint32_t count = 0;
+            uint64_t flags = interrupts_save();
+
+            while (count < BENCH_ALLOC_BATCH && n + count < BENCH_SAMPLES) {
+                uint64_t start = rdtscp();
+                uint64_t pfn = pmm_try_alloc_pages(order, ZONE_DMA32, MIGRATE_UNMOVABLE);
+                uint64_t end = rdtscp();
+
+                if (pfn == 0) {
+                    break;
+                }
+
+                alloc_samples[n + count] = bench_elapsed(start, end);
+                pfns[count++] = pfn;
+            }
+
+            for (uint32_t i = 0; i < count; i++) {
+                uint64_t start = rdtscp();
+                pmm_free_pages(pfns[i]);
+                uint64_t end = rdtscp();
+
+                free_samples[n + i] = bench_elapsed(start, end);
+            }
+
+            interrupts_restore(flags);
+
+            if (count == 0) {
+                break;
+            }
+            n += count;
+        }
+
+        bench_report("pmm_alloc", "order", order, alloc_samples, n, 1);
+        bench_report("pmm_free", "order", order, free_samples, n, 1);
+    }
+
+    pmm_drain_local_pages();
+}
+
+// 内核堆不同大小的分配和释放，同样关中断计时，不能直接压缩
+static void bench_kheap(uint64_t *alloc_samples, uint64_t *free_samples) {
+    static const uint64_t sizes[] = {
+        4096, 16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024, 4 * 1024 * 1024,
+    };
+    uint64_t pfns[BENCH_ALLOC_BATCH];
+
+    for (uint32_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        uint32_t n = 0;
+
+        while (n < BENCH_SAMPLES) {
+            uint32_t count = 0;
+            uint64_t flags = interrupts_save();
+
+            while (count < BENCH_ALLOC_BATCH && n + count < BENCH_SAMPLES) {
+                uint64_t start = rdtscp();
+                uint64_t pfn = kheap_try_alloc(sizes[s]);
+                uint64_t end = rdtscp();
+
+                if (pfn == 0) {
+                    break;
+                }
+
+                alloc_samples[n + count] = bench_elapsed(start, end);
+                pfns[count++] = pfn;
+            }
+
+            for (uint32_t i = 0; i < count; i++) {
+                uint64_t start = rdtscp();
+                kheap_free(pfns[i]);
+                uint64_t end = rdtscp();
+
+                free_samples[n + i] = bench_elapsed(start, end);
+            }
+
+            interrupts_restore(flags);
+
+            if (count == 0) {
+                break;
+            }
+            n += count;
+        }
+
+        bench_report("kheap_alloc", "size", sizes[s], alloc_samples, n, 1);
+        bench_report("kheap_free", "size", sizes[s], free_samples, n, 1);
+    }
+
+    pmm_drain_local_pages();
+}
+
+// 没有竞争时一次加锁解锁
+static void bench_spin_uncontended(uint64_t *samples) {
+    spinlock_t lock = SPIN_LOCK_INIT;
+    uint64_t flags = interrupts_save();
+
+    for (uint32_t i = 0; i < BENCH_SAMPLES; i++) {
+        uint64_t start = rdtscp();
+
+        for (uint32_t j = 0; j < BENCH_BATCH; j++) {
+            spin_lock(&lock);
+            spin_unlock(&lock);
+        }
+
+        samples[i] = bench_elapsed(start, rdtscp());
+    }
+
+    interrupts_restore(flags);
+
+    bench_report("spin_uncontended", NULL, 0, samples, BENCH_SAMPLES, BENCH_BATCH);
+}
+
+/*
+ * 所有核心同时对同一个锁加锁解锁
+ * 每个核心写自己的样本区，全部到齐后才开始
+ */
+typedef struct {
+    spinlock_t lock;
+    uint64_t counter;
+    uint32_t cpus;
+    uint32_t slot;
+    uint32_t arrived;
+    uint32_t done;
+    uint64_t *samples;
+} bench_spin_t;
+
+static void bench_spin_worker(void *arg) {
+    bench_spin_t *ctx = arg;
+    uint32_t slot = __atomic_fetch_add(&ctx->slot, 1, __ATOMIC_RELAXED);
+    uint64_t *out = ctx->samples + (uint64_t)slot * BENCH_SAMPLES;
+
+    __atomic_fetch_add(&ctx->arrived, 1, __ATOMIC_ACQ_REL);
+    while (__atomic_load_n(&ctx->arrived, __ATOMIC_ACQUIRE) < ctx->cpus) {
+        __asm__ __volatile__("pause");
+    }
+
+    for (uint32_t i = 0; i < BENCH_SAMPLES; i++) {
+        uint64_t start = rdtscp();
+        spin_lock(&ctx->lock);
+        ctx->counter++;
+        spin_unlock(&ctx->lock);
+        out[i] = bench_elapsed(start, rdtscp());
+    }
+
+    __atomic_fetch_add(&ctx->done, 1, __ATOMIC_RELEASE);
+}
+
+static void bench_spin_contended(void) {
+    static bench_spin_t ctx;
+    uint32_t cpus = smp_num_online();
+
+    spinlock_init(&ctx.lock);
+    ctx.counter = 0;
+    ctx.cpus = cpus;
+    ctx.slot = 0;
+    ctx.arrived = 0;
+    ctx.done = 0;
+    ctx.samples = samples_alloc(cpus * BENCH_SAMPLES);
+
+    if (ctx.samples == NULL) {
+        serial_puts("BENCH_ERROR name=spin_contended no memory\n");
+        return;
+    }
+
+    uint64_t flags = interrupts_save();
+
+    smp_call_function(bench_spin_worker, &ctx, false);
+    bench_spin_worker(&ctx);
+
+    while (__atomic_load_n(&ctx.done, __ATOMIC_ACQUIRE) < cpus) {
+        __asm__ __volatile__("pause");
+    }
+
+    interrupts_restore(flags);
+
+    // 计数不对说明锁没有互斥
+    if (ctx.counter != (uint64_t)cpus * BENCH_SAMPLES) {
+        serial_puts("BENCH_ERROR name=spin_contended lost updates\n");
+    }
+
+    bench_report("spin_contended", "cpus", cpus, ctx.samples, cpus * BENCH_SAMPLES, 1);
+    kfree(ctx.samples);
+}
+
+/*
+ * 通过线性映射读、写、复制内存
+ * 样本是BENCH_BW_CHUNK字节的周期数，按4KB页输出
+ */
+static void bench_bandwidth(uint64_t *samples) {
+    uint64_t *blocks[BENCH_BW_BLOCKS];
+    uint64_t block_bytes = PAGE_SIZE << BENCH_BW_ORDER;
+    uint32_t chunks = block_bytes / BENCH_BW_CHUNK;
+    uint32_t pages = BENCH_BW_CHUNK / PAGE_SIZE;
+    uint32_t count = 0;
+
+    for (; count < BENCH_BW_BLOCKS; count++) {
+        uint64_t pfn = pmm_alloc_pages(BENCH_BW_ORDER, ZONE_DMA32);
+        if (pfn == 0) {
+            break;
+        }
+        blocks[count] = (uint64_t *)PHYS_TO_LINEAR(pfn * PAGE_SIZE);
+    }
+
+    if (count < 2) {
+        serial_puts("BENCH_ERROR name=bandwidth no memory\n");
+        goto out;
+    }
+
+    uint64_t flags = interrupts_save();
+    uint32_t n = 0;
+
+    // 写
+    for (uint32_t b = 0; b < count; b++) {
+        for (uint32_t c = 0; c < chunks && n < BENCH_SAMPLES; c++) {
+            uint64_t *p = blocks[b] + c * BENCH_BW_CHUNK / sizeof(uint64_t);
+            uint64_t start = rdtscp();
+            __asm__ __volatile__("rep stosq"
+                                 : "+D"(p)
+                                 : "c"(BENCH_BW_CHUNK / sizeof(uint64_t)), "a"(c)
+                                 : "memory");
+            samples[n++] = bench_elapsed(start, rdtscp());
+        }
+    }
+
+    interrupts_restore(flags);
+    bench_report("mem_write", "chunk", BENCH_BW_CHUNK, samples, n, pages);
+
+    flags = interrupts_save();
+    n = 0;
+
+    // 读
+    uint64_t sum = 0;
+    for (uint32_t b = 0; b < count; b++) {
+        for (uint32_t c = 0; c < chunks && n < BENCH_SAMPLES; c++) {
+            volatile uint64_t *p = blocks[b] + c * BENCH_BW_CHUNK / sizeof(uint64_t);
+            uint64_t start = rdtscp();
+            for (uint32_t i = 0; i < BENCH_BW_CHUNK / sizeof(uint64_t); i++) {
+                sum += p[i];
+            }
+            samples[n++] = bench_elapsed(start, rdtscp());
+        }
+    }
+
+    interrupts_restore(flags);
+    bench_report("mem_read", "chunk", BENCH_BW_CHUNK, samples, n, pages);
+
+    flags = interrupts_save();
+    n = 0;
+
+    // 复制，前一半的块复制到后一半
+    for (uint32_t b = 0; b < count / 2; b++) {
+        for (uint32_t c = 0; c < chunks && n < BENCH_SAMPLES; c++) {
+            uint64_t *src = blocks[b] + c * BENCH_BW_CHUNK / sizeof(uint64_t);
+            uint64_t *dst = blocks[b + count / 2] + c * BENCH_BW_CHUNK / sizeof(uint64_t);
+            uint64_t start = rdtscp();
+            __asm__ __volatile__("rep movsq"
+                                 : "+S"(src), "+D"(dst)
+                                 : "c"(BENCH_BW_CHUNK / sizeof(uint64_t))
+                                 : "memory");
+            samples[n++] = bench_elapsed(start, rdtscp());
+        }
+    }
+
+    interrupts_restore(flags);
+    bench_report("mem_copy", "chunk", BENCH_BW_CHUNK, samples, n, pages);
+
+    // 防止读循环被优化掉
+    __asm__ __volatile__("" : : "r"(sum));
+
+out:
+    for (uint32_t b = 0; b < count; b++) {
+        pmm_free_pages(LINEAR_TO_PHYS(blocks[b]) / PAGE_SIZE);
+    }
+}
+
+void bench_run(void) {
+    // 后台初始化的内存和分配路径上的初始化都会干扰测量
+    pmm_init_wait();
+
+    uint64_t *alloc_samples = samples_alloc(BENCH_SAMPLES);
+    uint64_t *free_samples = samples_alloc(BENCH_SAMPLES);
+
+    if (alloc_samples == NULL || free_samples == NULL) {
+        panic("[BENCH] ERROR: Cannot allocate sample buffers\n");
+    }
+
+    bench_calibrate();
+
+    serial_puts("BENCH_BEGIN");
+    put_field("cpus", smp_num_online());
+    put_field("overhead", overhead);
+    serial_puts("\n");
+
+    bench_pmm(alloc_samples, free_samples);
+    bench_kheap(alloc_samples, free_samples);
+    bench_spin_uncontended(alloc_samples);
+    bench_spin_contended();
+    bench_bandwidth(alloc_samples);
+
+    serial_puts("BENCH_END\n");
+
+    kfree(alloc_samples);
+    kfree(free_samples);
+
+    serial_flush();
+    outb(BENCH_EXIT_PORT, 0);
+}
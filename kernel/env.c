@@ -0,0 +1,113 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <bootboot.h>
+#include <env.h>
+
+static inline bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+/*
+ * 查找key所在行的值
+ * 返回值的起始位置，len为值的长度，去掉了首尾空白
+ */
+static const char *env_find(const char *key, size_t *len) {
+    const char *env = (const char *)BOOTBOOT_ENV;
+    const char *end = env + ENV_SIZE;
+    const char *p = env;
+
+    while (p < end && *p) {
+        const char *line = p;
+
+        while (p < end && *p && *p != '\n') {
+            p++;
+        }
+
+        const char *line_end = p;
+
+        if (p < end && *p == '\n') {
+            p++;
+        }
+
+        while (line < line_end && is_space(*line)) {
+            line++;
+        }
+
+        if (line == line_end || *line == '#' || (line[0] == '/' && line + 1 < line_end && line[1] == '/')) {
+            continue;
+        }
+
+        // 比较键
+        const char *k = key;
+        while (*k && line < line_end && *line == *k) {
+            line++;
+            k++;
+        }
+
+        while (line < line_end && is_space(*line)) {
+            line++;
+        }
+
+        if (*k != '\0' || line == line_end || *line != '=') {
+            continue;
+        }
+
+        line++;
+
+        while (line < line_end && is_space(*line)) {
+            line++;
+        }
+        while (line_end > line && is_space(line_end[-1])) {
+            line_end--;
+        }
+
+        *len = line_end - line;
+        return line;
+    }
+
+    return NULL;
+}
+
+bool env_get(const char *key, char *value, size_t size) {
+    size_t len;
+    const char *found = env_find(key, &len);
+
+    if (found == NULL) {
+        return false;
+    }
+
+    if (size == 0) {
+        return true;
+    }
+
+    if (len > size - 1) {
+        len = size - 1;
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        value[i] = found[i];
+    }
+    value[len] = '\0';
+
+    return true;
+}
+
+bool env_is(const char *key, const char *value) {
+    size_t len;
+    const char *found = env_find(key, &len);
+
+    if (found == NULL) {
+        return false;
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        if (value[i] != found[i]) {
+            return false;
+        }
+    }
+
+    return value[len] == '\0';
+}
@@ -0,0 +1,32 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+
+// 每项测试的样本数
+#define BENCH_SAMPLES   1024
+
+// 开销很小的操作每个样本执行的次数
+#define BENCH_BATCH     64
+
+// QEMU isa-debug-exit设备的端口，写入后QEMU退出
+#define BENCH_EXIT_PORT 0xF4
+
+/*
+ * 内核基准测试
+ *
+ * BOOTBOOT环境中mode=bench时在smp_init之后运行
+ * 结果以一行一项的格式输出到串口，由tools/bench_collect.py解析：
+ *
+ *   BENCH_BEGIN cpus=4 overhead=38
+ *   BENCH name=pmm_alloc order=0 n=1024 min=.. p50=.. p90=.. p99=.. max=.. mean=..
+ *   BENCH_END
+ *
+ * 数值是rdtscp测得的每次操作的周期数，已经减去rdtscp本身的开销
+ * 结束后通过BENCH_EXIT_PORT让QEMU退出
+ */
+void bench_run(void);
+
+#endif // BENCH_H
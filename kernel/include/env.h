@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef ENV_H
+#define ENV_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// BOOTBOOT环境字符串最大长度
+#define ENV_SIZE 4096
+
+/**
+ * 读取BOOTBOOT环境中的一项
+ * 环境来自引导盘上的sys/config，每行一个key=value
+ * 以#或//开头的行是注释
+ *
+ * @param key   键
+ * @param value 输出，以0结尾
+ * @param size  value的大小
+ * @return 找到返回true，值太长时截断
+ */
+bool env_get(const char *key, char *value, size_t size);
+
+/**
+ * 检查环境中key的值是否等于value
+ *
+ * @param key   键
+ * @param value 期望的值
+ * @return key存在并且值相等返回true
+ */
+bool env_is(const char *key, const char *value);
+
+#endif // ENV_H
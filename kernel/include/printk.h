@@ -0,0 +1,102 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef PRINTK_H
+#define PRINTK_H
+
+#include <stdint.h>
+#include <config.h>
+
+// 每条日志最多的参数个数
+#define LOG_MAX_ARGS    6
+
+// 日志环形缓冲区的记录数，必须是2的幂
+#define LOG_RING_SIZE   1024
+
+// 格式化后一行的最大长度
+#define LOG_LINE_MAX    256
+
+/*
+ * 日志记录
+ * 只保存格式字符串的指针和原始参数，输出时才格式化
+ * seq在写完后最后写入，为位置加1，读者用它判断记录是否完整
+ */
+typedef struct {
+    uint64_t seq;
+    uint64_t tsc;
+    const char *fmt;
+    uint8_t level;
+    uint8_t nargs;
+    uint16_t cpu;
+    uint64_t args[LOG_MAX_ARGS];
+} log_record_t;
+
+/*
+ * 把参数逐个转换为uint64_t
+ * 最多LOG_MAX_ARGS个
+ */
+#define __LOG_NARGS(...) __LOG_NARGS_(0, ##__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+#define __LOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, N, ...) N
+
+#define __LOG_CAST0()
+#define __LOG_CAST1(a)                  (uint64_t)(a)
+#define __LOG_CAST2(a, b)               (uint64_t)(a), (uint64_t)(b)
+#define __LOG_CAST3(a, b, c)            __LOG_CAST2(a, b), (uint64_t)(c)
+#define __LOG_CAST4(a, b, c, d)         __LOG_CAST3(a, b, c), (uint64_t)(d)
+#define __LOG_CAST5(a, b, c, d, e)      __LOG_CAST4(a, b, c, d), (uint64_t)(e)
+#define __LOG_CAST6(a, b, c, d, e, f)   __LOG_CAST5(a, b, c, d, e), (uint64_t)(f)
+
+#define __LOG_CONCAT(a, b) a##b
+#define __LOG_CASTN(n) __LOG_CONCAT(__LOG_CAST, n)
+
+/**
+ * 格式化日志
+ *
+ * 支持%d %i %u %x %X %p %s %c %%，整数可以带l或ll
+ * 格式化发生在输出时，所以%s只能指向一直有效的字符串，比如字符串常量
+ * 级别大于LOG_LEVEL时整条语句在编译时被去掉
+ *
+ * @param level LOG_EMERG到LOG_DEBUG
+ * @param fmt   格式字符串，必须是字符串常量
+ */
+#define kprintf(level, fmt, ...) do {                                           \
+    if ((level) <= LOG_LEVEL) {                                                 \
+        const uint64_t __log_args[] = {                                         \
+            0, __LOG_CASTN(__LOG_NARGS(__VA_ARGS__))(__VA_ARGS__)               \
+        };                                                                      \
+        _Static_assert(__LOG_NARGS(__VA_ARGS__) <= LOG_MAX_ARGS,                \
+                       "too many kprintf arguments");                           \
+        log_write((level), (fmt), __LOG_NARGS(__VA_ARGS__), __log_args + 1);    \
+    }                                                                           \
+} while (0)
+
+#define pr_emerg(fmt, ...)  kprintf(LOG_EMERG, fmt, ##__VA_ARGS__)
+#define pr_err(fmt, ...)    kprintf(LOG_ERR, fmt, ##__VA_ARGS__)
+#define pr_warn(fmt, ...)   kprintf(LOG_WARN, fmt, ##__VA_ARGS__)
+#define pr_info(fmt, ...)   kprintf(LOG_INFO, fmt, ##__VA_ARGS__)
+#define pr_debug(fmt, ...)  kprintf(LOG_DEBUG, fmt, ##__VA_ARGS__)
+
+/**
+ * 写入一条日志记录
+ * 缓冲区满时覆盖最旧的记录
+ * 级别不高于LOG_WARN的记录写入后立即输出
+ *
+ * @param level 日志级别
+ * @param fmt   格式字符串
+ * @param nargs 参数个数
+ * @param args  参数
+ */
+void log_write(uint8_t level, const char *fmt, uint32_t nargs, const uint64_t *args);
+
+/*
+ * 格式化并输出缓冲区中的所有记录
+ * 同一时刻只有一个核心输出，其他核心直接返回
+ */
+void log_drain(void);
+
+/*
+ * panic时使用
+ * 不管其他核心是否正在输出，直接输出剩下的记录
+ */
+void log_panic_drain(void);
+
+#endif // PRINTK_H
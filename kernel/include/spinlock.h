@@ -5,36 +5,429 @@
 
 #include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <config.h>
+#include <io.h>
+
+#ifndef SPINLOCK_TYPE
+#define SPINLOCK_TYPE SPINLOCK_TAS
+#endif
+
+#ifndef LOCK_STAT
+#define LOCK_STAT 0
+#endif
+
+#if SPINLOCK_TYPE == SPINLOCK_TICKET
+
+/*
+ * 排号锁
+ * 获取锁时取一个号，等到owner叫到自己的号
+ * 按到达顺序获得锁
+ */
+typedef union {
+    uint32_t val;
+    struct {
+        uint16_t owner;     // 当前持有者的号
+        uint16_t next;      // 下一个要发出的号
+    };
+} raw_spinlock_t;
+
+// 锁初始化宏
+#define RAW_SPIN_LOCK_INIT { .val = 0 }
+
+// 初始化锁
+static inline void raw_spinlock_init(raw_spinlock_t *lock) {
+    __atomic_store_n(&lock->val, 0, __ATOMIC_RELAXED);
+}
+
+// 获取锁
+static inline void raw_spin_lock(raw_spinlock_t *lock) {
+    uint16_t ticket = __atomic_fetch_add(&lock->next, 1, __ATOMIC_RELAXED);
+
+    while (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket) {
+        // 锁被占用时暂停指令，减少CPU占用
+        cpu_relax();
+    }
+}
+
+// 释放锁
+static inline void raw_spin_unlock(raw_spinlock_t *lock) {
+    // 只有持有者会修改owner
+    __atomic_store_n(&lock->owner, lock->owner + 1, __ATOMIC_RELEASE);
+}
+
+// 尝试获取锁，返回结果
+static inline bool raw_spin_trylock(raw_spinlock_t *lock) {
+    raw_spinlock_t old;
+    old.val = __atomic_load_n(&lock->val, __ATOMIC_RELAXED);
+
+    if (old.owner != old.next) {
+        return false;
+    }
+
+    raw_spinlock_t new = old;
+    new.next++;
+
+    return __atomic_compare_exchange_n(&lock->val, &old.val, new.val, false,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+#elif SPINLOCK_TYPE == SPINLOCK_QUEUED
+
+// 每个核心可以同时排队的锁数（普通、中断、NMI嵌套）
+#define SPIN_QNODES 4
+
+/*
+ * 队列节点
+ * 等待者只在自己的节点上自旋
+ * 不会所有核心争抢同一个缓存行
+ */
+typedef struct spin_qnode {
+    struct spin_qnode *next;
+    uint32_t wait;
+} spin_qnode_t;
+
+/*
+ * 队列锁
+ * locked是锁本身
+ * tail指向等待队列的最后一个节点
+ *
+ * 没有等待者时直接CAS获取locked
+ * 否则排到队尾，轮到队首时再获取locked
+ * 获得锁后就把队首交给下一个节点，自己的节点可以复用
+ * 所以释放锁只需要清除locked
+ */
+typedef struct {
+    uint32_t locked;
+    spin_qnode_t *tail;
+} raw_spinlock_t;
+
+// 锁初始化宏
+#define RAW_SPIN_LOCK_INIT { 0, NULL }
+
+// 慢速路径，在spinlock.c中
+void raw_spin_lock_slowpath(raw_spinlock_t *lock);
+
+// 初始化锁
+static inline void raw_spinlock_init(raw_spinlock_t *lock) {
+    __atomic_store_n(&lock->tail, NULL, __ATOMIC_RELAXED);
+    __atomic_store_n(&lock->locked, 0, __ATOMIC_RELAXED);
+}
+
+// 尝试获取锁，返回结果
+static inline bool raw_spin_trylock(raw_spinlock_t *lock) {
+    uint32_t expected = 0;
+
+    // 有等待者时不插队
+    if (__atomic_load_n(&lock->tail, __ATOMIC_RELAXED) != NULL) {
+        return false;
+    }
+
+    return __atomic_compare_exchange_n(&lock->locked, &expected, 1, false,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+// 获取锁
+static inline void raw_spin_lock(raw_spinlock_t *lock) {
+    if (raw_spin_trylock(lock)) {
+        return;
+    }
+
+    raw_spin_lock_slowpath(lock);
+}
+
+// 释放锁
+static inline void raw_spin_unlock(raw_spinlock_t *lock) {
+    __atomic_store_n(&lock->locked, 0, __ATOMIC_RELEASE);
+}
+
+#else
 
 // 自旋锁结构
 typedef struct {
     atomic_flag flag;
-} spinlock_t;
+} raw_spinlock_t;
 
 // 锁初始化宏
-#define SPIN_LOCK_INIT { ATOMIC_FLAG_INIT }
+#define RAW_SPIN_LOCK_INIT { ATOMIC_FLAG_INIT }
 
 // 初始化锁
-static inline void spinlock_init(spinlock_t *lock) {
+static inline void raw_spinlock_init(raw_spinlock_t *lock) {
     atomic_flag_clear(&lock->flag);
 }
 
 // 获取锁
-static inline void spin_lock(spinlock_t *lock) {
+static inline void raw_spin_lock(raw_spinlock_t *lock) {
     while (atomic_flag_test_and_set_explicit(&lock->flag, memory_order_acquire)) {
         // 锁被占用时暂停指令，减少CPU占用
-        __asm__ __volatile__ ("pause");
+        cpu_relax();
     }
 }
 
 // 释放锁
-static inline void spin_unlock(spinlock_t *lock) {
+static inline void raw_spin_unlock(raw_spinlock_t *lock) {
     atomic_flag_clear_explicit(&lock->flag, memory_order_release);
 }
 
 // 尝试获取锁，返回结果
-static inline bool spin_trylock(spinlock_t *lock) {
+static inline bool raw_spin_trylock(raw_spinlock_t *lock) {
     return !atomic_flag_test_and_set_explicit(&lock->flag, memory_order_acquire);
 }
 
-#endif
\ No newline at end of file
+#endif
+
+/*
+ * 对外使用的自旋锁
+ * 
+ * LOCK_STAT打开时每个锁额外记录统计信息
+ * 获取次数、竞争次数、等待的总周期和最大周期，以及调用位置
+ * 统计在持有锁时更新，所以不需要原子操作
+ * 通过lock_stat_dump从串口输出
+ */
+#if LOCK_STAT
+
+typedef struct lock_stat {
+    const char *file;           // 第一次获取的位置，用来区分锁
+    int line;
+    const char *max_file;       // 等待最久的一次获取的位置
+    int max_line;
+    uint64_t acquisitions;      // 获取次数
+    uint64_t contended;         // 需要等待的次数
+    uint64_t wait_cycles;       // 等待的总周期
+    uint64_t max_wait_cycles;   // 等待的最大周期
+} lock_stat_t;
+
+typedef struct {
+    raw_spinlock_t raw;
+    lock_stat_t *stat;
+} spinlock_t;
+
+// 锁初始化宏
+#define SPIN_LOCK_INIT { RAW_SPIN_LOCK_INIT, NULL }
+
+// 在spinlock.c中
+void lock_stat_record(spinlock_t *lock, uint64_t wait, const char *file, int line);
+void lock_stat_dump(void);
+void lock_stat_reset(void);
+
+// 初始化锁
+static inline void spinlock_init(spinlock_t *lock) {
+    raw_spinlock_init(&lock->raw);
+    lock->stat = NULL;
+}
+
+static inline void __spin_lock(spinlock_t *lock, const char *file, int line) {
+    uint64_t wait = 0;
+
+    if (!raw_spin_trylock(&lock->raw)) {
+        uint64_t start = rdtsc();
+        raw_spin_lock(&lock->raw);
+        wait = rdtsc() - start;
+    }
+
+    lock_stat_record(lock, wait, file, line);
+}
+
+static inline bool __spin_trylock(spinlock_t *lock, const char *file, int line) {
+    if (!raw_spin_trylock(&lock->raw)) {
+        return false;
+    }
+
+    lock_stat_record(lock, 0, file, line);
+    return true;
+}
+
+// 获取锁
+#define spin_lock(lock) __spin_lock((lock), __FILE__, __LINE__)
+
+// 尝试获取锁，返回结果
+#define spin_trylock(lock) __spin_trylock((lock), __FILE__, __LINE__)
+
+// 释放锁
+static inline void spin_unlock(spinlock_t *lock) {
+    raw_spin_unlock(&lock->raw);
+}
+
+#else
+
+typedef raw_spinlock_t spinlock_t;
+
+// 锁初始化宏
+#define SPIN_LOCK_INIT RAW_SPIN_LOCK_INIT
+
+// 初始化锁
+static inline void spinlock_init(spinlock_t *lock) {
+    raw_spinlock_init(lock);
+}
+
+// 获取锁
+static inline void spin_lock(spinlock_t *lock) {
+    raw_spin_lock(lock);
+}
+
+// 释放锁
+static inline void spin_unlock(spinlock_t *lock) {
+    raw_spin_unlock(lock);
+}
+
+// 尝试获取锁，返回结果
+static inline bool spin_trylock(spinlock_t *lock) {
+    return raw_spin_trylock(lock);
+}
+
+static inline void lock_stat_dump(void) {}
+static inline void lock_stat_reset(void) {}
+
+#endif
+
+/*
+ * 读写锁
+ * 多个读者可以同时持有，写者独占
+ * 写者优先：有写者在等待时新的读者不能进入
+ * 适合读多写少并且读者需要看到稳定数据的场合
+ */
+#define RW_WRITER 0x80000000U
+
+typedef struct {
+    uint32_t cnt;           // 低位为读者数，RW_WRITER为写者持有
+    uint32_t writers;       // 等待中的写者数
+} rwlock_t;
+
+#define RW_LOCK_INIT { 0, 0 }
+
+static inline void rwlock_init(rwlock_t *lock) {
+    __atomic_store_n(&lock->cnt, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&lock->writers, 0, __ATOMIC_RELAXED);
+}
+
+static inline bool read_trylock(rwlock_t *lock) {
+    if (__atomic_load_n(&lock->writers, __ATOMIC_RELAXED) != 0 ||
+        (__atomic_load_n(&lock->cnt, __ATOMIC_RELAXED) & RW_WRITER)) {
+        return false;
+    }
+
+    uint32_t old = __atomic_fetch_add(&lock->cnt, 1, __ATOMIC_ACQUIRE);
+    if (old & RW_WRITER) {
+        // 写者抢先了，撤销
+        __atomic_fetch_sub(&lock->cnt, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    return true;
+}
+
+static inline void read_lock(rwlock_t *lock) {
+    while (!read_trylock(lock)) {
+        cpu_relax();
+    }
+}
+
+static inline void read_unlock(rwlock_t *lock) {
+    __atomic_fetch_sub(&lock->cnt, 1, __ATOMIC_RELEASE);
+}
+
+static inline bool write_trylock(rwlock_t *lock) {
+    uint32_t expected = 0;
+
+    return __atomic_compare_exchange_n(&lock->cnt, &expected, RW_WRITER, false,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static inline void write_lock(rwlock_t *lock) {
+    // 先登记，阻止新的读者进入
+    __atomic_fetch_add(&lock->writers, 1, __ATOMIC_RELAXED);
+
+    while (__atomic_load_n(&lock->cnt, __ATOMIC_RELAXED) != 0 || !write_trylock(lock)) {
+        cpu_relax();
+    }
+
+    __atomic_fetch_sub(&lock->writers, 1, __ATOMIC_RELAXED);
+}
+
+static inline void write_unlock(rwlock_t *lock) {
+    // 不能直接写0，读者可能正在临时加1
+    __atomic_fetch_sub(&lock->cnt, RW_WRITER, __ATOMIC_RELEASE);
+}
+
+/*
+ * 顺序计数
+ * 写者修改数据前后各加1，修改期间为奇数
+ * 读者不加锁，读之前和读之后的序号相同且为偶数才算读到一致的数据
+ * 写者之间需要自己用锁互斥
+ *
+ * 读者用法：
+ * do {
+ *     seq = read_seqcount_begin(&s);
+ *     ...读取数据...
+ * } while (read_seqcount_retry(&s, seq));
+ */
+typedef struct {
+    uint32_t sequence;
+} seqcount_t;
+
+#define SEQCOUNT_INIT { 0 }
+
+static inline void seqcount_init(seqcount_t *s) {
+    __atomic_store_n(&s->sequence, 0, __ATOMIC_RELAXED);
+}
+
+static inline uint32_t read_seqcount_begin(const seqcount_t *s) {
+    uint32_t seq;
+
+    while ((seq = __atomic_load_n(&s->sequence, __ATOMIC_ACQUIRE)) & 1) {
+        cpu_relax();
+    }
+
+    return seq;
+}
+
+static inline bool read_seqcount_retry(const seqcount_t *s, uint32_t start) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&s->sequence, __ATOMIC_RELAXED) != start;
+}
+
+static inline void write_seqcount_begin(seqcount_t *s) {
+    __atomic_store_n(&s->sequence, s->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void write_seqcount_end(seqcount_t *s) {
+    __atomic_store_n(&s->sequence, s->sequence + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * 顺序锁
+ * 顺序计数加上写者之间互斥用的自旋锁
+ */
+typedef struct {
+    seqcount_t seq;
+    spinlock_t lock;
+} seqlock_t;
+
+#define SEQ_LOCK_INIT { SEQCOUNT_INIT, SPIN_LOCK_INIT }
+
+static inline void seqlock_init(seqlock_t *sl) {
+    seqcount_init(&sl->seq);
+    spinlock_init(&sl->lock);
+}
+
+static inline void write_seqlock(seqlock_t *sl) {
+    spin_lock(&sl->lock);
+    write_seqcount_begin(&sl->seq);
+}
+
+static inline void write_sequnlock(seqlock_t *sl) {
+    write_seqcount_end(&sl->seq);
+    spin_unlock(&sl->lock);
+}
+
+static inline uint32_t read_seqbegin(const seqlock_t *sl) {
+    return read_seqcount_begin(&sl->seq);
+}
+
+static inline bool read_seqretry(const seqlock_t *sl, uint32_t start) {
+    return read_seqcount_retry(&sl->seq, start);
+}
+
+#endif
@@ -0,0 +1,115 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <config.h>
+
+/*
+ * 跟踪点
+ *
+ * TRACE关闭时跟踪点在编译时被去掉，参数也不会被求值
+ * TRACE打开时每个跟踪点是一次trace_mask的读取和一个预测为不跳转的分支
+ * 事件写入当前核心的环形缓冲区，满了覆盖最旧的记录
+ * trace_dump把所有核心的缓冲区以二进制帧输出到串口，由tools/trace_decode.py解码
+ */
+
+// 事件
+#define TRACE_PMM_ALLOC     0   // pfn：分配结果，0为失败
+#define TRACE_PMM_FREE      1
+#define TRACE_BUDDY_SPLIT   2   // order：拆分前的order
+#define TRACE_BUDDY_MERGE   3   // pfn、order：合并后的块
+#define TRACE_KHEAP_ALLOC   4   // arg：请求的字节数
+#define TRACE_EVENTS        5
+
+#define TRACE_ALL           ((1U << TRACE_EVENTS) - 1)
+
+// 每个核心的记录数，必须是2的幂
+#define TRACE_RING_SIZE     4096
+
+// 每帧最多的记录数，一帧必须能放进串口发送缓冲区的一半
+#define TRACE_FRAME_RECORDS 256
+
+#define TRACE_MAGIC         "STRC"
+#define TRACE_VERSION       1
+
+// 一条记录
+typedef struct {
+    uint64_t tsc;
+    uint64_t pfn;
+    uint32_t arg;
+    uint8_t event;
+    uint8_t order;
+    uint8_t zone;
+    uint8_t reserved;
+} __attribute__((packed)) trace_record_t;
+
+/*
+ * 串口输出的帧头，后面跟count条记录
+ * 输出中可能夹着其他核心的文本，解码时按magic查找帧
+ */
+typedef struct {
+    char magic[4];
+    uint8_t version;
+    uint8_t record_size;
+    uint16_t cpu;
+    uint32_t count;
+    uint32_t reserved;
+    uint64_t seq;           // 第一条记录在该核心上的序号，序号不连续说明有记录被覆盖
+} __attribute__((packed)) trace_frame_t;
+
+#if TRACE
+
+extern uint32_t trace_mask;
+
+void __trace_event(uint8_t event, uint64_t pfn, uint32_t arg, uint8_t order, uint8_t zone);
+
+#define trace_event(event, pfn, arg, order, zone) do {                          \
+    if (__builtin_expect(__atomic_load_n(&trace_mask, __ATOMIC_RELAXED) &       \
+                         (1U << (event)), 0)) {                                 \
+        __trace_event((event), (pfn), (arg), (order), (zone));                  \
+    }                                                                           \
+} while (0)
+
+/*
+ * 为每个核心分配缓冲区并打开所有事件
+ * 必须在kmem_cache_init之后调用
+ */
+void trace_init(void);
+
+/**
+ * 设置记录哪些事件
+ *
+ * @param mask 事件位图，第n位对应事件n
+ */
+void trace_set_mask(uint32_t mask);
+
+/*
+ * 输出所有核心的缓冲区
+ * 输出期间暂停记录，结束后恢复
+ */
+void trace_dump(void);
+
+#else
+
+#define trace_event(event, pfn, arg, order, zone) do { } while (0)
+
+static inline void trace_init(void) {}
+static inline void trace_set_mask(uint32_t mask) {}
+static inline void trace_dump(void) {}
+
+#endif
+
+#define trace_pmm_alloc(pfn, order, zone) \
+    trace_event(TRACE_PMM_ALLOC, (pfn), 0, (order), (zone))
+#define trace_pmm_free(pfn, order, zone) \
+    trace_event(TRACE_PMM_FREE, (pfn), 0, (order), (zone))
+#define trace_buddy_split(pfn, order, zone) \
+    trace_event(TRACE_BUDDY_SPLIT, (pfn), 0, (order), (zone))
+#define trace_buddy_merge(pfn, order, zone) \
+    trace_event(TRACE_BUDDY_MERGE, (pfn), 0, (order), (zone))
+#define trace_kheap_alloc(pfn, size, order, zone) \
+    trace_event(TRACE_KHEAP_ALLOC, (pfn), (uint32_t)(size), (order), (zone))
+
+#endif // TRACE_H
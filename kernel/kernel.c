@@ -1,19 +1,55 @@
 /* SPDX-License-Identifier: Apache-2.0 */
 
 #include <kernel.h>
+#include <bootboot.h>
 #include <serial.h>  
+#include <printk.h>
+#include <trace.h>
+#include <env.h>
+#include <bench.h>
+#include <spinlock.h>
+#include <cpu/smp.h>
+#include <cpu/idt.h>
+#include <ioapic.h>
+#include <mm/tlb.h>
+#include <mm/fault.h>
 #include "mm/init.h"
 
 void kernel_main(void) {
     init_serial();  
     
-    serial_puts("[KERNEL]ShiziOS KERNEL v");
-    serial_puts(KERNEL_VERSION);
-    serial_puts("\n");
+    pr_info("[KERNEL]ShiziOS KERNEL v%s\n", KERNEL_VERSION);
     
     memory_init();
+
+    idt_init();
+    ioapic_init();
+    tlb_init();
+    page_fault_init();
+    serial_irq_init(((BOOTBOOT *)BOOTBOOT_INFO)->bspid);
+
+    smp_init();
+
+    memory_late_init();
+
+    interrupts_enable();
+
+    log_drain();
+
+    // 引导盘的sys/config中mode=bench时运行基准测试
+    if (env_is("mode", "bench")) {
+        bench_run();
+    }
+
+    // LOCK_STAT和TRACE关闭时为空操作
+    lock_stat_dump();
+    trace_dump();
   
     while (1) {
+        // 空闲时输出积累的日志，合并大页，压缩内存
+        log_drain();
+        mm_collapse_work();
+        compact_work();
         __asm__ __volatile__("hlt");
     }
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
  
 #include <bootboot.h>
 #include <serial.h>
+#include <printk.h>
 #include <mm/bootmem/boot_allot.h>
 #include <mm/bootmem/linear_map.h>
 
@@ -16,20 +17,42 @@ static size_t bitmap_pages = 0;
 #define BITMAP_CLEAR(bit) (bitmap[(bit) / 8] &= ~(1 << ((bit) % 8)))
 #define BITMAP_TEST(bit)  (bitmap[(bit) / 8] & (1 << ((bit) % 8)))
 
+/*
+ * 标记区间
+ * 首尾不对齐的部分按位处理，中间按64位整字处理
+ * 位图按字节存储，第bit位在第bit / 8字节的第bit % 8位
+ * 小端序下和按64位字访问的位置相同
+ */
 static void set_bitmap_region(uint64_t start_pfn, uint64_t count, int used)
 {
-    for (uint64_t i = 0; i < count; i++) {
+    uint64_t pfn = start_pfn;
+    uint64_t end_pfn = start_pfn + count;
+
+    for (; pfn < end_pfn && (pfn % 64) != 0; pfn++) {
+        if (used) {
+            BITMAP_SET(pfn);
+        } else {
+            BITMAP_CLEAR(pfn);
+        }
+    }
+
+    uint64_t* words = (uint64_t*)bitmap;
+    for (; pfn + 64 <= end_pfn; pfn += 64) {
+        words[pfn / 64] = used ? 0xFFFFFFFFFFFFFFFF : 0;
+    }
+
+    for (; pfn < end_pfn; pfn++) {
         if (used) {
-            BITMAP_SET(start_pfn + i);
+            BITMAP_SET(pfn);
         } else {
-            BITMAP_CLEAR(start_pfn + i);
+            BITMAP_CLEAR(pfn);
         }
     }
 }
 
 void boot_alloc_init(void)
 {
-    serial_puts("[boot_alloc] Initializing\n");
+    pr_info("[boot_alloc] Initializing\n");
     
     // 通过临时记录结构体分配位图内存
     temp_linear_map_t* temp_map = linear_map_get_temp();
@@ -53,9 +76,7 @@ void boot_alloc_init(void)
     
     bitmap = (uint8_t*)bitmap_phys;
     
-    for (size_t i = 0; i < BOOT_ALLOC_BITMAP_SIZE; i++) {
-        bitmap[i] = 0xFF;
-    }
+    set_bitmap_region(0, BOOT_ALLOC_MAX_PAGES, 1);
     
     // 遍历内存映射，标记空闲区域
     BOOTBOOT* bootboot = (BOOTBOOT*)BOOTBOOT_INFO;
@@ -107,9 +128,7 @@ void boot_alloc_init(void)
         }
     }
     
-    serial_puts("[boot_alloc] Ready: ");
-    serial_put_dec(free_pages);
-    serial_puts(" free pages\n");
+    pr_info("[boot_alloc] Ready: %lu free pages\n", free_pages);
 }
 
 void* boot_alloc(size_t pages)
@@ -135,9 +154,7 @@ void* boot_alloc(size_t pages)
     }
     
     if (consecutive < pages) {
-        serial_puts("[boot_alloc] Allocation failed: ");
-        serial_put_dec(pages);
-        serial_puts(" pages\n");
+        pr_err("[boot_alloc] Allocation failed: %lu pages\n", pages);
         return NULL;
     }
     
@@ -152,11 +169,7 @@ void* boot_alloc(size_t pages)
 
 void boot_alloc_info(void)
 {
-    serial_puts("[boot_alloc] Memory: ");
-    serial_put_dec(free_pages);
-    serial_puts("/");
-    serial_put_dec(total_pages);
-    serial_puts(" pages free\n");
+    pr_info("[boot_alloc] Memory: %lu/%lu pages free\n", free_pages, total_pages);
 }
 
 void* boot_alloc_get_bitmap(void)
@@ -0,0 +1,146 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <mm/pmm/pmm.h>
+#include <mm/pmm/buddy.h>
+#include <mm/vmm/mm.h>
+#include "compact.h"
+
+// 直接压缩每次最多检查的页数，找不到可以腾空的块时不会扫描整个大zone
+#define COMPACT_SCAN_PAGES  (64 * PAGEBLOCK_PAGES)
+
+// 后台压缩每次调用最多检查的页数
+#define COMPACT_WORK_PAGES  (8 * PAGEBLOCK_PAGES)
+
+/*
+ * 每个zone的压缩状态
+ * next是下一次开始检查的页帧号，多个核心同时压缩时只是从相近的位置开始
+ * wanted的第o位表示有order o的可移动分配失败过，等待后台压缩
+ * left是后台还要检查的页数，检查完整个zone还没有腾出块就放弃，等下一次失败再开始
+ */
+static uint64_t compact_next[ZONE_NORMAL + 1];
+static uint32_t compact_wanted[ZONE_NORMAL + 1];
+static uint64_t compact_left[ZONE_NORMAL + 1];
+
+// 同时只有一个核心做后台压缩
+static bool compact_busy = false;
+
+/*
+ * 压缩一个块
+ * 隔离块，迁移其中的可移动页，再取消隔离
+ * 迁移走的页释放后直接回到伙伴系统，全部迁移成功时合并成覆盖整个块的空闲块
+ * 
+ * 成功返回块的pfn，capture时块已经分配出来
+ */
+static uint64_t compact_block(uint64_t pfn, uint8_t order, bool capture) {
+    uint8_t migrate;
+    uint64_t movable = pmm_isolate_pages(pfn, order, &migrate);
+
+    if (movable == 0) {
+        return 0;
+    }
+
+    mm_migrate_pages(pfn, 1ULL << order, movable);
+
+    return pmm_unisolate_pages(pfn, order, migrate, capture);
+}
+
+/*
+ * 从zone上次停下的位置开始，按order对齐逐块尝试，最多检查budget页
+ * 到zone结尾后从头开始，zone的起始页帧号对齐到最大块
+ */
+static uint64_t compact_zone(uint8_t order, uint8_t zone, uint64_t budget, bool capture) {
+    zone_info_t info;
+    uint64_t pages = 1ULL << order;
+
+    if (!pmm_zone_info(zone, &info) || info.end_pfn - info.start_pfn < pages) {
+        return 0;
+    }
+
+    uint64_t pfn = __atomic_load_n(&compact_next[zone], __ATOMIC_RELAXED) & ~(pages - 1);
+    uint64_t result = 0;
+
+    for (uint64_t scanned = 0; scanned < budget && result == 0; scanned += pages) {
+        if (pfn < info.start_pfn || pfn + pages > info.end_pfn) {
+            pfn = info.start_pfn;
+        }
+
+        result = compact_block(pfn, order, capture);
+        pfn += pages;
+    }
+
+    __atomic_store_n(&compact_next[zone], pfn, __ATOMIC_RELAXED);
+
+    return result;
+}
+
+uint64_t compact_alloc(uint8_t order, uint8_t zone) {
+    if (order >= MAX_ORDER || zone > ZONE_NORMAL) {
+        return 0;
+    }
+
+    return compact_zone(order, zone, COMPACT_SCAN_PAGES, true);
+}
+
+void compact_wakeup(uint8_t order, uint8_t zone) {
+    zone_info_t info;
+
+    if (order >= MAX_ORDER || !pmm_zone_info(zone, &info)) {
+        return;
+    }
+
+    __atomic_store_n(&compact_left[zone], info.end_pfn - info.start_pfn, __ATOMIC_RELAXED);
+    __atomic_fetch_or(&compact_wanted[zone], 1U << order, __ATOMIC_RELEASE);
+}
+
+// 清除不大于order的请求，有这么大的空闲块时它们都能满足
+static inline void compact_done(uint8_t zone, uint8_t order) {
+    __atomic_fetch_and(&compact_wanted[zone], ~((2U << order) - 1), __ATOMIC_RELAXED);
+}
+
+void compact_work(void) {
+    if (__atomic_exchange_n(&compact_busy, true, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    for (uint8_t zone = ZONE_DMA; zone <= ZONE_NORMAL; zone++) {
+        uint32_t wanted = __atomic_load_n(&compact_wanted[zone], __ATOMIC_ACQUIRE);
+        uint64_t left = __atomic_load_n(&compact_left[zone], __ATOMIC_RELAXED);
+        zone_info_t info;
+
+        if (wanted == 0 || !pmm_zone_info(zone, &info)) {
+            continue;
+        }
+
+        // 请求之后已经有块释放了
+        for (int8_t order = MAX_ORDER - 1; order >= 0; order--) {
+            if (info.nr_free[order] != 0) {
+                compact_done(zone, order);
+                wanted &= ~((2U << order) - 1);
+                break;
+            }
+        }
+
+        if (wanted == 0) {
+            continue;
+        }
+
+        if (left == 0) {
+            compact_done(zone, MAX_ORDER - 1);
+            continue;
+        }
+
+        // 先满足最大的请求，腾出的块同时满足更小的请求
+        uint8_t order = 31 - __builtin_clz(wanted);
+        uint64_t budget = left < COMPACT_WORK_PAGES ? left : COMPACT_WORK_PAGES;
+
+        __atomic_store_n(&compact_left[zone], left - budget, __ATOMIC_RELAXED);
+
+        if (compact_zone(order, zone, budget, false) != 0) {
+            compact_done(zone, order);
+        }
+    }
+
+    __atomic_store_n(&compact_busy, false, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,54 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef COMPACT_H
+#define COMPACT_H
+
+#include <stdint.h>
+#include <mm/pmm/pmm.h>
+
+/*
+ * 内存压缩
+ *
+ * 长时间运行后空闲页散落在各处，空闲页很多也凑不出大块
+ * 压缩在zone中找一个只由空闲页和可移动页组成的块
+ * 隔离它，把其中的页迁移到其他物理页，释放的页在伙伴系统中合并成一个大块
+ *
+ * 可移动的页是用户地址空间中只有一个映射的单页
+ * 通过遍历所有地址空间的区域找到映射它们的页表项
+ */
+
+// 分配失败时触发压缩的最小order，更小的分配由per-CPU缓存满足
+#define COMPACT_MIN_ORDER PCP_ORDERS
+
+/**
+ * 直接压缩
+ * 不可移动的高order分配失败时由分配者调用
+ * 从上次停下的位置继续检查zone中的块，腾空一个就直接分配出来
+ *
+ * @param order 需要的块大小
+ * @param zone  内存区域
+ *
+ * @return 成功：块的pfn，和pmm_alloc_pages分配的块一样
+ * @return 没有能腾空的块：0
+ *
+ * 其他核心持有地址空间的锁时跳过，不会等待
+ */
+uint64_t compact_alloc(uint8_t order, uint8_t zone);
+
+/**
+ * 请求后台压缩
+ * 可移动的高order分配失败时调用，不等待
+ *
+ * @param order 需要的块大小
+ * @param zone  内存区域
+ */
+void compact_wakeup(uint8_t order, uint8_t zone);
+
+/**
+ * 后台压缩
+ * 在空闲循环中调用，每次最多检查几个pageblock
+ * 有请求的zone腾出一个足够大的空闲块后请求被清除，没有请求时什么也不做
+ */
+void compact_work(void);
+
+#endif // COMPACT_H
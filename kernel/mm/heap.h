@@ -1,29 +1,66 @@
-/* SPDX-License-Identifier: Apache-2.0 */
-
-#ifndef HEAP_H
-#define HEAD_H
-
-#include <stdint.h>
-
-/**
- * 内核堆分配
- * 
- * @param size 要分配的内存大小(字节)
- * @param zone 内存区域
- * 
- * @return 成功：pfn
- * @return 失败：0
- */
-uint64_t _kheap_alloc(uint64_t size, uint8_t zone);
-
-// 默认使用正常内存区域
-#define kheap_alloc(size) _kheap_alloc((size), ZONE_NORMAL)
-
-/**
- * 释放内核堆内存
- * 
- * @param pfn 被释放的伙伴块的页帧号
- */
-void kheap_free(uint64_t pfn);
-
-#endif // HEAD_H
\ No newline at end of file
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef HEAP_H
+#define HEAP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * 内核堆分配
+ * 
+ * @param size 要分配的内存大小(字节)
+ * @param zone 内存区域
+ * 
+ * @return 成功：pfn
+ * @return 失败：0
+ * 
+ * 大小不小于(PAGE_SIZE << COMPACT_MIN_ORDER)时失败会直接压缩并等待TLB刷新
+ * 不能在持有自旋锁或关中断时调用，这些场合用_kheap_try_alloc
+ */
+uint64_t _kheap_alloc(uint64_t size, uint8_t zone);
+
+/**
+ * 尝试内核堆分配，失败时不直接压缩
+ * 可以在持有自旋锁或关中断时调用
+ * 
+ * @param size 要分配的内存大小(字节)
+ * @param zone 内存区域
+ * 
+ * @return 成功：pfn
+ * @return 失败：0
+ */
+uint64_t _kheap_try_alloc(uint64_t size, uint8_t zone);
+
+// 默认使用正常内存区域
+#define kheap_alloc(size) _kheap_alloc((size), ZONE_NORMAL)
+#define kheap_try_alloc(size) _kheap_try_alloc((size), ZONE_NORMAL)
+
+/**
+ * 释放内核堆内存
+ * 
+ * @param pfn 被释放的伙伴块的页帧号
+ */
+void kheap_free(uint64_t pfn);
+
+/**
+ * 内核内存分配
+ * 
+ * @param size 要分配的内存大小(字节)
+ * 
+ * @return 成功：线性映射区的虚拟地址
+ * @return 失败：NULL
+ * 
+ * 不超过KMALLOC_MAX_SIZE的请求由slab分配
+ * 更大的请求直接分配伙伴块
+ */
+void *kmalloc(size_t size);
+
+/**
+ * 释放kmalloc分配的内存
+ * 
+ * @param ptr kmalloc返回的地址，可以为NULL
+ */
+void kfree(void *ptr);
+
+#endif // HEAP_H
\ No newline at end of file
@@ -6,13 +6,34 @@
 #include "bootmem/linear_map.h"
 #include "bootmem/boot_allot.h"
 #include "pmm/buddy.h"
+#include "slab/slab.h"
+#include "vmm/vma.h"
+#include "vmm/mm.h"
+#include "compact.h"
+#include <cpu/percpu.h>
+#include <trace.h>
 
 // 初始化内存管理
 static inline void memory_init(void)
 {
     linear_map_setup();    // 建立线性映射
     boot_alloc_init();     // 初始化启动分配器
+    percpu_init();         // 分配per-CPU副本
     pmm_init();         //初始化伙伴系统
+    kmem_cache_init();     // 初始化slab分配器
+    vma_init();            // 创建VMA缓存
+    mm_init();             // 创建地址空间缓存
+    trace_init();          // 分配跟踪缓冲区
+}
+
+// 启动AP后完成内存初始化
+static inline void memory_late_init(void)
+{
+    /*
+     * 唤醒AP，在空闲循环中通过pmm_init_work初始化每个zone剩余的section
+     * 没初始化完时分配失败的一方也会自己初始化
+     */
+    pmm_init_late();
 }
 
 // 获取内存状态信息
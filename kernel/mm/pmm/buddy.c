@@ -4,9 +4,17 @@
 #include <bootboot.h>
 #include <mm/bootmem/boot_allot.h>
 #include <serial.h>
+#include <printk.h>
+#include <trace.h>
 #include <spinlock.h>
 #include <stddef.h>
+#include <cpu/cpu.h>
+#include <cpu/smp.h>
+#include <cpu/idt.h>
+#include <io.h>
+#include <mm/compact.h>
 #include "pmm.h"
+#include "buddy.h"
 
 
 
@@ -30,6 +38,39 @@ static uint64_t* bitmap64 = NULL;
  */
 static mem_block_array_t* mem_block = NULL;
 
+/*
+ * 页帧的mem_block和不常用的页信息
+ * 只用于有mem_block的页帧，伙伴块不会跨section
+ * 所以块内各页的mem_block是连续的
+ */
+static inline mem_block_t *block_of(uint64_t pfn) {
+    return &mem_block->sections[pfn >> PMM_SECTION_SHIFT].hot[pfn & (PMM_SECTION_PAGES - 1)];
+}
+
+static inline mem_block_cold_t *cold_of(uint64_t pfn) {
+    return &mem_block->sections[pfn >> PMM_SECTION_SHIFT].cold[pfn & (PMM_SECTION_PAGES - 1)];
+}
+
+/*
+ * 页帧所在块的首页
+ * 
+ * 尾页的is_head总是0，所以从order 0开始向上
+ * 第一个对齐后是首页的页帧就是块的首页
+ * 最多查MAX_ORDER次，不需要尾页记录首页的位置
+ */
+static uint64_t block_head(uint64_t pfn) {
+    for (uint8_t order = 0; order < MAX_ORDER; order++) {
+        uint64_t head = pfn & ~((1ULL << order) - 1);
+        mem_block_t *block = block_of(head);
+
+        if (block->is_head) {
+            return head + (1ULL << block->order) > pfn ? head : 0;
+        }
+    }
+
+    return 0;
+}
+
 static void calculate_max_pfn(void) {
     size_t num_entries = (((BOOTBOOT*)BOOTBOOT_INFO)->size - 128) / sizeof(MMapEnt);
     MMapEnt* mmap = &((BOOTBOOT*)BOOTBOOT_INFO)->mmap;
@@ -63,6 +104,58 @@ static void calculate_max_pfn(void) {
     }
 }
 
+/*
+ * 位图区间操作
+ * 首尾不满一个字的部分用掩码处理，中间按整字处理
+ */
+static void bitmap_fill(uint64_t *map, uint64_t start, uint64_t end, bool set) {
+    if (start >= end) {
+        return;
+    }
+
+    uint64_t first = start / 64;
+    uint64_t last = (end - 1) / 64;
+    uint64_t head = ~0ULL << (start % 64);
+    uint64_t tail = ~0ULL >> (63 - (end - 1) % 64);
+
+    if (first == last) {
+        head &= tail;
+    }
+
+    map[first] = set ? map[first] | head : map[first] & ~head;
+
+    if (first == last) {
+        return;
+    }
+
+    for (uint64_t i = first + 1; i < last; i++) {
+        map[i] = set ? ~0ULL : 0;
+    }
+
+    map[last] = set ? map[last] | tail : map[last] & ~tail;
+}
+
+// 在[start, end)中查找第一个值为set的位，没有返回end
+static uint64_t bitmap_find(const uint64_t *map, uint64_t start, uint64_t end, bool set) {
+    if (start >= end) {
+        return end;
+    }
+
+    uint64_t index = start / 64;
+    uint64_t word = (set ? map[index] : ~map[index]) & (~0ULL << (start % 64));
+
+    while (word == 0) {
+        index++;
+        if (index * 64 >= end) {
+            return end;
+        }
+        word = set ? map[index] : ~map[index];
+    }
+
+    uint64_t bit = index * 64 + __builtin_ctzll(word);
+    return bit < end ? bit : end;
+}
+
 static void alloc_bitmap_init(void){
     // 计算创建位图所需的页数
     size_t alloc_bitmap_size = ((max_pfn + 1) + (PAGE_SIZE * 8 - 1)) / (PAGE_SIZE * 8);
@@ -97,35 +190,26 @@ static void alloc_bitmap_init(void){
             if (start_pfn > max_pfn) continue;
             if (end_pfn > max_pfn + 1) end_pfn = max_pfn + 1;
             
-            for (uint64_t pfn = start_pfn; pfn < end_pfn; pfn++) {
-                size_t index = pfn / 64;           
-                size_t bit = pfn % 64;             
-                
-                bitmap64[index] &= ~(1ULL << bit);
-            }
+            bitmap_fill(bitmap64, start_pfn, end_pfn, false);
         }
     }
     
     /*
      * 复制早期位图分配情况
      * 因为早期位图存储了一些mmap没有记录的内存
+     * 早期位图第pfn位在第pfn / 8字节的第pfn % 8位
+     * 小端序下和按64位字访问的位置相同，可以整字复制
      */
     if (boot_bitmap) {
-        for (size_t pfn = 0; pfn < BOOT_ALLOC_MAX_PAGES; pfn++) {
-            size_t boot_byte_index = pfn / 8;
-            size_t boot_bit_index = pfn % 8;
-            uint8_t boot_byte = ((uint8_t*)boot_bitmap)[boot_byte_index];
-            bool is_allocated = (boot_byte >> boot_bit_index) & 1;
-            
-            size_t index = pfn / 64;
-            size_t bit = pfn % 64;
-            uint64_t mask = 1ULL << bit;
-            
-            if (is_allocated) {
-                bitmap64[index] |= mask;
-            } else {
-                bitmap64[index] &= ~mask;
-            }
+        const uint64_t *boot_words = (const uint64_t *)boot_bitmap;
+        size_t boot_qwords = BOOT_ALLOC_MAX_PAGES / 64;
+
+        if (boot_qwords > qword_count) {
+            boot_qwords = qword_count;
+        }
+
+        for (size_t i = 0; i < boot_qwords; i++) {
+            bitmap64[i] = boot_words[i];
         }
     }
     
@@ -139,48 +223,52 @@ static void alloc_bitmap_init(void){
         uint64_t start_pfn = boot_bitmap_phys / PAGE_SIZE;
         uint64_t end_pfn = (boot_bitmap_phys + BOOT_ALLOC_BITMAP_SIZE + PAGE_SIZE - 1) / PAGE_SIZE;
         
-        for (uint64_t pfn = start_pfn; pfn < end_pfn; pfn++) {
-            size_t index = pfn / 64;           
-            size_t bit = pfn % 64;             
-            
-            bitmap64[index] &= ~(1ULL << bit);
+        bitmap_fill(bitmap64, start_pfn, end_pfn, false);
+    }
+}
+
+// [start_pfn, end_pfn)中第一段至少pages页的空闲区域，没有返回end_pfn
+static uint64_t bitmap_find_free(uint64_t start_pfn, uint64_t end_pfn, uint64_t pages) {
+    uint64_t pfn = start_pfn;
+
+    while (pfn < end_pfn) {
+        uint64_t free_start = bitmap_find(bitmap64, pfn, end_pfn, false);
+        uint64_t free_end = bitmap_find(bitmap64, free_start, end_pfn, true);
+
+        if (free_end - free_start >= pages) {
+            return free_start;
         }
+
+        pfn = free_end;
     }
+
+    return end_pfn;
 }
 
 /*
  * 全局位图内存分配
  * 内存占用信息获取
  * 伙伴系统建立后不再用于分配
+ * 
+ * 从上次分配结束的位置继续查找，找不到再从头查找
+ * 每个section的mem_block分配一次，不会每次都扫描前面已经用掉的内存
  */
 static void *bitmap_alloc(uint64_t pages) {
-    uint64_t consecutive = 0;  
-    uint64_t start_pfn = 0;    
-    
-    for (uint64_t i = 0; i <= max_pfn; i++) {
-        size_t index = i / 64;  
-        size_t bit = i % 64;    
-        
-        if ((bitmap64[index] & (1ULL << bit)) == 0) {
-            if (consecutive == 0) {
-                start_pfn = i;
-            }
-            consecutive++;
-            
-            if (consecutive == pages) {
-                for (uint64_t j = start_pfn; j < start_pfn + pages; j++) {
-                    size_t idx = j / 64;
-                    size_t b = j % 64;
-                    bitmap64[idx] |= (1ULL << b);
-                }
-                return PHYS_TO_LINEAR(start_pfn * PAGE_SIZE);
-            }
-        } else {
-            consecutive = 0;
-        }
+    static uint64_t next_pfn = 0;
+    uint64_t pfn = bitmap_find_free(next_pfn, max_pfn + 1, pages);
+
+    if (pfn > max_pfn) {
+        pfn = bitmap_find_free(0, max_pfn + 1, pages);
     }
-    
-    panic("[PMM] ERROR: Cannot allocate required memory for system initialization\n");
+
+    if (pfn > max_pfn) {
+        panic("[PMM] ERROR: Cannot allocate required memory for system initialization\n");
+    }
+
+    bitmap_fill(bitmap64, pfn, pfn + pages, true);
+    next_pfn = pfn + pages;
+
+    return PHYS_TO_LINEAR(pfn * PAGE_SIZE);
 }
 
 /*
@@ -222,9 +310,148 @@ static void zone_init(void){
     //初始化zone锁和free_areas链表头
     for(i = 0; i < 3; i++){
         spinlock_init(&zones[i].lock);  
+        seqcount_init(&zones[i].seq);
+        zones[i].free_pages = 0;
+        zones[i].pageblock_types = NULL;
+        zones[i].init_chunks = 0;
+        zones[i].init_next = 0;
+        zones[i].init_done = 0;
+        for(j = 0; j < MIGRATE_TYPES; j++){
+            zones[i].free_orders[j] = 0;
+        }
         for(j = 0; j < MAX_ORDER; j++){
-            zones[i].free_areas[j].head = NULL;
+            for(uint8_t type = 0; type < MIGRATE_TYPES; type++){
+                zones[i].free_areas[j].head[type] = NULL;
+            }
+            zones[i].free_areas[j].map = NULL;
+            zones[i].free_areas[j].nr_free = 0;
+        }
+    }
+}
+
+// zone中的pageblock数，最后一个可以不满
+static inline uint64_t zone_pageblocks(uint8_t zone_id) {
+    return (zones[zone_id].end_pfn - zones[zone_id].start_pfn + PAGEBLOCK_PAGES - 1) >> PAGEBLOCK_ORDER;
+}
+
+/*
+ * 分配每个zone每个order的空闲块位图和pageblock的迁移类型
+ * 所有位图一次性分配，初始全部为0
+ * pageblock初始都是MIGRATE_MOVABLE，init_range再标记有已分配页的pageblock
+ * 必须在free_lists_init之前调用
+ * 因为使用了bitmap_alloc
+ */
+static void free_area_map_init(void) {
+    size_t total_words = 0;
+    size_t total_types = 0;
+
+    for (uint8_t zone_id = ZONE_DMA; zone_id <= ZONE_NORMAL; zone_id++) {
+        if (zones[zone_id].start_pfn >= zones[zone_id].end_pfn) continue;
+
+        uint64_t zone_pages = zones[zone_id].end_pfn - zones[zone_id].start_pfn;
+        for (uint8_t order = 0; order < MAX_ORDER; order++) {
+            uint64_t bits = (zone_pages >> order) + 1;
+            total_words += (bits + 63) / 64;
+        }
+        total_types += zone_pageblocks(zone_id);
+    }
+
+    size_t map_bytes = total_words * sizeof(uint64_t);
+    size_t pages = (map_bytes + total_types + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint64_t *map = (uint64_t *)bitmap_alloc(pages);
+    uint8_t *types = (uint8_t *)map + map_bytes;
+
+    for (size_t i = 0; i < total_words; i++) {
+        map[i] = 0;
+    }
+
+    for (size_t i = 0; i < total_types; i++) {
+        types[i] = MIGRATE_MOVABLE;
+    }
+
+    for (uint8_t zone_id = ZONE_DMA; zone_id <= ZONE_NORMAL; zone_id++) {
+        if (zones[zone_id].start_pfn >= zones[zone_id].end_pfn) continue;
+
+        uint64_t zone_pages = zones[zone_id].end_pfn - zones[zone_id].start_pfn;
+        for (uint8_t order = 0; order < MAX_ORDER; order++) {
+            uint64_t bits = (zone_pages >> order) + 1;
+            zones[zone_id].free_areas[order].map = map;
+            map += (bits + 63) / 64;
         }
+
+        zones[zone_id].pageblock_types = types;
+        types += zone_pageblocks(zone_id);
+    }
+}
+
+/*
+ * 空闲块位图操作
+ * zone的起始页帧号都对齐到最大块大小
+ * 所以(pfn - start_pfn) >> order就是块的下标
+ * 调用时需要zone.lock锁
+ */
+static inline uint64_t free_area_index(uint8_t zone, uint8_t order, uint64_t pfn) {
+    return (pfn - zones[zone].start_pfn) >> order;
+}
+
+static inline bool free_area_test(uint8_t zone, uint8_t order, uint64_t pfn) {
+    uint64_t index = free_area_index(zone, order, pfn);
+    return (zones[zone].free_areas[order].map[index / 64] >> (index % 64)) & 1ULL;
+}
+
+static inline void free_area_set(uint8_t zone, uint8_t order, uint64_t pfn) {
+    uint64_t index = free_area_index(zone, order, pfn);
+    zones[zone].free_areas[order].map[index / 64] |= 1ULL << (index % 64);
+}
+
+static inline void free_area_clear(uint8_t zone, uint8_t order, uint64_t pfn) {
+    uint64_t index = free_area_index(zone, order, pfn);
+    zones[zone].free_areas[order].map[index / 64] &= ~(1ULL << (index % 64));
+}
+
+/*
+ * pageblock的迁移类型
+ * zone的起始页帧号对齐到最大块，也就对齐到pageblock
+ * 修改时需要zone.lock锁，per-CPU缓存释放时不加锁读取，读到旧值只影响页放进哪个缓存
+ */
+static inline uint8_t *pageblock_of(uint8_t zone, uint64_t pfn) {
+    return &zones[zone].pageblock_types[(pfn - zones[zone].start_pfn) >> PAGEBLOCK_ORDER];
+}
+
+/*
+ * 把节点放到zone中order和type对应的链表头
+ * 只修改链表和free_orders，位图和计数由调用者维护
+ * 调用时需要zone.lock锁
+ */
+static void free_list_link(uint8_t zone, uint8_t order, uint8_t type, free_list_t *node) {
+    free_list_t **head = &zones[zone].free_areas[order].head[type];
+
+    node->prev = NULL;
+    node->next = *head;
+
+    if (*head != NULL) {
+        (*head)->prev = node;
+    }
+
+    *head = node;
+    zones[zone].free_orders[type] |= 1U << order;
+}
+
+static void free_list_unlink(uint8_t zone, uint8_t order, uint8_t type, free_list_t *node) {
+    free_list_t **head = &zones[zone].free_areas[order].head[type];
+
+    if (node->prev == NULL) {
+        *head = node->next;
+    } else {
+        node->prev->next = node->next;
+    }
+
+    if (node->next != NULL) {
+        node->next->prev = node->prev;
+    }
+
+    if (*head == NULL) {
+        zones[zone].free_orders[type] &= ~(1U << order);
     }
 }
 
@@ -235,41 +462,21 @@ static void zone_init(void){
  * @param zone_count 伙伴块属于的zone区域
  * @param order_count 伙伴块属于的order区域
  * 
+ * 直接插入首页所在pageblock的类型对应的链表头，O(1)
+ * 合并时通过mem_block查找伙伴，不依赖链表顺序
+ * 
  * 调用时需要zone.lock锁
  * 因为访问了空闲链表
  */ 
 static void add_free_lists(free_list_t *free_list, uint8_t zone_count, uint8_t order_count) {
     free_area_t *free_area = &zones[zone_count].free_areas[order_count];
+    uint64_t pfn = LINEAR_TO_PHYS((uintptr_t)free_list) >> PAGE_SHIFT;
     
-    free_list->prev = NULL;
-    free_list->next = NULL;
-    
-    if (free_area->head == NULL) {
-        free_area->head = free_list;
-    } else {
-        free_list_t *current = free_area->head;
-        free_list_t *prev = NULL;
-        
-        // 按地址顺序查找插入位置
-        while (current != NULL && (uintptr_t)current < (uintptr_t)free_list) {
-            prev = current;
-            current = current->next;
-        }
-        
-        if (prev == NULL) {
-            free_list->next = free_area->head;
-            free_area->head->prev = free_list;
-            free_area->head = free_list;
-        } else if (current == NULL) {
-            prev->next = free_list;
-            free_list->prev = prev;
-        } else {
-            prev->next = free_list;
-            free_list->prev = prev;
-            free_list->next = current;
-            current->prev = free_list;
-        }
-    }
+    free_list_link(zone_count, order_count, *pageblock_of(zone_count, pfn), free_list);
+
+    free_area_set(zone_count, order_count, pfn);
+    free_area->nr_free++;
+    zones[zone_count].free_pages += 1ULL << order_count;
 }
 
 /**
@@ -278,6 +485,8 @@ static void add_free_lists(free_list_t *free_list, uint8_t zone_count, uint8_t o
  * @param pfn 要移除的伙伴块的页帧号
  * 
  * 使用pfn来查询伙伴信息
+ * 空闲块总是在首页所在pageblock的类型对应的链表中
+ * 修改pageblock的类型时会一起移动其中的空闲块
  *
  * 调用时需要zone.lock锁
  * 因为访问了空闲链表
@@ -285,65 +494,122 @@ static void add_free_lists(free_list_t *free_list, uint8_t zone_count, uint8_t o
 static void remove_free_lists(uint64_t pfn) {
     uintptr_t phys_addr = pfn * PAGE_SIZE;
     free_list_t *node = (free_list_t *)PHYS_TO_LINEAR(phys_addr);
-    uint8_t zone = mem_block->blocks[pfn].zone;
-    uint8_t order = mem_block->blocks[pfn].order;
+    uint8_t zone = block_of(pfn)->zone;
+    uint8_t order = block_of(pfn)->order;
 
     //pfn不在任何zone范围内
     if (zone == 0xFF) {
         return;
     }
     
-    free_list_t *next = node->next;
-    free_list_t *prev = node->prev;
+    free_list_unlink(zone, order, *pageblock_of(zone, pfn), node);
 
-    if (node->prev == NULL) {
-        zones[zone].free_areas[order].head = next;
-    } else {
-        prev->next = next;
+    free_area_t *free_area = &zones[zone].free_areas[order];
+
+    free_area_clear(zone, order, pfn);
+    free_area->nr_free--;
+    zones[zone].free_pages -= 1ULL << order;
+}
+
+/*
+ * 修改[start_pfn, end_pfn)中pageblock的迁移类型
+ * 两端对齐到pageblock，或者是zone的结束位置
+ * 首页在这些pageblock中的空闲块移到新类型的链表
+ * 
+ * 空闲块通过各order的位图查找，不访问mem_block
+ * 还没有初始化的区间位图全为0，不会被当成空闲块
+ * 调用时需要zone.lock锁
+ */
+static void set_pageblock_type(uint8_t zone, uint64_t start_pfn, uint64_t end_pfn, uint8_t type) {
+    uint64_t base = zones[zone].start_pfn;
+
+    for (uint8_t order = 0; order < MAX_ORDER; order++) {
+        uint64_t *map = zones[zone].free_areas[order].map;
+        uint64_t first = (start_pfn - base + (1ULL << order) - 1) >> order;
+        uint64_t last = (end_pfn - base + (1ULL << order) - 1) >> order;
+
+        for (uint64_t index = bitmap_find(map, first, last, true); index < last;
+             index = bitmap_find(map, index + 1, last, true)) {
+            uint64_t pfn = base + (index << order);
+            free_list_t *node = (free_list_t *)PHYS_TO_LINEAR(pfn * PAGE_SIZE);
+
+            free_list_unlink(zone, order, *pageblock_of(zone, pfn), node);
+            free_list_link(zone, order, type, node);
+        }
+    }
+
+    for (uint64_t pfn = start_pfn; pfn < end_pfn; pfn += PAGEBLOCK_PAGES) {
+        *pageblock_of(zone, pfn) = type;
     }
+}
+
+// pageblock中伙伴系统的空闲页数，同样只查位图，调用时需要zone.lock锁
+static uint64_t pageblock_free_pages(uint8_t zone, uint64_t pfn) {
+    uint64_t base = zones[zone].start_pfn;
+    uint64_t start_pfn = pfn & ~(PAGEBLOCK_PAGES - 1);
+    uint64_t end_pfn = start_pfn + PAGEBLOCK_PAGES;
+    uint64_t pages = 0;
+
+    if (end_pfn > zones[zone].end_pfn) {
+        end_pfn = zones[zone].end_pfn;
+    }
+
+    // 比pageblock大的空闲块覆盖整个pageblock
+    for (uint8_t order = PAGEBLOCK_ORDER + 1; order < MAX_ORDER; order++) {
+        if (free_area_test(zone, order, start_pfn & ~((1ULL << order) - 1))) {
+            return end_pfn - start_pfn;
+        }
+    }
+
+    for (uint8_t order = 0; order <= PAGEBLOCK_ORDER; order++) {
+        uint64_t *map = zones[zone].free_areas[order].map;
+        uint64_t first = (start_pfn - base) >> order;
+        uint64_t last = (end_pfn - base + (1ULL << order) - 1) >> order;
 
-    if (next != NULL) {
-        next->prev = prev;
+        for (uint64_t index = bitmap_find(map, first, last, true); index < last;
+             index = bitmap_find(map, index + 1, last, true)) {
+            pages += 1ULL << order;
+        }
     }
+
+    return pages;
 }
 
 /*
- * 如果同时需要zone锁和mem_block锁
- * 必须先获取mem_block锁再获取zone锁
- * 为了避免死锁
- * 释放尽量以获取的反向顺序
+ * 获取修改zone空闲链表需要的锁
+ * 并开始zone的顺序计数写区间
+ *
+ * zone之间没有共享的状态：伙伴块不跨zone，合并只检查本zone内的伙伴
+ * 空闲块的mem_block只在所属zone的锁下修改，所以不同zone的操作可以并行
  */
+static inline void zone_lock(uint8_t zone) {
+    spin_lock(&zones[zone].lock);
+    write_seqcount_begin(&zones[zone].seq);
+}
+
+static inline void zone_unlock(uint8_t zone) {
+    write_seqcount_end(&zones[zone].seq);
+    spin_unlock(&zones[zone].lock);
+}
 
 /*
  * 拆分空闲链表中的伙伴块
- * 调用者必须持有zone锁和mem_block锁
+ * 调用者必须持有zone锁
  */
 static free_list_t *split_buddy_block(uint64_t pfn) {
-    uint8_t zone = mem_block->blocks[pfn].zone;
-    uint8_t order = mem_block->blocks[pfn].order;
+    uint8_t zone = block_of(pfn)->zone;
+    uint8_t order = block_of(pfn)->order;
     uint64_t buddy_pfn = pfn ^ (1ULL << (order - 1));  
     free_list_t *left = (free_list_t *)PHYS_TO_LINEAR(pfn * PAGE_SIZE);
     free_list_t *right = (free_list_t *)PHYS_TO_LINEAR(buddy_pfn * PAGE_SIZE);
 
-    uint64_t block_size = 1ULL << (order - 1);
+    trace_buddy_split(pfn, order, zone);
 
     remove_free_lists(pfn);
 
-    for (uint64_t i = 0; i < block_size; i++) {
-        // 更新左半部分
-        mem_block->blocks[pfn + i].order = order - 1;
-        mem_block->blocks[pfn + i].is_head = (i == 0) ? 1 : 0;
-        mem_block->blocks[pfn + i].is_free = 1;
-        mem_block->blocks[pfn + i].zone = zone;
-        mem_block->blocks[pfn + i].ref_count = 0;
-        
-        // 更新右半部分
-        mem_block->blocks[buddy_pfn + i].order = order - 1;
-        mem_block->blocks[buddy_pfn + i].is_head = (i == 0) ? 1 : 0;
-        mem_block->blocks[buddy_pfn + i].is_free = 1;
-        mem_block->blocks[buddy_pfn + i].zone = zone;
-        mem_block->blocks[buddy_pfn + i].ref_count = 0;
-    }
+    // 尾页不变，只更新两半的首页
+    block_of(pfn)->order = order - 1;
+    *block_of(buddy_pfn) = (mem_block_t){ .is_head = 1, .is_free = 1, .order = order - 1, .zone = zone };
 
     add_free_lists(left, zone, order - 1);
     add_free_lists(right, zone, order - 1);
@@ -353,15 +619,15 @@ static free_list_t *split_buddy_block(uint64_t pfn) {
 
 /*
  * 合并空闲链表中的伙伴块
- * 调用者必须持有zone锁和mem_block锁
+ * 调用者必须持有zone锁
  * 成功：返回合并后块的虚拟地址（free_list_t*）
  * 失败：返回NULL
  */
 static free_list_t* merge_buddy_block(uint64_t pfn1, uint64_t pfn2) {
-    uint8_t order1 = mem_block->blocks[pfn1].order;
-    uint8_t order2 = mem_block->blocks[pfn2].order;
-    uint8_t zone1 = mem_block->blocks[pfn1].zone;
-    uint8_t zone2 = mem_block->blocks[pfn2].zone;
+    uint8_t order1 = block_of(pfn1)->order;
+    uint8_t order2 = block_of(pfn2)->order;
+    uint8_t zone1 = block_of(pfn1)->zone;
+    uint8_t zone2 = block_of(pfn2)->zone;
 
     free_list_t *result = NULL;
     
@@ -379,18 +645,16 @@ static free_list_t* merge_buddy_block(uint64_t pfn1, uint64_t pfn2) {
     uint64_t merged_pfn = is_pfn1_first ? pfn1 : pfn2;
     free_list_t *merged_node = (free_list_t *)(is_pfn1_first ? PHYS_TO_LINEAR(pfn1 * PAGE_SIZE) : PHYS_TO_LINEAR(pfn2 * PAGE_SIZE));
     uint8_t new_order = order1 + 1;
-    uint64_t new_block_pages = 1ULL << new_order;
     
     remove_free_lists(pfn1);
     remove_free_lists(pfn2);
     add_free_lists(merged_node, zone1, new_order);
     
-    for (uint64_t i = 0; i < new_block_pages; i++) {
-        uint64_t current_pfn = merged_pfn + i;
-        mem_block->blocks[current_pfn].is_head = (i == 0) ? 1 : 0;
-        mem_block->blocks[current_pfn].order = new_order;
-        mem_block->blocks[current_pfn].is_free = 1;
-    }
+    // 右半的首页变成尾页
+    block_of(merged_pfn)->order = new_order;
+    *block_of(merged_pfn ^ (1ULL << order1)) = (mem_block_t){ .zone = zone1 };
+
+    trace_buddy_merge(merged_pfn, new_order, zone1);
 
     result = merged_node;
 
@@ -398,119 +662,99 @@ static free_list_t* merge_buddy_block(uint64_t pfn1, uint64_t pfn2) {
 }
 
 /*
- * 检查页是否被分配
- * 只能用于伙伴系统建立之前
- * 因为伙伴系统建立后使用mem_block
- */ 
-static inline bool page_is_alloc(uint64_t pfn) {
-    size_t index = pfn / 64;
-    size_t bit = pfn % 64;
-    return (bitmap64[index] >> bit) & 1ULL;
-}
-
-/*
- * 空闲链表初始化
- * 调用了add_free_lists没加锁
- * 因为初始化阶段没有多核
- * 所以不需要加锁
+ * 初始化zone中[start_pfn, end_pfn)的mem_block和空闲链表
+ * 
+ * 区间必须在一个有mem_block的section内
+ * 两端必须对齐到最大块，或者是zone的边界
+ * 空闲区域按页帧号对齐切块，切出的块不会跨过区间边界
+ * 所以不同的区间可以由不同核心同时初始化
+ * 
+ * 已分配和空闲的页都按连续区域处理，通过位图整字查找区域边界
+ * 只有加入空闲链表时需要获取zone锁
  */
-static void free_lists_init(void) {
-    // 遍历每个内存区域
-    for (int zone_id = ZONE_DMA; zone_id <= ZONE_NORMAL; zone_id++) {
-        zone_t* zone = &zones[zone_id];
-        
-        for (int order = 0; order < MAX_ORDER; order++) {
-            zone->free_areas[order].head = NULL;
+static void init_range(uint8_t zone_id, uint64_t start_pfn, uint64_t end_pfn) {
+    mem_block_t *blocks = block_of(start_pfn);
+    mem_block_cold_t *colds = cold_of(start_pfn);
+    uint64_t pfn = start_pfn;
+
+    /*
+     * 有已分配页的pageblock标记为不可移动
+     * 启动时占用的内存不会被迁移，以后不可移动的分配优先放在这里
+     * 区间中的空闲块还没有加入链表，修改类型不需要移动链表
+     */
+    for (uint64_t block = start_pfn; block < end_pfn; block += PAGEBLOCK_PAGES) {
+        uint64_t block_end = block + PAGEBLOCK_PAGES < end_pfn ? block + PAGEBLOCK_PAGES : end_pfn;
+
+        if (bitmap_find(bitmap64, block, block_end, true) < block_end) {
+            *pageblock_of(zone_id, block) = MIGRATE_UNMOVABLE;
         }
-        
-        uint64_t pfn = zone->start_pfn;
-        
-        // 扫描zone
-        while (pfn < zone->end_pfn) {
-            // 跳过已分配的页
-            while (pfn < zone->end_pfn && page_is_alloc(pfn)) {
-                pfn++;
+    }
+
+    while (pfn < end_pfn) {
+        // 已分配的页作为order 0的块首页
+        uint64_t free_start = bitmap_find(bitmap64, pfn, end_pfn, false);
+
+        for (; pfn < free_start; pfn++) {
+            blocks[pfn - start_pfn] = (mem_block_t){ .is_head = 1, .zone = zone_id };
+            colds[pfn - start_pfn] = (mem_block_cold_t){ 0 };
+        }
+
+        uint64_t free_end = bitmap_find(bitmap64, free_start, end_pfn, true);
+
+        /*
+         * 切割空闲区域
+         * 块大小同时受当前页帧号的对齐和剩余页数限制
+         */
+        while (pfn < free_end) {
+            uint8_t order = MAX_ORDER - 1;
+            uint64_t remaining = free_end - pfn;
+
+            if (pfn != 0 && __builtin_ctzll(pfn) < order) {
+                order = __builtin_ctzll(pfn);
             }
-            
-            if (pfn >= zone->end_pfn) {
-                break;
+            if (63 - __builtin_clzll(remaining) < order) {
+                order = 63 - __builtin_clzll(remaining);
             }
-            
-            // 找到连续空闲区域的起点
-            uint64_t free_start = pfn;
-            uint64_t free_size = 0;
-            
-            while (pfn < zone->end_pfn && !page_is_alloc(pfn)) {
-                free_size++;
-                pfn++;
+
+            uint64_t block_pages = 1ULL << order;
+
+            mem_block_t *block = &blocks[pfn - start_pfn];
+            mem_block_cold_t *cold = &colds[pfn - start_pfn];
+
+            block[0] = (mem_block_t){ .is_head = 1, .is_free = 1, .order = order, .zone = zone_id };
+            for (uint64_t i = 1; i < block_pages; i++) {
+                block[i] = (mem_block_t){ .zone = zone_id };
             }
-            
-            // 切割这个区域
-            uint64_t current = free_start;
-            uint64_t remaining = free_size;
-            
-            while (remaining > 0) {
-                int best_order = -1;
-                
-                // 从大到小寻找合适的order
-                for (int order = MAX_ORDER - 1; order >= 0; order--) {
-                    uint64_t block_size = 1ULL << order;
-                    
-                    // 确保块大小不超过剩余页数，当前地址对齐到块大小
-                    if (block_size <= remaining && (current & (block_size - 1)) == 0) {
-                        best_order = order;
-                        break;
-                    }
-                }
-                
-                // 没找到合适的order（理论上都能找到）
-                if (best_order < 0) {
-                    best_order = 0;
-                }
-                
-                uint64_t block_size = 1ULL << best_order;
-                
-                free_list_t* node = (free_list_t*)PHYS_TO_LINEAR(current * PAGE_SIZE);
-                add_free_lists(node, zone_id, best_order);
-                
-                current += block_size;
-                remaining -= block_size;
+            for (uint64_t i = 0; i < block_pages; i++) {
+                cold[i] = (mem_block_cold_t){ 0 };
             }
+
+            zone_lock(zone_id);
+            add_free_lists((free_list_t *)PHYS_TO_LINEAR(pfn * PAGE_SIZE), zone_id, order);
+            zone_unlock(zone_id);
+
+            pfn += block_pages;
         }
     }
 }
 
 static void print_zone_info(void) {
-    serial_puts("[PMM] Zone DMA: 0-16MB");
-    
     uint64_t total_memory = (max_pfn + 1) * PAGE_SIZE;
     uint64_t total_mb = total_memory / (1024 * 1024);
     
     if (total_memory > (4ULL * 1024 * 1024 * 1024)) {
-        serial_puts(", DMA32: 16MB-4GB, NORMAL: 4GB-");
-        serial_put_dec(total_mb);
-        serial_puts("MB");
+        pr_info("[PMM] Zone DMA: 0-16MB, DMA32: 16MB-4GB, NORMAL: 4GB-%luMB\n", total_mb);
     } else {
-        serial_puts(", DMA32: 16MB-");
-        serial_put_dec(total_mb);
-        serial_puts("MB");
+        pr_info("[PMM] Zone DMA: 0-16MB, DMA32: 16MB-%luMB\n", total_mb);
     }
-    
-    serial_puts("\n");
 }
 
 //计算总空闲内存
 static uint64_t calculate_total_free_pages(void) {
     uint64_t total_free_pages = 0;
     
-    for (int z = ZONE_DMA; z <= ZONE_NORMAL; z++) {
-        for (int o = 0; o < MAX_ORDER; o++) {
-            free_list_t* node = zones[z].free_areas[o].head;  
-            while (node) {
-                total_free_pages += (1ULL << o);
-                node = node->next;
-            }
-        }
+    for (uint8_t z = ZONE_DMA; z <= ZONE_NORMAL; z++) {
+        total_free_pages += pmm_zone_free_pages(z);
     }
     
     return total_free_pages;
@@ -519,184 +763,646 @@ static uint64_t calculate_total_free_pages(void) {
 /* 
  * 分配内存创建mem_block结构体
  * 建立后通过这个来访问伙伴块信息
+ * 
+ * 按section分配，只有含空闲页的section有mem_block数组
+ * 空洞和只有保留内存的section只占sections中的一个指针
+ * 数组项由init_range按区间初始化
  */ 
 static void alloc_mem_block(void) {
-    size_t header_size = offsetof(mem_block_array_t, blocks);
-    size_t array_size = (max_pfn + 1) * sizeof(mem_block_t);
-    size_t total_size = header_size + array_size;
+    uint64_t nr_sections = (max_pfn >> PMM_SECTION_SHIFT) + 1;
+    size_t header_size = offsetof(mem_block_array_t, sections);
+    size_t total_size = header_size + nr_sections * sizeof(mem_block_t *);
     size_t pages = (total_size + PAGE_SIZE - 1) / PAGE_SIZE;
+    size_t hot_pages = PMM_SECTION_PAGES * sizeof(mem_block_t) / PAGE_SIZE;
+    size_t cold_pages = PMM_SECTION_PAGES * sizeof(mem_block_cold_t) / PAGE_SIZE;
+    uint64_t present = 0;
     
     mem_block_array_t* array = (mem_block_array_t*)bitmap_alloc(pages);
-    array->count = max_pfn;
-    spinlock_init(&array->lock);
+    array->count = nr_sections;
     
-    for (uint64_t i = 0; i <= max_pfn; i++) {
-        mem_block_t* block = &array->blocks[i];
-        
-        block->is_head = 0;
-        block->is_free = 0;
-        block->flags = 0;
-        block->order = 0;
-        block->zone = 0;
-        block->map_count = 0;
-        block->ref_count = 0;
+    /*
+     * 位图中的空闲页来自BOOTBOOT报告的空闲内存
+     * section中没有空闲页就不会有页进入伙伴系统
+     * 分配mem_block数组本身占用的页之后不会释放，不影响判断
+     */
+    for (uint64_t section = 0; section < nr_sections; section++) {
+        uint64_t start_pfn = section << PMM_SECTION_SHIFT;
+        uint64_t end_pfn = start_pfn + PMM_SECTION_PAGES;
+
+        if (end_pfn > max_pfn + 1) {
+            end_pfn = max_pfn + 1;
+        }
+
+        if (bitmap_find(bitmap64, start_pfn, end_pfn, false) < end_pfn) {
+            array->sections[section].hot = (mem_block_t *)bitmap_alloc(hot_pages);
+            array->sections[section].cold = (mem_block_cold_t *)bitmap_alloc(cold_pages);
+            present++;
+        } else {
+            array->sections[section].hot = NULL;
+            array->sections[section].cold = NULL;
+        }
     }
     
     mem_block = array;
+
+    pr_info("[PMM] mem_block: %lu of %lu sections, %luKB\n",
+            present, nr_sections, present * (hot_pages + cold_pages) * PAGE_SIZE / 1024);
 }
+
 /*
- * mem_block初始化
- * 访问数据不需要加锁
- * 因为初始化阶段没有多核
+ * 本类型没有空闲块时依次尝试的类型
+ * MIGRATE_ISOLATE不在其中，隔离的空闲块不会被分配
  */
-static void mem_block_init(void) {
-    uint64_t pfn = 0;
+static const uint8_t fallbacks[MIGRATE_PCPTYPES][MIGRATE_PCPTYPES - 1] = {
+    [MIGRATE_UNMOVABLE]   = { MIGRATE_RECLAIMABLE, MIGRATE_MOVABLE },
+    [MIGRATE_MOVABLE]     = { MIGRATE_RECLAIMABLE, MIGRATE_UNMOVABLE },
+    [MIGRATE_RECLAIMABLE] = { MIGRATE_UNMOVABLE, MIGRATE_MOVABLE },
+};
 
-    for (uint8_t zone_id = ZONE_DMA; zone_id <= ZONE_NORMAL; zone_id++) {
-        zone_t *zone = &zones[zone_id];
+/*
+ * type链表中不小于order的第一个空闲块
+ * free_orders[type]中不小于order的最低位
+ * 就是第一个有空闲块的order
+ * 调用者必须持有zone锁，没有返回0
+ */
+static uint64_t free_area_find(uint8_t zone, uint8_t order, uint8_t type) {
+    uint32_t orders = zones[zone].free_orders[type] & ~((1U << order) - 1);
 
-        if (zone->start_pfn >= zone->end_pfn) continue;
+    while (orders != 0) {
+        uint8_t current_order = __builtin_ctz(orders);
+        free_list_t *head = zones[zone].free_areas[current_order].head[type];
+        uint64_t pfn = LINEAR_TO_PHYS((uintptr_t)head) >> PAGE_SHIFT;
 
-        pfn = zone->start_pfn;
-        while (pfn < zone->end_pfn) {
-            if (page_is_alloc(pfn)) {
-                mem_block->blocks[pfn].is_head = 1;
-                mem_block->blocks[pfn].is_free = 0;
-                mem_block->blocks[pfn].order = 0;
-                mem_block->blocks[pfn].zone = zone_id;
-            }
-            pfn++;
+        // 链表头和位图不一致，跳过这个order
+        if (head != NULL && free_area_test(zone, current_order, pfn)) {
+            return pfn;
         }
-    }
 
-    for (uint8_t zone_id = ZONE_DMA; zone_id <= ZONE_NORMAL; zone_id++) {
-        for (uint8_t order_id = 0; order_id < MAX_ORDER; order_id++) {
-            for (free_list_t *free_lists_ptr = zones[zone_id].free_areas[order_id].head; 
-                 free_lists_ptr != NULL; 
-                 free_lists_ptr = free_lists_ptr->next) {
-                
-                uintptr_t phys_addr = LINEAR_TO_PHYS((uintptr_t)free_lists_ptr);
-                pfn = phys_addr >> PAGE_SHIFT;
-                uint64_t pages = 1ULL << order_id;
-                
-                for (uint64_t i = 0; i < pages; i++) {
-                    mem_block_t* block = &mem_block->blocks[pfn + i];
-                    block->is_head = (i == 0) ? 1 : 0;
-                    block->is_free = 1;
-                    block->order = order_id;
-                    block->zone = zone_id;
-                }
-            }
-        }
+        orders &= ~(1U << current_order);
     }
+
+    return 0;
 }
 
-/**
- * 分配伙伴块
- * 
- * @param order 分配的伙伴块大小
- * @param zone  首选内存区域：ZONE_DMA(0)、ZONE_DMA32(1)、ZONE_NORMAL(2)
- * @return 成功：pfn；失败：0
- * 
- * 
- * - order必须小于MAX_ORDER
+/*
+ * 从其他类型借一个空闲块
  * 
- * 1. 在指定zone的对应order链表中查找空闲块
- * 2. 若找不到，尝试更高order（拆分）
- * 3. 若zone不足，回退到上一个zone
- * 4. 更新位图和mem_block元数据
+ * 从最大的order开始找，借走的块越大，剩下的碎片越少
+ * 块不小于半个pageblock，或者所在的pageblock至少一半空闲时
+ * 把整个pageblock改成请求的类型，以后这里释放的页也留在这个类型中
+ * 否则只借这一块，pageblock的类型不变
+ * 调用者必须持有zone锁，没有返回0
  */
-uint64_t pmm_alloc_pages(uint8_t order, uint8_t zone) {
-    // 检查zone和order是否合规
-    if (order >= MAX_ORDER || zone > ZONE_NORMAL) {
-        return 0;
-    }
+static uint64_t steal_fallback(uint8_t zone, uint8_t order, uint8_t migrate) {
+    for (int16_t current_order = MAX_ORDER - 1; current_order >= order; current_order--) {
+        for (uint8_t i = 0; i < MIGRATE_PCPTYPES - 1; i++) {
+            uint8_t type = fallbacks[migrate][i];
 
-    uint64_t pfn = 0;
-    uint8_t find_order = 0;
-    bool find = false;
+            if (!(zones[zone].free_orders[type] & (1U << current_order))) {
+                continue;
+            }
 
-    spin_lock(&mem_block->lock);
+            uint64_t pfn = free_area_find(zone, current_order, type);
 
-    // 检查zone是否有内存
-    if (zones[zone].start_pfn >= zones[zone].end_pfn) {
-        spin_unlock(&mem_block->lock);
-        return 0;
-    }
+            if (pfn == 0 || block_of(pfn)->order != current_order) {
+                continue;
+            }
 
-    spin_lock(&zones[zone].lock);
+            if (current_order >= PAGEBLOCK_ORDER) {
+                set_pageblock_type(zone, pfn, pfn + (1ULL << current_order), migrate);
+            } else if (current_order >= PAGEBLOCK_ORDER / 2 ||
+                       pageblock_free_pages(zone, pfn) >= PAGEBLOCK_PAGES / 2) {
+                uint64_t block = pfn & ~(PAGEBLOCK_PAGES - 1);
+                uint64_t block_end = block + PAGEBLOCK_PAGES;
 
-    /*
-     * 寻找空闲伙伴块
-     * 如果当前order没有空闲块
-     * 会一直向上寻找
-     */
-    for (uint8_t current_order = order; current_order < MAX_ORDER; current_order++) {
-        free_list_t *head = zones[zone].free_areas[current_order].head;
-
-        if (head == NULL) {
-            continue;  // 当前oarder没有空闲块
-        } else {
-            // 找到空闲块保存信息退出循环
-            pfn = LINEAR_TO_PHYS((uintptr_t)head) >> PAGE_SHIFT;
-            
-            if (mem_block->blocks[pfn].is_free == 0 ||
-                mem_block->blocks[pfn].order != current_order ||
-                mem_block->blocks[pfn].zone != zone) {
-                continue;
+                set_pageblock_type(zone, block,
+                                   block_end < zones[zone].end_pfn ? block_end : zones[zone].end_pfn,
+                                   migrate);
             }
-            
-            find_order = current_order;
-            find = true;
-            break; 
+
+            return pfn;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * 从空闲块head中取出[pfn, pfn + (1 << order))
+ * 拆分时每次留下包含pfn的一半，另一半按所在pageblock的类型放回链表
+ * 调用者必须持有zone锁
+ */
+static void buddy_take_block(uint64_t head, uint64_t pfn, uint8_t order) {
+    while (block_of(head)->order > order) {
+        split_buddy_block(head);
+
+        uint64_t half = 1ULL << block_of(head)->order;
+
+        if (pfn >= head + half) {
+            head += half;
         }
     }
+
+    // 分配
+    remove_free_lists(pfn);
+
+    block_of(pfn)->is_free = 0;
+    cold_of(pfn)->ref_count = 1;
+}
+
+/*
+ * 从伙伴系统分配一个块
+ * 调用者必须持有zone锁
+ * 成功：pfn；失败：0
+ * 
+ * 1. 在指定zone的对应类型和order链表中查找空闲块
+ * 2. 若找不到，尝试更高order（拆分）
+ * 3. 还找不到，从其他类型借
+ * 4. 更新mem_block元数据
+ */
+static uint64_t buddy_alloc_block(uint8_t order, uint8_t zone, uint8_t migrate) {
+    uint64_t pfn = free_area_find(zone, order, migrate);
+
+    if (pfn == 0) {
+        pfn = steal_fallback(zone, order, migrate);
+    }
+
+    if (pfn == 0) {
+        return 0;
+    }
+
+    /*
+     * 如果找到的order比需要的等级高
+     * 就拆分到需要的大小
+     * 因为拆分函数返回的都是左伙伴
+     * 所以pfn不变
+     */
+    buddy_take_block(pfn, pfn, order);
+
+    return pfn;
+}
+
+/*
+ * 检查伙伴块是否可以合并
+ * 伙伴必须在同一个zone内
+ * 并且是同一order空闲链表中的块
+ * 只查位图，不访问伙伴页和mem_block
+ * 调用者必须持有zone锁
+ */
+static inline bool buddy_is_free(uint64_t buddy_pfn, uint8_t zone, uint8_t order) {
+    if (buddy_pfn < zones[zone].start_pfn || buddy_pfn >= zones[zone].end_pfn) {
+        return false;
+    }
+
+    return free_area_test(zone, order, buddy_pfn);
+}
+
+/*
+ * 把块放回伙伴系统并尝试合并
+ * 调用者必须持有zone锁
+ * 块的引用计数必须已经为0
+ * 
+ * 伙伴的pfn由pfn ^ (1 << order)直接算出
+ * 通过mem_block判断伙伴是否空闲
+ * 只要有一次合并成功
+ * 就继续向上尝试合并
+ * 直到到达MAX_ORDER或者伙伴不空闲
+ */
+static void buddy_free_block(uint64_t pfn, uint8_t zone, uint8_t order) {
+    block_of(pfn)->is_free = 1;
+
+    add_free_lists((free_list_t *)PHYS_TO_LINEAR(pfn * PAGE_SIZE), zone, order);
     
-    if (find) {
-        /*
-         * 如果找到的order比需要的等级高
-         * 就拆分到需要的大小
-         * 因为拆分函数返回的都是左伙伴
-         * 所以pfn不变
-         */
-        for (uint8_t current_order = find_order; current_order > order; current_order--) {
-            free_list_t *split = split_buddy_block(pfn);
+    uint64_t current_pfn = pfn;
+    uint8_t current_order = order;
+    
+    while (current_order < MAX_ORDER - 1) {
+        uint64_t buddy_pfn = current_pfn ^ (1ULL << current_order);
 
-            if (split == NULL) {
-                pfn = 0;
-                break;
-            }
+        if (!buddy_is_free(buddy_pfn, zone, current_order)) {
+            break;
         }
 
-        // 分配
-        if (pfn != 0) {
-            remove_free_lists(pfn);
+        free_list_t *merged_node = merge_buddy_block(current_pfn, buddy_pfn);
+        if (merged_node == NULL) {
+            break;
+        }
 
-            uint64_t block_pages = 1ULL << order;
-            for (uint64_t i = 0; i < block_pages; i++) {
-                mem_block_t* block = &mem_block->blocks[pfn + i];
-                block->is_head = (i == 0) ? 1 : 0;
-                block->is_free = 0;
-                block->ref_count = 1;
+        // 合并成功，继续向上合并
+        current_pfn = LINEAR_TO_PHYS((uintptr_t)merged_node) >> PAGE_SHIFT;
+        current_order++;
+    }
+}
+
+/*
+ * 延迟初始化
+ * 
+ * 每个区间是zone和一个section的交集
+ * 区间由领取者独占初始化，init_range只在加入空闲链表时获取zone锁
+ * 领取区间和完成计数都是原子操作，不需要额外的锁
+ */
+
+// zone的第chunk个区间，section没有mem_block时返回false
+static bool chunk_range(uint8_t zone_id, uint64_t chunk, uint64_t *start_pfn, uint64_t *end_pfn) {
+    zone_t *zone = &zones[zone_id];
+    uint64_t section = (zone->start_pfn >> PMM_SECTION_SHIFT) + chunk;
+
+    *start_pfn = section << PMM_SECTION_SHIFT;
+    *end_pfn = *start_pfn + PMM_SECTION_PAGES;
+
+    if (*start_pfn < zone->start_pfn) {
+        *start_pfn = zone->start_pfn;
+    }
+    if (*end_pfn > zone->end_pfn) {
+        *end_pfn = zone->end_pfn;
+    }
+
+    return mem_block->sections[section].hot != NULL;
+}
+
+// 领取并初始化zone的下一个区间，没有可领取的区间返回false
+static bool deferred_init_chunk(uint8_t zone_id) {
+    zone_t *zone = &zones[zone_id];
+
+    if (__atomic_load_n(&zone->init_next, __ATOMIC_RELAXED) >= zone->init_chunks) {
+        return false;
+    }
+
+    uint64_t chunk = __atomic_fetch_add(&zone->init_next, 1, __ATOMIC_RELAXED);
+
+    if (chunk >= zone->init_chunks) {
+        return false;
+    }
+
+    uint64_t start_pfn, end_pfn;
+
+    if (chunk_range(zone_id, chunk, &start_pfn, &end_pfn)) {
+        init_range(zone_id, start_pfn, end_pfn);
+    }
+
+    __atomic_fetch_add(&zone->init_done, 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/*
+ * 分配失败时扩充zone
+ * 有可领取的区间就由分配者初始化
+ * 否则等待其他核心正在初始化的区间完成一个
+ * 返回false表示zone已经全部初始化，分配失败是真的没有内存
+ */
+static bool deferred_grow(uint8_t zone_id) {
+    zone_t *zone = &zones[zone_id];
+    uint64_t done = __atomic_load_n(&zone->init_done, __ATOMIC_ACQUIRE);
+
+    if (done >= zone->init_chunks) {
+        return false;
+    }
+
+    if (deferred_init_chunk(zone_id)) {
+        return true;
+    }
+
+    while (__atomic_load_n(&zone->init_done, __ATOMIC_ACQUIRE) == done) {
+        cpu_relax();
+    }
+
+    return true;
+}
+
+// 还没有初始化的页数，包括正在初始化的区间，不包括没有mem_block的section
+static uint64_t deferred_pages(void) {
+    uint64_t pages = 0;
+
+    for (uint8_t zone_id = ZONE_DMA; zone_id <= ZONE_NORMAL; zone_id++) {
+        zone_t *zone = &zones[zone_id];
+        uint64_t done = __atomic_load_n(&zone->init_done, __ATOMIC_ACQUIRE);
+
+        for (uint64_t chunk = done; chunk < zone->init_chunks; chunk++) {
+            uint64_t start_pfn, end_pfn;
+
+            if (chunk_range(zone_id, chunk, &start_pfn, &end_pfn)) {
+                pages += end_pfn - start_pfn;
             }
         }
     }
 
-    spin_unlock(&zones[zone].lock);
-    spin_unlock(&mem_block->lock);
+    return pages;
+}
+
+/*
+ * per-CPU页缓存
+ * 
+ * 每个核心在每个zone有一组按迁移类型和order分开的缓存链表
+ * 小order的分配和释放只操作本核心的链表，不需要任何锁
+ * 链表空了或者太长时才获取一次zone锁
+ * 批量从伙伴系统填充或者批量回收到伙伴系统
+ * 
+ * 缓存中的块对伙伴系统来说是已分配的
+ * 首页的is_free为0，ref_count为0，并带有MEM_BLOCK_PCP标志
+ * 
+ * 缓存是per-CPU变量，每个核心的副本互不共享缓存行
+ *
+ * 访问缓存时关中断，中断和打开中断的缺页处理可以在任何位置打断分配器
+ * 在同一核心上再分配页时不会看到改了一半的链表
+ * zone锁没有关中断，中断处理函数仍然不能分配页，否则可能等待本核心持有的zone锁
+ */
+static DEFINE_PER_CPU(per_cpu_pages_t, pcp_pages[3]);
+
+// 获取当前核心在zone中的页缓存，zone为空返回NULL
+static inline per_cpu_pages_t *pcp_this_cpu(uint8_t zone) {
+    if (zones[zone].start_pfn >= zones[zone].end_pfn) {
+        return NULL;
+    }
+
+    return this_cpu_ptr(&pcp_pages[zone]);
+}
+
+// 每次与zone交换的块数
+static inline uint32_t pcp_batch(uint8_t order) {
+    uint32_t batch = PCP_BATCH_PAGES >> order;
+    return batch ? batch : 1;
+}
+
+// 热端放入
+static void pcp_push_head(pcp_list_t *list, free_list_t *node) {
+    node->prev = NULL;
+    node->next = list->head;
+
+    if (list->head != NULL) {
+        list->head->prev = node;
+    } else {
+        list->tail = node;
+    }
+
+    list->head = node;
+    list->count++;
+}
+
+// 冷端放入
+static void pcp_push_tail(pcp_list_t *list, free_list_t *node) {
+    node->next = NULL;
+    node->prev = list->tail;
+
+    if (list->tail != NULL) {
+        list->tail->next = node;
+    } else {
+        list->head = node;
+    }
+
+    list->tail = node;
+    list->count++;
+}
+
+// 热端取出
+static free_list_t *pcp_pop_head(pcp_list_t *list) {
+    free_list_t *node = list->head;
+
+    if (node == NULL) {
+        return NULL;
+    }
+
+    list->head = node->next;
+    if (list->head != NULL) {
+        list->head->prev = NULL;
+    } else {
+        list->tail = NULL;
+    }
+
+    list->count--;
+    return node;
+}
+
+// 冷端取出
+static free_list_t *pcp_pop_tail(pcp_list_t *list) {
+    free_list_t *node = list->tail;
+
+    if (node == NULL) {
+        return NULL;
+    }
+
+    list->tail = node->prev;
+    if (list->tail != NULL) {
+        list->tail->next = NULL;
+    } else {
+        list->head = NULL;
+    }
+
+    list->count--;
+    return node;
+}
+
+/*
+ * 从伙伴系统批量填充缓存
+ * 一批只获取一次锁
+ * 借来的其他类型的页也放进这个类型的缓存
+ */
+static void pcp_refill(pcp_list_t *list, uint8_t order, uint8_t zone, uint8_t migrate) {
+    uint32_t batch = pcp_batch(order);
+
+    zone_lock(zone);
+
+    for (uint32_t n = 0; n < batch; n++) {
+        uint64_t pfn = buddy_alloc_block(order, zone, migrate);
+
+        if (pfn == 0) {
+            break;
+        }
+
+        cold_of(pfn)->ref_count = 0;
+        block_of(pfn)->flags |= MEM_BLOCK_PCP;
+
+        pcp_push_tail(list, (free_list_t *)PHYS_TO_LINEAR(pfn * PAGE_SIZE));
+    }
+
+    zone_unlock(zone);
+}
+
+/*
+ * 从冷端批量回收count个块到伙伴系统
+ * 一批只获取一次锁
+ */
+static void pcp_drain(pcp_list_t *list, uint8_t order, uint8_t zone, uint32_t count) {
+    zone_lock(zone);
+
+    for (uint32_t n = 0; n < count; n++) {
+        free_list_t *node = pcp_pop_tail(list);
+
+        if (node == NULL) {
+            break;
+        }
+
+        uint64_t pfn = LINEAR_TO_PHYS((uintptr_t)node) >> PAGE_SHIFT;
+        block_of(pfn)->flags &= ~MEM_BLOCK_PCP;
+        buddy_free_block(pfn, zone, order);
+    }
+
+    zone_unlock(zone);
+}
+
+// 从缓存分配，缓存为空时先批量填充
+static uint64_t pcp_alloc(per_cpu_pages_t *pcp, uint8_t order, uint8_t zone, uint8_t migrate) {
+    pcp_list_t *list = &pcp->lists[migrate][order];
+    uint64_t flags = interrupts_save();
+
+    if (list->count == 0) {
+        pcp_refill(list, order, zone, migrate);
+    }
+
+    free_list_t *node = pcp_pop_head(list);
+
+    interrupts_restore(flags);
+
+    if (node == NULL) {
+        return 0;
+    }
+
+    uint64_t pfn = LINEAR_TO_PHYS((uintptr_t)node) >> PAGE_SHIFT;
+
+    block_of(pfn)->flags &= ~MEM_BLOCK_PCP;
+    cold_of(pfn)->ref_count = 1;
+
+    return pfn;
+}
+
+/*
+ * 释放到缓存
+ * 调用者已经释放了最后一个引用
+ * 按所在pageblock的类型放进对应的缓存
+ */
+static void pcp_free(per_cpu_pages_t *pcp, uint64_t pfn, uint8_t order, uint8_t zone, uint8_t migrate) {
+    mem_block_t *block = block_of(pfn);
+
+    block->flags |= MEM_BLOCK_PCP;
+
+    pcp_list_t *list = &pcp->lists[migrate][order];
+    uint64_t flags = interrupts_save();
+
+    pcp_push_head(list, (free_list_t *)PHYS_TO_LINEAR(pfn * PAGE_SIZE));
+
+    // 缓存太长，把冷端一批还给伙伴系统
+    if ((uint64_t)list->count << order > PCP_HIGH_PAGES) {
+        pcp_drain(list, order, zone, pcp_batch(order));
+    }
+
+    interrupts_restore(flags);
+}
+
+/**
+ * 分配伙伴块
+ * 
+ * @param order   分配的伙伴块大小
+ * @param zone    首选内存区域：ZONE_DMA(0)、ZONE_DMA32(1)、ZONE_NORMAL(2)
+ * @param migrate 迁移类型：MIGRATE_UNMOVABLE、MIGRATE_MOVABLE、MIGRATE_RECLAIMABLE
+ * @param compact 失败时是否直接压缩
+ * @return 成功：pfn；失败：0
+ * 
+ * 
+ * - order必须小于MAX_ORDER
+ * 
+ * order小于PCP_ORDERS时先走per-CPU缓存
+ * 否则直接从伙伴系统分配
+ * 失败时如果zone还有没初始化的区间，初始化后重试
+ * 高order的分配仍然失败时通过压缩迁移可移动的页腾出空闲块
+ * compact为false时不直接压缩，只请求后台压缩
+ */
+static uint64_t alloc_pages(uint8_t order, uint8_t zone, uint8_t migrate, bool compact) {
+    // 检查zone、order和迁移类型是否合规
+    if (order >= MAX_ORDER || zone > ZONE_NORMAL || migrate >= MIGRATE_PCPTYPES) {
+        return 0;
+    }
+
+    // 检查zone是否有内存，zone在初始化后不变
+    if (zones[zone].start_pfn >= zones[zone].end_pfn) {
+        return 0;
+    }
+
+    uint64_t pfn;
+
+    do {
+        per_cpu_pages_t *pcp = order < PCP_ORDERS ? pcp_this_cpu(zone) : NULL;
+
+        if (pcp != NULL) {
+            pfn = pcp_alloc(pcp, order, zone, migrate);
+        } else {
+            zone_lock(zone);
+            pfn = buddy_alloc_block(order, zone, migrate);
+            zone_unlock(zone);
+        }
+    } while (pfn == 0 && deferred_grow(zone));
+
+    /*
+     * 本核心缓存中的页对伙伴系统是已分配的，先还回去再试一次
+     * 不可移动的分配(DMA缓冲区等)没有退路，由分配者直接压缩
+     * 可移动的分配和有退路的分配(大页)可以退回小页，只通知后台压缩
+     * 直接压缩会获取地址空间的锁并等待TLB刷新，不能在持有自旋锁时进行
+     */
+    if (pfn == 0 && order >= COMPACT_MIN_ORDER) {
+        pmm_drain_local_pages();
+
+        zone_lock(zone);
+        pfn = buddy_alloc_block(order, zone, migrate);
+        zone_unlock(zone);
+
+        if (pfn == 0 && compact && migrate != MIGRATE_MOVABLE) {
+            pfn = compact_alloc(order, zone);
+        }
+
+        if (pfn == 0) {
+            compact_wakeup(order, zone);
+        }
+    }
+
+    // 压缩时只迁移按可移动类型分配的页
+    if (pfn != 0) {
+        mem_block_t *block = block_of(pfn);
+
+        block->flags = migrate == MIGRATE_MOVABLE ? block->flags | MEM_BLOCK_MOVABLE
+                                                  : block->flags & ~MEM_BLOCK_MOVABLE;
+    }
+
+    trace_pmm_alloc(pfn, order, zone);
 
     return pfn;
 }
 
+uint64_t pmm_alloc_pages_type(uint8_t order, uint8_t zone, uint8_t migrate) {
+    return alloc_pages(order, zone, migrate, true);
+}
+
+uint64_t pmm_try_alloc_pages(uint8_t order, uint8_t zone, uint8_t migrate) {
+    return alloc_pages(order, zone, migrate, false);
+}
+
+uint64_t pmm_alloc_pages(uint8_t order, uint8_t zone) {
+    return pmm_alloc_pages_type(order, zone, MIGRATE_UNMOVABLE);
+}
+
+/*
+ * 减少一个引用
+ * 只有释放最后一个引用的调用者返回true，由它把块还给分配器
+ * 计数已经为0时是重复释放，什么也不做
+ */
+static bool ref_put(mem_block_cold_t *cold) {
+    uint32_t count = __atomic_load_n(&cold->ref_count, __ATOMIC_RELAXED);
+
+    do {
+        if (count == 0) {
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&cold->ref_count, &count, count - 1, true,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    return count == 1;
+}
+
 /**
  * 释放内存
  * 
  * @param pfn 被释放的伙伴块的页帧号
  * 
- * 释放后会尝试合并伙伴
- * 只要有一次合并成功
- * 就继续向上尝试合并
- * 直到到达MAX_ORDER或者没有伙伴块
+ * 引用计数原子地减少，不是最后一个引用时不加锁
+ * 最后一个引用释放时，小order块放入所在pageblock类型的per-CPU缓存
+ * 其他块还给伙伴系统并尝试合并
  */
 void pmm_free_pages(uint64_t pfn) {
     /*
@@ -704,148 +1410,460 @@ void pmm_free_pages(uint64_t pfn) {
      * 获取zone不需要锁
      * 因为zone在初始化后不变
      * 所以不会缓存不一致
+     * 没有mem_block的页帧不是伙伴系统分配的
      */
-    uint8_t zone = mem_block->blocks[pfn].zone;
+    mem_block_t *block = pfn_to_block(pfn);
 
-    spin_lock(&mem_block->lock);
-    spin_lock(&zones[zone].lock);
+    if (block == NULL) {
+        return;
+    }
 
-    mem_block_t* block = &mem_block->blocks[pfn];
-    
-    if (block->is_head == 0 || block->is_free == 1) {
-        spin_unlock(&mem_block->lock);
-        spin_unlock(&zones[zone].lock);
+    // 不是已分配的块首页
+    if (block->is_head == 0 || block->is_free == 1 || (block->flags & MEM_BLOCK_PCP)) {
         return;
     }
-    
+
+    uint8_t zone = block->zone;
     uint8_t order = block->order;
-    uint16_t order_size = 1 << order;
-    
-    for (uint16_t i = 0; i < order_size; i++) {
-        mem_block_t* current = &mem_block->blocks[pfn + i];
-        if (current->ref_count > 0) {
-            current->ref_count--;
-        }
-    }
+
+    trace_pmm_free(pfn, order, zone);
+
     /*
-     * 引用计数大于0
+     * 还有其他引用
      * 说明还在被使用
      * 不应该释放
      */
-    if (block->ref_count > 0) {
-        spin_unlock(&mem_block->lock);
-        spin_unlock(&zones[zone].lock);
+    if (!ref_put(cold_of(pfn))) {
         return;
     }
-    
-    
-    free_list_t *addr = (free_list_t *)PHYS_TO_LINEAR(pfn * PAGE_SIZE);
-    add_free_lists(addr, zone, order);
-    
+
     /*
-     * 尝试合并伙伴块
-     * 检测节点是左伙伴还是右伙伴
-     * 
-     * 如果是左伙伴
-     * 就计算右伙伴的pfn
-     * 检测右伙伴的pfn是否和前驱指针的pfn相同
-     * 如果相同就合并
-     * 不相同就继续检查
-     * 
-     * 如果是右伙伴
-     * 就计算左伙伴的pfn
-     * 检测左伙伴的pfn是否和后继指针的pfn相同
-     * 如果相同就合并
-     * 不相同就退出循环
-     */ 
-    {
-        free_list_t *current_node = addr;
-        uint64_t current_pfn = pfn;
-        uint8_t current_order = order;
-        bool can_merge = true;  
-        
-        while (can_merge && current_order < MAX_ORDER - 1) {
-            can_merge = false;  // 默认下次不合并
-            
-            // 判断当前节点是左伙伴还是右伙伴
-            bool is_left = ((current_pfn & (1ULL << current_order)) == 0);
-            uint64_t buddy_pfn;
-            
-            if (is_left) {
-                // 当前是左伙伴，计算右伙伴的pfn
-                buddy_pfn = current_pfn + (1ULL << current_order);
-                
-                // 检查后继节点是否存在且是当前节点的右伙伴
-                if (current_node->next != NULL) {
-                    uint64_t next_pfn = LINEAR_TO_PHYS((uintptr_t)current_node->next) >> PAGE_SHIFT;
-                    if (next_pfn == buddy_pfn) {
-                        // 合并
-                        free_list_t *merged_node = merge_buddy_block(current_pfn, buddy_pfn);
-                        if (merged_node != NULL) {
-                            // 合并成功，更新当前节点和状态
-                            current_node = merged_node;
-                            current_pfn = LINEAR_TO_PHYS((uintptr_t)merged_node) >> PAGE_SHIFT;
-                            current_order = mem_block->blocks[current_pfn].order;
-                            can_merge = true;   // 可以继续向上合并
-                            continue;
-                        }
-                    }
-                }
-            } else {
-                // 当前是右伙伴，计算左伙伴的pfn
-                buddy_pfn = current_pfn - (1ULL << current_order);
-                
-                // 检查前驱节点是否存在且是当前节点左伙伴
-                if (current_node->prev != NULL) {
-                    uint64_t prev_pfn = LINEAR_TO_PHYS((uintptr_t)current_node->prev) >> PAGE_SHIFT;
-                    if (prev_pfn == buddy_pfn) {
-                        // 执行合并
-                        free_list_t *merged_node = merge_buddy_block(buddy_pfn, current_pfn);
-                        if (merged_node != NULL) {
-                            // 合并成功，更新当前节点和状态
-                            current_node = merged_node;
-                            current_pfn = LINEAR_TO_PHYS((uintptr_t)merged_node) >> PAGE_SHIFT;
-                            current_order = mem_block->blocks[current_pfn].order;
-                            can_merge = true; // 可以继续向上合并
-                            continue;
-                        }
-                    }
+     * 隔离的pageblock中的页直接回到伙伴系统
+     * 压缩在等这些页合并成大块
+     */
+    uint8_t migrate = *pageblock_of(zone, pfn);
+
+    if (order < PCP_ORDERS && migrate != MIGRATE_ISOLATE) {
+        per_cpu_pages_t *pcp = pcp_this_cpu(zone);
+
+        if (pcp != NULL) {
+            pcp_free(pcp, pfn, order, zone, migrate);
+            return;
+        }
+    }
+
+    zone_lock(zone);
+    buddy_free_block(pfn, zone, order);
+    zone_unlock(zone);
+}
+
+/*
+ * 回收当前核心的所有per-CPU页缓存
+ * 用于需要伙伴系统看到全部空闲内存的场合
+ */
+void pmm_drain_local_pages(void) {
+    for (uint8_t zone_id = ZONE_DMA; zone_id <= ZONE_NORMAL; zone_id++) {
+        per_cpu_pages_t *pcp = pcp_this_cpu(zone_id);
+
+        if (pcp == NULL) {
+            continue;
+        }
+
+        uint64_t flags = interrupts_save();
+
+        for (uint8_t type = 0; type < MIGRATE_PCPTYPES; type++) {
+            for (uint8_t order = 0; order < PCP_ORDERS; order++) {
+                pcp_list_t *list = &pcp->lists[type][order];
+
+                if (list->count > 0) {
+                    pcp_drain(list, order, zone_id, list->count);
                 }
             }
-            
-            // 如果无法合并，退出循环
         }
+
+        interrupts_restore(flags);
     }
-    
-    spin_unlock(&zones[zone].lock);
-    spin_unlock(&mem_block->lock);
+}
 
-    return;
+/*
+ * 统计信息读取
+ * 通过zone的顺序计数无锁读取
+ * 不会阻塞分配器，读到一半被修改时重读
+ * 不包含per-CPU页缓存中的页
+ */
+uint64_t pmm_zone_free_pages(uint8_t zone) {
+    uint64_t free_pages;
+    uint32_t seq;
+
+    if (zone > ZONE_NORMAL) {
+        return 0;
+    }
+
+    do {
+        seq = read_seqcount_begin(&zones[zone].seq);
+        free_pages = zones[zone].free_pages;
+    } while (read_seqcount_retry(&zones[zone].seq, seq));
+
+    return free_pages;
+}
+
+bool pmm_zone_info(uint8_t zone, zone_info_t *info) {
+    uint32_t seq;
+
+    if (zone > ZONE_NORMAL || info == NULL) {
+        return false;
+    }
+
+    do {
+        seq = read_seqcount_begin(&zones[zone].seq);
+
+        info->start_pfn = zones[zone].start_pfn;
+        info->end_pfn = zones[zone].end_pfn;
+        info->free_pages = zones[zone].free_pages;
+        for (uint8_t order = 0; order < MAX_ORDER; order++) {
+            info->nr_free[order] = zones[zone].free_areas[order].nr_free;
+        }
+    } while (read_seqcount_retry(&zones[zone].seq, seq));
+
+    return true;
+}
+
+uint64_t pmm_block_head(uint64_t pfn) {
+    if (pfn_to_block(pfn) == NULL) {
+        return 0;
+    }
+
+    return block_head(pfn);
+}
+
+mem_block_t *pfn_to_block(uint64_t pfn) {
+    if (pfn > max_pfn || mem_block->sections[pfn >> PMM_SECTION_SHIFT].hot == NULL) {
+        return NULL;
+    }
+
+    return block_of(pfn);
+}
+
+bool pmm_get_page(uint64_t pfn) {
+    mem_block_t *block = pfn_to_block(pfn);
+
+    if (block == NULL || block->is_head == 0 || block->is_free == 1 ||
+        (block->flags & MEM_BLOCK_PCP)) {
+        return false;
+    }
+
+    /*
+     * 调用者自己持有一个引用
+     * 计数不会在这期间降到0，直接加就行
+     */
+    __atomic_fetch_add(&cold_of(pfn)->ref_count, 1, __ATOMIC_RELAXED);
+
+    return true;
+}
+
+uint32_t pmm_page_ref(uint64_t pfn) {
+    if (pfn_to_block(pfn) == NULL) {
+        return 0;
+    }
+
+    return __atomic_load_n(&cold_of(pfn)->ref_count, __ATOMIC_ACQUIRE);
+}
+
+void pmm_page_map(uint64_t pfn) {
+    if (pfn_to_block(pfn) != NULL) {
+        __atomic_fetch_add(&cold_of(pfn)->map_count, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void pmm_page_unmap(uint64_t pfn) {
+    if (pfn_to_block(pfn) != NULL) {
+        __atomic_fetch_sub(&cold_of(pfn)->map_count, 1, __ATOMIC_RELEASE);
+    }
+}
+
+uint32_t pmm_page_mapcount(uint64_t pfn) {
+    if (pfn_to_block(pfn) == NULL) {
+        return 0;
+    }
+
+    return __atomic_load_n(&cold_of(pfn)->map_count, __ATOMIC_ACQUIRE);
+}
+
+bool pmm_split_pages(uint64_t pfn, uint8_t order) {
+    mem_block_t *block = pfn_to_block(pfn);
+
+    if (block == NULL) {
+        return false;
+    }
+
+    uint8_t zone = block->zone;
+    bool ok = false;
+
+    zone_lock(zone);
+
+    if (block->is_head == 1 && block->is_free == 0 && !(block->flags & MEM_BLOCK_PCP) &&
+        block->order >= order) {
+        uint64_t end = pfn + (1ULL << block->order);
+        mem_block_cold_t head = *cold_of(pfn);
+
+        // 尾页本来就是is_head为0，只需要写每一块的首页
+        for (uint64_t new = pfn; new < end; new += 1ULL << order) {
+            *block_of(new) = (mem_block_t){ .is_head = 1, .is_free = 0, .flags = block->flags,
+                                            .order = order, .zone = zone };
+            *cold_of(new) = head;
+        }
+
+        ok = true;
+    }
+
+    zone_unlock(zone);
+
+    return ok;
+}
+
+uint8_t pmm_pageblock_type(uint64_t pfn) {
+    mem_block_t *block = pfn_to_block(pfn);
+
+    if (block == NULL) {
+        return MIGRATE_TYPES;
+    }
+
+    return __atomic_load_n(pageblock_of(block->zone, pfn), __ATOMIC_RELAXED);
+}
+
+/*
+ * 压缩的块所在的pageblock
+ * 块不大于pageblock时是包含它的pageblock，否则是块本身
+ * 结束位置不超过zone的结束位置
+ */
+static void isolate_range(uint8_t zone, uint64_t pfn, uint8_t order,
+                          uint64_t *start_pfn, uint64_t *end_pfn) {
+    if (order >= PAGEBLOCK_ORDER) {
+        *start_pfn = pfn;
+        *end_pfn = pfn + (1ULL << order);
+    } else {
+        *start_pfn = pfn & ~(PAGEBLOCK_PAGES - 1);
+        *end_pfn = *start_pfn + PAGEBLOCK_PAGES;
+    }
+
+    if (*end_pfn > zones[zone].end_pfn) {
+        *end_pfn = zones[zone].end_pfn;
+    }
+}
+
+/*
+ * 页是否可以迁移
+ * 按可移动类型分配的单页，只有一个映射持有它，没有其他引用
+ */
+static inline bool block_movable(uint64_t pfn) {
+    mem_block_t *block = block_of(pfn);
+
+    return block->order == 0 &&
+           (block->flags & (MEM_BLOCK_PCP | MEM_BLOCK_SLAB | MEM_BLOCK_MOVABLE)) == MEM_BLOCK_MOVABLE &&
+           __atomic_load_n(&cold_of(pfn)->ref_count, __ATOMIC_RELAXED) == 1 &&
+           __atomic_load_n(&cold_of(pfn)->map_count, __ATOMIC_RELAXED) == 1;
+}
+
+uint64_t pmm_isolate_pages(uint64_t pfn, uint8_t order, uint8_t *migrate) {
+    uint64_t pages = 1ULL << order;
+    mem_block_t *block = pfn_to_block(pfn);
+
+    if (order >= MAX_ORDER || (pfn & (pages - 1)) != 0 || block == NULL) {
+        return 0;
+    }
+
+    uint8_t zone = block->zone;
+
+    if (pfn < zones[zone].start_pfn || pfn + pages > zones[zone].end_pfn) {
+        return 0;
+    }
+
+    // 还有没初始化的区间时，mem_block和空闲块不一定已经建立
+    if (__atomic_load_n(&zones[zone].init_done, __ATOMIC_ACQUIRE) < zones[zone].init_chunks) {
+        return 0;
+    }
+
+    uint64_t start_pfn, end_pfn;
+    uint64_t movable = 0;
+    bool ok = true;
+
+    isolate_range(zone, pfn, order, &start_pfn, &end_pfn);
+
+    zone_lock(zone);
+
+    // 所有pageblock的类型相同，并且没有被其他核心隔离
+    uint8_t type = *pageblock_of(zone, start_pfn);
+
+    for (uint64_t block_pfn = start_pfn; block_pfn < end_pfn; block_pfn += PAGEBLOCK_PAGES) {
+        if (*pageblock_of(zone, block_pfn) != type || type == MIGRATE_ISOLATE) {
+            ok = false;
+        }
+    }
+
+    // 块在一个更大的块中，已经全部空闲或者已经被整个分配出去
+    if (block_head(pfn) != pfn) {
+        ok = false;
+    }
+
+    /*
+     * 块中的每页都在空闲块中，或者可以迁移
+     * 不能有per-CPU缓存中的页，它们对伙伴系统来说是已分配的，压缩后也合并不起来
+     */
+    for (uint64_t current = pfn; ok && current < pfn + pages; ) {
+        mem_block_t *head = block_of(current);
+
+        if (head->is_free) {
+            current += 1ULL << head->order;
+        } else if (block_movable(current)) {
+            movable++;
+            current++;
+        } else {
+            ok = false;
+        }
+    }
+
+    if (ok && movable > 0) {
+        set_pageblock_type(zone, start_pfn, end_pfn, MIGRATE_ISOLATE);
+        *migrate = type;
+    }
+
+    zone_unlock(zone);
+
+    return ok ? movable : 0;
+}
+
+uint64_t pmm_unisolate_pages(uint64_t pfn, uint8_t order, uint8_t migrate, bool capture) {
+    uint64_t pages = 1ULL << order;
+    mem_block_t *block = pfn_to_block(pfn);
+
+    if (order >= MAX_ORDER || block == NULL || migrate >= MIGRATE_PCPTYPES) {
+        return 0;
+    }
+
+    uint8_t zone = block->zone;
+    uint64_t start_pfn, end_pfn;
+    uint64_t result = 0;
+
+    isolate_range(zone, pfn, order, &start_pfn, &end_pfn);
+
+    zone_lock(zone);
+
+    set_pageblock_type(zone, start_pfn, end_pfn, migrate);
+
+    // 迁移走的页都已经释放并合并成了覆盖整个块的空闲块
+    uint64_t head = block_head(pfn);
+
+    if (head != 0 && block_of(head)->is_free &&
+        head + (1ULL << block_of(head)->order) >= pfn + pages) {
+        result = pfn;
+
+        // 和恢复类型在同一次持锁中取出，其他核心来不及分配
+        if (capture) {
+            buddy_take_block(head, pfn, order);
+        }
+    }
+
+    zone_unlock(zone);
+
+    return result;
 }
 
 void pmm_init(void) {
-    serial_puts("[PMM] Initializing physical memory manager\n");
+    pr_info("[PMM] Initializing physical memory manager\n");
     
     calculate_max_pfn();  
-    serial_puts("[PMM] Physical memory: ");
-    serial_put_dec((max_pfn + 1) * PAGE_SIZE / (1024 * 1024));
-    serial_puts("MB detected\n");
+    pr_info("[PMM] Physical memory: %luMB detected\n", (max_pfn + 1) * PAGE_SIZE / (1024 * 1024));
     
     alloc_bitmap_init();
     
     zone_init();
 
     alloc_mem_block();
+
+    free_area_map_init();
     
     print_zone_info();
     
-    free_lists_init();
+    // 每个zone先初始化到有空闲内存的第一个区间
+    for (uint8_t zone_id = ZONE_DMA; zone_id <= ZONE_NORMAL; zone_id++) {
+        zone_t *zone = &zones[zone_id];
+
+        if (zone->start_pfn >= zone->end_pfn) {
+            continue;
+        }
 
-    mem_block_init();
+        zone->init_chunks = ((zone->end_pfn - 1) >> PMM_SECTION_SHIFT) -
+                            (zone->start_pfn >> PMM_SECTION_SHIFT) + 1;
+
+        while (zone->free_pages == 0 && deferred_init_chunk(zone_id)) {
+        }
+    }
     
     uint64_t total_free_pages = calculate_total_free_pages();
     
-    serial_puts("[PMM] Buddy system initialized: ");
-    serial_put_dec(total_free_pages * PAGE_SIZE / (1024 * 1024));
-    serial_puts("MB free\n");
-}
\ No newline at end of file
+    pr_info("[PMM] Buddy system initialized: %luMB free, %luMB deferred\n",
+            total_free_pages * PAGE_SIZE / (1024 * 1024), deferred_pages() * PAGE_SIZE / (1024 * 1024));
+}
+
+// 领取所有zone的剩余区间
+static void deferred_worker(void) {
+    for (uint8_t zone_id = ZONE_DMA; zone_id <= ZONE_NORMAL; zone_id++) {
+        while (deferred_init_chunk(zone_id)) {
+        }
+    }
+}
+
+// pmm_init_late之后为true，直到所有区间都被领取
+static bool deferred_running = false;
+
+// 只用来唤醒在hlt中等待的核心，初始化在它们的空闲循环中进行
+static void deferred_wakeup(void *arg) {
+}
+
+/*
+ * 其他核心在空闲循环中通过pmm_init_work逐个区间初始化，执行期间中断是打开的
+ * IPI处理函数立即返回，不会让TLB刷新和后续的smp_call_function等待
+ * 当前核心不参与，直接返回
+ */
+void pmm_init_late(void) {
+    uint64_t pages = deferred_pages();
+
+    if (pages == 0) {
+        return;
+    }
+
+    __atomic_store_n(&deferred_running, true, __ATOMIC_RELEASE);
+
+    uint32_t helpers = smp_call_function(deferred_wakeup, NULL, false);
+
+    pr_info("[PMM] Initializing %luMB in background on %u cores\n",
+            pages * PAGE_SIZE / (1024 * 1024), helpers);
+}
+
+bool pmm_init_work(void) {
+    if (!__atomic_load_n(&deferred_running, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+
+    for (uint8_t zone_id = ZONE_DMA; zone_id <= ZONE_NORMAL; zone_id++) {
+        if (deferred_init_chunk(zone_id)) {
+            return true;
+        }
+    }
+
+    __atomic_store_n(&deferred_running, false, __ATOMIC_RELAXED);
+    return false;
+}
+
+void pmm_init_wait(void) {
+    deferred_worker();
+
+    // 等待其他核心领取的区间
+    for (uint8_t zone_id = ZONE_DMA; zone_id <= ZONE_NORMAL; zone_id++) {
+        zone_t *zone = &zones[zone_id];
+
+        while (__atomic_load_n(&zone->init_done, __ATOMIC_ACQUIRE) < zone->init_chunks) {
+            cpu_relax();
+        }
+    }
+}
@@ -3,8 +3,36 @@
 #ifndef BUDDY_H
 #define BUDDY_H
 
+#include <stdint.h>
+#include <stdbool.h>
+#include "pmm_types.h"
+
+/*
+ * 初始化伙伴系统
+ * 每个zone只初始化第一个section，耗时和内存大小无关
+ * 其余section由pmm_init_late在后台初始化
+ * 或者在分配失败时由分配者初始化
+ */
 void pmm_init(void);
 
+/*
+ * 让其他在线核心在后台初始化剩余的section，不等待完成
+ * 必须在smp_init之后调用
+ */
+void pmm_init_late(void);
+
+/*
+ * 初始化一个剩余的区间，在AP的空闲循环中调用，调用时中断是打开的
+ * 返回false表示没有需要做的了，可以进入hlt
+ */
+bool pmm_init_work(void);
+
+/*
+ * 初始化所有剩余的section并等待完成
+ * 用于需要伙伴系统看到全部内存的场合
+ */
+void pmm_init_wait(void);
+
 /**
  * 分配伙伴块
  * 
@@ -14,9 +42,41 @@ void pmm_init(void);
  * 
  * 
  * - order必须小于MAX_ORDER
+ * - 按MIGRATE_UNMOVABLE分配
+ * - order不小于COMPACT_MIN_ORDER时失败会直接压缩并等待TLB刷新
+ *   不能在持有自旋锁或关中断时调用，这些场合用pmm_try_alloc_pages
+ *   更小的order不会压缩，没有这个限制
  */
 uint64_t pmm_alloc_pages(uint8_t order, uint8_t zone);
 
+/**
+ * 按迁移类型分配伙伴块
+ * 
+ * @param order   分配的伙伴块大小
+ * @param zone    首选内存区域
+ * @param migrate MIGRATE_UNMOVABLE、MIGRATE_MOVABLE或MIGRATE_RECLAIMABLE
+ * @return 成功：pfn；失败：0
+ * 
+ * 优先从同类型的pageblock分配，没有时从其他类型借
+ * 可移动的页只能由vmm_map_absent映射到用户地址空间，压缩时会被换到其他物理页
+ * order不小于COMPACT_MIN_ORDER的分配失败时
+ * 不可移动的分配由调用者直接压缩，可移动的分配交给后台压缩
+ * 所以不可移动的高order分配不能在持有自旋锁或关中断时调用
+ */
+uint64_t pmm_alloc_pages_type(uint8_t order, uint8_t zone, uint8_t migrate);
+
+/**
+ * 尝试分配伙伴块，失败时不直接压缩
+ * 用于失败后有退路的分配，例如大页退回4KB页
+ * 可以在持有自旋锁或关中断时调用，高order的分配失败只请求后台压缩
+ * 
+ * @param order   分配的伙伴块大小
+ * @param zone    首选内存区域
+ * @param migrate MIGRATE_UNMOVABLE、MIGRATE_MOVABLE或MIGRATE_RECLAIMABLE
+ * @return 成功：pfn；失败：0
+ */
+uint64_t pmm_try_alloc_pages(uint8_t order, uint8_t zone, uint8_t migrate);
+
 /**
  * 释放内存
  * 
@@ -24,4 +84,143 @@ uint64_t pmm_alloc_pages(uint8_t order, uint8_t zone);
  */
 void pmm_free_pages(uint64_t pfn);
 
+/**
+ * 回收当前核心的per-CPU页缓存到伙伴系统
+ */
+void pmm_drain_local_pages(void);
+
+/**
+ * 获取zone中的空闲页数
+ * 
+ * @param zone 内存区域
+ * @return 伙伴系统中的空闲页数，不包括per-CPU页缓存
+ * 
+ * 无锁读取，不会阻塞分配器
+ */
+uint64_t pmm_zone_free_pages(uint8_t zone);
+
+/**
+ * 获取zone统计信息的一致快照
+ * 
+ * @param zone 内存区域
+ * @param info 输出
+ * @return zone无效返回false
+ * 
+ * 无锁读取，不会阻塞分配器
+ */
+bool pmm_zone_info(uint8_t zone, zone_info_t *info);
+
+/**
+ * 获取页帧的mem_block
+ * 
+ * @param pfn 页帧号
+ * @return mem_block指针，pfn所在的section没有mem_block时返回NULL
+ * 
+ * 只有块首页的order、is_free和flags有效
+ * 尾页的is_head为0，用pmm_block_head找到块首页
+ */
+mem_block_t *pfn_to_block(uint64_t pfn);
+
+/**
+ * 获取页帧所在块的首页
+ * 
+ * @param pfn 页帧号
+ * @return 块首页的页帧号；pfn没有mem_block时返回0
+ * 
+ * 最多访问MAX_ORDER个mem_block
+ */
+uint64_t pmm_block_head(uint64_t pfn);
+
+/**
+ * 增加块的引用计数
+ * 
+ * @param pfn 已分配块的首页帧号
+ * @return 成功：true；pfn不是已分配的块首页：false
+ * 
+ * 原子操作，不加zone锁
+ * 每个引用对应一次pmm_free_pages
+ */
+bool pmm_get_page(uint64_t pfn);
+
+/**
+ * 获取块的引用计数
+ * 
+ * @param pfn 块首页帧号
+ * @return 引用计数；pfn没有mem_block时返回0
+ */
+uint32_t pmm_page_ref(uint64_t pfn);
+
+/**
+ * 页被映射到一个页表项时增加映射计数
+ * 
+ * @param pfn 页帧号，大页映射用首页
+ * 
+ * 原子操作，不加zone锁
+ * 映射计数只用于判断页是否被多个地址空间共享，不影响释放
+ */
+void pmm_page_map(uint64_t pfn);
+
+/**
+ * 页的一个映射被移除时减少映射计数
+ * 
+ * @param pfn 页帧号
+ */
+void pmm_page_unmap(uint64_t pfn);
+
+/**
+ * 获取页的映射计数
+ * 
+ * @param pfn 页帧号
+ * @return 映射计数；pfn没有mem_block时返回0
+ */
+uint32_t pmm_page_mapcount(uint64_t pfn);
+
+/**
+ * 把已分配的块拆成order大小的块
+ * 
+ * @param pfn   已分配块的首页帧号
+ * @param order 拆分后每块的order
+ * @return 成功：true；pfn不是已分配的块首页或者块比order小：false
+ * 
+ * 每块继承原来首页的引用计数和映射计数，之后分别释放
+ * 用于大页映射被拆成小页时
+ */
+bool pmm_split_pages(uint64_t pfn, uint8_t order);
+
+/**
+ * 获取页帧所在pageblock的迁移类型
+ * 
+ * @param pfn 页帧号
+ * @return MIGRATE_*；pfn没有mem_block时返回MIGRATE_TYPES
+ */
+uint8_t pmm_pageblock_type(uint64_t pfn);
+
+/**
+ * 隔离一个块准备压缩
+ * 
+ * @param pfn     块首页帧号，按order对齐
+ * @param order   块的order
+ * @param migrate 返回隔离前的迁移类型，由pmm_unisolate_pages恢复
+ * @return 块中可以迁移的页数；块不能压缩或者已经空闲时返回0，不隔离
+ * 
+ * 块中每页都在空闲块中，或者是只有一个映射的可移动单页时才能压缩
+ * 块所在的pageblock改成MIGRATE_ISOLATE，其中的空闲块不再分配
+ * 之后释放的页不进入per-CPU缓存，直接回到伙伴系统合并
+ * zone还有没初始化的区间时不隔离
+ */
+uint64_t pmm_isolate_pages(uint64_t pfn, uint8_t order, uint8_t *migrate);
+
+/**
+ * 取消隔离
+ * 
+ * @param pfn     pmm_isolate_pages隔离的块
+ * @param order   块的order
+ * @param migrate 恢复的迁移类型
+ * @param capture 块已经全部空闲时直接分配出来
+ * @return 块已经全部空闲：pfn；否则：0
+ * 
+ * capture时块和pmm_alloc_pages分配的块一样，由调用者释放
+ */
+uint64_t pmm_unisolate_pages(uint64_t pfn, uint8_t order, uint8_t migrate, bool capture);
+
 #endif 
\ No newline at end of file
@@ -14,6 +14,45 @@
 #define PAGE_SIZE 4096
 #define PAGE_SHIFT 12
 
+/*
+ * per-CPU页缓存参数
+ * order小于PCP_ORDERS的分配和释放走per-CPU缓存
+ * 每次与zone批量交换PCP_BATCH_PAGES页
+ * 缓存超过PCP_HIGH_PAGES页时回收一批到zone
+ */
+#define PCP_ORDERS      4
+#define PCP_BATCH_PAGES 32
+#define PCP_HIGH_PAGES  128
+
+/*
+ * mem_block的section，128MB
+ * mem_block按section分配，没有空闲内存的section不分配
+ * section也是延迟初始化的单位，启动时每个zone只初始化第一个section
+ * 必须是最大块的整数倍，这样伙伴块不会跨section
+ */
+#define PMM_SECTION_SHIFT 15
+#define PMM_SECTION_PAGES (1ULL << PMM_SECTION_SHIFT)
+
+/*
+ * 迁移类型
+ * zone按pageblock分组，每个pageblock有一个类型
+ * 空闲块按首页所在pageblock的类型放在不同的链表中，分配时先找同类型的链表
+ * 不可移动的页集中在少数pageblock中，其余pageblock可以通过迁移腾空
+ */
+#define MIGRATE_UNMOVABLE   0   // 页表、slab、内核堆等按物理地址使用的内存
+#define MIGRATE_MOVABLE     1   // 用户地址空间的页，压缩时可以迁移
+#define MIGRATE_RECLAIMABLE 2   // 可以丢弃后重建的缓存
+#define MIGRATE_PCPTYPES    3   // 有per-CPU页缓存的类型
+#define MIGRATE_ISOLATE     3   // 正在压缩，其中的空闲块不参与分配
+#define MIGRATE_TYPES       4
+
+/*
+ * pageblock，2MB
+ * 迁移类型分组的单位，和大页大小相同，腾空一个pageblock就能分配一个大页
+ */
+#define PAGEBLOCK_ORDER 9
+#define PAGEBLOCK_PAGES (1ULL << PAGEBLOCK_ORDER)
+
 #include "pmm_types.h"
 
 #endif // PMM_H
@@ -18,12 +18,39 @@ typedef struct free_list_node {
 
 /*
  * 空闲链表的头节点
- * 指向第一个链表节点
+ * 每个迁移类型一条链表，指向第一个链表节点
+ * 
+ * map是该order的空闲块位图，不区分迁移类型
+ * 第i位表示从zone起始页帧号开始的第i个(1 << order)页块
+ * 是否是这个order的空闲块
+ * 伙伴检查和统计只看位图，不需要访问空闲页本身
  */
 typedef struct {
-    free_list_t *head;                     
+    free_list_t *head[MIGRATE_TYPES];
+    uint64_t *map;              // 空闲块位图
+    uint64_t nr_free;           // 空闲块数量
 } free_area_t;
 
+/*
+ * per-CPU页缓存链表
+ * head端为热页，最近释放的页从这里放入和取出
+ * tail端为冷页，批量填充放到这里，回收也从这里取
+ */
+typedef struct {
+    free_list_t *head;
+    free_list_t *tail;
+    uint32_t count;             // 链表中的块数
+} pcp_list_t;
+
+/*
+ * 每个核心在每个zone有一份
+ * 只由所属核心访问，不需要加锁
+ * 按迁移类型分开，可移动和不可移动的页不会通过缓存混在一起
+ */
+typedef struct {
+    pcp_list_t lists[MIGRATE_PCPTYPES][PCP_ORDERS];
+} __attribute__((aligned(CACHE_LINE_SIZE))) per_cpu_pages_t;
+
 typedef struct {
     spinlock_t lock;  
     char _pad[CACHE_LINE_SIZE - sizeof(spinlock_t)];
@@ -31,29 +58,88 @@ typedef struct {
     uint64_t start_pfn;         // 起始页帧号
     uint64_t end_pfn;           // 结束页帧号
     free_area_t free_areas[MAX_ORDER]; 
+    uint32_t free_orders[MIGRATE_TYPES];    // 第o位表示free_areas[o]中这个类型的链表非空
+    uint64_t free_pages;        // 伙伴系统中的空闲页数
+    uint8_t *pageblock_types;   // 每个pageblock的MIGRATE_*
+
+    /*
+     * 持有zone锁修改空闲链表时递增
+     * 统计信息的读者通过它无锁读取
+     */
+    seqcount_t seq;
+
+    /*
+     * 延迟初始化
+     * zone按section分成init_chunks个区间
+     * init_next是下一个要领取的区间，init_done是完成的区间数
+     */
+    uint64_t init_chunks;
+    uint64_t init_next;
+    uint64_t init_done;
+
 } zone_t;
 
-//内存块结构体，多个页组成，order大小与空闲链表相关
+/*
+ * zone统计信息快照
+ * 由pmm_zone_info无锁读取
+ */
+typedef struct {
+    uint64_t start_pfn;
+    uint64_t end_pfn;
+    uint64_t free_pages;        // 伙伴系统中的空闲页数
+    uint64_t nr_free[MAX_ORDER];    // 每个order的空闲块数
+} zone_info_t;
+
+// mem_block_t.flags
+#define MEM_BLOCK_PCP       (1 << 0)    // 块在per-CPU页缓存中
+#define MEM_BLOCK_SLAB      (1 << 1)    // 块被slab分配器使用
+#define MEM_BLOCK_MOVABLE   (1 << 2)    // 块按MIGRATE_MOVABLE分配，压缩时可以迁移
+
+/*
+ * 内存块结构体，多个页组成，order大小与空闲链表相关
+ * 每页一个，只放分配器经常访问的字段
+ * 
+ * 只有块首页的is_free、flags和order有效
+ * 其他页is_head为0，表示是块的尾页，通过对齐找到首页
+ * 拆分和合并只需要修改首页，不需要访问尾页
+ * zone在初始化后不变，每页都有效
+ */
 typedef struct __attribute__((packed)) {
-    uint8_t is_head:1;   //是否为块的首页
-    uint8_t is_free:1;    //是否被分配
-    uint8_t flags:6;    //预留
+    uint8_t is_head:1;   //是否为块的首页，为0时是尾页
+    uint8_t is_free:1;    //是否空闲
+    uint8_t flags:6;    //MEM_BLOCK_*
     
     uint8_t order:5;
     uint8_t zone:3;
-    
-    uint16_t map_count;    //映射计数
-    uint32_t ref_count;     //引用计数
 } mem_block_t;
 
+/*
+ * 分配器不常访问的页信息
+ * 和mem_block_t分开存放，拆分合并时不会被带进缓存
+ */
 typedef struct {
-    uint64_t count;    
-    char _pad1[CACHE_LINE_SIZE - sizeof(uint64_t)];       
+    uint32_t ref_count;     //块的引用计数，只在块首页有效
+    uint32_t map_count;     //页的映射计数
+} mem_block_cold_t;
 
-    spinlock_t lock;
-    char _pad2[CACHE_LINE_SIZE - sizeof(spinlock_t)];
+/*
+ * 一个section的mem_block
+ * 没有空闲内存的section两个指针都为NULL
+ */
+typedef struct {
+    mem_block_t *hot;
+    mem_block_cold_t *cold;
+} mem_section_t;
+
+/*
+ * mem_block按section分配
+ * sections[pfn >> PMM_SECTION_SHIFT]是pfn所在section的mem_block
+ */
+typedef struct {
+    uint64_t count;             // section数
+    char _pad1[CACHE_LINE_SIZE - sizeof(uint64_t)];       
 
-    mem_block_t blocks[];   
+    mem_section_t sections[];   
 } mem_block_array_t;
 
 #endif // PMM_TYPES_H 
\ No newline at end of file
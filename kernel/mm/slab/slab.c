@@ -0,0 +1,481 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <serial.h>
+#include <printk.h>
+#include <spinlock.h>
+#include <cpu/cpu.h>
+#include <cpu/idt.h>
+#include <mm/bootmem/linear_map.h>
+#include <mm/pmm/buddy.h>
+#include <mm/pmm/pmm.h>
+#include <mm/heap.h>
+#include "slab.h"
+
+/*
+ * slab分配器
+ *
+ * 每个kmem_cache管理一种大小的对象
+ * 对象从slab中切分，slab是从伙伴系统分配的2^order页
+ * slab头部放在slab开头，空闲对象通过内嵌指针串成链表
+ *
+ * 每个核心有一个弹匣缓存最近释放的对象
+ * 弹匣不空时分配和释放不需要任何锁
+ * 弹匣空了或满了才获取cache锁，批量与slab交换一半
+ *
+ * 每个新slab的第一个对象错开一个缓存行（着色）
+ * 避免不同slab的同号对象落在同一个缓存组
+ *
+ * 访问弹匣时关中断，中断和打开中断的缺页处理打断分配时不会看到改了一半的弹匣
+ * cache锁在关中断时获取，但slab从伙伴系统分配，中断处理函数同样不能分配对象
+ */
+
+// 用来分配kmem_cache_t本身
+static kmem_cache_t cache_cache;
+
+// 所有cache组成的链表
+static kmem_cache_t *cache_chain = NULL;
+static spinlock_t cache_chain_lock = SPIN_LOCK_INIT;
+
+// kmalloc大小类
+static const uint32_t kmalloc_sizes[] = {
+    8, 16, 32, 64, 96, 128, 192, 256, 512, 1024, 2048, 4096, 8192
+};
+
+static const char *kmalloc_names[] = {
+    "kmalloc-8", "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-96",
+    "kmalloc-128", "kmalloc-192", "kmalloc-256", "kmalloc-512",
+    "kmalloc-1k", "kmalloc-2k", "kmalloc-4k", "kmalloc-8k"
+};
+
+#define KMALLOC_CLASSES (sizeof(kmalloc_sizes) / sizeof(kmalloc_sizes[0]))
+
+static kmem_cache_t *kmalloc_caches[KMALLOC_CLASSES];
+
+static inline size_t align_up(size_t value, size_t align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+// 着色步长，至少一个缓存行，且不破坏对象对齐
+static inline uint32_t color_step(kmem_cache_t *cache) {
+    return cache->align > CACHE_LINE_SIZE ? cache->align : CACHE_LINE_SIZE;
+}
+
+/*
+ * 通过对象地址找到slab头部
+ * slab是伙伴块，块首页对齐到块大小
+ * 不是slab分配的地址返回NULL
+ */
+static slab_t *slab_of(const void *obj) {
+    uint64_t pfn = LINEAR_TO_PHYS((uintptr_t)obj) >> PAGE_SHIFT;
+    uint64_t head_pfn = pmm_block_head(pfn);
+
+    if (head_pfn == 0 || !(pfn_to_block(head_pfn)->flags & MEM_BLOCK_SLAB)) {
+        return NULL;
+    }
+
+    return (slab_t *)PHYS_TO_LINEAR(head_pfn << PAGE_SHIFT);
+}
+
+// slab按已分配对象数所在的链表
+static inline slab_t **slab_list_of(kmem_cache_t *cache, uint32_t inuse) {
+    if (inuse == 0) {
+        return &cache->free;
+    }
+
+    if (inuse == cache->objs_per_slab) {
+        return &cache->full;
+    }
+
+    return &cache->partial;
+}
+
+static void slab_list_add(slab_t **head, slab_t *slab) {
+    slab->prev = NULL;
+    slab->next = *head;
+
+    if (*head != NULL) {
+        (*head)->prev = slab;
+    }
+
+    *head = slab;
+}
+
+static void slab_list_del(slab_t **head, slab_t *slab) {
+    if (slab->prev != NULL) {
+        slab->prev->next = slab->next;
+    } else {
+        *head = slab->next;
+    }
+
+    if (slab->next != NULL) {
+        slab->next->prev = slab->prev;
+    }
+}
+
+/*
+ * 分配新的slab
+ * 调用者必须持有cache锁
+ * 成功：slab；失败：NULL
+ */
+static slab_t *slab_create(kmem_cache_t *cache) {
+    // 持有cache锁且关中断，不能直接压缩
+    uint64_t pfn = _kheap_try_alloc(PAGE_SIZE << cache->order, ZONE_NORMAL);
+
+    if (pfn == 0) {
+        return NULL;
+    }
+
+    pfn_to_block(pfn)->flags |= MEM_BLOCK_SLAB;
+
+    uint8_t *base = (uint8_t *)PHYS_TO_LINEAR(pfn << PAGE_SHIFT);
+    slab_t *slab = (slab_t *)base;
+
+    uint32_t color = cache->color_next;
+    cache->color_next = (color + 1) % cache->color_count;
+
+    slab->cache = cache;
+    slab->inuse = 0;
+    slab->s_mem = base + cache->obj_offset + color * color_step(cache);
+    slab->freelist = NULL;
+
+    // 倒序建立空闲链表，让低地址的对象先被分配
+    for (uint32_t i = cache->objs_per_slab; i > 0; i--) {
+        void **obj = (void **)((uint8_t *)slab->s_mem + (i - 1) * cache->size);
+        *obj = slab->freelist;
+        slab->freelist = obj;
+    }
+
+    slab_list_add(&cache->free, slab);
+    cache->nr_slabs++;
+
+    return slab;
+}
+
+/*
+ * 释放空slab
+ * 调用者必须持有cache锁
+ */
+static void slab_destroy(kmem_cache_t *cache, slab_t *slab) {
+    uint64_t pfn = LINEAR_TO_PHYS((uintptr_t)slab) >> PAGE_SHIFT;
+
+    slab_list_del(&cache->free, slab);
+    cache->nr_slabs--;
+
+    pfn_to_block(pfn)->flags &= ~MEM_BLOCK_SLAB;
+    kheap_free(pfn);
+}
+
+/*
+ * 从slab分配一个对象
+ * 优先使用部分分配的slab
+ * 调用者必须持有cache锁
+ */
+static void *cache_alloc_locked(kmem_cache_t *cache) {
+    slab_t *slab = cache->partial;
+
+    if (slab == NULL) {
+        slab = cache->free;
+    }
+
+    if (slab == NULL) {
+        slab = slab_create(cache);
+        if (slab == NULL) {
+            return NULL;
+        }
+    }
+
+    slab_t **old_list = slab_list_of(cache, slab->inuse);
+
+    void **obj = (void **)slab->freelist;
+    slab->freelist = *obj;
+    slab->inuse++;
+
+    slab_t **new_list = slab_list_of(cache, slab->inuse);
+    if (new_list != old_list) {
+        slab_list_del(old_list, slab);
+        slab_list_add(new_list, slab);
+    }
+
+    return obj;
+}
+
+/*
+ * 把对象还给slab
+ * 空slab最多保留一个，多的还给伙伴系统
+ * 调用者必须持有cache锁
+ */
+static void cache_free_locked(kmem_cache_t *cache, void *obj) {
+    slab_t *slab = slab_of(obj);
+
+    if (slab == NULL || slab->cache != cache) {
+        return;
+    }
+
+    slab_t **old_list = slab_list_of(cache, slab->inuse);
+
+    *(void **)obj = slab->freelist;
+    slab->freelist = obj;
+    slab->inuse--;
+
+    slab_t **new_list = slab_list_of(cache, slab->inuse);
+    if (new_list != old_list) {
+        slab_list_del(old_list, slab);
+        slab_list_add(new_list, slab);
+    }
+
+    if (slab->inuse == 0 && slab->next != NULL) {
+        slab_destroy(cache, slab);
+    }
+}
+
+// 获取当前核心的弹匣，没有返回NULL
+static inline kmem_magazine_t *cache_this_mag(kmem_cache_t *cache) {
+    uint32_t cpu = cpu_id();
+
+    if (cache->mags == NULL || cpu >= cache->nr_mags) {
+        return NULL;
+    }
+
+    return &cache->mags[cpu];
+}
+
+/*
+ * 分配per-CPU弹匣
+ * 失败时不使用弹匣，所有操作走加锁路径
+ */
+static void cache_mags_init(kmem_cache_t *cache) {
+    uint32_t cpus = cpu_count();
+    uint64_t size = (uint64_t)cpus * sizeof(kmem_magazine_t);
+    uint64_t pfn = _kheap_try_alloc(size, ZONE_NORMAL);
+
+    cache->mags = NULL;
+    cache->nr_mags = 0;
+
+    if (pfn == 0) {
+        return;
+    }
+
+    kmem_magazine_t *mags = (kmem_magazine_t *)PHYS_TO_LINEAR(pfn << PAGE_SHIFT);
+    for (uint32_t i = 0; i < cpus; i++) {
+        mags[i].count = 0;
+    }
+
+    cache->mags = mags;
+    cache->nr_mags = cpus;
+}
+
+/*
+ * 计算对象布局
+ * 从小到大选择slab的order
+ * 直到浪费的空间不超过slab的1/8
+ * 成功返回true
+ */
+static bool cache_setup(kmem_cache_t *cache, const char *name, size_t size, size_t align, uint32_t flags) {
+    if (align == 0) {
+        align = SLAB_MIN_ALIGN;
+    }
+
+    if ((flags & SLAB_HWCACHE_ALIGN) && align < CACHE_LINE_SIZE) {
+        align = CACHE_LINE_SIZE;
+    }
+
+    // 对齐必须是2的幂
+    if (align < SLAB_MIN_ALIGN || (align & (align - 1)) != 0) {
+        return false;
+    }
+
+    if (size < sizeof(void *)) {
+        size = sizeof(void *);
+    }
+
+    size = align_up(size, align);
+    if (size > KMALLOC_MAX_SIZE) {
+        return false;
+    }
+
+    size_t header = align_up(sizeof(slab_t), align);
+    uint8_t order = 0;
+    size_t objs = 0;
+    size_t left = 0;
+
+    for (order = 0; order <= SLAB_MAX_ORDER; order++) {
+        size_t bytes = (size_t)PAGE_SIZE << order;
+
+        if (bytes < header + size) {
+            continue;
+        }
+
+        objs = (bytes - header) / size;
+        left = bytes - header - objs * size;
+
+        if (left * 8 <= bytes || order == SLAB_MAX_ORDER) {
+            break;
+        }
+    }
+
+    if (objs == 0) {
+        return false;
+    }
+
+    spinlock_init(&cache->lock);
+    cache->name = name;
+    cache->size = size;
+    cache->align = align;
+    cache->flags = flags;
+    cache->order = order;
+    cache->objs_per_slab = objs;
+    cache->obj_offset = header;
+    cache->color_count = left / color_step(cache) + 1;
+    cache->color_next = 0;
+    cache->partial = NULL;
+    cache->full = NULL;
+    cache->free = NULL;
+    cache->nr_slabs = 0;
+    cache->next = NULL;
+
+    cache_mags_init(cache);
+
+    return true;
+}
+
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align, uint32_t flags) {
+    kmem_cache_t *cache = (kmem_cache_t *)kmem_cache_alloc(&cache_cache);
+
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    if (!cache_setup(cache, name, size, align, flags)) {
+        kmem_cache_free(&cache_cache, cache);
+        return NULL;
+    }
+
+    spin_lock(&cache_chain_lock);
+    cache->next = cache_chain;
+    cache_chain = cache;
+    spin_unlock(&cache_chain_lock);
+
+    return cache;
+}
+
+void *kmem_cache_alloc(kmem_cache_t *cache) {
+    uint64_t flags = interrupts_save();
+    kmem_magazine_t *mag = cache_this_mag(cache);
+    void *obj = NULL;
+
+    // 快速路径：从本核心弹匣取
+    if (mag != NULL && mag->count > 0) {
+        obj = mag->objs[--mag->count];
+        interrupts_restore(flags);
+        return obj;
+    }
+
+    spin_lock(&cache->lock);
+
+    if (mag != NULL) {
+        // 弹匣空了，批量装填一半
+        while (mag->count < SLAB_MAG_SIZE / 2) {
+            void *fill = cache_alloc_locked(cache);
+
+            if (fill == NULL) {
+                break;
+            }
+
+            mag->objs[mag->count++] = fill;
+        }
+
+        if (mag->count > 0) {
+            obj = mag->objs[--mag->count];
+        }
+    } else {
+        obj = cache_alloc_locked(cache);
+    }
+
+    spin_unlock(&cache->lock);
+    interrupts_restore(flags);
+
+    return obj;
+}
+
+void kmem_cache_free(kmem_cache_t *cache, void *obj) {
+    if (obj == NULL) {
+        return;
+    }
+
+    uint64_t flags = interrupts_save();
+    kmem_magazine_t *mag = cache_this_mag(cache);
+
+    // 快速路径：放回本核心弹匣
+    if (mag != NULL && mag->count < SLAB_MAG_SIZE) {
+        mag->objs[mag->count++] = obj;
+        interrupts_restore(flags);
+        return;
+    }
+
+    spin_lock(&cache->lock);
+
+    if (mag != NULL) {
+        // 弹匣满了，把最早放入的一半还给slab
+        uint32_t half = SLAB_MAG_SIZE / 2;
+
+        for (uint32_t i = 0; i < half; i++) {
+            cache_free_locked(cache, mag->objs[i]);
+        }
+
+        for (uint32_t i = half; i < mag->count; i++) {
+            mag->objs[i - half] = mag->objs[i];
+        }
+
+        mag->count -= half;
+        mag->objs[mag->count++] = obj;
+    } else {
+        cache_free_locked(cache, obj);
+    }
+
+    spin_unlock(&cache->lock);
+    interrupts_restore(flags);
+}
+
+kmem_cache_t *kmem_cache_of(const void *obj) {
+    slab_t *slab = slab_of(obj);
+
+    return slab ? slab->cache : NULL;
+}
+
+kmem_cache_t *kmalloc_cache(size_t size) {
+    if (size == 0 || size > KMALLOC_MAX_SIZE) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < KMALLOC_CLASSES; i++) {
+        if (size <= kmalloc_sizes[i]) {
+            return kmalloc_caches[i];
+        }
+    }
+
+    return NULL;
+}
+
+void kmem_cache_init(void) {
+    pr_info("[SLAB] Initializing slab allocator\n");
+
+    if (!cache_setup(&cache_cache, "kmem_cache", sizeof(kmem_cache_t), CACHE_LINE_SIZE, 0)) {
+        panic("[SLAB] ERROR: Cannot create kmem_cache\n");
+    }
+
+    cache_chain = &cache_cache;
+
+    for (size_t i = 0; i < KMALLOC_CLASSES; i++) {
+        kmalloc_caches[i] = kmem_cache_create(kmalloc_names[i], kmalloc_sizes[i], 0, 0);
+
+        if (kmalloc_caches[i] == NULL) {
+            panic("[SLAB] ERROR: Cannot create kmalloc caches\n");
+        }
+    }
+
+    pr_info("[SLAB] Ready: %u kmalloc caches, %uB-%uB\n",
+            KMALLOC_CLASSES, KMALLOC_MIN_SIZE, KMALLOC_MAX_SIZE);
+}
@@ -0,0 +1,66 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "slab_types.h"
+
+/*
+ * 初始化slab分配器
+ * 创建kmalloc使用的各个大小类
+ * 必须在pmm_init之后调用
+ */
+void kmem_cache_init(void);
+
+/**
+ * 创建对象缓存
+ *
+ * @param name  缓存名字
+ * @param size  对象大小(字节)，不能超过KMALLOC_MAX_SIZE
+ * @param align 对象对齐，0表示默认对齐
+ * @param flags SLAB_HWCACHE_ALIGN等
+ *
+ * @return 成功：缓存指针
+ * @return 失败：NULL
+ */
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align, uint32_t flags);
+
+/**
+ * 从缓存分配一个对象
+ *
+ * @param cache 对象缓存
+ *
+ * @return 成功：对象的虚拟地址
+ * @return 失败：NULL
+ */
+void *kmem_cache_alloc(kmem_cache_t *cache);
+
+/**
+ * 释放对象到缓存
+ *
+ * @param cache 对象缓存
+ * @param obj   kmem_cache_alloc返回的地址
+ */
+void kmem_cache_free(kmem_cache_t *cache, void *obj);
+
+/**
+ * 获取对象所属的缓存
+ *
+ * @param obj 对象的虚拟地址
+ *
+ * @return 对象不是slab分配的返回NULL
+ */
+kmem_cache_t *kmem_cache_of(const void *obj);
+
+/**
+ * 获取能容纳size字节的kmalloc大小类
+ *
+ * @param size 字节数
+ *
+ * @return 超过KMALLOC_MAX_SIZE或size为0返回NULL
+ */
+kmem_cache_t *kmalloc_cache(size_t size);
+
+#endif // SLAB_H
@@ -0,0 +1,83 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef SLAB_TYPES_H
+#define SLAB_TYPES_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <spinlock.h>
+#include <mm/pmm/pmm.h>
+
+// 每个per-CPU弹匣最多缓存的对象数
+#define SLAB_MAG_SIZE       30
+
+// slab最大order，8KB对象使用64KB的slab
+#define SLAB_MAX_ORDER      4
+
+// 对象最小对齐
+#define SLAB_MIN_ALIGN      8
+
+// kmalloc的大小类范围
+#define KMALLOC_MIN_SIZE    8
+#define KMALLOC_MAX_SIZE    8192
+
+// kmem_cache_create的flags
+#define SLAB_HWCACHE_ALIGN  (1 << 0)    // 对象对齐到缓存行
+
+struct kmem_cache;
+
+/*
+ * slab头部
+ * 放在slab第一页的开头
+ * 空闲对象的前8字节存放下一个空闲对象的地址
+ */
+typedef struct slab {
+    struct slab *prev;
+    struct slab *next;
+    struct kmem_cache *cache;
+    void *freelist;             // 空闲对象链表
+    void *s_mem;                // 第一个对象的地址（已加上着色偏移）
+    uint32_t inuse;             // 已分配的对象数
+} slab_t;
+
+/*
+ * per-CPU弹匣
+ * 只由所属核心访问，不需要加锁
+ */
+typedef struct {
+    uint32_t count;
+    void *objs[SLAB_MAG_SIZE];
+} __attribute__((aligned(CACHE_LINE_SIZE))) kmem_magazine_t;
+
+typedef struct kmem_cache {
+    spinlock_t lock;
+    char _pad[CACHE_LINE_SIZE - sizeof(spinlock_t)];
+
+    const char *name;
+    uint32_t size;              // 对象大小（已对齐）
+    uint32_t align;
+    uint32_t flags;
+    uint8_t order;              // 每个slab的order
+    uint32_t objs_per_slab;
+    uint32_t obj_offset;        // 第一个对象相对slab开头的偏移
+    uint32_t color_count;       // 可用的着色数
+    uint32_t color_next;        // 下一个slab使用的着色
+
+    /*
+     * 三个slab链表
+     * partial 部分分配
+     * full    全部分配
+     * free    全部空闲，最多保留一个
+     */
+    slab_t *partial;
+    slab_t *full;
+    slab_t *free;
+    uint64_t nr_slabs;
+
+    kmem_magazine_t *mags;      // per-CPU弹匣，按核心编号索引
+    uint32_t nr_mags;
+
+    struct kmem_cache *next;    // 全局cache链表
+} kmem_cache_t;
+
+#endif // SLAB_TYPES_H
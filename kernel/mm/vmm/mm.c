@@ -0,0 +1,184 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <config.h>
+#include <serial.h>
+#include <spinlock.h>
+#include <mm/bootmem/bootmem.h>
+#include <mm/bootmem/linear_map.h>
+#include <mm/pmm/pmm.h>
+#include <mm/pmm/buddy.h>
+#include <mm/slab/slab.h>
+#include <mm/tlb.h>
+#include "vmm.h"
+#include "vma.h"
+#include "mm.h"
+
+// 低半部分的大小，PML4的前256项
+#define USER_SPACE_END  (1ULL << 47)
+#define KERNEL_PML4     (PAGE_TABLE_ENTRIES / 2)
+
+// 后台合并时每次最多检查的2MB范围
+#define COLLAPSE_BATCH  8
+
+static kmem_cache_t *mm_cache = NULL;
+
+/*
+ * 所有地址空间，包括kernel_mm
+ * 压缩时遍历它找到映射可移动页的页表项
+ * collapse_mm和collapse_addr是后台合并扫描到的位置
+ * 都由mm_list_lock保护
+ */
+static spinlock_t mm_list_lock;
+static mm_t *mm_list = NULL;
+static mm_t *collapse_mm = NULL;
+static uint64_t collapse_addr = 0;
+
+mm_t *mm_create(void) {
+    mm_t *mm = kmem_cache_alloc(mm_cache);
+
+    if (mm == NULL) {
+        return NULL;
+    }
+
+    uint64_t pfn = 0;
+
+    for (int16_t zone = ZONE_NORMAL; zone >= ZONE_DMA && pfn == 0; zone--) {
+        pfn = pmm_alloc_pages(0, zone);
+    }
+
+    if (pfn == 0) {
+        kmem_cache_free(mm_cache, mm);
+        return NULL;
+    }
+
+    /*
+     * 内核的PML4项指向同一批页表，之后在下级页表中的修改所有地址空间都能看到
+     * kernel_mm之后新增的PML4项不会传播到已经创建的地址空间
+     */
+    uint64_t *pgd = PHYS_TO_LINEAR(pfn * PAGE_SIZE);
+    const uint64_t *kernel_pgd = PHYS_TO_LINEAR(kernel_mm.pgd);
+
+    for (uint32_t i = 0; i < KERNEL_PML4; i++) {
+        pgd[i] = 0;
+    }
+
+    for (uint32_t i = KERNEL_PML4; i < PAGE_TABLE_ENTRIES; i++) {
+        pgd[i] = kernel_pgd[i];
+    }
+
+    mm->pgd = pfn * PAGE_SIZE;
+    cpumask_clear_all(&mm->cpus);
+    spinlock_init(&mm->lock);
+    rwlock_init(&mm->vma_lock);
+    mm->vma_root = NULL;
+
+    spin_lock(&mm_list_lock);
+    mm->next = mm_list;
+    mm_list = mm;
+    spin_unlock(&mm_list_lock);
+
+    return mm;
+}
+
+mm_t *mm_fork(mm_t *parent) {
+    mm_t *child = mm_create();
+
+    if (child == NULL) {
+        return NULL;
+    }
+
+    if (!vma_fork(child, parent)) {
+        mm_destroy(child);
+        return NULL;
+    }
+
+    return child;
+}
+
+void mm_destroy(mm_t *mm) {
+    spin_lock(&mm_list_lock);
+
+    mm_t **link = &mm_list;
+
+    while (*link != mm) {
+        link = &(*link)->next;
+    }
+    *link = mm->next;
+
+    if (collapse_mm == mm) {
+        collapse_mm = mm->next;
+        collapse_addr = 0;
+    }
+
+    spin_unlock(&mm_list_lock);
+
+    // 区域释放时放掉页的引用，再释放剩下的页表
+    vmm_release(mm, 0, USER_SPACE_END);
+    vmm_unmap_pages(mm, 0, USER_SPACE_END);
+
+    pmm_free_pages(mm->pgd / PAGE_SIZE);
+    kmem_cache_free(mm_cache, mm);
+}
+
+void mm_collapse_work(void) {
+#if THP
+    spin_lock(&mm_list_lock);
+
+    if (collapse_mm == NULL) {
+        collapse_mm = mm_list;
+        collapse_addr = 0;
+    }
+
+    // 内核地址空间的页可能被按物理地址使用，和压缩一样不换到其他物理页
+    if (collapse_mm == &kernel_mm) {
+        collapse_mm = kernel_mm.next;
+        collapse_addr = 0;
+    }
+
+    // 持有链表锁，扫描期间地址空间不会被销毁
+    if (collapse_mm != NULL) {
+        collapse_addr = vma_collapse_scan(collapse_mm, collapse_addr, COLLAPSE_BATCH);
+
+        if (collapse_addr == 0) {
+            collapse_mm = collapse_mm->next;
+        }
+    }
+
+    spin_unlock(&mm_list_lock);
+#endif
+}
+
+uint64_t mm_migrate_pages(uint64_t pfn, uint64_t pages, uint64_t count) {
+    uint64_t moved = 0;
+
+    // 持有链表锁的可能就是正在分配内存的调用者，例如后台合并，不等待
+    if (!spin_trylock(&mm_list_lock)) {
+        return 0;
+    }
+
+    for (mm_t *mm = mm_list; mm != NULL && moved < count; mm = mm->next) {
+        // 内核地址空间的页可能被按物理地址使用，不迁移
+        if (mm != &kernel_mm) {
+            moved += vma_migrate(mm, pfn, pages);
+        }
+    }
+
+    spin_unlock(&mm_list_lock);
+
+    return moved;
+}
+
+void mm_init(void) {
+    spinlock_init(&mm_list_lock);
+    kernel_mm.next = NULL;
+    mm_list = &kernel_mm;
+
+    mm_cache = kmem_cache_create("mm", sizeof(mm_t), 0, 0);
+
+    if (mm_cache == NULL) {
+        panic("[MM] ERROR: Cannot create mm cache\n");
+    }
+}
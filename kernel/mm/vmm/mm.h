@@ -0,0 +1,71 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef MM_H
+#define MM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "vmm_types.h"
+
+/*
+ * 地址空间的创建、复制和销毁
+ *
+ * 用户地址空间的高半部分和kernel_mm共用内核的页表
+ * 复制地址空间时区域原样复制，已经分配的页只读地共享，写入时才复制
+ * 所有地址空间串在一个链表中，空闲时后台把填满的2MB范围合并成大页
+ * 压缩内存时通过这个链表找到映射可移动页的地址空间
+ */
+
+// 创建地址空间对象缓存，必须在kmem_cache_init之后调用
+void mm_init(void);
+
+/**
+ * 创建一个空的用户地址空间
+ * 复制kernel_mm的高半部分PML4项，低半部分为空
+ *
+ * @return 成功：地址空间
+ * @return 分配失败：NULL
+ */
+mm_t *mm_create(void);
+
+/**
+ * 复制地址空间
+ *
+ * @param parent 被复制的地址空间
+ *
+ * @return 成功：新的地址空间
+ * @return 分配失败：NULL，parent中被共享的页仍然只读，写入时会恢复
+ */
+mm_t *mm_fork(mm_t *parent);
+
+/**
+ * 销毁地址空间
+ * 释放所有区域和低半部分的页表，共享的页只放掉一个引用
+ * 调用者保证没有核心加载着这个地址空间
+ *
+ * @param mm mm_create或mm_fork返回的地址空间
+ */
+void mm_destroy(mm_t *mm);
+
+/**
+ * 后台合并大页
+ * 轮流扫描所有用户地址空间的区域，每次调用最多检查几个2MB范围
+ * 内核地址空间不合并，它的页不能换到其他物理页
+ * 在空闲循环中调用，THP关闭时什么也不做
+ */
+void mm_collapse_work(void);
+
+/**
+ * 把映射在物理范围中的可移动页迁移到其他物理页
+ * 压缩时调用，遍历除kernel_mm外所有地址空间的区域
+ * 链表或者地址空间的锁被其他核心持有时跳过，不等待
+ *
+ * @param pfn   起始页帧号
+ * @param pages 页数
+ * @param count 范围中可移动的页数，全部迁移后提前结束
+ *
+ * @return 迁移的页数
+ */
+uint64_t mm_migrate_pages(uint64_t pfn, uint64_t pages, uint64_t count);
+
+#endif // MM_H
@@ -0,0 +1,588 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <config.h>
+#include <serial.h>
+#include <printk.h>
+#include <spinlock.h>
+#include <mm/bootmem/linear_map.h>
+#include <mm/pmm/pmm.h>
+#include <mm/pmm/buddy.h>
+#include <mm/slab/slab.h>
+#include <mm/tlb.h>
+#include "vmm.h"
+#include "vma.h"
+
+static kmem_cache_t *vma_cache = NULL;
+
+static inline int32_t node_height(const vm_area_t *node) {
+    return node != NULL ? node->height : 0;
+}
+
+static inline void node_update(vm_area_t *node) {
+    int32_t left = node_height(node->left);
+    int32_t right = node_height(node->right);
+
+    node->height = 1 + (left > right ? left : right);
+}
+
+static vm_area_t *rotate_right(vm_area_t *node) {
+    vm_area_t *left = node->left;
+
+    node->left = left->right;
+    left->right = node;
+    node_update(node);
+    node_update(left);
+
+    return left;
+}
+
+static vm_area_t *rotate_left(vm_area_t *node) {
+    vm_area_t *right = node->right;
+
+    node->right = right->left;
+    right->left = node;
+    node_update(node);
+    node_update(right);
+
+    return right;
+}
+
+// 左右子树高度差超过1时旋转，返回新的子树根
+static vm_area_t *rebalance(vm_area_t *node) {
+    node_update(node);
+
+    int32_t balance = node_height(node->left) - node_height(node->right);
+
+    if (balance > 1) {
+        if (node_height(node->left->left) < node_height(node->left->right)) {
+            node->left = rotate_left(node->left);
+        }
+        return rotate_right(node);
+    }
+
+    if (balance < -1) {
+        if (node_height(node->right->right) < node_height(node->right->left)) {
+            node->right = rotate_right(node->right);
+        }
+        return rotate_left(node);
+    }
+
+    return node;
+}
+
+static vm_area_t *tree_insert(vm_area_t *root, vm_area_t *vma) {
+    if (root == NULL) {
+        vma->left = NULL;
+        vma->right = NULL;
+        vma->height = 1;
+        return vma;
+    }
+
+    if (vma->start < root->start) {
+        root->left = tree_insert(root->left, vma);
+    } else {
+        root->right = tree_insert(root->right, vma);
+    }
+
+    return rebalance(root);
+}
+
+// 从子树中取出最小的节点
+static vm_area_t *tree_remove_min(vm_area_t *root, vm_area_t **min) {
+    if (root->left == NULL) {
+        *min = root;
+        return root->right;
+    }
+
+    root->left = tree_remove_min(root->left, min);
+
+    return rebalance(root);
+}
+
+static vm_area_t *tree_remove(vm_area_t *root, vm_area_t *vma) {
+    if (root == vma) {
+        if (root->left == NULL) {
+            return root->right;
+        }
+
+        if (root->right == NULL) {
+            return root->left;
+        }
+
+        // 用右子树中最小的节点代替被删除的节点
+        vm_area_t *min;
+        vm_area_t *right = tree_remove_min(root->right, &min);
+
+        min->left = root->left;
+        min->right = right;
+
+        return rebalance(min);
+    }
+
+    if (vma->start < root->start) {
+        root->left = tree_remove(root->left, vma);
+    } else {
+        root->right = tree_remove(root->right, vma);
+    }
+
+    return rebalance(root);
+}
+
+/*
+ * 第一个end大于addr的区域
+ * 区域不重叠，按start排序也就是按end排序
+ */
+static vm_area_t *vma_lower_bound(mm_t *mm, uint64_t addr) {
+    vm_area_t *node = mm->vma_root;
+    vm_area_t *found = NULL;
+
+    while (node != NULL) {
+        if (node->end > addr) {
+            found = node;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+
+    return found;
+}
+
+vm_area_t *vma_find(mm_t *mm, uint64_t addr) {
+    vm_area_t *vma = vma_lower_bound(mm != NULL ? mm : &kernel_mm, addr);
+
+    return (vma != NULL && vma->start <= addr) ? vma : NULL;
+}
+
+static bool range_valid(uint64_t start, uint64_t size) {
+    return size != 0 && ((start | size) & (PAGE_SIZE - 1)) == 0 && start + size > start;
+}
+
+/*
+ * 插入一个区域，和已有区域重叠时返回false
+ * 调用者持有mm->vma_lock的写锁
+ */
+static bool area_insert(mm_t *mm, vm_area_t *vma) {
+    vm_area_t *next = vma_lower_bound(mm, vma->start);
+
+    if (next != NULL && next->start < vma->end) {
+        return false;
+    }
+
+    mm->vma_root = tree_insert(mm->vma_root, vma);
+
+    return true;
+}
+
+bool vmm_reserve(mm_t *mm, uint64_t start, uint64_t size, uint32_t flags) {
+    if (mm == NULL) {
+        mm = &kernel_mm;
+    }
+
+    if (!range_valid(start, size)) {
+        return false;
+    }
+
+    vm_area_t *vma = kmem_cache_alloc(vma_cache);
+
+    if (vma == NULL) {
+        return false;
+    }
+
+    vma->start = start;
+    vma->end = start + size;
+    vma->flags = flags;
+
+    write_lock(&mm->vma_lock);
+    bool ok = area_insert(mm, vma);
+    write_unlock(&mm->vma_lock);
+
+    if (!ok) {
+        kmem_cache_free(vma_cache, vma);
+    }
+
+    return ok;
+}
+
+bool vmm_release(mm_t *mm, uint64_t start, uint64_t size) {
+    if (mm == NULL) {
+        mm = &kernel_mm;
+    }
+
+    if (!range_valid(start, size)) {
+        return false;
+    }
+
+    uint64_t end = start + size;
+    bool ok = true;
+    vm_area_t *vma;
+
+    write_lock(&mm->vma_lock);
+
+    while ((vma = vma_lower_bound(mm, start)) != NULL && vma->start < end) {
+        uint64_t from = vma->start > start ? vma->start : start;
+        uint64_t to = vma->end < end ? vma->end : end;
+        vm_area_t *tail = NULL;
+
+        // 从区域中间释放时一分为二
+        if (vma->start < from && vma->end > to) {
+            tail = kmem_cache_alloc(vma_cache);
+
+            if (tail == NULL) {
+                ok = false;
+                break;
+            }
+        }
+
+        // 持有写锁，缺页处理不会在释放后重新映射
+        if (!vmm_free_pages(mm, from, to - from)) {
+            if (tail != NULL) {
+                kmem_cache_free(vma_cache, tail);
+            }
+            ok = false;
+            break;
+        }
+
+        if (tail != NULL) {
+            tail->start = to;
+            tail->end = vma->end;
+            tail->flags = vma->flags;
+            vma->end = from;
+            mm->vma_root = tree_insert(mm->vma_root, tail);
+        } else if (vma->start < from) {
+            vma->end = from;
+        } else if (vma->end > to) {
+            // [start, to)中没有其他区域，改start不影响顺序
+            vma->start = to;
+        } else {
+            mm->vma_root = tree_remove(mm->vma_root, vma);
+            kmem_cache_free(vma_cache, vma);
+        }
+    }
+
+    write_unlock(&mm->vma_lock);
+
+    return ok;
+}
+
+/*
+ * 分配一个页
+ * 和kheap一样从NORMAL向下尝试
+ */
+static uint64_t page_alloc(mm_t *mm) {
+    for (int16_t zone = ZONE_NORMAL; zone >= ZONE_DMA; zone--) {
+        uint64_t pfn = pmm_alloc_pages_type(0, zone, vmm_migrate_type(mm));
+
+        if (pfn != 0) {
+            return pfn;
+        }
+    }
+
+    return 0;
+}
+
+// 映射失败时放掉新页
+static inline void page_discard(uint64_t pfn) {
+    pmm_page_unmap(pfn);
+    pmm_free_pages(pfn);
+}
+
+// 其他核心已经处理了同一页，权限足够就重新执行
+static inline bool fault_retry(mm_t *mm, uint64_t page, uint32_t access) {
+    uint32_t prot;
+
+    return vmm_translate(mm, page, NULL, NULL, &prot) && (access & ~prot) == 0;
+}
+
+/*
+ * 写时复制
+ * 只剩这一个映射和引用时直接恢复写权限
+ * 否则复制到新页，替换成功后放掉对旧页的引用
+ * 复制时页在这个地址空间中是只读的，其他地址空间写入的是自己的副本
+ */
+static bool fault_cow(mm_t *mm, vm_area_t *vma, uint64_t page, uint64_t old_phys, uint32_t access) {
+    uint64_t old_pfn = old_phys / PAGE_SIZE;
+
+    if (pmm_page_mapcount(old_pfn) == 1 && pmm_page_ref(old_pfn) == 1) {
+        return vmm_replace_page(mm, page, old_phys, old_phys, vma->flags) ||
+               fault_retry(mm, page, access);
+    }
+
+    uint64_t pfn = page_alloc(mm);
+
+    if (pfn == 0) {
+        pr_warn("[VMA] WARNING: Out of memory on copy-on-write at %p\n", page);
+        return false;
+    }
+
+    const uint64_t *src = PHYS_TO_LINEAR(old_phys);
+    uint64_t *dst = PHYS_TO_LINEAR(pfn * PAGE_SIZE);
+
+    for (uint32_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++) {
+        dst[i] = src[i];
+    }
+
+    pmm_page_map(pfn);
+
+    if (vmm_replace_page(mm, page, old_phys, pfn * PAGE_SIZE, vma->flags)) {
+        page_discard(old_pfn);
+        return true;
+    }
+
+    page_discard(pfn);
+
+    return fault_retry(mm, page, access);
+}
+
+static void page_clear(uint64_t pfn, uint64_t pages) {
+    uint64_t *data = PHYS_TO_LINEAR(pfn * PAGE_SIZE);
+
+    for (uint64_t i = 0; i < pages * PAGE_SIZE / sizeof(uint64_t); i++) {
+        data[i] = 0;
+    }
+}
+
+#if THP
+/*
+ * 缺页地址所在的2MB完全在区域内并且还没有任何映射时，直接映射一个2MB页
+ * 只从NORMAL和DMA32分配，失败时退回4KB页，不影响正常的缺页处理
+ * 有退路，所以失败时不直接压缩，只请求后台压缩
+ */
+static bool fault_huge(mm_t *mm, vm_area_t *vma, uint64_t page) {
+    uint64_t huge = page & ~(HUGE_PAGE_SIZE - 1);
+
+    if ((vma->flags & VM_NOHUGE) || huge < vma->start || vma->end - huge < HUGE_PAGE_SIZE ||
+        !vmm_slot_empty(mm, huge, HUGE_PAGE_SIZE)) {
+        return false;
+    }
+
+    uint64_t pfn = 0;
+
+    for (int16_t zone = ZONE_NORMAL; zone >= ZONE_DMA32 && pfn == 0; zone--) {
+        pfn = pmm_try_alloc_pages(HUGE_PAGE_ORDER, zone, vmm_migrate_type(mm));
+    }
+
+    if (pfn == 0) {
+        return false;
+    }
+
+    page_clear(pfn, 1ULL << HUGE_PAGE_ORDER);
+    pmm_page_map(pfn);
+
+    if (vmm_map_absent(mm, huge, pfn * PAGE_SIZE, HUGE_PAGE_SIZE, vma->flags)) {
+        return true;
+    }
+
+    // 其他核心先映射了这个范围中的页
+    page_discard(pfn);
+
+    return false;
+}
+
+/*
+ * 把区域中填满的2MB范围合并成大页
+ * 持有写锁，缺页处理不会同时修改这些页
+ */
+uint64_t vma_collapse_scan(mm_t *mm, uint64_t addr, uint32_t budget) {
+    vm_area_t *vma = NULL;
+
+    write_lock(&mm->vma_lock);
+
+    while (budget > 0 && (vma = vma_lower_bound(mm, addr)) != NULL) {
+        uint64_t from = vma->start > addr ? vma->start : addr;
+        uint64_t huge = (from + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+
+        // 区域中已经没有完整的2MB范围
+        if (huge < from || vma->end < huge || vma->end - huge < HUGE_PAGE_SIZE) {
+            addr = vma->end;
+            continue;
+        }
+
+        if (!(vma->flags & VM_NOHUGE)) {
+            vmm_collapse(mm, huge, vma->flags);
+        }
+        budget--;
+        addr = huge + HUGE_PAGE_SIZE;
+    }
+
+    write_unlock(&mm->vma_lock);
+
+    // 扫到最后一个区域之后从头开始
+    return vma != NULL ? addr : 0;
+}
+#endif
+
+/*
+ * 匿名内存的缺页
+ * 页已经有映射时，是其他核心先处理了同一页，或者TLB中还留着旧的项
+ * 权限足够就直接返回，重新执行时会看到新的映射
+ * 区域可写但页只读，说明页是共享的，写入时复制
+ */
+static bool fault_anon(mm_t *mm, vm_area_t *vma, uint64_t page, uint32_t access) {
+    uint64_t phys, page_size;
+    uint32_t prot;
+
+    if (vmm_translate(mm, page, &phys, &page_size, &prot)) {
+        if ((access & ~prot) == 0) {
+            return true;
+        }
+
+        // 目前只有4KB的页会被共享
+        if ((access & VM_WRITE) && !(prot & VM_WRITE) && page_size == PAGE_SIZE) {
+            return fault_cow(mm, vma, page, phys, access);
+        }
+
+        return false;
+    }
+
+#if THP
+    if (fault_huge(mm, vma, page)) {
+        return true;
+    }
+#endif
+
+    uint64_t pfn = page_alloc(mm);
+
+    if (pfn == 0) {
+        pr_warn("[VMA] WARNING: Out of memory on fault at %p\n", page);
+        return false;
+    }
+
+    page_clear(pfn, 1);
+    pmm_page_map(pfn);
+
+    if (vmm_map_absent(mm, page, pfn * PAGE_SIZE, PAGE_SIZE, vma->flags)) {
+        return true;
+    }
+
+    // 其他核心抢先映射了
+    page_discard(pfn);
+
+    return fault_retry(mm, page, access);
+}
+
+bool vmm_fault(mm_t *mm, uint64_t addr, uint32_t access) {
+    if (mm == NULL) {
+        mm = &kernel_mm;
+    }
+
+    bool handled = false;
+
+    read_lock(&mm->vma_lock);
+
+    vm_area_t *vma = vma_find(mm, addr);
+
+    if (vma != NULL && (access & ~vma->flags) == 0) {
+        handled = fault_anon(mm, vma, addr & ~(uint64_t)(PAGE_SIZE - 1), access);
+    }
+
+    read_unlock(&mm->vma_lock);
+
+    return handled;
+}
+
+bool vmm_dup_area(mm_t *mm, uint64_t start, uint64_t size, uint64_t new_start) {
+    if (mm == NULL) {
+        mm = &kernel_mm;
+    }
+
+    if (!range_valid(start, size) || !range_valid(new_start, size)) {
+        return false;
+    }
+
+    vm_area_t *copy = kmem_cache_alloc(vma_cache);
+
+    if (copy == NULL) {
+        return false;
+    }
+
+    copy->start = new_start;
+    copy->end = new_start + size;
+
+    // 写锁挡住缺页，共享过程中源范围的映射不会变化
+    write_lock(&mm->vma_lock);
+
+    vm_area_t *vma = vma_find(mm, start);
+    bool ok = vma != NULL && vma->end - start >= size;
+
+    if (ok) {
+        copy->flags = vma->flags;
+        ok = area_insert(mm, copy);
+    }
+
+    if (ok && !vmm_share_pages(mm, start, mm, new_start, size)) {
+        // 撤销已经共享的部分
+        vmm_free_pages(mm, new_start, size);
+        mm->vma_root = tree_remove(mm->vma_root, copy);
+        ok = false;
+    }
+
+    write_unlock(&mm->vma_lock);
+
+    if (!ok) {
+        kmem_cache_free(vma_cache, copy);
+    }
+
+    return ok;
+}
+
+// 按地址顺序把src子树中的区域复制到dst
+static bool fork_areas(mm_t *dst, mm_t *src, const vm_area_t *node) {
+    if (node == NULL) {
+        return true;
+    }
+
+    uint64_t size = node->end - node->start;
+
+    return fork_areas(dst, src, node->left) &&
+           vmm_reserve(dst, node->start, size, node->flags) &&
+           vmm_share_pages(src, node->start, dst, node->start, size) &&
+           fork_areas(dst, src, node->right);
+}
+
+bool vma_fork(mm_t *dst, mm_t *src) {
+    write_lock(&src->vma_lock);
+    bool ok = fork_areas(dst, src, src->vma_root);
+    write_unlock(&src->vma_lock);
+
+    return ok;
+}
+
+// 按地址顺序迁移子树中每个区域的页
+static uint64_t migrate_areas(mm_t *mm, const vm_area_t *node, uint64_t pfn, uint64_t pages) {
+    if (node == NULL) {
+        return 0;
+    }
+
+    return migrate_areas(mm, node->left, pfn, pages) +
+           vmm_migrate_pages(mm, node->start, node->end - node->start, pfn, pages) +
+           migrate_areas(mm, node->right, pfn, pages);
+}
+
+uint64_t vma_migrate(mm_t *mm, uint64_t pfn, uint64_t pages) {
+    if (mm == NULL) {
+        mm = &kernel_mm;
+    }
+
+    // 持有vma_lock的可能就是正在分配内存的调用者，例如缺页处理，不等待
+    if (!write_trylock(&mm->vma_lock)) {
+        return 0;
+    }
+
+    uint64_t moved = migrate_areas(mm, mm->vma_root, pfn, pages);
+
+    write_unlock(&mm->vma_lock);
+
+    return moved;
+}
+
+void vma_init(void) {
+    vma_cache = kmem_cache_create("vm_area", sizeof(vm_area_t), 0, 0);
+
+    if (vma_cache == NULL) {
+        panic("[VMA] ERROR: Cannot create vm_area cache\n");
+    }
+}
@@ -0,0 +1,127 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef VMA_H
+#define VMA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "vmm_types.h"
+
+/*
+ * 虚拟内存区域
+ *
+ * 区域只预留地址，不分配内存
+ * 第一次访问时缺页处理分配一个清零的页并映射，没有访问过的部分不占内存
+ * 复制地址空间或者区域时页只读地共享，写入时才复制
+ * THP打开时，完全在区域内的2MB范围第一次访问时直接分配2MB页
+ * 区域按起始地址存放在AVL树中，查找缺页地址是O(log n)
+ * 用户地址空间的页按可移动类型分配，压缩时可以换到其他物理页
+ *
+ * mm为NULL表示内核地址空间
+ */
+
+// 创建VMA对象缓存，必须在kmem_cache_init之后调用
+void vma_init(void);
+
+/**
+ * 预留一段虚拟地址
+ *
+ * @param mm    地址空间
+ * @param start 起始虚拟地址
+ * @param size  大小(字节)
+ * @param flags VM_*，区域内的页按这个属性映射
+ *
+ * @return 成功：true
+ * @return 没有对齐、和已有区域重叠或者分配失败：false
+ */
+bool vmm_reserve(mm_t *mm, uint64_t start, uint64_t size, uint32_t flags);
+
+/**
+ * 释放一段虚拟地址
+ * 范围内的区域被删除或者截短，已经分配的页取消映射并释放
+ * 范围内没有区域的部分跳过
+ *
+ * @param mm    地址空间
+ * @param start 起始虚拟地址
+ * @param size  大小(字节)
+ *
+ * @return 成功：true
+ * @return 没有对齐或者分配失败：false，已经处理的部分不恢复
+ */
+bool vmm_release(mm_t *mm, uint64_t start, uint64_t size);
+
+/**
+ * 查找包含addr的区域
+ * 调用者持有mm->vma_lock
+ *
+ * @param mm   地址空间
+ * @param addr 虚拟地址
+ *
+ * @return 没有时返回NULL
+ */
+vm_area_t *vma_find(mm_t *mm, uint64_t addr);
+
+/**
+ * 处理缺页
+ *
+ * @param mm     地址空间
+ * @param addr   访问的虚拟地址
+ * @param access 访问方式，VM_WRITE和VM_USER的组合
+ *
+ * @return 已经处理，可以重新执行：true
+ * @return 不在任何区域中或者区域不允许这种访问：false
+ */
+bool vmm_fault(mm_t *mm, uint64_t addr, uint32_t access);
+
+/**
+ * 在同一个地址空间中复制一段内存
+ * 新区域使用源区域的属性，已经分配的页写时复制，没有分配的页各自在访问时分配
+ *
+ * @param mm        地址空间
+ * @param start     源起始虚拟地址，整个范围在一个区域中
+ * @param size      大小(字节)
+ * @param new_start 新区域的起始虚拟地址
+ *
+ * @return 成功：true
+ * @return 没有对齐、源不在一个区域中、新区域和已有区域重叠或者分配失败：false
+ */
+bool vmm_dup_area(mm_t *mm, uint64_t start, uint64_t size, uint64_t new_start);
+
+/**
+ * 把src的所有区域复制到dst
+ * 已经分配的页只读地共享，任何一边写入时复制
+ * 复制期间持有src->vma_lock的写锁
+ *
+ * @param dst 新建的地址空间，没有区域
+ * @param src 被复制的地址空间
+ *
+ * @return 成功：true
+ * @return 分配失败：false，已经复制的区域留在dst中，由调用者释放
+ */
+bool vma_fork(mm_t *dst, mm_t *src);
+
+/**
+ * 合并区域中填满4KB页的2MB范围
+ * 从addr开始最多检查budget个2MB范围，只在THP打开时存在
+ *
+ * @param mm     地址空间
+ * @param addr   开始扫描的虚拟地址
+ * @param budget 最多检查的2MB范围数
+ *
+ * @return 下次开始扫描的地址，扫完所有区域时返回0
+ */
+uint64_t vma_collapse_scan(mm_t *mm, uint64_t addr, uint32_t budget);
+
+/**
+ * 把区域中映射在物理范围内的可移动页迁移到其他物理页
+ * 持有mm->vma_lock的写锁，缺页处理等待迁移完成
+ *
+ * @param mm    地址空间
+ * @param pfn   起始页帧号
+ * @param pages 页数
+ *
+ * @return 迁移的页数；vma_lock被其他核心持有时不等待，返回0
+ */
+uint64_t vma_migrate(mm_t *mm, uint64_t pfn, uint64_t pages);
+
+#endif // VMA_H
@@ -0,0 +1,1138 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <spinlock.h>
+#include <mm/bootmem/bootmem.h>
+#include <mm/bootmem/linear_map.h>
+#include <mm/pmm/pmm.h>
+#include <mm/pmm/buddy.h>
+#include <mm/tlb.h>
+#include "vmm.h"
+
+/*
+ * 页表级别
+ * 0是PT，1是PD，2是PDPT，3是PML4
+ * 级别n的一项覆盖1 << (12 + 9n)字节，PDPT及以下的项可以是叶子
+ */
+#define PT_LEVELS   4
+#define LEAF_LEVELS 3
+
+/*
+ * 软件可用位，表示指向的页表由vmm分配，清空后可以释放
+ * BOOTBOOT和linear_map建立的页表没有这一位，只会被断开
+ */
+#define PAGE_VMM_TABLE (1ULL << 9)
+
+/*
+ * 软件可用位，表示叶子映射的是缺页时分配的页
+ * 这样的叶子持有页的一个引用和一个映射计数，大页叶子映射的是整个order 9的块
+ */
+#define PAGE_VMM_PAGE  (1ULL << 10)
+
+// HUGE_PAGE_SIZE的页所在的级别
+#define HUGE_LEVEL 1
+
+// 指向下级页表的表项，权限由叶子决定，中间级别全部放开
+#define TABLE_FLAGS (PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER | PAGE_VMM_TABLE)
+
+// 叶子中由VM_*决定的位，修改属性时其余位(A/D位等)保留
+#define LEAF_PROT_MASK (PAGE_WRITABLE | PAGE_USER | PAGE_PWT | PAGE_PCD | PAGE_GLOBAL)
+
+// 取消映射时一次最多记录的物理页，满了先放开mm->lock刷新TLB再释放
+#define FREE_BATCH_PAGES 64
+
+typedef enum {
+    WALK_MAP,
+    WALK_MAP_ABSENT,            // 只在没有映射时映射
+    WALK_UNMAP,
+    WALK_PROTECT,
+} walk_op_t;
+
+// 一次调用的状态
+typedef struct {
+    walk_op_t op;
+    bool free_pages;            // 取消映射时释放所有映射的物理页，不只是PAGE_VMM_PAGE的叶子
+    uint64_t leaf_flags;        // 新叶子的属性，不含PS位
+    uint64_t freed;             // 等待释放的页表，为0表示没有
+    uint32_t nr_pages;
+    uint64_t pages[FREE_BATCH_PAGES];
+    bool full;                  // pages记满了，遍历停在resume，刷新释放后从这里继续
+    uint64_t resume;
+    tlb_batch_t batch;
+} walk_t;
+
+static inline uint32_t level_shift(int level) {
+    return PAGE_SHIFT + 9 * level;
+}
+
+static inline uint64_t level_size(int level) {
+    return 1ULL << level_shift(level);
+}
+
+static inline uint64_t *entry_table(uint64_t entry) {
+    return (uint64_t *)PHYS_TO_LINEAR(entry & PAGE_ADDR_MASK);
+}
+
+static inline bool entry_is_leaf(uint64_t entry, int level) {
+    return level == 0 || (entry & PAGE_SIZE_BIT);
+}
+
+// 叶子映射的物理地址，大页的第12位是PAT，不属于地址
+static inline uint64_t leaf_phys(uint64_t entry, int level) {
+    return entry & PAGE_ADDR_MASK & ~(level_size(level) - 1);
+}
+
+// 其他核心的页表遍历可能同时在读
+static inline void set_entry(uint64_t *entry, uint64_t value) {
+    __atomic_store_n(entry, value, __ATOMIC_RELEASE);
+}
+
+// 48位虚拟地址，高16位是第47位的符号扩展
+static inline bool canonical(uint64_t addr) {
+    return (uint64_t)((int64_t)(addr << 16) >> 16) == addr;
+}
+
+static uint64_t prot_to_flags(mm_t *mm, uint32_t prot) {
+    uint64_t flags = PAGE_PRESENT;
+
+    if (prot & VM_WRITE) {
+        flags |= PAGE_WRITABLE;
+    }
+
+    // 内核映射在所有地址空间中相同，切换地址空间时不需要刷新
+    if (prot & VM_USER) {
+        flags |= PAGE_USER;
+    } else if (mm == &kernel_mm) {
+        flags |= PAGE_GLOBAL;
+    }
+
+    if (prot & VM_NOCACHE) {
+        flags |= PAGE_PCD | PAGE_PWT;
+    }
+
+    return flags;
+}
+
+static uint32_t flags_to_prot(uint64_t flags) {
+    uint32_t prot = 0;
+
+    if (flags & PAGE_WRITABLE) {
+        prot |= VM_WRITE;
+    }
+
+    if (flags & PAGE_USER) {
+        prot |= VM_USER;
+    }
+
+    if (flags & PAGE_PCD) {
+        prot |= VM_NOCACHE;
+    }
+
+    return prot;
+}
+
+/*
+ * 分配一个清空的页表
+ * 和kheap一样从NORMAL向下尝试
+ *
+ * 返回物理地址，失败返回0
+ * 遍历页表时在mm->lock中调用
+ * order 0的分配不会直接压缩，可以持有自旋锁
+ */
+static uint64_t table_alloc(void) {
+    for (int16_t zone = ZONE_NORMAL; zone >= ZONE_DMA; zone--) {
+        uint64_t pfn = pmm_alloc_pages(0, zone);
+
+        if (pfn != 0) {
+            uint64_t *table = PHYS_TO_LINEAR(pfn * PAGE_SIZE);
+
+            for (uint32_t i = 0; i < PAGE_TABLE_ENTRIES; i++) {
+                table[i] = 0;
+            }
+
+            return pfn * PAGE_SIZE;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * 页表在TLB刷新之前不能释放，其他核心的页表缓存可能还指向它
+ * 先通过第一项串起来，刷新之后再释放
+ * 第一项存的是页对齐的地址，P位为0，硬件遍历到也只会当作没有映射
+ */
+static void table_defer_free(walk_t *walk, uint64_t phys) {
+    uint64_t *table = PHYS_TO_LINEAR(phys);
+
+    table[0] = walk->freed;
+    walk->freed = phys;
+}
+
+static void table_free_deferred(walk_t *walk) {
+    while (walk->freed != 0) {
+        uint64_t phys = walk->freed;
+
+        walk->freed = ((uint64_t *)PHYS_TO_LINEAR(phys))[0];
+        pmm_free_pages(phys / PAGE_SIZE);
+    }
+}
+
+// 去掉一个映射并放掉它持有的引用，共享的页在最后一个引用释放时才还给伙伴系统
+static inline void page_release(uint64_t pfn) {
+    pmm_page_unmap(pfn);
+    pmm_free_pages(pfn);
+}
+
+/*
+ * 被取消映射或者替换的叶子是否要放掉映射的页
+ * PAGE_VMM_PAGE的叶子持有页的引用和映射计数，不管怎样去掉都要放掉
+ */
+static inline bool page_owned(walk_t *walk, uint64_t leaf) {
+    return walk->free_pages || (leaf & PAGE_VMM_PAGE);
+}
+
+/*
+ * 取消映射的物理页同样要等TLB刷新后才能释放
+ * 其他核心可能还在通过旧的TLB项写入，不能像页表一样把链表写在页里
+ *
+ * 刷新要等其他核心应答，不能在mm->lock中进行：
+ * 关中断等待mm->lock的核心不会处理IPI，两边互相等待
+ * 所以记录满了就在修改叶子之前停下，由vmm_walk放开锁刷新释放后从virt继续
+ */
+static bool page_defer_full(walk_t *walk, uint64_t leaf, uint64_t virt) {
+    if (!page_owned(walk, leaf) || walk->nr_pages < FREE_BATCH_PAGES) {
+        return false;
+    }
+
+    walk->full = true;
+    walk->resume = virt;
+    return true;
+}
+
+// 调用者已经用page_defer_full确认还有位置
+static void page_defer_free(walk_t *walk, uint64_t leaf, int level) {
+    if (!page_owned(walk, leaf)) {
+        return;
+    }
+
+    walk->pages[walk->nr_pages++] = leaf_phys(leaf, level) / PAGE_SIZE;
+}
+
+static void page_free_deferred(walk_t *walk) {
+    for (uint32_t i = 0; i < walk->nr_pages; i++) {
+        page_release(walk->pages[i]);
+    }
+
+    walk->nr_pages = 0;
+}
+
+static bool table_empty(const uint64_t *table) {
+    for (uint32_t i = 0; i < PAGE_TABLE_ENTRIES; i++) {
+        if (table[i] & PAGE_PRESENT) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * 把virt处被修改的level级表项加入批次
+ * 原来是叶子时，invlpg大页中的任意地址就能清掉整个大页的TLB项
+ * 原来是页表时，下面可能缓存了很多4KB的TLB项，要刷新整个范围
+ */
+static void flush_entry(walk_t *walk, uint64_t virt, uint64_t old, int level) {
+    if (entry_is_leaf(old, level)) {
+        tlb_batch_add(&walk->batch, virt, 1);
+    } else {
+        tlb_batch_add(&walk->batch, virt, level_size(level) / PAGE_SIZE);
+    }
+}
+
+/*
+ * 把level级的大页拆成下一级的512项
+ * 拆分前后映射相同，不需要刷新，随后被修改的部分会加入批次
+ * 缺页分配的大页同时拆开伙伴块，每个小页分别持有引用，之后可以单独释放
+ */
+static bool split_leaf(uint64_t *entry, int level) {
+    uint64_t table_phys = table_alloc();
+
+    if (table_phys == 0) {
+        return false;
+    }
+
+    uint64_t old = *entry;
+    uint64_t phys = leaf_phys(old, level);
+
+    if ((old & PAGE_VMM_PAGE) && !pmm_split_pages(phys / PAGE_SIZE, 9 * (level - 1))) {
+        pmm_free_pages(table_phys / PAGE_SIZE);
+        return false;
+    }
+
+    uint64_t flags = old & ~PAGE_ADDR_MASK;
+    uint64_t child_size = level_size(level - 1);
+    uint64_t *table = PHYS_TO_LINEAR(table_phys);
+
+    // PT中第7位是PAT，不是PS
+    if (level == 1) {
+        flags &= ~PAGE_SIZE_BIT;
+    }
+
+    for (uint32_t i = 0; i < PAGE_TABLE_ENTRIES; i++) {
+        table[i] = (phys + i * child_size) | flags;
+    }
+
+    set_entry(entry, table_phys | TABLE_FLAGS);
+
+    return true;
+}
+
+/*
+ * 返回entry指向的下一级页表
+ * 没有时分配，是大页时拆分，失败返回NULL
+ */
+static uint64_t *entry_descend(uint64_t *entry, int level) {
+    uint64_t old = *entry;
+
+    if (!(old & PAGE_PRESENT)) {
+        uint64_t table_phys = table_alloc();
+
+        if (table_phys == 0) {
+            return NULL;
+        }
+
+        set_entry(entry, table_phys | TABLE_FLAGS);
+    } else if (entry_is_leaf(old, level) && !split_leaf(entry, level)) {
+        return NULL;
+    }
+
+    return entry_table(*entry);
+}
+
+/*
+ * 在level级的页表中处理[virt, end)
+ * phys是virt对应的物理地址，只有映射时使用
+ */
+static bool walk_range(walk_t *walk, uint64_t *table, int level,
+                       uint64_t virt, uint64_t end, uint64_t phys) {
+    uint64_t size = level_size(level);
+
+    while (virt < end) {
+        // 地址空间最高的一项结束时boundary回绕为0
+        uint64_t boundary = (virt & ~(size - 1)) + size;
+        uint64_t next = (boundary == 0 || boundary > end) ? end : boundary;
+        uint64_t *entry = &table[(virt >> level_shift(level)) & PAGE_TABLE_MASK];
+        uint64_t old = *entry;
+        bool present = old & PAGE_PRESENT;
+        bool whole = next - virt == size;
+
+        if (walk->op == WALK_MAP || walk->op == WALK_MAP_ABSENT) {
+            bool leaf = level < LEAF_LEVELS && whole && (phys & (size - 1)) == 0;
+
+            // 已经有映射时不拆分也不替换
+            if (walk->op == WALK_MAP_ABSENT && present && (leaf || entry_is_leaf(old, level))) {
+                return false;
+            }
+
+            if (leaf) {
+                /*
+                 * 能用这一级的页时不再往下，原来的页表先逐项取消映射再整个释放
+                 * 中途停下时从这一项的开头继续，仍然映射成这一级的页
+                 */
+                if (present && !entry_is_leaf(old, level) && (old & PAGE_VMM_TABLE)) {
+                    walk->op = WALK_UNMAP;
+                    bool ok = walk_range(walk, entry_table(old), level - 1, virt, next, 0);
+                    walk->op = WALK_MAP;
+
+                    if (!ok) {
+                        if (walk->full) {
+                            walk->resume = virt;
+                        }
+                        return false;
+                    }
+                } else if (present && entry_is_leaf(old, level) && page_defer_full(walk, old, virt)) {
+                    return false;
+                }
+
+                set_entry(entry, phys | walk->leaf_flags | (level > 0 ? PAGE_SIZE_BIT : 0));
+
+                if (present) {
+                    if (entry_is_leaf(old, level)) {
+                        page_defer_free(walk, old, level);
+                    } else if (old & PAGE_VMM_TABLE) {
+                        table_defer_free(walk, old & PAGE_ADDR_MASK);
+                    }
+                    flush_entry(walk, virt, old, level);
+                }
+            } else {
+                uint64_t *child = entry_descend(entry, level);
+
+                if (child == NULL || !walk_range(walk, child, level - 1, virt, next, phys)) {
+                    return false;
+                }
+            }
+        } else if (!present) {
+            // 取消映射和修改属性跳过没有映射的部分
+        } else if (walk->op == WALK_UNMAP) {
+            /*
+             * vmm分配的页表也逐项处理，释放的页记满时可以停在任意一个叶子
+             * 不是vmm分配的页表只断开，里面的叶子不持有页
+             */
+            if (whole && (entry_is_leaf(old, level) || !(old & PAGE_VMM_TABLE))) {
+                if (entry_is_leaf(old, level) && page_defer_full(walk, old, virt)) {
+                    return false;
+                }
+
+                set_entry(entry, 0);
+
+                if (entry_is_leaf(old, level)) {
+                    page_defer_free(walk, old, level);
+                }
+                flush_entry(walk, virt, old, level);
+            } else {
+                uint64_t *child = entry_descend(entry, level);
+
+                if (child == NULL || !walk_range(walk, child, level - 1, virt, next, phys)) {
+                    return false;
+                }
+
+                // 下级页表空了就释放，刷新一次清掉页表缓存中指向它的项
+                uint64_t current = *entry;
+
+                if ((current & PAGE_VMM_TABLE) && table_empty(child)) {
+                    set_entry(entry, 0);
+                    table_defer_free(walk, current & PAGE_ADDR_MASK);
+                    tlb_batch_add(&walk->batch, virt, 1);
+                }
+            }
+        } else {
+            if (whole && entry_is_leaf(old, level)) {
+                uint64_t new = (old & ~LEAF_PROT_MASK) | (walk->leaf_flags & LEAF_PROT_MASK);
+
+                if (new != old) {
+                    set_entry(entry, new);
+                    flush_entry(walk, virt, old, level);
+                }
+            } else {
+                uint64_t *child = entry_descend(entry, level);
+
+                if (child == NULL || !walk_range(walk, child, level - 1, virt, next, phys)) {
+                    return false;
+                }
+            }
+        }
+
+        phys += next - virt;
+        virt = next;
+    }
+
+    return true;
+}
+
+// 非空的范围不能回绕，也不能跨过非规范地址的空洞
+static bool range_valid(uint64_t virt, uint64_t size) {
+    uint64_t last = virt + size - 1;
+
+    return last >= virt && canonical(virt) && canonical(last) && ((virt ^ last) >> 63) == 0;
+}
+
+static void walk_init(walk_t *walk, mm_t *mm, walk_op_t op, bool free_pages, uint64_t leaf_flags) {
+    walk->op = op;
+    walk->free_pages = free_pages;
+    walk->leaf_flags = leaf_flags;
+    walk->freed = 0;
+    walk->nr_pages = 0;
+    walk->full = false;
+    walk->resume = 0;
+    tlb_batch_init(&walk->batch, mm);
+}
+
+static bool vmm_walk(mm_t *mm, walk_op_t op, bool free_pages, uint64_t virt, uint64_t phys,
+                     uint64_t size, uint32_t prot) {
+    if (mm == NULL) {
+        mm = &kernel_mm;
+    }
+
+    if (((virt | phys | size) & (PAGE_SIZE - 1)) != 0) {
+        return false;
+    }
+
+    if (size == 0) {
+        return true;
+    }
+
+    if (!range_valid(virt, size)) {
+        return false;
+    }
+
+    walk_t walk;
+
+    uint64_t leaf_flags = prot_to_flags(mm, prot);
+
+    // 缺页时映射的页由页表持有引用
+    if (op == WALK_MAP_ABSENT) {
+        leaf_flags |= PAGE_VMM_PAGE;
+    }
+
+    walk_init(&walk, mm, op, free_pages, leaf_flags);
+
+    uint64_t end = virt + size;
+
+    while (1) {
+        spin_lock(&mm->lock);
+        bool ok = walk_range(&walk, PHYS_TO_LINEAR(mm->pgd), PT_LEVELS - 1, virt, end, phys);
+        spin_unlock(&mm->lock);
+
+        // 失败时已经修改的部分也要刷新
+        tlb_batch_flush(&walk.batch);
+        table_free_deferred(&walk);
+        page_free_deferred(&walk);
+
+        if (!walk.full) {
+            return ok;
+        }
+
+        // 释放的页记满了，从停下的地方继续
+        phys += walk.resume - virt;
+        virt = walk.resume;
+        walk.full = false;
+    }
+}
+
+bool vmm_map_pages(mm_t *mm, uint64_t virt, uint64_t phys, uint64_t size, uint32_t prot) {
+    return vmm_walk(mm, WALK_MAP, false, virt, phys, size, prot);
+}
+
+bool vmm_map_absent(mm_t *mm, uint64_t virt, uint64_t phys, uint64_t size, uint32_t prot) {
+    return vmm_walk(mm, WALK_MAP_ABSENT, false, virt, phys, size, prot);
+}
+
+bool vmm_unmap_pages(mm_t *mm, uint64_t virt, uint64_t size) {
+    return vmm_walk(mm, WALK_UNMAP, false, virt, 0, size, 0);
+}
+
+bool vmm_free_pages(mm_t *mm, uint64_t virt, uint64_t size) {
+    return vmm_walk(mm, WALK_UNMAP, true, virt, 0, size, 0);
+}
+
+bool vmm_protect(mm_t *mm, uint64_t virt, uint64_t size, uint32_t prot) {
+    return vmm_walk(mm, WALK_PROTECT, false, virt, 0, size, prot);
+}
+
+/*
+ * 查找virt所在的叶子
+ * 调用者持有mm->lock，没有映射返回NULL
+ */
+static uint64_t *leaf_lookup(mm_t *mm, uint64_t virt, int *leaf_level) {
+    uint64_t *table = PHYS_TO_LINEAR(mm->pgd);
+
+    for (int level = PT_LEVELS - 1; level >= 0; level--) {
+        uint64_t *entry = &table[(virt >> level_shift(level)) & PAGE_TABLE_MASK];
+
+        if (!(*entry & PAGE_PRESENT)) {
+            return NULL;
+        }
+
+        if (level < LEAF_LEVELS && entry_is_leaf(*entry, level)) {
+            *leaf_level = level;
+            return entry;
+        }
+
+        table = entry_table(*entry);
+    }
+
+    return NULL;
+}
+
+bool vmm_translate(mm_t *mm, uint64_t virt, uint64_t *phys, uint64_t *page_size, uint32_t *prot) {
+    if (mm == NULL) {
+        mm = &kernel_mm;
+    }
+
+    int level;
+
+    spin_lock(&mm->lock);
+
+    uint64_t *entry = leaf_lookup(mm, virt, &level);
+
+    if (entry != NULL) {
+        uint64_t size = level_size(level);
+
+        if (phys != NULL) {
+            *phys = leaf_phys(*entry, level) + (virt & (size - 1));
+        }
+
+        if (page_size != NULL) {
+            *page_size = size;
+        }
+
+        if (prot != NULL) {
+            *prot = flags_to_prot(*entry);
+        }
+    }
+
+    spin_unlock(&mm->lock);
+
+    return entry != NULL;
+}
+
+bool vmm_replace_page(mm_t *mm, uint64_t virt, uint64_t old_phys, uint64_t new_phys, uint32_t prot) {
+    if (mm == NULL) {
+        mm = &kernel_mm;
+    }
+
+    if (((virt | old_phys | new_phys) & (PAGE_SIZE - 1)) != 0 || !canonical(virt)) {
+        return false;
+    }
+
+    tlb_batch_t batch;
+    int level;
+    bool ok = false;
+
+    tlb_batch_init(&batch, mm);
+
+    spin_lock(&mm->lock);
+
+    uint64_t *entry = leaf_lookup(mm, virt, &level);
+
+    /*
+     * 只替换仍然映射old_phys的只读4KB页
+     * 检查和修改都在锁内，同一页的多个写时复制只有一个成功
+     * 已经变成可写说明其他核心处理过了，可能已经有写入，不能再覆盖
+     */
+    if (entry != NULL && level == 0 && leaf_phys(*entry, 0) == old_phys &&
+        !(*entry & PAGE_WRITABLE)) {
+        set_entry(entry, new_phys | prot_to_flags(mm, prot) | PAGE_VMM_PAGE);
+        tlb_batch_add(&batch, virt, 1);
+        ok = true;
+    }
+
+    spin_unlock(&mm->lock);
+
+    // 返回后调用者才能释放旧页
+    tlb_batch_flush(&batch);
+
+    return ok;
+}
+
+// 共享一段映射的状态
+typedef struct {
+    walk_t dst;                 // 在目标地址空间中建立只读映射
+    uint64_t *dst_pgd;
+    mm_t *dst_mm;
+    uint64_t offset;            // 目标地址减源地址，按模2^64计算
+    tlb_batch_t src_batch;      // 源地址空间中改成只读的页
+} share_t;
+
+/*
+ * 共享一个4KB的叶子
+ * 先在目标中建立只读映射，再把源改成只读，两边写入时都会复制
+ */
+static bool share_leaf(share_t *share, uint64_t *entry, uint64_t virt) {
+    uint64_t old = *entry;
+    uint64_t pfn = leaf_phys(old, 0) / PAGE_SIZE;
+    uint64_t dst_virt = virt + share->offset;
+
+    // 只有缺页时分配的页有引用计数，例如MMIO不能共享
+    if (!(old & PAGE_VMM_PAGE) || !pmm_get_page(pfn)) {
+        return false;
+    }
+    pmm_page_map(pfn);
+
+    share->dst.leaf_flags = prot_to_flags(share->dst_mm, flags_to_prot(old) & ~VM_WRITE) |
+                            PAGE_VMM_PAGE;
+
+    if (!walk_range(&share->dst, share->dst_pgd, PT_LEVELS - 1,
+                    dst_virt, dst_virt + PAGE_SIZE, pfn * PAGE_SIZE)) {
+        page_release(pfn);
+        return false;
+    }
+
+    if (old & PAGE_WRITABLE) {
+        set_entry(entry, old & ~PAGE_WRITABLE);
+        tlb_batch_add(&share->src_batch, virt, 1);
+    }
+
+    return true;
+}
+
+static bool share_range(share_t *share, uint64_t *table, int level, uint64_t virt, uint64_t end) {
+    uint64_t size = level_size(level);
+
+    while (virt < end) {
+        uint64_t boundary = (virt & ~(size - 1)) + size;
+        uint64_t next = (boundary == 0 || boundary > end) ? end : boundary;
+        uint64_t *entry = &table[(virt >> level_shift(level)) & PAGE_TABLE_MASK];
+        uint64_t old = *entry;
+
+        if (!(old & PAGE_PRESENT)) {
+            // 没有映射的部分在目标中也没有映射，访问时各自分配
+        } else if (level == 0) {
+            if (!share_leaf(share, entry, virt)) {
+                return false;
+            }
+        } else {
+            // 大页先在源中拆成4KB页，共享的页只以4KB为单位复制
+            uint64_t *child = entry_descend(entry, level);
+
+            if (child == NULL || !share_range(share, child, level - 1, virt, next)) {
+                return false;
+            }
+        }
+
+        virt = next;
+    }
+
+    return true;
+}
+
+bool vmm_share_pages(mm_t *src, uint64_t src_virt, mm_t *dst, uint64_t dst_virt, uint64_t size) {
+    if (src == NULL) {
+        src = &kernel_mm;
+    }
+
+    if (dst == NULL) {
+        dst = &kernel_mm;
+    }
+
+    if (((src_virt | dst_virt | size) & (PAGE_SIZE - 1)) != 0) {
+        return false;
+    }
+
+    if (size == 0) {
+        return true;
+    }
+
+    if (!range_valid(src_virt, size) || !range_valid(dst_virt, size)) {
+        return false;
+    }
+
+    // 同一个地址空间中两段范围重叠时，新建的映射会被当作源再共享一次
+    if (src == dst && src_virt < dst_virt + size && dst_virt < src_virt + size) {
+        return false;
+    }
+
+    share_t share;
+
+    walk_init(&share.dst, dst, WALK_MAP_ABSENT, false, 0);
+    share.dst_pgd = PHYS_TO_LINEAR(dst->pgd);
+    share.dst_mm = dst;
+    share.offset = dst_virt - src_virt;
+    tlb_batch_init(&share.src_batch, src);
+
+    // 两个地址空间按地址顺序加锁，相反方向同时共享时不会死锁
+    mm_t *first = src < dst ? src : dst;
+    mm_t *second = src < dst ? dst : src;
+
+    spin_lock(&first->lock);
+    if (second != first) {
+        spin_lock(&second->lock);
+    }
+
+    bool ok = share_range(&share, PHYS_TO_LINEAR(src->pgd), PT_LEVELS - 1,
+                          src_virt, src_virt + size);
+
+    if (second != first) {
+        spin_unlock(&second->lock);
+    }
+    spin_unlock(&first->lock);
+
+    // 目标中只建立了新映射，源中改成只读的页要刷新，否则旧的TLB项还能写入共享页
+    tlb_batch_flush(&share.src_batch);
+    tlb_batch_flush(&share.dst.batch);
+    table_free_deferred(&share.dst);
+
+    return ok;
+}
+
+bool vmm_slot_empty(mm_t *mm, uint64_t virt, uint64_t size) {
+    if (mm == NULL) {
+        mm = &kernel_mm;
+    }
+
+    int target = 0;
+
+    while (target < LEAF_LEVELS - 1 && level_size(target) < size) {
+        target++;
+    }
+
+    bool empty = true;
+
+    spin_lock(&mm->lock);
+
+    uint64_t *table = PHYS_TO_LINEAR(mm->pgd);
+
+    for (int level = PT_LEVELS - 1; level >= target; level--) {
+        uint64_t entry = table[(virt >> level_shift(level)) & PAGE_TABLE_MASK];
+
+        // 上级没有页表时整个范围都没有映射
+        if (!(entry & PAGE_PRESENT)) {
+            break;
+        }
+
+        if (level == target || entry_is_leaf(entry, level)) {
+            empty = false;
+            break;
+        }
+
+        table = entry_table(entry);
+    }
+
+    spin_unlock(&mm->lock);
+
+    return empty;
+}
+
+/*
+ * 用户地址空间的页可以被压缩迁移
+ * 内核地址空间的页可能被按物理地址使用，不可移动
+ */
+uint8_t vmm_migrate_type(mm_t *mm) {
+    return mm == NULL || mm == &kernel_mm ? MIGRATE_UNMOVABLE : MIGRATE_MOVABLE;
+}
+
+/*
+ * 分配合并用的大页，不用DMA zone
+ * 合并只是优化，失败时不直接压缩，调用者持有vma_lock和地址空间链表的锁
+ */
+static uint64_t huge_alloc(mm_t *mm) {
+    for (int16_t zone = ZONE_NORMAL; zone >= ZONE_DMA32; zone--) {
+        uint64_t pfn = pmm_try_alloc_pages(HUGE_PAGE_ORDER, zone, vmm_migrate_type(mm));
+
+        if (pfn != 0) {
+            return pfn;
+        }
+    }
+
+    return 0;
+}
+
+// PD中virt的表项，上级没有页表或者是大页时返回NULL
+static uint64_t *huge_entry(mm_t *mm, uint64_t virt) {
+    uint64_t *table = PHYS_TO_LINEAR(mm->pgd);
+
+    for (int level = PT_LEVELS - 1; level > HUGE_LEVEL; level--) {
+        uint64_t entry = table[(virt >> level_shift(level)) & PAGE_TABLE_MASK];
+
+        if (!(entry & PAGE_PRESENT) || entry_is_leaf(entry, level)) {
+            return NULL;
+        }
+
+        table = entry_table(entry);
+    }
+
+    return &table[(virt >> level_shift(HUGE_LEVEL)) & PAGE_TABLE_MASK];
+}
+
+/*
+ * 页表中512项都是缺页分配的页，并且只被这里映射
+ * 共享的页合并后就不能再写时复制了
+ */
+static bool table_collapsible(const uint64_t *table) {
+    for (uint32_t i = 0; i < PAGE_TABLE_ENTRIES; i++) {
+        uint64_t entry = table[i];
+        uint64_t pfn = leaf_phys(entry, 0) / PAGE_SIZE;
+
+        if (!(entry & PAGE_PRESENT) || !(entry & PAGE_VMM_PAGE) ||
+            pmm_page_mapcount(pfn) != 1 || pmm_page_ref(pfn) != 1) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// 把页表中可写的叶子改成只读，刷新后其他核心的写入会缺页，等到合并完成后重新执行
+static void collapse_protect(uint64_t *table, uint64_t virt, tlb_batch_t *batch) {
+    for (uint32_t i = 0; i < PAGE_TABLE_ENTRIES; i++) {
+        if (table[i] & PAGE_WRITABLE) {
+            set_entry(&table[i], table[i] & ~PAGE_WRITABLE);
+            tlb_batch_add(batch, virt + i * PAGE_SIZE, 1);
+        }
+    }
+}
+
+// 页表中的512页复制到大页pfn
+static void collapse_copy(const uint64_t *table, uint64_t pfn) {
+    uint64_t *dst = PHYS_TO_LINEAR(pfn * PAGE_SIZE);
+
+    for (uint32_t i = 0; i < PAGE_TABLE_ENTRIES; i++) {
+        const uint64_t *src = PHYS_TO_LINEAR(leaf_phys(table[i], 0));
+
+        for (uint32_t j = 0; j < PAGE_SIZE / sizeof(uint64_t); j++) {
+            dst[i * PAGE_SIZE / sizeof(uint64_t) + j] = src[j];
+        }
+    }
+}
+
+/*
+ * mm->lock只在检查和修改页表时持有，刷新TLB、分配大页和复制2MB时放开
+ * 调用者持有vma_lock的写锁，缺页处理和增删区域都在等待，页表不会被释放
+ * 放开锁期间表项还是被修改了就放弃，只读的页在写入时由缺页处理恢复写权限
+ */
+bool vmm_collapse(mm_t *mm, uint64_t virt, uint32_t prot) {
+    if (mm == NULL) {
+        mm = &kernel_mm;
+    }
+
+    if ((virt & (HUGE_PAGE_SIZE - 1)) != 0 || !canonical(virt)) {
+        return false;
+    }
+
+    tlb_batch_t batch;
+
+    tlb_batch_init(&batch, mm);
+
+    spin_lock(&mm->lock);
+
+    uint64_t *entry = huge_entry(mm, virt);
+    uint64_t old = entry != NULL ? *entry : 0;
+    bool ok = (old & PAGE_PRESENT) && (old & PAGE_VMM_TABLE) && !entry_is_leaf(old, HUGE_LEVEL) &&
+              table_collapsible(entry_table(old));
+
+    if (ok) {
+        collapse_protect(entry_table(old), virt, &batch);
+    }
+
+    spin_unlock(&mm->lock);
+
+    if (!ok) {
+        return false;
+    }
+
+    tlb_batch_flush(&batch);
+
+    uint64_t pfn = huge_alloc(mm);
+    uint64_t *table = entry_table(old);
+
+    if (pfn == 0) {
+        return false;
+    }
+
+    collapse_copy(table, pfn);
+
+    spin_lock(&mm->lock);
+
+    entry = huge_entry(mm, virt);
+    ok = entry != NULL && *entry == old && table_collapsible(table);
+
+    for (uint32_t i = 0; ok && i < PAGE_TABLE_ENTRIES; i++) {
+        ok = !(table[i] & PAGE_WRITABLE);
+    }
+
+    if (ok) {
+        pmm_page_map(pfn);
+        set_entry(entry, pfn * PAGE_SIZE | prot_to_flags(mm, prot) | PAGE_SIZE_BIT | PAGE_VMM_PAGE);
+        tlb_batch_add(&batch, virt, HUGE_PAGE_SIZE / PAGE_SIZE);
+    }
+
+    spin_unlock(&mm->lock);
+
+    if (!ok) {
+        pmm_free_pages(pfn);
+        return false;
+    }
+
+    // 刷新后旧页和页表不再被访问，页表中还留着旧页的地址
+    tlb_batch_flush(&batch);
+
+    for (uint32_t i = 0; i < PAGE_TABLE_ENTRIES; i++) {
+        page_release(leaf_phys(table[i], 0) / PAGE_SIZE);
+    }
+    pmm_free_pages((old & PAGE_ADDR_MASK) / PAGE_SIZE);
+
+    return true;
+}
+
+// 迁移时一批最多处理的页，每批刷新两次TLB
+#define MIGRATE_BATCH 16
+
+// 一次迁移的状态
+typedef struct {
+    uint64_t start_pfn;         // 要腾空的物理范围[start_pfn, end_pfn)
+    uint64_t end_pfn;
+    uint64_t moved;             // 已经迁移的页数
+    bool full;                  // 一批记满了，遍历停在resume，迁移完这一批后从这里继续
+    uint64_t resume;
+    uint32_t nr;
+    uint64_t virts[MIGRATE_BATCH];
+    uint64_t olds[MIGRATE_BATCH];   // 改成只读之前的叶子
+    uint64_t pfns[MIGRATE_BATCH];   // 新页
+    bool done[MIGRATE_BATCH];       // 已经换上新页
+    tlb_batch_t batch;
+} migrate_t;
+
+/*
+ * 分配迁移的目标页
+ * 被腾空的范围已经隔离，新页不会落在里面
+ */
+static uint64_t migrate_alloc(void) {
+    for (int16_t zone = ZONE_NORMAL; zone >= ZONE_DMA; zone--) {
+        uint64_t pfn = pmm_alloc_pages_type(0, zone, MIGRATE_MOVABLE);
+
+        if (pfn != 0) {
+            return pfn;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * 复制一批已经改成只读的页，换成新页
+ * 调用时不持有mm->lock，刷新TLB要等其他核心应答
+ * 先刷新，其他核心不会再写入旧页，复制的就是最终的内容
+ * 换页时重新查找叶子，放开锁期间被换掉或者取消映射的页不迁移
+ * 新的叶子保留原来的属性，换上后再刷新一次才释放旧页
+ */
+static void migrate_flush(mm_t *mm, migrate_t *migrate) {
+    tlb_batch_flush(&migrate->batch);
+
+    for (uint32_t i = 0; i < migrate->nr; i++) {
+        const uint64_t *src = PHYS_TO_LINEAR(leaf_phys(migrate->olds[i], 0));
+        uint64_t *dst = PHYS_TO_LINEAR(migrate->pfns[i] * PAGE_SIZE);
+
+        for (uint32_t j = 0; j < PAGE_SIZE / sizeof(uint64_t); j++) {
+            dst[j] = src[j];
+        }
+    }
+
+    spin_lock(&mm->lock);
+
+    for (uint32_t i = 0; i < migrate->nr; i++) {
+        int level;
+        uint64_t *entry = leaf_lookup(mm, migrate->virts[i], &level);
+
+        migrate->done[i] = entry != NULL && level == 0 && !(*entry & PAGE_WRITABLE) &&
+                           leaf_phys(*entry, 0) == leaf_phys(migrate->olds[i], 0);
+
+        if (migrate->done[i]) {
+            pmm_page_map(migrate->pfns[i]);
+            set_entry(entry, (migrate->olds[i] & ~PAGE_ADDR_MASK) | migrate->pfns[i] * PAGE_SIZE);
+            tlb_batch_add(&migrate->batch, migrate->virts[i], 1);
+        }
+    }
+
+    spin_unlock(&mm->lock);
+
+    tlb_batch_flush(&migrate->batch);
+
+    // 换上的放掉旧页，没换上的放掉新页
+    for (uint32_t i = 0; i < migrate->nr; i++) {
+        if (migrate->done[i]) {
+            page_release(leaf_phys(migrate->olds[i], 0) / PAGE_SIZE);
+            migrate->moved++;
+        } else {
+            pmm_free_pages(migrate->pfns[i]);
+        }
+    }
+
+    migrate->nr = 0;
+}
+
+/*
+ * 记录一个要迁移的4KB叶子并改成只读
+ * 只迁移缺页时分配的、只有这一个映射和引用的页，共享的页由写时复制处理
+ * 这一批记满了或者新页分配失败返回false，停止遍历
+ */
+static bool migrate_leaf(migrate_t *migrate, uint64_t *entry, uint64_t virt) {
+    uint64_t old = *entry;
+    uint64_t pfn = leaf_phys(old, 0) / PAGE_SIZE;
+
+    if (!(old & PAGE_VMM_PAGE) || pfn < migrate->start_pfn || pfn >= migrate->end_pfn ||
+        pmm_page_mapcount(pfn) != 1 || pmm_page_ref(pfn) != 1) {
+        return true;
+    }
+
+    if (migrate->nr == MIGRATE_BATCH) {
+        migrate->full = true;
+        migrate->resume = virt;
+        return false;
+    }
+
+    uint64_t new_pfn = migrate_alloc();
+
+    if (new_pfn == 0) {
+        return false;
+    }
+
+    if (old & PAGE_WRITABLE) {
+        set_entry(entry, old & ~PAGE_WRITABLE);
+        tlb_batch_add(&migrate->batch, virt, 1);
+    }
+
+    migrate->virts[migrate->nr] = virt;
+    migrate->olds[migrate->nr] = old;
+    migrate->pfns[migrate->nr] = new_pfn;
+    migrate->nr++;
+
+    return true;
+}
+
+// 大页映射的是整个order 9的块，不是可以迁移的单页，跳过
+static bool migrate_range(migrate_t *migrate, uint64_t *table, int level, uint64_t virt, uint64_t end) {
+    uint64_t size = level_size(level);
+
+    while (virt < end) {
+        uint64_t boundary = (virt & ~(size - 1)) + size;
+        uint64_t next = (boundary == 0 || boundary > end) ? end : boundary;
+        uint64_t *entry = &table[(virt >> level_shift(level)) & PAGE_TABLE_MASK];
+
+        if (!(*entry & PAGE_PRESENT) || (level > 0 && entry_is_leaf(*entry, level))) {
+            // 没有映射或者是大页
+        } else if (level == 0) {
+            if (!migrate_leaf(migrate, entry, virt)) {
+                return false;
+            }
+        } else if (!migrate_range(migrate, entry_table(*entry), level - 1, virt, next)) {
+            return false;
+        }
+
+        virt = next;
+    }
+
+    return true;
+}
+
+uint64_t vmm_migrate_pages(mm_t *mm, uint64_t virt, uint64_t size, uint64_t pfn, uint64_t pages) {
+    if (mm == NULL) {
+        mm = &kernel_mm;
+    }
+
+    if (((virt | size) & (PAGE_SIZE - 1)) != 0 || !range_valid(virt, size)) {
+        return 0;
+    }
+
+    migrate_t migrate;
+
+    migrate.start_pfn = pfn;
+    migrate.end_pfn = pfn + pages;
+    migrate.moved = 0;
+    migrate.nr = 0;
+    tlb_batch_init(&migrate.batch, mm);
+
+    uint64_t end = virt + size;
+
+    // 调用者持有vma_lock的写锁，复制期间缺页处理等待
+    while (1) {
+        migrate.full = false;
+
+        spin_lock(&mm->lock);
+        migrate_range(&migrate, PHYS_TO_LINEAR(mm->pgd), PT_LEVELS - 1, virt, end);
+        spin_unlock(&mm->lock);
+
+        // 分配失败之前已经改成只读的页也要完成迁移
+        if (migrate.nr > 0) {
+            migrate_flush(mm, &migrate);
+        }
+
+        if (!migrate.full) {
+            return migrate.moved;
+        }
+
+        virt = migrate.resume;
+    }
+}
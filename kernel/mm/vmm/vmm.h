@@ -0,0 +1,210 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef VMM_H
+#define VMM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "vmm_types.h"
+
+// 映射属性，不带VM_WRITE时只读
+#define VM_WRITE    (1U << 0)
+#define VM_USER     (1U << 1)   // 用户态可访问
+#define VM_NOCACHE  (1U << 2)   // 禁止缓存，用于MMIO
+#define VM_NOHUGE   (1U << 3)   // 区域缺页时不使用大页，只对vmm_reserve有效
+
+// 缺页时可以直接分配的大页，PD级的叶子，对应order 9的伙伴块
+#define HUGE_PAGE_SIZE  (2ULL * 1024 * 1024)
+#define HUGE_PAGE_ORDER 9
+
+/*
+ * 虚拟内存管理
+ *
+ * 在四级页表上映射任意4KB对齐的范围
+ * 每一段按虚拟地址和物理地址的对齐选择最大的页：1GB、2MB或4KB
+ * 页表从伙伴系统分配，由vmm分配的页表清空后释放
+ * 每次调用修改的地址累积在一个TLB批次中，返回前统一刷新
+ * 刷新要等其他核心应答，总是在放开mm->lock之后进行
+ * 释放的页多到一批放不下时，先放开锁刷新释放这一批再继续
+ *
+ * mm为NULL表示内核地址空间，必须在tlb_init之后使用
+ */
+
+/**
+ * 映射一段物理内存
+ * 范围内已有的映射被替换，被替换的vmm_map_absent映射的页和取消映射时一样放掉
+ * 失败时已经映射的部分保留，调用者用vmm_unmap_pages撤销
+ *
+ * @param mm   地址空间
+ * @param virt 起始虚拟地址
+ * @param phys 起始物理地址
+ * @param size 大小(字节)
+ * @param prot VM_*
+ *
+ * @return 成功：true
+ * @return 参数没有对齐或者页表分配失败：false
+ */
+bool vmm_map_pages(mm_t *mm, uint64_t virt, uint64_t phys, uint64_t size, uint32_t prot);
+
+/**
+ * 映射一页，已经有映射时不做修改
+ * 多个核心同时处理同一页的缺页时只有一个成功
+ * 映射持有页的一个引用和一个映射计数，由vmm_free_pages放掉
+ * 2MB的页在部分取消映射或者修改属性时拆成4KB页，伙伴块也随之拆开
+ *
+ * @param mm   地址空间
+ * @param virt 虚拟地址
+ * @param phys 物理地址
+ * @param size 页大小，4KB或者2MB
+ * @param prot VM_*
+ *
+ * @return 成功：true
+ * @return 已经有映射或者页表分配失败：false
+ */
+bool vmm_map_absent(mm_t *mm, uint64_t virt, uint64_t phys, uint64_t size, uint32_t prot);
+
+/**
+ * 取消一段映射
+ * 不释放映射的物理内存，范围内没有映射的部分跳过
+ * vmm_map_absent映射的页例外，映射持有的引用和映射计数总是放掉
+ *
+ * @param mm   地址空间
+ * @param virt 起始虚拟地址
+ * @param size 大小(字节)
+ *
+ * @return 成功：true
+ * @return 参数没有对齐或者拆分大页时页表分配失败：false
+ */
+bool vmm_unmap_pages(mm_t *mm, uint64_t virt, uint64_t size);
+
+/**
+ * 取消一段映射并释放映射的物理页
+ * 只用于映射的页都由伙伴系统分配的范围，例如缺页时分配的内存
+ * 每页减少一个映射计数并放掉一个引用，共享的页在最后一个引用释放时才回到伙伴系统
+ * 物理页在TLB刷新之后释放
+ *
+ * @param mm   地址空间
+ * @param virt 起始虚拟地址
+ * @param size 大小(字节)
+ *
+ * @return 成功：true
+ * @return 参数没有对齐或者拆分大页时页表分配失败：false
+ */
+bool vmm_free_pages(mm_t *mm, uint64_t virt, uint64_t size);
+
+/**
+ * 修改一段映射的属性
+ * 范围内没有映射的部分跳过
+ *
+ * @param mm   地址空间
+ * @param virt 起始虚拟地址
+ * @param size 大小(字节)
+ * @param prot VM_*
+ *
+ * @return 成功：true
+ * @return 参数没有对齐或者拆分大页时页表分配失败：false
+ */
+bool vmm_protect(mm_t *mm, uint64_t virt, uint64_t size, uint32_t prot);
+
+/**
+ * 把一段映射只读地共享到另一个地址空间，用于写时复制
+ * 源中可写的页改成只读，目标中建立相同页的只读映射
+ * 每个共享的页增加一个引用和一个映射计数，取消映射时由vmm_free_pages放掉
+ * 范围内只能有vmm_map_absent映射的页，大页先在源中拆成4KB页
+ * 失败时已经共享的部分保留，调用者用vmm_free_pages撤销目标中的映射
+ *
+ * @param src      源地址空间
+ * @param src_virt 源起始虚拟地址
+ * @param dst      目标地址空间，可以和src相同
+ * @param dst_virt 目标起始虚拟地址，目标范围中不能已经有映射
+ * @param size     大小(字节)
+ *
+ * @return 成功：true
+ * @return 参数没有对齐、两段范围重叠、目标已有映射或者页表分配失败：false
+ */
+bool vmm_share_pages(mm_t *src, uint64_t src_virt, mm_t *dst, uint64_t dst_virt, uint64_t size);
+
+/**
+ * 把映射old_phys的只读4KB页换成new_phys
+ * 写时复制的最后一步，old_phys和new_phys相同时只是恢复写权限
+ * 返回时TLB已经刷新，调用者可以释放旧页
+ *
+ * @param mm       地址空间
+ * @param virt     虚拟地址
+ * @param old_phys 期望的当前物理地址
+ * @param new_phys 新的物理地址
+ * @param prot     新映射的VM_*
+ *
+ * @return 成功：true
+ * @return 当前不是映射old_phys的只读4KB页：false，其他核心已经处理过
+ */
+bool vmm_replace_page(mm_t *mm, uint64_t virt, uint64_t old_phys, uint64_t new_phys, uint32_t prot);
+
+/**
+ * 查询虚拟地址的映射
+ *
+ * @param mm        地址空间
+ * @param virt      虚拟地址
+ * @param phys      返回对应的物理地址，可以为NULL
+ * @param page_size 返回所在页的大小，可以为NULL
+ * @param prot      返回映射属性，可以为NULL
+ *
+ * @return 有映射：true
+ */
+bool vmm_translate(mm_t *mm, uint64_t virt, uint64_t *phys, uint64_t *page_size, uint32_t *prot);
+
+/**
+ * 查询一个页大小的范围是否完全没有映射，也没有下级页表
+ * 用于缺页时判断能不能直接映射大页
+ *
+ * @param mm   地址空间
+ * @param virt 虚拟地址，按size对齐
+ * @param size 4KB、2MB或1GB
+ *
+ * @return 对应级别的表项为空，或者上级就没有页表：true
+ */
+bool vmm_slot_empty(mm_t *mm, uint64_t virt, uint64_t size);
+
+/**
+ * 把一个2MB区域中的512个4KB页合并成一个2MB页
+ * 只有512页都由vmm_map_absent映射并且没有被共享时才合并
+ * 内容复制到新分配的order 9块中，旧页和页表在TLB刷新后释放
+ * 调用者持有mm->vma_lock的写锁，复制期间缺页处理等待
+ *
+ * @param mm   地址空间
+ * @param virt 区域起始地址，按2MB对齐
+ * @param prot 大页的VM_*
+ *
+ * @return 已经合并：true
+ * @return 区域没有填满、有共享的页或者分配失败：false
+ */
+bool vmm_collapse(mm_t *mm, uint64_t virt, uint32_t prot);
+
+/**
+ * 把一段范围中映射在物理范围[pfn, pfn + pages)内的页换到其他物理页
+ * 压缩时调用，只迁移vmm_map_absent映射的、没有被共享的4KB页
+ * 新页按可移动类型分配，内容复制过去，叶子的属性不变，旧页在TLB刷新后释放
+ * 调用者持有mm->vma_lock的写锁，复制期间缺页处理等待
+ *
+ * @param mm    地址空间
+ * @param virt  起始虚拟地址
+ * @param size  大小(字节)
+ * @param pfn   要腾空的起始页帧号
+ * @param pages 要腾空的页数
+ *
+ * @return 迁移的页数，新页分配失败时提前结束
+ */
+uint64_t vmm_migrate_pages(mm_t *mm, uint64_t virt, uint64_t size, uint64_t pfn, uint64_t pages);
+
+/**
+ * 地址空间中缺页分配的页使用的迁移类型
+ * 缺页处理和合并大页都按它分配
+ *
+ * @param mm 地址空间，NULL表示内核地址空间
+ *
+ * @return 用户地址空间：MIGRATE_MOVABLE
+ * @return 内核地址空间：MIGRATE_UNMOVABLE
+ */
+uint8_t vmm_migrate_type(mm_t *mm);
+
+#endif // VMM_H
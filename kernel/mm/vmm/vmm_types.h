@@ -4,5 +4,40 @@
 #define VMM_TYPES_H
 
 #include <stdint.h>
+#include <spinlock.h>
+#include <cpu/cpumask.h>
+
+/*
+ * 虚拟内存区域[start, end)
+ * 区域内的页在第一次访问时分配
+ * 按start排序存放在地址空间的AVL树中
+ */
+typedef struct vm_area {
+    uintptr_t start;            // 虚拟起始地址
+    uintptr_t end;              // 虚拟结束地址
+    uint32_t flags;             // VM_*
+    int32_t height;             // 子树高度，叶子为1
+    struct vm_area *left;
+    struct vm_area *right;
+} vm_area_t;
+
+/*
+ * 地址空间
+ * cpus是当前加载着这个地址空间的核心
+ * 切换走的核心会把自己移出，TLB shootdown只需要通知cpus中的核心
+ *
+ * lock保护页表的修改
+ * vma_lock保护VMA树，缺页处理持有读锁，增删区域持有写锁
+ * 两个锁都要持有时先取vma_lock
+ * 共享页时同时持有两个地址空间的lock，按mm_t的地址顺序获取
+ */
+typedef struct mm {
+    uint64_t pgd;               // PML4的物理地址
+    cpumask_t cpus;
+    spinlock_t lock;
+    rwlock_t vma_lock;
+    vm_area_t *vma_root;
+    struct mm *next;            // 所有地址空间的链表，后台合并大页时遍历
+} mm_t;
 
 #endif // VMM_TYPES_H
\ No newline at end of file
@@ -0,0 +1,230 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <io.h>
+#include <serial.h>
+#include <printk.h>
+#include <cpu/cpu.h>
+
+/*
+ * 日志环形缓冲区
+ *
+ * 写者用fetch_add取得位置，写满后覆盖最旧的记录，从不等待
+ * 读者只有一个，按位置读取，seq不等于位置加1说明记录还没写完或已被覆盖
+ * 读者落后超过一圈时跳过被覆盖的部分并计数
+ */
+static log_record_t log_ring[LOG_RING_SIZE];
+static uint64_t log_head = 0;       // 下一个写入的位置
+static uint64_t log_tail = 0;       // 下一个输出的位置
+static uint64_t log_dropped = 0;
+static uint32_t log_draining = 0;
+
+void log_write(uint8_t level, const char *fmt, uint32_t nargs, const uint64_t *args) {
+    uint64_t pos = __atomic_fetch_add(&log_head, 1, __ATOMIC_RELAXED);
+    log_record_t *record = &log_ring[pos % LOG_RING_SIZE];
+
+    // 先作废旧记录，读者不会把写了一半的记录当成旧记录
+    __atomic_store_n(&record->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    record->tsc = rdtsc();
+    record->fmt = fmt;
+    record->level = level;
+    record->nargs = nargs;
+    record->cpu = cpu_id();
+
+    for (uint32_t i = 0; i < nargs; i++) {
+        record->args[i] = args[i];
+    }
+
+    __atomic_store_n(&record->seq, pos + 1, __ATOMIC_RELEASE);
+
+    if (level <= LOG_WARN) {
+        log_drain();
+    }
+}
+
+/*
+ * 读取pos处的记录
+ * 返回false表示还没写完或已被覆盖
+ */
+static bool log_read(uint64_t pos, log_record_t *out) {
+    log_record_t *record = &log_ring[pos % LOG_RING_SIZE];
+
+    if (__atomic_load_n(&record->seq, __ATOMIC_ACQUIRE) != pos + 1) {
+        return false;
+    }
+
+    *out = *record;
+
+    // 复制期间被覆盖时seq会改变
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&record->seq, __ATOMIC_RELAXED) == pos + 1;
+}
+
+typedef struct {
+    char *buf;
+    uint32_t len;
+} log_line_t;
+
+static void line_putc(log_line_t *line, char c) {
+    if (line->len < LOG_LINE_MAX - 1) {
+        line->buf[line->len++] = c;
+    }
+}
+
+static void line_puts(log_line_t *line, const char *s) {
+    if (s == NULL) {
+        s = "(null)";
+    }
+    while (*s) {
+        line_putc(line, *s++);
+    }
+}
+
+static void line_putu(log_line_t *line, uint64_t value, uint32_t base, bool upper) {
+    const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char tmp[24];
+    int n = 0;
+
+    do {
+        tmp[n++] = digits[value % base];
+        value /= base;
+    } while (value != 0);
+
+    while (n > 0) {
+        line_putc(line, tmp[--n]);
+    }
+}
+
+// 按格式字符串格式化一条记录
+static void log_format(const log_record_t *record, log_line_t *line) {
+    const char *p = record->fmt;
+    uint32_t arg = 0;
+
+    while (*p) {
+        if (*p != '%') {
+            line_putc(line, *p++);
+            continue;
+        }
+
+        p++;
+
+        uint32_t longs = 0;
+        while (*p == 'l') {
+            longs++;
+            p++;
+        }
+
+        if (*p == '%') {
+            line_putc(line, '%');
+            p++;
+            continue;
+        }
+
+        if (*p == '\0') {
+            break;
+        }
+
+        uint64_t value = arg < record->nargs ? record->args[arg] : 0;
+        arg++;
+
+        switch (*p) {
+        case 'd':
+        case 'i': {
+            int64_t v = longs ? (int64_t)value : (int64_t)(int32_t)value;
+            if (v < 0) {
+                line_putc(line, '-');
+                line_putu(line, (uint64_t)-v, 10, false);
+            } else {
+                line_putu(line, (uint64_t)v, 10, false);
+            }
+            break;
+        }
+        case 'u':
+            line_putu(line, longs ? value : (uint32_t)value, 10, false);
+            break;
+        case 'x':
+        case 'X':
+            line_putu(line, longs ? value : (uint32_t)value, 16, *p == 'X');
+            break;
+        case 'p':
+            line_puts(line, "0x");
+            line_putu(line, value, 16, false);
+            break;
+        case 's':
+            line_puts(line, (const char *)value);
+            break;
+        case 'c':
+            line_putc(line, (char)value);
+            break;
+        default:
+            line_putc(line, '%');
+            line_putc(line, *p);
+            break;
+        }
+
+        p++;
+    }
+
+    line->buf[line->len] = '\0';
+}
+
+static void log_output(void) {
+    char buf[LOG_LINE_MAX];
+    log_record_t record;
+
+    while (1) {
+        uint64_t tail = log_tail;
+        uint64_t head = __atomic_load_n(&log_head, __ATOMIC_ACQUIRE);
+
+        if (tail == head) {
+            break;
+        }
+
+        // 落后超过一圈，最旧的记录已被覆盖
+        if (head - tail > LOG_RING_SIZE) {
+            log_dropped += head - tail - LOG_RING_SIZE;
+            log_tail = head - LOG_RING_SIZE;
+            continue;
+        }
+
+        if (!log_read(tail, &record)) {
+            // 写者还没写完，下次再输出
+            if (__atomic_load_n(&log_head, __ATOMIC_RELAXED) - tail <= LOG_RING_SIZE) {
+                break;
+            }
+            continue;
+        }
+
+        log_tail = tail + 1;
+
+        if (log_dropped != 0) {
+            serial_puts("[LOG] ");
+            serial_put_dec(log_dropped);
+            serial_puts(" records dropped\n");
+            log_dropped = 0;
+        }
+
+        log_line_t line = { buf, 0 };
+        log_format(&record, &line);
+        serial_puts(buf);
+    }
+}
+
+void log_drain(void) {
+    if (__atomic_exchange_n(&log_draining, 1, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    log_output();
+
+    __atomic_store_n(&log_draining, 0, __ATOMIC_RELEASE);
+}
+
+void log_panic_drain(void) {
+    __atomic_store_n(&log_draining, 1, __ATOMIC_RELEASE);
+    log_output();
+}
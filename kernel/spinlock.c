@@ -0,0 +1,211 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <stdint.h>
+#include <spinlock.h>
+#include <cpu/cpu.h>
+
+#if SPINLOCK_TYPE == SPINLOCK_QUEUED
+
+/*
+ * 每个核心的队列节点
+ * depth是当前正在排队的层数
+ * 只由所属核心访问
+ */
+typedef struct {
+    spin_qnode_t nodes[SPIN_QNODES];
+    uint32_t depth;
+} __attribute__((aligned(64))) spin_qnode_cpu_t;
+
+static spin_qnode_cpu_t spin_qnodes[MAX_CPUS];
+
+// 没有可用节点时退化为直接争抢locked
+static void spin_lock_unqueued(raw_spinlock_t *lock) {
+    uint32_t expected = 0;
+
+    while (__atomic_load_n(&lock->locked, __ATOMIC_RELAXED) != 0 ||
+           !__atomic_compare_exchange_n(&lock->locked, &expected, 1, false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        expected = 0;
+        cpu_relax();
+    }
+}
+
+/*
+ * 队列锁慢速路径
+ *
+ * 1. 把本核心的节点放到队尾
+ * 2. 有前驱就在自己的节点上等前驱叫醒
+ * 3. 成为队首后等待locked被释放并获取
+ * 4. 把队首交给后继，如果没有后继就清空队列
+ */
+void raw_spin_lock_slowpath(raw_spinlock_t *lock) {
+    uint32_t cpu = cpu_id();
+
+    if (cpu >= MAX_CPUS || spin_qnodes[cpu].depth >= SPIN_QNODES) {
+        spin_lock_unqueued(lock);
+        return;
+    }
+
+    spin_qnode_cpu_t *qcpu = &spin_qnodes[cpu];
+    spin_qnode_t *node = &qcpu->nodes[qcpu->depth++];
+
+    node->next = NULL;
+    node->wait = 1;
+
+    spin_qnode_t *prev = __atomic_exchange_n(&lock->tail, node, __ATOMIC_ACQ_REL);
+
+    if (prev != NULL) {
+        __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+
+        while (__atomic_load_n(&node->wait, __ATOMIC_ACQUIRE)) {
+            cpu_relax();
+        }
+    }
+
+    // 已经是队首，只有队首会争抢locked
+    spin_lock_unqueued(lock);
+
+    spin_qnode_t *next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+
+    if (next == NULL) {
+        spin_qnode_t *expected = node;
+
+        if (__atomic_compare_exchange_n(&lock->tail, &expected, NULL, false,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            qcpu->depth--;
+            return;
+        }
+
+        // 有新节点正在入队，等它链接上
+        while ((next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)) == NULL) {
+            cpu_relax();
+        }
+    }
+
+    __atomic_store_n(&next->wait, 0, __ATOMIC_RELEASE);
+    qcpu->depth--;
+}
+
+#endif
+
+#if LOCK_STAT
+
+#include <serial.h>
+
+// 最多统计的锁数
+#define LOCK_STAT_MAX 256
+
+static lock_stat_t lock_stats[LOCK_STAT_MAX];
+static uint32_t lock_stat_used = 0;
+static uint64_t lock_stat_overflow = 0;     // 没有统计槽的获取次数
+
+/*
+ * 记录一次获取
+ * 调用时已经持有锁，统计槽只会被锁的持有者修改
+ * 第一次获取时分配统计槽
+ */
+void lock_stat_record(spinlock_t *lock, uint64_t wait, const char *file, int line) {
+    lock_stat_t *stat = lock->stat;
+
+    if (stat == NULL) {
+        uint32_t index = __atomic_fetch_add(&lock_stat_used, 1, __ATOMIC_RELAXED);
+
+        if (index >= LOCK_STAT_MAX) {
+            __atomic_fetch_add(&lock_stat_overflow, 1, __ATOMIC_RELAXED);
+            return;
+        }
+
+        stat = &lock_stats[index];
+        stat->file = file;
+        stat->line = line;
+        lock->stat = stat;
+    }
+
+    stat->acquisitions++;
+
+    if (wait == 0) {
+        return;
+    }
+
+    stat->contended++;
+    stat->wait_cycles += wait;
+
+    if (wait > stat->max_wait_cycles) {
+        stat->max_wait_cycles = wait;
+        stat->max_file = file;
+        stat->max_line = line;
+    }
+}
+
+/*
+ * 输出所有锁的统计
+ * 每个锁一行，字段用空格分隔，方便在主机上处理
+ * [LOCKSTAT] 位置 获取次数 竞争次数 总等待周期 最大等待周期 最大等待位置
+ */
+void lock_stat_dump(void) {
+    uint32_t used = __atomic_load_n(&lock_stat_used, __ATOMIC_RELAXED);
+
+    if (used > LOCK_STAT_MAX) {
+        used = LOCK_STAT_MAX;
+    }
+
+    serial_puts("[LOCKSTAT] site acquisitions contended wait_cycles max_wait_cycles max_site\n");
+
+    for (uint32_t i = 0; i < used; i++) {
+        lock_stat_t *stat = &lock_stats[i];
+
+        serial_puts("[LOCKSTAT] ");
+        serial_puts(stat->file);
+        serial_puts(":");
+        serial_put_dec(stat->line);
+        serial_puts(" ");
+        serial_put_dec(stat->acquisitions);
+        serial_puts(" ");
+        serial_put_dec(stat->contended);
+        serial_puts(" ");
+        serial_put_dec(stat->wait_cycles);
+        serial_puts(" ");
+        serial_put_dec(stat->max_wait_cycles);
+        serial_puts(" ");
+        if (stat->max_file != NULL) {
+            serial_puts(stat->max_file);
+            serial_puts(":");
+            serial_put_dec(stat->max_line);
+        } else {
+            serial_puts("-");
+        }
+        serial_puts("\n");
+    }
+
+    if (lock_stat_overflow != 0) {
+        serial_puts("[LOCKSTAT] untracked acquisitions: ");
+        serial_put_dec(lock_stat_overflow);
+        serial_puts("\n");
+    }
+}
+
+/*
+ * 清零统计
+ * 锁和统计槽的对应关系保留
+ * 其他核心可能同时在更新，结果只是近似值
+ */
+void lock_stat_reset(void) {
+    uint32_t used = __atomic_load_n(&lock_stat_used, __ATOMIC_RELAXED);
+
+    if (used > LOCK_STAT_MAX) {
+        used = LOCK_STAT_MAX;
+    }
+
+    for (uint32_t i = 0; i < used; i++) {
+        lock_stats[i].acquisitions = 0;
+        lock_stats[i].contended = 0;
+        lock_stats[i].wait_cycles = 0;
+        lock_stats[i].max_wait_cycles = 0;
+        lock_stats[i].max_file = NULL;
+        lock_stats[i].max_line = 0;
+    }
+
+    lock_stat_overflow = 0;
+}
+
+#endif
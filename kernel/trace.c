@@ -0,0 +1,143 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <trace.h>
+
+#if TRACE
+
+#include <io.h>
+#include <serial.h>
+#include <printk.h>
+#include <cpu/cpu.h>
+#include <cpu/idt.h>
+#include <mm/bootmem/linear_map.h>
+#include <mm/pmm/pmm.h>
+#include <mm/heap.h>
+
+/*
+ * 每个核心的环形缓冲区
+ * 只有本核心写入，关中断即可互斥
+ * head只增不减，head - TRACE_RING_SIZE之前的记录已被覆盖
+ */
+typedef struct {
+    trace_record_t *records;
+    uint64_t head;
+} trace_ring_t;
+
+static DEFINE_PER_CPU(trace_ring_t, trace_ring);
+
+uint32_t trace_mask = 0;
+
+void __trace_event(uint8_t event, uint64_t pfn, uint32_t arg, uint8_t order, uint8_t zone) {
+    trace_ring_t *ring = this_cpu_ptr(&trace_ring);
+
+    // 缓冲区分配之前的事件直接丢弃
+    if (ring->records == NULL) {
+        return;
+    }
+
+    uint64_t flags = interrupts_save();
+
+    trace_record_t *record = &ring->records[ring->head & (TRACE_RING_SIZE - 1)];
+    record->tsc = rdtsc();
+    record->pfn = pfn;
+    record->arg = arg;
+    record->event = event;
+    record->order = order;
+    record->zone = zone;
+    record->reserved = 0;
+
+    ring->head++;
+
+    interrupts_restore(flags);
+}
+
+void trace_init(void) {
+    uint64_t size = (uint64_t)TRACE_RING_SIZE * sizeof(trace_record_t);
+    uint32_t count = percpu_count();
+
+    for (uint32_t cpu = 0; cpu < count; cpu++) {
+        uint64_t pfn = kheap_alloc(size);
+
+        if (pfn == 0) {
+            pr_warn("[TRACE] WARNING: No buffer for core %u\n", cpu);
+            continue;
+        }
+
+        trace_ring_t *ring = per_cpu_ptr(&trace_ring, cpu);
+        ring->records = (trace_record_t *)PHYS_TO_LINEAR(pfn << PAGE_SHIFT);
+        ring->head = 0;
+    }
+
+    trace_set_mask(TRACE_ALL);
+
+    pr_info("[TRACE] %u records per core\n", TRACE_RING_SIZE);
+}
+
+void trace_set_mask(uint32_t mask) {
+    __atomic_store_n(&trace_mask, mask & TRACE_ALL, __ATOMIC_RELEASE);
+}
+
+// 输出一个核心缓冲区中seq开始的count条记录
+static void trace_dump_frame(uint32_t cpu, trace_ring_t *ring, uint64_t seq, uint32_t count) {
+    trace_frame_t frame = {
+        .magic = TRACE_MAGIC,
+        .version = TRACE_VERSION,
+        .record_size = sizeof(trace_record_t),
+        .cpu = (uint16_t)cpu,
+        .count = count,
+        .reserved = 0,
+        .seq = seq,
+    };
+
+    serial_write(&frame, sizeof(frame));
+
+    // 环形缓冲区回绕时分两段输出
+    uint64_t start = seq & (TRACE_RING_SIZE - 1);
+    uint32_t first = count;
+
+    if (start + count > TRACE_RING_SIZE) {
+        first = (uint32_t)(TRACE_RING_SIZE - start);
+    }
+
+    serial_write(&ring->records[start], first * sizeof(trace_record_t));
+
+    if (first < count) {
+        serial_write(&ring->records[0], (count - first) * sizeof(trace_record_t));
+    }
+}
+
+/*
+ * 每个核心的记录从旧到新分帧输出
+ * 其他核心在输出期间可能刚好写完最后一条记录，不影响已经复制的部分
+ */
+void trace_dump(void) {
+    uint32_t mask = __atomic_exchange_n(&trace_mask, 0, __ATOMIC_ACQ_REL);
+
+    // 先输出积累的日志，避免和二进制帧混在一起
+    log_drain();
+
+    for (uint32_t cpu = 0; cpu < percpu_count(); cpu++) {
+        trace_ring_t *ring = per_cpu_ptr(&trace_ring, cpu);
+
+        if (ring->records == NULL) {
+            continue;
+        }
+
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t seq = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+
+        while (seq < head) {
+            uint32_t count = head - seq > TRACE_FRAME_RECORDS ? TRACE_FRAME_RECORDS : (uint32_t)(head - seq);
+            trace_dump_frame(cpu, ring, seq, count);
+            seq += count;
+        }
+    }
+
+    serial_flush();
+
+    trace_set_mask(mask);
+}
+
+#endif
@@ -0,0 +1,294 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <mm/pmm/pmm.h>
+#include <mm/pmm/buddy.h>
+#include <cpu/cpu.h>
+#include <printk.h>
+#include "host.h"
+
+static uint64_t memory_mb = 1024;
+static uint32_t max_threads = 4;
+static uint64_t iterations = 100000;
+
+/*
+ * 每个order的分配和释放延迟
+ * 一次分配batch个块再全部释放，分别计时，per-CPU缓存的填充和回收也算在内
+ */
+static void bench_latency(void) {
+    enum { BATCH = 512 };
+    uint64_t pfns[BATCH];
+
+    printf("\nlatency (ns per operation, zone DMA32)\n");
+    printf("%-6s %10s %10s\n", "order", "alloc", "free");
+
+    for (uint8_t order = 0; order < MAX_ORDER; order++) {
+        uint64_t rounds = iterations / BATCH + 1;
+        uint64_t alloc_ns = 0, free_ns = 0, ops = 0;
+
+        for (uint64_t r = 0; r < rounds; r++) {
+            uint64_t n = 0;
+            uint64_t start = host_ns();
+
+            while (n < BATCH) {
+                uint64_t pfn = pmm_alloc_pages(order, ZONE_DMA32);
+                if (pfn == 0) {
+                    break;
+                }
+                pfns[n++] = pfn;
+            }
+
+            uint64_t mid = host_ns();
+
+            for (uint64_t i = 0; i < n; i++) {
+                pmm_free_pages(pfns[i]);
+            }
+
+            free_ns += host_ns() - mid;
+            alloc_ns += mid - start;
+            ops += n;
+        }
+
+        if (ops == 0) {
+            printf("%-6u %10s %10s\n", order, "-", "-");
+            continue;
+        }
+
+        printf("%-6u %10.1f %10.1f\n", order, (double)alloc_ns / ops, (double)free_ns / ops);
+    }
+
+    pmm_drain_local_pages();
+}
+
+typedef struct {
+    uint64_t pfn;
+    uint8_t order;
+} block_t;
+
+// 最大的空闲块order，没有空闲块返回-1
+static int largest_order(const zone_info_t *info) {
+    for (int order = MAX_ORDER - 1; order >= 0; order--) {
+        if (info->nr_free[order] != 0) {
+            return order;
+        }
+    }
+    return -1;
+}
+
+/*
+ * 随机负载下的碎片
+ * 活跃内存保持在zone的一半左右，每一步随机分配或释放
+ * 输出空闲内存中能组成order 9(2MB)以上块的比例
+ */
+static void bench_fragmentation(void) {
+    zone_info_t info;
+    pmm_zone_info(ZONE_DMA32, &info);
+
+    uint64_t target = info.free_pages / 2;
+    uint64_t capacity = target + 1024;
+    block_t *live = malloc(capacity * sizeof(block_t));
+    uint64_t nr_live = 0, live_pages = 0;
+    unsigned int seed = 42;
+
+    HOST_CHECK(live != NULL);
+
+    printf("\nfragmentation (zone DMA32, %llu free pages, live target %llu pages)\n",
+           (unsigned long long)info.free_pages, (unsigned long long)target);
+    printf("%-10s %12s %12s %8s %10s\n", "step", "live pages", "free pages", "largest", ">=2MB");
+
+    uint64_t steps = iterations * 10;
+    uint64_t report = steps / 10;
+
+    for (uint64_t step = 1; step <= steps; step++) {
+        bool do_alloc = nr_live == 0 ||
+                        (live_pages < target ? rand_r(&seed) % 100 < 60 : rand_r(&seed) % 100 < 40);
+
+        if (do_alloc && nr_live < capacity) {
+            uint8_t order = rand_r(&seed) % 100 < 85 ? rand_r(&seed) % 3 : rand_r(&seed) % MAX_ORDER;
+            uint64_t pfn = pmm_alloc_pages(order, ZONE_DMA32);
+
+            if (pfn != 0) {
+                live[nr_live++] = (block_t){ pfn, order };
+                live_pages += 1ULL << order;
+            }
+        } else if (nr_live > 0) {
+            uint64_t j = rand_r(&seed) % nr_live;
+            pmm_free_pages(live[j].pfn);
+            live_pages -= 1ULL << live[j].order;
+            live[j] = live[--nr_live];
+        }
+
+        if (step % report == 0) {
+            pmm_zone_info(ZONE_DMA32, &info);
+
+            uint64_t huge = 0;
+            for (uint8_t order = 9; order < MAX_ORDER; order++) {
+                huge += info.nr_free[order] << order;
+            }
+
+            printf("%-10llu %12llu %12llu %8d %9.1f%%\n",
+                   (unsigned long long)step, (unsigned long long)live_pages,
+                   (unsigned long long)info.free_pages, largest_order(&info),
+                   info.free_pages ? 100.0 * huge / info.free_pages : 0.0);
+        }
+    }
+
+    while (nr_live > 0) {
+        pmm_free_pages(live[--nr_live].pfn);
+    }
+
+    pmm_drain_local_pages();
+    free(live);
+}
+
+typedef struct {
+    pthread_t thread;
+    uint32_t cpu;
+    uint64_t ops;
+    uint64_t start_ns;
+    uint64_t end_ns;
+} worker_t;
+
+static pthread_barrier_t start_barrier;
+
+/*
+ * 每个线程保持一小组活跃块，随机分配释放
+ * 大部分请求落在per-CPU缓存能处理的order上
+ */
+static void *worker_main(void *arg) {
+    worker_t *worker = arg;
+    enum { LIVE = 64 };
+    block_t live[LIVE];
+    uint32_t nr_live = 0;
+    unsigned int seed = worker->cpu * 7919 + 1;
+
+    host_set_cpu(worker->cpu);
+    pthread_barrier_wait(&start_barrier);
+    worker->start_ns = host_ns();
+
+    for (uint64_t i = 0; i < iterations; i++) {
+        if (nr_live == LIVE || (nr_live > 0 && rand_r(&seed) % 2)) {
+            uint32_t j = rand_r(&seed) % nr_live;
+            pmm_free_pages(live[j].pfn);
+            live[j] = live[--nr_live];
+        } else {
+            uint8_t order = rand_r(&seed) % 100 < 90 ? rand_r(&seed) % 4 : rand_r(&seed) % 8;
+            uint64_t pfn = pmm_alloc_pages(order, ZONE_DMA32);
+
+            if (pfn != 0) {
+                live[nr_live++] = (block_t){ pfn, order };
+            }
+        }
+    }
+
+    while (nr_live > 0) {
+        pmm_free_pages(live[--nr_live].pfn);
+    }
+
+    pmm_drain_local_pages();
+    worker->end_ns = host_ns();
+    worker->ops = iterations;
+    return NULL;
+}
+
+static void bench_threads(void) {
+    worker_t *workers = calloc(max_threads, sizeof(worker_t));
+
+    HOST_CHECK(workers != NULL);
+
+    printf("\nthroughput (%llu operations per thread, zone DMA32)\n", (unsigned long long)iterations);
+    printf("%-8s %12s\n", "threads", "Mops/s");
+
+    uint32_t threads = 1;
+
+    while (1) {
+        pthread_barrier_init(&start_barrier, NULL, threads + 1);
+
+        for (uint32_t t = 0; t < threads; t++) {
+            workers[t].cpu = t;
+            HOST_CHECK(pthread_create(&workers[t].thread, NULL, worker_main, &workers[t]) == 0);
+        }
+
+        pthread_barrier_wait(&start_barrier);
+
+        // 从最早开始的线程到最晚结束的线程
+        uint64_t ops = 0, start = UINT64_MAX, end = 0;
+        for (uint32_t t = 0; t < threads; t++) {
+            pthread_join(workers[t].thread, NULL);
+            ops += workers[t].ops;
+            start = workers[t].start_ns < start ? workers[t].start_ns : start;
+            end = workers[t].end_ns > end ? workers[t].end_ns : end;
+        }
+
+        uint64_t elapsed = end - start;
+        pthread_barrier_destroy(&start_barrier);
+
+        printf("%-8u %12.2f\n", threads, elapsed ? ops * 1000.0 / elapsed : 0.0);
+
+        // 1、2、4……，最后一轮是max_threads
+        if (threads == max_threads) {
+            break;
+        }
+        threads = threads * 2 > max_threads ? max_threads : threads * 2;
+    }
+
+    free(workers);
+}
+
+static void usage(const char *name) {
+    printf("usage: %s [--memory MB] [--threads N] [--iterations N]\n", name);
+}
+
+int main(int argc, char **argv) {
+    static const struct option options[] = {
+        { "memory",     required_argument, NULL, 'm' },
+        { "threads",    required_argument, NULL, 't' },
+        { "iterations", required_argument, NULL, 'i' },
+        { "help",       no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "m:t:i:h", options, NULL)) != -1) {
+        switch (opt) {
+        case 'm':
+            memory_mb = strtoull(optarg, NULL, 0);
+            break;
+        case 't':
+            max_threads = strtoul(optarg, NULL, 0);
+            break;
+        case 'i':
+            iterations = strtoull(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (memory_mb < 64 || max_threads == 0 || max_threads > MAX_CPUS || iterations == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // 启动时的初始化和之后的延迟初始化分开计时
+    uint64_t start = host_ns();
+    host_pmm_init_boot(memory_mb * HOST_MB, max_threads);
+    uint64_t boot = host_ns();
+    pmm_init_late();
+    pmm_init_wait();
+    log_drain();
+    printf("pmm_init: %.2f ms boot, %.2f ms deferred for %llu MB\n",
+           (boot - start) / 1e6, (host_ns() - boot) / 1e6, (unsigned long long)memory_mb);
+
+    bench_latency();
+    bench_fragmentation();
+    bench_threads();
+
+    return 0;
+}
@@ -0,0 +1,446 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <mm/pmm/pmm.h>
+#include <mm/pmm/buddy.h>
+#include "host.h"
+
+#define TEST_MEMORY     (256 * HOST_MB)
+#define TEST_CPUS       4
+
+// 每页开头写入的标记，用来发现重叠分配
+#define STAMP(pfn, owner) (((uint64_t)(owner) << 40) ^ (pfn) ^ 0x5A5A000000000000ULL)
+
+static zone_info_t baseline[ZONE_NORMAL + 1];
+static uint64_t memory = TEST_MEMORY;
+
+static void snapshot(zone_info_t *info) {
+    for (uint8_t zone = ZONE_DMA; zone <= ZONE_NORMAL; zone++) {
+        pmm_zone_info(zone, &info[zone]);
+    }
+}
+
+/*
+ * 所有块释放并回收per-CPU缓存后
+ * 伙伴系统应该完全合并回初始化时的样子
+ */
+static void check_baseline(const char *name) {
+    zone_info_t now[ZONE_NORMAL + 1];
+
+    pmm_drain_local_pages();
+    snapshot(now);
+
+    for (uint8_t zone = ZONE_DMA; zone <= ZONE_NORMAL; zone++) {
+        if (now[zone].free_pages != baseline[zone].free_pages) {
+            fprintf(stderr, "%s: zone %u free pages %llu, expected %llu\n", name, zone,
+                    (unsigned long long)now[zone].free_pages,
+                    (unsigned long long)baseline[zone].free_pages);
+            exit(1);
+        }
+
+        for (uint8_t order = 0; order < MAX_ORDER; order++) {
+            if (now[zone].nr_free[order] != baseline[zone].nr_free[order]) {
+                fprintf(stderr, "%s: zone %u order %u has %llu blocks, expected %llu\n",
+                        name, zone, order,
+                        (unsigned long long)now[zone].nr_free[order],
+                        (unsigned long long)baseline[zone].nr_free[order]);
+                exit(1);
+            }
+        }
+    }
+}
+
+static void stamp_block(uint64_t pfn, uint8_t order, uint64_t owner) {
+    for (uint64_t i = 0; i < (1ULL << order); i++) {
+        uint64_t *page = host_page(pfn + i);
+        HOST_CHECK(page[0] != STAMP(pfn + i, owner));
+        page[0] = STAMP(pfn + i, owner);
+    }
+}
+
+static void unstamp_block(uint64_t pfn, uint8_t order, uint64_t owner) {
+    for (uint64_t i = 0; i < (1ULL << order); i++) {
+        uint64_t *page = host_page(pfn + i);
+        HOST_CHECK(page[0] == STAMP(pfn + i, owner));
+        page[0] = 0;
+    }
+}
+
+static void check_block(uint64_t pfn, uint8_t order, uint8_t zone) {
+    HOST_CHECK(pfn != 0);
+    HOST_CHECK((pfn & ((1ULL << order) - 1)) == 0);
+    HOST_CHECK(pfn >= baseline[zone].start_pfn);
+    HOST_CHECK(pfn + (1ULL << order) <= baseline[zone].end_pfn);
+    HOST_CHECK(pfn_to_block(pfn)->order == order);
+    HOST_CHECK(pmm_block_head(pfn + (1ULL << order) - 1) == pfn);
+    HOST_CHECK(pmm_block_head(pfn + ((1ULL << order) >> 1)) == pfn);
+}
+
+static bool has_normal(void) {
+    return baseline[ZONE_NORMAL].start_pfn < baseline[ZONE_NORMAL].end_pfn;
+}
+
+/*
+ * 初始化后的zone
+ * 每个order的空闲块加起来等于空闲页数
+ * host.c的内存映射中4GB以上全部空闲，NORMAL应该没有缺页
+ */
+static void test_init(void) {
+    for (uint8_t zone = ZONE_DMA; zone <= ZONE_NORMAL; zone++) {
+        uint64_t pages = 0;
+
+        for (uint8_t order = 0; order < MAX_ORDER; order++) {
+            pages += baseline[zone].nr_free[order] << order;
+        }
+
+        HOST_CHECK(pages == baseline[zone].free_pages);
+    }
+
+    if (has_normal()) {
+        HOST_CHECK(baseline[ZONE_NORMAL].free_pages ==
+                   baseline[ZONE_NORMAL].end_pfn - baseline[ZONE_NORMAL].start_pfn);
+
+        // PCI空洞的section没有mem_block
+        uint64_t hole_pfn = HOST_PCI_HOLE / PAGE_SIZE;
+        for (uint64_t pfn = hole_pfn; pfn < 4 * HOST_GB / PAGE_SIZE; pfn += PMM_SECTION_PAGES) {
+            HOST_CHECK(pfn_to_block(pfn) == NULL);
+        }
+        HOST_CHECK(pfn_to_block(hole_pfn - 1) != NULL);
+        HOST_CHECK(baseline[ZONE_DMA32].free_pages < hole_pfn);
+    }
+
+    // 最后一页之后没有mem_block
+    uint64_t end_pfn = has_normal() ? baseline[ZONE_NORMAL].end_pfn : baseline[ZONE_DMA32].end_pfn;
+    HOST_CHECK(pfn_to_block(end_pfn) == NULL);
+}
+
+static void test_invalid(void) {
+    HOST_CHECK(pmm_alloc_pages(MAX_ORDER, ZONE_DMA32) == 0);
+    HOST_CHECK(pmm_alloc_pages(0, ZONE_NORMAL + 1) == 0);
+    HOST_CHECK(pmm_alloc_pages_type(0, ZONE_DMA32, MIGRATE_ISOLATE) == 0);
+
+    // 4GB以下没有NORMAL zone
+    if (!has_normal()) {
+        HOST_CHECK(pmm_alloc_pages(0, ZONE_NORMAL) == 0);
+    }
+}
+
+static void test_each_order(void) {
+    uint8_t last = has_normal() ? ZONE_NORMAL : ZONE_DMA32;
+
+    for (uint8_t zone = ZONE_DMA; zone <= last; zone++) {
+        // 内存大时启动分配区会占满DMA
+        if (baseline[zone].free_pages == 0) {
+            continue;
+        }
+
+        for (uint8_t order = 0; order < MAX_ORDER; order++) {
+            uint64_t pfn = pmm_alloc_pages(order, zone);
+            check_block(pfn, order, zone);
+            stamp_block(pfn, order, 1);
+            unstamp_block(pfn, order, 1);
+            pmm_free_pages(pfn);
+        }
+    }
+
+    check_baseline("each_order");
+}
+
+// 分配到zone耗尽，数量必须等于空闲页数
+static void test_exhaust(void) {
+    uint64_t expected = baseline[ZONE_DMA].free_pages;
+    uint64_t *pfns = malloc(expected * sizeof(uint64_t));
+    uint64_t count = 0;
+
+    HOST_CHECK(pfns != NULL);
+
+    while (1) {
+        uint64_t pfn = pmm_alloc_pages(0, ZONE_DMA);
+        if (pfn == 0) {
+            break;
+        }
+        HOST_CHECK(count < expected);
+        check_block(pfn, 0, ZONE_DMA);
+        stamp_block(pfn, 0, 2);
+        pfns[count++] = pfn;
+    }
+
+    HOST_CHECK(count == expected);
+    HOST_CHECK(pmm_zone_free_pages(ZONE_DMA) == 0);
+
+    for (uint64_t i = 0; i < count; i++) {
+        unstamp_block(pfns[i], 0, 2);
+        pmm_free_pages(pfns[i]);
+    }
+
+    free(pfns);
+    check_baseline("exhaust");
+}
+
+typedef struct {
+    uint64_t pfn;
+    uint8_t order;
+    uint8_t zone;
+} block_t;
+
+// 小order为主的随机order，和内核中的分配分布接近
+static uint8_t random_order(unsigned int *seed) {
+    return rand_r(seed) % 100 < 80 ? rand_r(seed) % 4 : rand_r(seed) % MAX_ORDER;
+}
+
+static void shuffle(block_t *blocks, uint64_t count, unsigned int *seed) {
+    for (uint64_t i = count; i > 1; i--) {
+        uint64_t j = rand_r(seed) % i;
+        block_t tmp = blocks[i - 1];
+        blocks[i - 1] = blocks[j];
+        blocks[j] = tmp;
+    }
+}
+
+// 随机分配后乱序释放，检查没有重叠并且能完全合并
+static void test_random(void) {
+    enum { COUNT = 20000 };
+    block_t *blocks = malloc(COUNT * sizeof(block_t));
+    unsigned int seed = 1;
+
+    HOST_CHECK(blocks != NULL);
+
+    for (int round = 0; round < 3; round++) {
+        uint64_t count = 0, live_pages = 0;
+
+        for (uint64_t i = 0; i < COUNT; i++) {
+            uint8_t order = random_order(&seed);
+            uint8_t zone = rand_r(&seed) % 4 == 0 ? ZONE_DMA : ZONE_DMA32;
+
+            // 标记会写入每一页，内存大时限制写过的页数
+            if (live_pages + (1ULL << order) > TEST_MEMORY / PAGE_SIZE) {
+                continue;
+            }
+
+            uint64_t pfn = pmm_alloc_pages(order, zone);
+
+            if (pfn == 0) {
+                continue;
+            }
+
+            check_block(pfn, order, zone);
+            stamp_block(pfn, order, 3);
+            blocks[count++] = (block_t){ pfn, order, zone };
+            live_pages += 1ULL << order;
+        }
+
+        shuffle(blocks, count, &seed);
+
+        for (uint64_t i = 0; i < count; i++) {
+            unstamp_block(blocks[i].pfn, blocks[i].order, 3);
+            pmm_free_pages(blocks[i].pfn);
+        }
+
+        check_baseline("random");
+    }
+
+    free(blocks);
+}
+
+/*
+ * 多个线程同时分配释放
+ * 每个线程扮演一个核心，有自己的per-CPU页缓存
+ */
+static void *thread_main(void *arg) {
+    uint32_t cpu = (uint32_t)(uintptr_t)arg;
+    enum { LIVE = 256, OPS = 20000 };
+    block_t live[LIVE];
+    uint32_t nr_live = 0;
+    unsigned int seed = cpu + 100;
+
+    host_set_cpu(cpu);
+
+    for (uint32_t i = 0; i < OPS; i++) {
+        if (nr_live == LIVE || (nr_live > 0 && rand_r(&seed) % 2)) {
+            uint32_t j = rand_r(&seed) % nr_live;
+            unstamp_block(live[j].pfn, live[j].order, cpu + 10);
+            pmm_free_pages(live[j].pfn);
+            live[j] = live[--nr_live];
+            continue;
+        }
+
+        uint8_t order = rand_r(&seed) % 100 < 90 ? rand_r(&seed) % 4 : rand_r(&seed) % 8;
+        uint64_t pfn = pmm_alloc_pages(order, ZONE_DMA32);
+
+        if (pfn != 0) {
+            check_block(pfn, order, ZONE_DMA32);
+            stamp_block(pfn, order, cpu + 10);
+            live[nr_live++] = (block_t){ pfn, order, ZONE_DMA32 };
+        }
+    }
+
+    while (nr_live > 0) {
+        nr_live--;
+        unstamp_block(live[nr_live].pfn, live[nr_live].order, cpu + 10);
+        pmm_free_pages(live[nr_live].pfn);
+    }
+
+    // 线程退出后它的per-CPU缓存就找不到了
+    pmm_drain_local_pages();
+    return NULL;
+}
+
+static void test_threads(void) {
+    pthread_t threads[TEST_CPUS];
+
+    for (uint32_t cpu = 0; cpu < TEST_CPUS; cpu++) {
+        HOST_CHECK(pthread_create(&threads[cpu], NULL, thread_main, (void *)(uintptr_t)cpu) == 0);
+    }
+
+    for (uint32_t cpu = 0; cpu < TEST_CPUS; cpu++) {
+        pthread_join(threads[cpu], NULL);
+    }
+
+    check_baseline("threads");
+}
+
+/*
+ * 不可移动和可移动的分配交替进行
+ * 每种分配只落在自己类型的pageblock中，一种用完时整个pageblock转过来
+ */
+static void test_migrate_types(void) {
+    const uint64_t count = 4 * PAGEBLOCK_PAGES;
+    uint64_t *pfns = malloc(2 * count * sizeof(uint64_t));
+
+    HOST_CHECK(pfns != NULL);
+
+    for (uint64_t i = 0; i < 2 * count; i++) {
+        uint8_t migrate = i & 1 ? MIGRATE_MOVABLE : MIGRATE_UNMOVABLE;
+        uint64_t pfn = pmm_alloc_pages_type(0, ZONE_DMA32, migrate);
+
+        check_block(pfn, 0, ZONE_DMA32);
+        HOST_CHECK(pmm_pageblock_type(pfn) == migrate);
+        stamp_block(pfn, 0, 4);
+        pfns[i] = pfn;
+    }
+
+    for (uint64_t i = 0; i < 2 * count; i++) {
+        unstamp_block(pfns[i], 0, 4);
+        pmm_free_pages(pfns[i]);
+    }
+
+    free(pfns);
+    check_baseline("migrate_types");
+}
+
+typedef struct {
+    pthread_t thread;
+    uint32_t cpu;
+    uint8_t zone;
+    uint64_t count;
+    uint64_t *pfns;
+} grow_t;
+
+static void *grow_main(void *arg) {
+    grow_t *grow = arg;
+
+    host_set_cpu(grow->cpu);
+
+    while (1) {
+        uint64_t pfn = pmm_alloc_pages(MAX_ORDER - 1, grow->zone);
+        if (pfn == 0) {
+            break;
+        }
+        check_block(pfn, MAX_ORDER - 1, grow->zone);
+        grow->pfns[grow->count++] = pfn;
+    }
+
+    return NULL;
+}
+
+/*
+ * 只有每个zone的第一个区间在启动时初始化
+ * 多个线程同时用最大块耗尽zone，剩余区间由分配失败的线程初始化
+ * 之后pmm_init_wait不应该再找到没初始化的区间
+ */
+static void test_deferred(void) {
+    zone_info_t boot[ZONE_NORMAL + 1];
+    grow_t grows[TEST_CPUS];
+
+    // check_block用到baseline中的zone范围
+    snapshot(baseline);
+    snapshot(boot);
+
+    for (uint8_t zone = ZONE_DMA; zone <= ZONE_NORMAL; zone++) {
+        HOST_CHECK(boot[zone].free_pages <= PMM_SECTION_PAGES);
+
+        if (boot[zone].start_pfn >= boot[zone].end_pfn) {
+            continue;
+        }
+
+        uint64_t blocks = ((boot[zone].end_pfn - boot[zone].start_pfn) >> (MAX_ORDER - 1)) + 1;
+
+        for (uint32_t cpu = 0; cpu < TEST_CPUS; cpu++) {
+            grows[cpu] = (grow_t){ .cpu = cpu, .zone = zone, .pfns = malloc(blocks * sizeof(uint64_t)) };
+            HOST_CHECK(grows[cpu].pfns != NULL);
+            HOST_CHECK(pthread_create(&grows[cpu].thread, NULL, grow_main, &grows[cpu]) == 0);
+        }
+
+        uint64_t count = 0;
+        for (uint32_t cpu = 0; cpu < TEST_CPUS; cpu++) {
+            pthread_join(grows[cpu].thread, NULL);
+            count += grows[cpu].count;
+        }
+
+        pmm_init_wait();
+        pmm_zone_info(zone, &boot[zone]);
+        HOST_CHECK(boot[zone].nr_free[MAX_ORDER - 1] == 0);
+
+        // host.c的内存映射中4GB以上全部空闲
+        if (zone == ZONE_NORMAL) {
+            HOST_CHECK(count << (MAX_ORDER - 1) == boot[zone].end_pfn - boot[zone].start_pfn);
+        }
+
+        for (uint32_t cpu = 0; cpu < TEST_CPUS; cpu++) {
+            for (uint64_t i = 0; i < grows[cpu].count; i++) {
+                pmm_free_pages(grows[cpu].pfns[i]);
+            }
+            free(grows[cpu].pfns);
+        }
+    }
+
+    pmm_drain_local_pages();
+}
+
+/*
+ * 参数是物理内存大小(MB)，超过4096时测试NORMAL zone
+ * 第二个参数为deferred时先测试分配时的延迟初始化
+ */
+int main(int argc, char **argv) {
+    bool deferred = argc > 2 && strcmp(argv[2], "deferred") == 0;
+
+    if (argc > 1) {
+        memory = strtoull(argv[1], NULL, 0) * HOST_MB;
+    }
+
+    if (deferred) {
+        host_pmm_init_boot(memory, TEST_CPUS);
+        test_deferred();
+    } else {
+        host_pmm_init(memory, TEST_CPUS);
+    }
+
+    snapshot(baseline);
+
+    HOST_CHECK(host_free_pages() > 0);
+
+    test_init();
+    test_invalid();
+    test_each_order();
+    test_exhaust();
+    test_random();
+    test_threads();
+    test_migrate_types();
+
+    printf("buddy_test: OK\n");
+    return 0;
+}
@@ -0,0 +1,230 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <bootboot.h>
+#include <serial.h>
+#include <printk.h>
+#include <cpu/cpu.h>
+#include <cpu/smp.h>
+#include <mm/bootmem/boot_allot.h>
+#include <mm/pmm/pmm.h>
+#include <mm/pmm/buddy.h>
+#include <mm/tlb.h>
+#include "host.h"
+
+uint8_t host_bootboot[4096] __attribute__((aligned(4096)));
+uintptr_t host_arena = 0;
+
+__thread uint32_t host_cpu = 0;
+uint32_t host_cpus = 1;
+
+mm_t kernel_mm;
+uint64_t host_tlb_flushes = 0;
+
+// 启动分配区
+static uint64_t boot_next = 0;
+static uint64_t boot_end = 0;
+
+void serial_puts(const char* str) {
+    fputs(str, stdout);
+}
+
+void serial_put_hex(uint64_t value) {
+    printf("0x%016llX", (unsigned long long)value);
+}
+
+void serial_put_dec(uint64_t value) {
+    printf("%llu", (unsigned long long)value);
+}
+
+void panic(const char* msg) {
+    log_drain();
+    fputs(msg, stderr);
+    fflush(stdout);
+    abort();
+}
+
+void* boot_alloc(size_t pages) {
+    uint64_t size = pages * PAGE_SIZE;
+
+    if (boot_next + size > boot_end) {
+        return NULL;
+    }
+
+    void *addr = PHYS_TO_LINEAR(boot_next);
+    boot_next += size;
+    memset(addr, 0, size);
+
+    return addr;
+}
+
+void* boot_alloc_get_bitmap(void) {
+    return NULL;
+}
+
+typedef struct {
+    pthread_t thread;
+    uint32_t cpu;
+    smp_call_func_t func;
+    void *arg;
+} host_call_t;
+
+static void *call_main(void *arg) {
+    host_call_t *call = arg;
+
+    host_set_cpu(call->cpu);
+    call->func(call->arg);
+
+    // IPI返回后回到ap_main的空闲循环
+    while (pmm_init_work()) {
+    }
+    return NULL;
+}
+
+/*
+ * 每个核心一个线程，扮演收到IPI的核心
+ * 不等待时线程分离，调用者自己确认工作完成
+ */
+uint32_t smp_call_function(smp_call_func_t func, void *arg, bool wait) {
+    static host_call_t calls[MAX_CPUS];
+    uint32_t targets = 0;
+
+    for (uint32_t cpu = 0; cpu < host_cpus; cpu++) {
+        if (cpu == host_cpu) {
+            continue;
+        }
+
+        calls[cpu] = (host_call_t){ .cpu = cpu, .func = func, .arg = arg };
+        HOST_CHECK(pthread_create(&calls[cpu].thread, NULL, call_main, &calls[cpu]) == 0);
+        targets++;
+    }
+
+    for (uint32_t cpu = 0; cpu < host_cpus; cpu++) {
+        if (cpu == host_cpu) {
+            continue;
+        }
+
+        if (wait) {
+            pthread_join(calls[cpu].thread, NULL);
+        } else {
+            pthread_detach(calls[cpu].thread);
+        }
+    }
+
+    return targets;
+}
+
+/*
+ * 没有真正的TLB，只记录刷新
+ * 和内核一样累积页数，非空的批次刷新时计数
+ */
+void tlb_batch_init(tlb_batch_t *batch, mm_t *mm) {
+    batch->mm = mm != NULL ? mm : &kernel_mm;
+    batch->count = 0;
+    batch->pages = 0;
+    batch->full = false;
+}
+
+void tlb_batch_add(tlb_batch_t *batch, uint64_t addr, uint64_t pages) {
+    HOST_CHECK((addr & (PAGE_SIZE - 1)) == 0);
+    batch->pages += pages;
+    batch->count++;
+}
+
+void tlb_batch_flush(tlb_batch_t *batch) {
+    if (batch->count != 0) {
+        __atomic_fetch_add(&host_tlb_flushes, 1, __ATOMIC_RELAXED);
+    }
+
+    batch->count = 0;
+    batch->pages = 0;
+}
+
+static void mmap_add(MMapEnt *entry, uint64_t start, uint64_t end, uint32_t type) {
+    entry->ptr = start;
+    entry->size = (end - start) | type;
+}
+
+void host_pmm_init_boot(uint64_t size, uint32_t cpus) {
+    void *arena = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (arena == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+
+    host_arena = (uintptr_t)arena;
+    host_cpus = cpus;
+
+    // 启动分配区要放得下位图和mem_block以外的结构
+    boot_next = 1 * HOST_MB;
+    boot_end = boot_next + 4 * HOST_MB + size / 256;
+
+    uint64_t hole = 32 * HOST_MB;
+    if (hole < boot_end) {
+        hole = (boot_end + 2 * HOST_MB) & ~(HOST_MB - 1);
+    }
+
+    BOOTBOOT *bootboot = (BOOTBOOT *)BOOTBOOT_INFO;
+    MMapEnt *mmap_ent = &bootboot->mmap;
+    uint32_t n = 0;
+
+    memset(host_bootboot, 0, sizeof(host_bootboot));
+    memcpy(bootboot->magic, BOOTBOOT_MAGIC, 4);
+    bootboot->numcores = cpus;
+
+    mmap_add(&mmap_ent[n++], 0, 1 * HOST_MB, MMAP_USED);
+    mmap_add(&mmap_ent[n++], 1 * HOST_MB, boot_end, MMAP_USED);
+    mmap_add(&mmap_ent[n++], boot_end, hole, MMAP_FREE);
+    mmap_add(&mmap_ent[n++], hole, hole + 64 * 1024, MMAP_ACPI);
+    if (size > 4 * HOST_GB) {
+        mmap_add(&mmap_ent[n++], hole + 64 * 1024, HOST_PCI_HOLE, MMAP_FREE);
+        mmap_add(&mmap_ent[n++], HOST_PCI_HOLE, 4 * HOST_GB, MMAP_MMIO);
+        mmap_add(&mmap_ent[n++], 4 * HOST_GB, size, MMAP_FREE);
+    } else {
+        mmap_add(&mmap_ent[n++], hole + 64 * 1024, size, MMAP_FREE);
+    }
+
+    bootboot->size = 128 + n * sizeof(MMapEnt);
+
+    pmm_init();
+    log_drain();
+}
+
+void host_pmm_init(uint64_t size, uint32_t cpus) {
+    host_pmm_init_boot(size, cpus);
+    pmm_init_late();
+    pmm_init_wait();
+    log_drain();
+}
+
+void host_set_cpu(uint32_t cpu) {
+    host_cpu = cpu;
+}
+
+uint64_t host_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+uint64_t host_free_pages(void) {
+    uint64_t total = 0;
+
+    for (uint8_t zone = ZONE_DMA; zone <= ZONE_NORMAL; zone++) {
+        total += pmm_zone_free_pages(zone);
+    }
+
+    return total;
+}
+
+void *host_page(uint64_t pfn) {
+    return PHYS_TO_LINEAR(pfn << PAGE_SHIFT);
+}
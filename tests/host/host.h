@@ -0,0 +1,55 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef HOST_H
+#define HOST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define HOST_MB (1024ULL * 1024)
+#define HOST_GB (1024ULL * HOST_MB)
+
+#define HOST_PCI_HOLE (3 * HOST_GB)
+
+/**
+ * 建立假的物理内存并初始化伙伴系统
+ *
+ * @param size 物理内存大小(字节)，超过4GB时有NORMAL zone
+ * @param cpus 扮演的核心数，不超过MAX_CPUS
+ *
+ * 内存映射：0-1MB和1MB开始的启动分配区为已使用
+ * DMA32中间有一段64KB的空洞，模拟ACPI表
+ * 超过4GB时[HOST_PCI_HOLE, 4GB)是MMIO，模拟PCI空洞
+ * 和内核启动顺序相同，pmm_init之后其他线程执行pmm_init_late
+ * 返回前等待延迟初始化完成
+ */
+void host_pmm_init(uint64_t size, uint32_t cpus);
+
+// 只执行pmm_init，其余区间留给分配时初始化
+void host_pmm_init_boot(uint64_t size, uint32_t cpus);
+
+// 非空的TLB批次被刷新的次数
+extern uint64_t host_tlb_flushes;
+
+// 当前线程扮演的核心
+void host_set_cpu(uint32_t cpu);
+
+// 单调时钟(纳秒)
+uint64_t host_ns(void);
+
+// 所有zone伙伴系统中的空闲页数，不包括per-CPU页缓存
+uint64_t host_free_pages(void);
+
+// 物理页对应的host地址
+void *host_page(uint64_t pfn);
+
+#define HOST_CHECK(cond) do {                                                   \
+    if (!(cond)) {                                                              \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);\
+        exit(1);                                                                \
+    }                                                                           \
+} while (0)
+
+#endif // HOST_H
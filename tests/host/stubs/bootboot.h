@@ -0,0 +1,14 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef HOST_BOOTBOOT_H
+#define HOST_BOOTBOOT_H
+
+#include_next <bootboot.h>
+
+// BOOTBOOT信息结构由host.c填写
+extern uint8_t host_bootboot[];
+
+#undef BOOTBOOT_INFO
+#define BOOTBOOT_INFO ((uintptr_t)host_bootboot)
+
+#endif // HOST_BOOTBOOT_H
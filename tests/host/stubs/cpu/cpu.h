@@ -0,0 +1,32 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef _CPU_H
+#define _CPU_H
+
+#include <stdint.h>
+
+#define MAX_CPUS 507
+
+/*
+ * 每个线程扮演一个核心
+ * per-CPU变量是线程局部变量，host_cpu是线程扮演的核心编号
+ */
+#define DEFINE_PER_CPU(type, name)  __thread __typeof__(type) name
+#define DECLARE_PER_CPU(type, name) extern __thread __typeof__(type) name
+
+#define this_cpu_ptr(ptr)           (ptr)
+#define this_cpu_read(var)          (var)
+#define this_cpu_write(var, value)  ((var) = (value))
+
+extern __thread uint32_t host_cpu;
+extern uint32_t host_cpus;
+
+static inline uint32_t cpu_id(void) {
+    return host_cpu;
+}
+
+static inline uint32_t cpu_count(void) {
+    return host_cpus;
+}
+
+#endif // _CPU_H
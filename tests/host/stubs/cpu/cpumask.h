@@ -0,0 +1,8 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+/*
+ * 使用内核的cpumask.h
+ * 先引入桩cpu.h，内核cpumask.h中的"cpu.h"因为保护宏相同不再展开
+ */
+#include "cpu.h"
+#include_next <cpu/cpumask.h>
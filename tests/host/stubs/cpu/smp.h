@@ -0,0 +1,18 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef _SMP_H
+#define _SMP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "cpu.h"
+
+typedef void (*smp_call_func_t)(void *arg);
+
+/*
+ * 除当前线程扮演的核心外，每个核心启动一个线程执行func
+ * 实现在host.c
+ */
+uint32_t smp_call_function(smp_call_func_t func, void *arg, bool wait);
+
+#endif // _SMP_H
@@ -0,0 +1,29 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef IO_H
+#define IO_H
+
+#include <stdint.h>
+#include <sched.h>
+#include <x86intrin.h>
+
+static inline uint64_t rdtsc(void) {
+    return __rdtsc();
+}
+
+/*
+ * 线程数可能多于宿主机的核心数
+ * 持有锁或排在队列中的线程被调度出去时，一直自旋的线程会等满整个时间片
+ * 所以每自旋一段时间让出一次
+ */
+static inline void cpu_relax(void) {
+    static __thread uint32_t spins = 0;
+
+    if ((++spins & 63) == 0) {
+        sched_yield();
+    } else {
+        _mm_pause();
+    }
+}
+
+#endif // IO_H
@@ -0,0 +1,20 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef BOOT_ALLOC_H
+#define BOOT_ALLOC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mm/bootmem/linear_map.h>
+
+#define BOOT_ALLOC_BITMAP_SIZE  (32 * 1024)
+#define BOOT_ALLOC_MAX_PAGES    (1024 * 1024 * 1024 / 4096)
+
+/*
+ * 从内存映射中预留的一段区域顺序分配
+ * 没有早期位图，boot_alloc_get_bitmap返回NULL
+ */
+void* boot_alloc(size_t pages);
+void* boot_alloc_get_bitmap(void);
+
+#endif // BOOT_ALLOC_H
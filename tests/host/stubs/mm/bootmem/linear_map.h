@@ -0,0 +1,19 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef LINEAR_MAP_H
+#define LINEAR_MAP_H
+
+#include <stdint.h>
+
+/*
+ * 物理地址0对应host_arena
+ * host_arena是mmap得到的一块内存，扮演全部物理内存
+ */
+extern uintptr_t host_arena;
+
+#define LINEAR_MAP_START    host_arena
+
+#define PHYS_TO_LINEAR(phys) ((void*)((uintptr_t)(phys) + LINEAR_MAP_START))
+#define LINEAR_TO_PHYS(virt) ((uintptr_t)(virt) - LINEAR_MAP_START)
+
+#endif // LINEAR_MAP_H
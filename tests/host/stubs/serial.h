@@ -0,0 +1,16 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include <stdint.h>
+
+// 串口输出写到标准输出
+void serial_puts(const char* str);
+void serial_put_hex(uint64_t value);
+void serial_put_dec(uint64_t value);
+
+// 输出msg后abort
+void panic(const char* msg) __attribute__((noreturn));
+
+#endif // SERIAL_H
@@ -0,0 +1,1105 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <mm/bootmem/bootmem.h>
+#include <mm/bootmem/linear_map.h>
+#include <mm/pmm/pmm.h>
+#include <mm/pmm/buddy.h>
+#include <mm/tlb.h>
+#include <mm/slab/slab.h>
+#include <mm/vmm/vmm.h>
+#include <mm/vmm/vma.h>
+#include <mm/vmm/mm.h>
+#include <mm/compact.h>
+#include "host.h"
+
+#define TEST_MEMORY     (256 * HOST_MB)
+#define TEST_CPUS       4
+
+#define KB              1024ULL
+#define MB              HOST_MB
+#define GB              HOST_GB
+
+// 测试使用的虚拟地址，物理地址不需要真实存在，页表只检查不加载
+#define TEST_VIRT       0xffffc00000000000ULL
+#define TEST_PHYS       (64 * GB)
+
+// 随机测试的窗口，按4KB记录期望的映射
+#define MODEL_SIZE      (64 * MB)
+#define MODEL_PAGES     (MODEL_SIZE / PAGE_SIZE)
+#define MODEL_ROUNDS    400
+
+// VMA树测试的区域数
+#define TREE_AREAS      1000
+
+// 并发缺页测试的页数
+#define FAULT_PAGES     1024
+
+// 写时复制测试使用的用户地址
+#define USER_VIRT       0x0000100000000000ULL
+#define COW_PAGES       16
+
+static uint64_t baseline_free;
+
+static uint64_t rand64(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+// 地址空间中页表的数量，包括PML4
+static uint64_t count_tables(uint64_t table_phys, int level) {
+    uint64_t *table = PHYS_TO_LINEAR(table_phys);
+    uint64_t count = 1;
+
+    if (level == 0) {
+        return count;
+    }
+
+    for (uint32_t i = 0; i < PAGE_TABLE_ENTRIES; i++) {
+        if ((table[i] & PAGE_PRESENT) && !(table[i] & PAGE_SIZE_BIT)) {
+            count += count_tables(table[i] & PAGE_ADDR_MASK, level - 1);
+        }
+    }
+
+    return count;
+}
+
+static void mm_setup(mm_t *mm) {
+    uint64_t pfn = pmm_alloc_pages(0, ZONE_DMA32);
+    HOST_CHECK(pfn != 0);
+
+    uint64_t *pgd = host_page(pfn);
+    for (uint32_t i = 0; i < PAGE_TABLE_ENTRIES; i++) {
+        pgd[i] = 0;
+    }
+
+    mm->pgd = pfn * PAGE_SIZE;
+    cpumask_clear_all(&mm->cpus);
+    spinlock_init(&mm->lock);
+    rwlock_init(&mm->vma_lock);
+    mm->vma_root = NULL;
+}
+
+// 地址空间应该只剩PML4
+static void mm_cleanup(mm_t *mm, const char *name) {
+    uint64_t tables = count_tables(mm->pgd, 3);
+
+    if (tables != 1) {
+        fprintf(stderr, "%s: %llu page tables left\n", name, (unsigned long long)tables);
+        exit(1);
+    }
+
+    HOST_CHECK(mm->vma_root == NULL);
+    pmm_free_pages(mm->pgd / PAGE_SIZE);
+}
+
+// 释放后伙伴系统回到初始状态
+static void mm_teardown(mm_t *mm, const char *name) {
+    mm_cleanup(mm, name);
+    pmm_drain_local_pages();
+    HOST_CHECK(host_free_pages() == baseline_free);
+}
+
+// slab会留着页，VMA测试只比较前后的空闲页数
+static uint64_t free_pages_now(void) {
+    pmm_drain_local_pages();
+    return host_free_pages();
+}
+
+static void check_mapping(mm_t *mm, uint64_t virt, uint64_t phys, uint64_t page_size, uint32_t prot) {
+    uint64_t got_phys, got_size;
+    uint32_t got_prot;
+
+    if (!vmm_translate(mm, virt, &got_phys, &got_size, &got_prot) ||
+        got_phys != phys || got_size != page_size || got_prot != prot) {
+        fprintf(stderr, "0x%llx: expected phys 0x%llx size 0x%llx prot %u\n",
+                (unsigned long long)virt, (unsigned long long)phys,
+                (unsigned long long)page_size, prot);
+        exit(1);
+    }
+}
+
+static void check_unmapped(mm_t *mm, uint64_t virt) {
+    if (vmm_translate(mm, virt, NULL, NULL, NULL)) {
+        fprintf(stderr, "0x%llx: expected no mapping\n", (unsigned long long)virt);
+        exit(1);
+    }
+}
+
+// 按对齐选择页大小
+static void test_leaf_sizes(void) {
+    mm_t mm;
+    mm_setup(&mm);
+
+    uint64_t flushes = host_tlb_flushes;
+
+    // 1GB + 2MB + 12KB，每一段用能用的最大页
+    HOST_CHECK(vmm_map_pages(&mm, TEST_VIRT, TEST_PHYS, GB + 2 * MB + 12 * KB, VM_WRITE));
+    check_mapping(&mm, TEST_VIRT, TEST_PHYS, GB, VM_WRITE);
+    check_mapping(&mm, TEST_VIRT + GB - PAGE_SIZE, TEST_PHYS + GB - PAGE_SIZE, GB, VM_WRITE);
+    check_mapping(&mm, TEST_VIRT + GB, TEST_PHYS + GB, 2 * MB, VM_WRITE);
+    check_mapping(&mm, TEST_VIRT + GB + 2 * MB + 8 * KB, TEST_PHYS + GB + 2 * MB + 8 * KB,
+                  PAGE_SIZE, VM_WRITE);
+    check_unmapped(&mm, TEST_VIRT + GB + 2 * MB + 12 * KB);
+
+    // PML4、PDPT、PD、PT
+    HOST_CHECK(count_tables(mm.pgd, 3) == 4);
+
+    // 原来没有映射，不需要刷新
+    HOST_CHECK(host_tlb_flushes == flushes);
+    HOST_CHECK(vmm_unmap_pages(&mm, TEST_VIRT, GB + 2 * MB + 12 * KB));
+    HOST_CHECK(host_tlb_flushes == flushes + 1);
+
+    // 物理地址只有4KB对齐时全部用4KB页
+    HOST_CHECK(vmm_map_pages(&mm, TEST_VIRT, TEST_PHYS + PAGE_SIZE, 4 * MB, 0));
+    check_mapping(&mm, TEST_VIRT, TEST_PHYS + PAGE_SIZE, PAGE_SIZE, 0);
+    check_mapping(&mm, TEST_VIRT + 2 * MB, TEST_PHYS + 2 * MB + PAGE_SIZE, PAGE_SIZE, 0);
+    HOST_CHECK(vmm_unmap_pages(&mm, TEST_VIRT, 4 * MB));
+
+    // 虚拟地址和物理地址同样错开4KB时，中间对齐的部分仍然用2MB页
+    HOST_CHECK(vmm_map_pages(&mm, TEST_VIRT + PAGE_SIZE, TEST_PHYS + PAGE_SIZE, 4 * MB, VM_USER));
+    check_mapping(&mm, TEST_VIRT + PAGE_SIZE, TEST_PHYS + PAGE_SIZE, PAGE_SIZE, VM_USER);
+    check_mapping(&mm, TEST_VIRT + 2 * MB, TEST_PHYS + 2 * MB, 2 * MB, VM_USER);
+    check_mapping(&mm, TEST_VIRT + 4 * MB, TEST_PHYS + 4 * MB, PAGE_SIZE, VM_USER);
+    check_unmapped(&mm, TEST_VIRT + 4 * MB + PAGE_SIZE);
+    HOST_CHECK(vmm_unmap_pages(&mm, TEST_VIRT, 8 * MB));
+
+    mm_teardown(&mm, "leaf sizes");
+}
+
+// 部分修改大页时拆分，整段重新映射时合并
+static void test_split(void) {
+    mm_t mm;
+    mm_setup(&mm);
+
+    HOST_CHECK(vmm_map_pages(&mm, TEST_VIRT, TEST_PHYS, GB, VM_WRITE));
+
+    // 从1GB页中间取消一页，拆成2MB页和一个PT
+    uint64_t flushes = host_tlb_flushes;
+    uint64_t hole = TEST_VIRT + 5 * MB;
+
+    HOST_CHECK(vmm_unmap_pages(&mm, hole, PAGE_SIZE));
+    HOST_CHECK(host_tlb_flushes == flushes + 1);
+    check_unmapped(&mm, hole);
+    check_mapping(&mm, hole - PAGE_SIZE, TEST_PHYS + 5 * MB - PAGE_SIZE, PAGE_SIZE, VM_WRITE);
+    check_mapping(&mm, hole + PAGE_SIZE, TEST_PHYS + 5 * MB + PAGE_SIZE, PAGE_SIZE, VM_WRITE);
+    check_mapping(&mm, TEST_VIRT, TEST_PHYS, 2 * MB, VM_WRITE);
+    check_mapping(&mm, TEST_VIRT + GB - PAGE_SIZE, TEST_PHYS + GB - PAGE_SIZE, 2 * MB, VM_WRITE);
+    HOST_CHECK(count_tables(mm.pgd, 3) == 4);
+
+    // 修改属性也会拆分，范围外的页不变
+    HOST_CHECK(vmm_protect(&mm, TEST_VIRT + 8 * MB + PAGE_SIZE, 2 * MB, 0));
+    check_mapping(&mm, TEST_VIRT + 8 * MB, TEST_PHYS + 8 * MB, PAGE_SIZE, VM_WRITE);
+    check_mapping(&mm, TEST_VIRT + 8 * MB + PAGE_SIZE, TEST_PHYS + 8 * MB + PAGE_SIZE, PAGE_SIZE, 0);
+    check_mapping(&mm, TEST_VIRT + 10 * MB, TEST_PHYS + 10 * MB, PAGE_SIZE, 0);
+    check_mapping(&mm, TEST_VIRT + 10 * MB + PAGE_SIZE, TEST_PHYS + 10 * MB + PAGE_SIZE,
+                  PAGE_SIZE, VM_WRITE);
+    check_mapping(&mm, TEST_VIRT + 12 * MB, TEST_PHYS + 12 * MB, 2 * MB, VM_WRITE);
+
+    // 整个2MB修改属性时不拆分
+    HOST_CHECK(vmm_protect(&mm, TEST_VIRT + 12 * MB, 2 * MB, VM_NOCACHE));
+    check_mapping(&mm, TEST_VIRT + 12 * MB, TEST_PHYS + 12 * MB, 2 * MB, VM_NOCACHE);
+    HOST_CHECK(count_tables(mm.pgd, 3) == 6);
+
+    // 没有映射的部分跳过
+    HOST_CHECK(vmm_protect(&mm, hole, PAGE_SIZE, VM_WRITE));
+    check_unmapped(&mm, hole);
+
+    // 重新映射整个1GB，下面的页表全部释放
+    flushes = host_tlb_flushes;
+    HOST_CHECK(vmm_map_pages(&mm, TEST_VIRT, TEST_PHYS + GB, GB, VM_WRITE));
+    HOST_CHECK(host_tlb_flushes == flushes + 1);
+    check_mapping(&mm, hole, TEST_PHYS + GB + 5 * MB, GB, VM_WRITE);
+    HOST_CHECK(count_tables(mm.pgd, 3) == 2);
+
+    // PDPT空了也一起释放
+    HOST_CHECK(vmm_unmap_pages(&mm, TEST_VIRT, GB));
+    HOST_CHECK(count_tables(mm.pgd, 3) == 1);
+
+    // 部分取消映射后页表空了就释放
+    HOST_CHECK(vmm_map_pages(&mm, TEST_VIRT + GB, TEST_PHYS, 3 * PAGE_SIZE, VM_WRITE));
+    HOST_CHECK(count_tables(mm.pgd, 3) == 4);
+    HOST_CHECK(vmm_unmap_pages(&mm, TEST_VIRT + GB, PAGE_SIZE));
+    HOST_CHECK(vmm_unmap_pages(&mm, TEST_VIRT + GB + PAGE_SIZE, 2 * PAGE_SIZE));
+
+    mm_teardown(&mm, "split");
+}
+
+static void test_invalid(void) {
+    mm_t mm;
+    mm_setup(&mm);
+
+    HOST_CHECK(!vmm_map_pages(&mm, TEST_VIRT + 1, TEST_PHYS, PAGE_SIZE, 0));
+    HOST_CHECK(!vmm_map_pages(&mm, TEST_VIRT, TEST_PHYS + 1, PAGE_SIZE, 0));
+    HOST_CHECK(!vmm_map_pages(&mm, TEST_VIRT, TEST_PHYS, PAGE_SIZE + 1, 0));
+
+    // 非规范地址和跨过空洞的范围
+    HOST_CHECK(!vmm_map_pages(&mm, 0x0000800000000000ULL, TEST_PHYS, PAGE_SIZE, 0));
+    HOST_CHECK(!vmm_unmap_pages(&mm, 0x00007ffffffff000ULL, 2 * PAGE_SIZE));
+    HOST_CHECK(!vmm_protect(&mm, 0xfffffffffffff000ULL, 2 * PAGE_SIZE, 0));
+
+    HOST_CHECK(vmm_map_pages(&mm, TEST_VIRT, TEST_PHYS, 0, 0));
+    HOST_CHECK(count_tables(mm.pgd, 3) == 1);
+
+    // 用户地址空间的最后一页
+    HOST_CHECK(vmm_map_pages(&mm, 0x00007ffffffff000ULL, TEST_PHYS, PAGE_SIZE, VM_USER));
+    check_mapping(&mm, 0x00007ffffffff000ULL, TEST_PHYS, PAGE_SIZE, VM_USER);
+    HOST_CHECK(vmm_unmap_pages(&mm, 0x00007ffffffff000ULL, PAGE_SIZE));
+
+    mm_teardown(&mm, "invalid");
+}
+
+/*
+ * 随机的映射、取消映射和修改属性
+ * 每次操作后逐页和模型比较
+ */
+typedef struct {
+    uint64_t phys;              // 为0表示没有映射
+    uint32_t prot;
+} model_page_t;
+
+static model_page_t model[MODEL_PAGES];
+
+static void test_model(void) {
+    mm_t mm;
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+
+    mm_setup(&mm);
+
+    for (uint32_t round = 0; round < MODEL_ROUNDS; round++) {
+        // 一半的操作按2MB对齐，让大页和拆分都能出现
+        uint64_t unit = (rand64(&seed) & 1) ? 2 * MB : PAGE_SIZE;
+        uint64_t units = MODEL_SIZE / unit;
+        uint64_t first = rand64(&seed) % units;
+        uint64_t count = 1 + rand64(&seed) % (units - first < 8 ? units - first : 8);
+        uint64_t start = first * unit / PAGE_SIZE;
+        uint64_t pages = count * unit / PAGE_SIZE;
+        uint64_t virt = TEST_VIRT + start * PAGE_SIZE;
+        uint32_t prot = rand64(&seed) % 8;
+        uint64_t phys = TEST_PHYS + (rand64(&seed) % 64) * unit;
+
+        switch (rand64(&seed) % 3) {
+        case 0:
+            HOST_CHECK(vmm_map_pages(&mm, virt, phys, pages * PAGE_SIZE, prot));
+            for (uint64_t i = 0; i < pages; i++) {
+                model[start + i] = (model_page_t){ phys + i * PAGE_SIZE, prot };
+            }
+            break;
+        case 1:
+            HOST_CHECK(vmm_unmap_pages(&mm, virt, pages * PAGE_SIZE));
+            for (uint64_t i = 0; i < pages; i++) {
+                model[start + i].phys = 0;
+            }
+            break;
+        default:
+            HOST_CHECK(vmm_protect(&mm, virt, pages * PAGE_SIZE, prot));
+            for (uint64_t i = 0; i < pages; i++) {
+                model[start + i].prot = prot;
+            }
+            break;
+        }
+
+        for (uint64_t i = 0; i < MODEL_PAGES; i++) {
+            uint64_t got_phys;
+            uint32_t got_prot;
+            bool mapped = vmm_translate(&mm, TEST_VIRT + i * PAGE_SIZE, &got_phys, NULL, &got_prot);
+
+            if (mapped != (model[i].phys != 0) ||
+                (mapped && (got_phys != model[i].phys || got_prot != model[i].prot))) {
+                fprintf(stderr, "model: round %u page %llu mismatch\n",
+                        round, (unsigned long long)i);
+                exit(1);
+            }
+        }
+    }
+
+    HOST_CHECK(vmm_unmap_pages(&mm, TEST_VIRT, MODEL_SIZE));
+    mm_teardown(&mm, "model");
+}
+
+/*
+ * 多个核心同时修改同一个地址空间的不同范围
+ * 共用上面几级页表，页表的分配和释放由mm->lock保护
+ */
+typedef struct {
+    mm_t *mm;
+    uint32_t cpu;
+} worker_t;
+
+static void *concurrent_worker(void *arg) {
+    worker_t *worker = arg;
+    uint64_t base = TEST_VIRT + worker->cpu * 4 * MB;
+    uint64_t seed = 0x1234567ULL + worker->cpu;
+
+    host_set_cpu(worker->cpu);
+
+    for (uint32_t i = 0; i < 2000; i++) {
+        uint64_t offset = (rand64(&seed) % 512) * PAGE_SIZE;
+        uint64_t size = (1 + rand64(&seed) % 512) * PAGE_SIZE;
+        uint64_t phys = TEST_PHYS + worker->cpu * GB + offset;
+
+        HOST_CHECK(vmm_map_pages(worker->mm, base + offset, phys, size, VM_WRITE));
+        check_mapping(worker->mm, base + offset + size - PAGE_SIZE, phys + size - PAGE_SIZE,
+                      PAGE_SIZE, VM_WRITE);
+        HOST_CHECK(vmm_unmap_pages(worker->mm, base + offset, size));
+        check_unmapped(worker->mm, base + offset);
+    }
+
+    // 线程退出后它的per-CPU缓存就找不到了
+    pmm_drain_local_pages();
+    return NULL;
+}
+
+static void test_concurrent(void) {
+    mm_t mm;
+    pthread_t threads[TEST_CPUS];
+    worker_t workers[TEST_CPUS];
+
+    mm_setup(&mm);
+
+    for (uint32_t cpu = 0; cpu < TEST_CPUS; cpu++) {
+        workers[cpu] = (worker_t){ &mm, cpu };
+        HOST_CHECK(pthread_create(&threads[cpu], NULL, concurrent_worker, &workers[cpu]) == 0);
+    }
+
+    for (uint32_t cpu = 0; cpu < TEST_CPUS; cpu++) {
+        pthread_join(threads[cpu], NULL);
+    }
+
+    mm_teardown(&mm, "concurrent");
+}
+
+// 检查AVL树的顺序、区域不重叠和平衡，返回高度
+static int32_t check_tree(const vm_area_t *node, uint64_t *last_end, uint32_t *count) {
+    if (node == NULL) {
+        return 0;
+    }
+
+    int32_t left = check_tree(node->left, last_end, count);
+
+    HOST_CHECK(node->start >= *last_end && node->start < node->end);
+    *last_end = node->end;
+    (*count)++;
+
+    int32_t right = check_tree(node->right, last_end, count);
+
+    HOST_CHECK(left - right <= 1 && right - left <= 1);
+    HOST_CHECK(node->height == 1 + (left > right ? left : right));
+
+    return node->height;
+}
+
+static void check_areas(mm_t *mm, uint32_t expected) {
+    uint64_t last_end = 0;
+    uint32_t count = 0;
+    int32_t height = check_tree(mm->vma_root, &last_end, &count);
+    int32_t limit = 2;
+
+    // AVL树的高度不超过1.44 * log2(n + 2)
+    for (uint32_t n = count + 2; n > 1; n >>= 1) {
+        limit += 2;
+    }
+
+    HOST_CHECK(count == expected);
+    HOST_CHECK(height <= limit);
+}
+
+static void test_vma_tree(void) {
+    static uint32_t order[TREE_AREAS];
+    uint64_t seed = 0xC0FFEEULL;
+    uint64_t stride = 4 * PAGE_SIZE;
+    mm_t mm;
+
+    mm_setup(&mm);
+
+    // 乱序插入，每个区域两页，之间空两页
+    for (uint32_t i = 0; i < TREE_AREAS; i++) {
+        order[i] = i;
+    }
+
+    for (uint32_t i = TREE_AREAS - 1; i > 0; i--) {
+        uint32_t j = rand64(&seed) % (i + 1);
+        uint32_t tmp = order[i];
+
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+
+    for (uint32_t i = 0; i < TREE_AREAS; i++) {
+        HOST_CHECK(vmm_reserve(&mm, TEST_VIRT + order[i] * stride, 2 * PAGE_SIZE, VM_WRITE));
+    }
+    check_areas(&mm, TREE_AREAS);
+
+    // 和已有区域重叠
+    HOST_CHECK(!vmm_reserve(&mm, TEST_VIRT + PAGE_SIZE, 2 * PAGE_SIZE, 0));
+    HOST_CHECK(!vmm_reserve(&mm, TEST_VIRT - PAGE_SIZE, 2 * PAGE_SIZE, 0));
+    HOST_CHECK(!vmm_reserve(&mm, TEST_VIRT + stride - PAGE_SIZE, 4 * PAGE_SIZE, 0));
+    HOST_CHECK(!vmm_reserve(&mm, TEST_VIRT + 1, PAGE_SIZE, 0));
+    check_areas(&mm, TREE_AREAS);
+
+    for (uint32_t i = 0; i < TREE_AREAS; i++) {
+        uint64_t start = TEST_VIRT + i * stride;
+
+        HOST_CHECK(vma_find(&mm, start)->start == start);
+        HOST_CHECK(vma_find(&mm, start + 2 * PAGE_SIZE - 1)->start == start);
+        HOST_CHECK(vma_find(&mm, start + 2 * PAGE_SIZE) == NULL);
+    }
+
+    // 从区域中间释放，一分为二
+    HOST_CHECK(vmm_reserve(&mm, TEST_VIRT + GB, 16 * PAGE_SIZE, 0));
+    HOST_CHECK(vmm_release(&mm, TEST_VIRT + GB + 4 * PAGE_SIZE, 4 * PAGE_SIZE));
+    HOST_CHECK(vma_find(&mm, TEST_VIRT + GB + 3 * PAGE_SIZE)->end == TEST_VIRT + GB + 4 * PAGE_SIZE);
+    HOST_CHECK(vma_find(&mm, TEST_VIRT + GB + 4 * PAGE_SIZE) == NULL);
+    HOST_CHECK(vma_find(&mm, TEST_VIRT + GB + 8 * PAGE_SIZE)->start == TEST_VIRT + GB + 8 * PAGE_SIZE);
+    check_areas(&mm, TREE_AREAS + 2);
+
+    // 跨过多个区域释放，最后一个区域截掉开头
+    HOST_CHECK(vmm_release(&mm, TEST_VIRT, 400 * stride + PAGE_SIZE));
+    HOST_CHECK(vma_find(&mm, TEST_VIRT + 400 * stride) == NULL);
+    HOST_CHECK(vma_find(&mm, TEST_VIRT + 400 * stride + PAGE_SIZE)->start ==
+               TEST_VIRT + 400 * stride + PAGE_SIZE);
+    check_areas(&mm, TREE_AREAS + 2 - 400);
+
+    HOST_CHECK(vmm_release(&mm, TEST_VIRT, 2 * GB));
+    check_areas(&mm, 0);
+
+    mm_cleanup(&mm, "vma tree");
+}
+
+// 预留不占内存，第一次访问时分配
+static void test_demand(void) {
+    mm_t mm;
+    uint64_t phys;
+
+    mm_setup(&mm);
+
+    HOST_CHECK(vmm_reserve(&mm, TEST_VIRT, GB, VM_WRITE | VM_NOHUGE));
+    HOST_CHECK(vmm_reserve(&mm, TEST_VIRT + GB, 2 * MB, VM_NOHUGE));
+    HOST_CHECK(count_tables(mm.pgd, 3) == 1);
+    check_unmapped(&mm, TEST_VIRT);
+
+    uint64_t reserved = free_pages_now();
+
+    HOST_CHECK(vmm_fault(&mm, TEST_VIRT + 123, 0));
+    HOST_CHECK(vmm_fault(&mm, TEST_VIRT + 5 * MB + 8, VM_WRITE));
+    HOST_CHECK(vmm_translate(&mm, TEST_VIRT + 5 * MB, &phys, NULL, NULL));
+
+    uint64_t *page = host_page(phys / PAGE_SIZE);
+    for (uint32_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++) {
+        HOST_CHECK(page[i] == 0);
+    }
+
+    // 两页，PDPT、PD和两个PT
+    uint64_t mapped = free_pages_now();
+    HOST_CHECK(reserved - mapped == 2 + 4);
+
+    // 已经有映射的页不再分配
+    HOST_CHECK(vmm_fault(&mm, TEST_VIRT + 5 * MB, VM_WRITE));
+    HOST_CHECK(free_pages_now() == mapped);
+
+    // 只取消映射或者被替换时同样放掉缺页分配的页，取消映射时空了的PT一起释放
+    HOST_CHECK(vmm_unmap_pages(&mm, TEST_VIRT + 5 * MB, PAGE_SIZE));
+    HOST_CHECK(free_pages_now() == mapped + 2);
+    HOST_CHECK(vmm_fault(&mm, TEST_VIRT + 5 * MB, VM_WRITE));
+    HOST_CHECK(free_pages_now() == mapped);
+    HOST_CHECK(vmm_map_pages(&mm, TEST_VIRT + 5 * MB, TEST_PHYS, PAGE_SIZE, VM_WRITE));
+    HOST_CHECK(free_pages_now() == mapped + 1);
+    HOST_CHECK(vmm_unmap_pages(&mm, TEST_VIRT + 5 * MB, PAGE_SIZE));
+    HOST_CHECK(vmm_fault(&mm, TEST_VIRT + 5 * MB, VM_WRITE));
+    HOST_CHECK(free_pages_now() == mapped);
+
+    // 区域不允许的访问和区域外的地址
+    HOST_CHECK(!vmm_fault(&mm, TEST_VIRT + GB, VM_WRITE));
+    HOST_CHECK(vmm_fault(&mm, TEST_VIRT + GB, 0));
+    uint32_t prot;
+    HOST_CHECK(vmm_translate(&mm, TEST_VIRT + GB, NULL, NULL, &prot) && prot == 0);
+    HOST_CHECK(!vmm_fault(&mm, TEST_VIRT + GB, VM_WRITE));
+    HOST_CHECK(!vmm_fault(&mm, TEST_VIRT, VM_USER));
+    HOST_CHECK(!vmm_fault(&mm, TEST_VIRT + GB + 2 * MB, 0));
+    HOST_CHECK(!vmm_fault(&mm, TEST_VIRT - PAGE_SIZE, 0));
+
+    // 释放后页和页表都还给伙伴系统
+    HOST_CHECK(vmm_release(&mm, TEST_VIRT, GB + 2 * MB));
+    HOST_CHECK(free_pages_now() == reserved);
+
+    mm_cleanup(&mm, "demand");
+}
+
+/*
+ * 多个核心按不同顺序访问同一批页
+ * 每页只能分配一次，输掉的核心释放自己分配的页
+ */
+static void *fault_worker(void *arg) {
+    worker_t *worker = arg;
+
+    host_set_cpu(worker->cpu);
+
+    for (uint32_t i = 0; i < FAULT_PAGES; i++) {
+        uint32_t index = (i * 7 + worker->cpu * 131) % FAULT_PAGES;
+
+        HOST_CHECK(vmm_fault(worker->mm, TEST_VIRT + index * PAGE_SIZE + 8, VM_WRITE));
+    }
+
+    pmm_drain_local_pages();
+    return NULL;
+}
+
+static void test_fault_concurrent(void) {
+    mm_t mm;
+    pthread_t threads[TEST_CPUS];
+    worker_t workers[TEST_CPUS];
+
+    mm_setup(&mm);
+    HOST_CHECK(vmm_reserve(&mm, TEST_VIRT, FAULT_PAGES * PAGE_SIZE, VM_WRITE | VM_NOHUGE));
+
+    uint64_t reserved = free_pages_now();
+
+    for (uint32_t cpu = 0; cpu < TEST_CPUS; cpu++) {
+        workers[cpu] = (worker_t){ &mm, cpu };
+        HOST_CHECK(pthread_create(&threads[cpu], NULL, fault_worker, &workers[cpu]) == 0);
+    }
+
+    for (uint32_t cpu = 0; cpu < TEST_CPUS; cpu++) {
+        pthread_join(threads[cpu], NULL);
+    }
+
+    // 每页一个物理页，PDPT、PD和两个PT
+    HOST_CHECK(reserved - free_pages_now() == FAULT_PAGES + 4);
+
+    // 每页写入自己的序号，没有两个虚拟页共用一个物理页
+    for (uint32_t i = 0; i < FAULT_PAGES; i++) {
+        uint64_t phys;
+
+        HOST_CHECK(vmm_translate(&mm, TEST_VIRT + i * PAGE_SIZE, &phys, NULL, NULL));
+        *(uint64_t *)host_page(phys / PAGE_SIZE) = i;
+    }
+
+    for (uint32_t i = 0; i < FAULT_PAGES; i++) {
+        uint64_t phys;
+
+        HOST_CHECK(vmm_translate(&mm, TEST_VIRT + i * PAGE_SIZE, &phys, NULL, NULL));
+        HOST_CHECK(*(uint64_t *)host_page(phys / PAGE_SIZE) == i);
+    }
+
+    // 释放的页超过一个批次，中途会先刷新一次
+    uint64_t flushes = host_tlb_flushes;
+
+    HOST_CHECK(vmm_release(&mm, TEST_VIRT, FAULT_PAGES * PAGE_SIZE));
+    HOST_CHECK(host_tlb_flushes > flushes + 1);
+    HOST_CHECK(free_pages_now() == reserved);
+
+    mm_cleanup(&mm, "fault concurrent");
+}
+
+// 页的物理地址，没有映射时失败
+static uint64_t page_phys(mm_t *mm, uint64_t virt) {
+    uint64_t phys;
+
+    HOST_CHECK(vmm_translate(mm, virt, &phys, NULL, NULL));
+    return phys;
+}
+
+static uint32_t page_prot(mm_t *mm, uint64_t virt) {
+    uint32_t prot;
+
+    HOST_CHECK(vmm_translate(mm, virt, NULL, NULL, &prot));
+    return prot;
+}
+
+static uint64_t *page_data(mm_t *mm, uint64_t virt) {
+    return host_page(page_phys(mm, virt) / PAGE_SIZE);
+}
+
+/*
+ * 复制地址空间后页只读共享
+ * 写入的一方复制，最后一个映射直接恢复写权限
+ */
+static void test_fork(void) {
+    const uint32_t flags = VM_WRITE | VM_USER;
+
+    // 对象缓存第一次分配时会留下slab页
+    mm_destroy(mm_create());
+    uint64_t before = free_pages_now();
+
+    mm_t *parent = mm_create();
+    HOST_CHECK(parent != NULL);
+    HOST_CHECK(vmm_reserve(parent, USER_VIRT, COW_PAGES * PAGE_SIZE, flags));
+
+    // 只访问前一半
+    for (uint32_t i = 0; i < COW_PAGES / 2; i++) {
+        HOST_CHECK(vmm_fault(parent, USER_VIRT + i * PAGE_SIZE, flags));
+        *page_data(parent, USER_VIRT + i * PAGE_SIZE) = i;
+    }
+
+    uint64_t populated = free_pages_now();
+    mm_t *child = mm_fork(parent);
+    HOST_CHECK(child != NULL);
+
+    // 子地址空间只有页表是新分配的：PML4、PDPT、PD、PT
+    HOST_CHECK(populated - free_pages_now() == 4);
+
+    for (uint32_t i = 0; i < COW_PAGES / 2; i++) {
+        uint64_t virt = USER_VIRT + i * PAGE_SIZE;
+        uint64_t pfn = page_phys(parent, virt) / PAGE_SIZE;
+
+        HOST_CHECK(page_phys(child, virt) == pfn * PAGE_SIZE);
+        HOST_CHECK(page_prot(parent, virt) == VM_USER);
+        HOST_CHECK(page_prot(child, virt) == VM_USER);
+        HOST_CHECK(pmm_page_ref(pfn) == 2 && pmm_page_mapcount(pfn) == 2);
+    }
+
+    check_unmapped(child, USER_VIRT + COW_PAGES / 2 * PAGE_SIZE);
+    HOST_CHECK(vma_find(child, USER_VIRT + (COW_PAGES - 1) * PAGE_SIZE) != NULL);
+
+    // 读不复制
+    HOST_CHECK(vmm_fault(child, USER_VIRT, VM_USER));
+    HOST_CHECK(page_phys(child, USER_VIRT) == page_phys(parent, USER_VIRT));
+
+    // 子写入时复制，内容保留
+    uint64_t shared = page_phys(parent, USER_VIRT);
+    uint64_t free = free_pages_now();
+
+    HOST_CHECK(vmm_fault(child, USER_VIRT, flags));
+    HOST_CHECK(free - free_pages_now() == 1);
+    HOST_CHECK(page_phys(child, USER_VIRT) != shared);
+    HOST_CHECK(page_prot(child, USER_VIRT) == flags);
+    HOST_CHECK(*page_data(child, USER_VIRT) == 0);
+    HOST_CHECK(pmm_page_ref(shared / PAGE_SIZE) == 1 && pmm_page_mapcount(shared / PAGE_SIZE) == 1);
+
+    // 父是最后一个映射，不复制
+    free = free_pages_now();
+    HOST_CHECK(vmm_fault(parent, USER_VIRT, flags));
+    HOST_CHECK(free_pages_now() == free);
+    HOST_CHECK(page_phys(parent, USER_VIRT) == shared);
+    HOST_CHECK(page_prot(parent, USER_VIRT) == flags);
+
+    // 两边的写入互不影响
+    *page_data(child, USER_VIRT) = 100;
+    *page_data(parent, USER_VIRT) = 200;
+    HOST_CHECK(*page_data(child, USER_VIRT) == 100);
+
+    // 没有访问过的页各自分配
+    HOST_CHECK(vmm_fault(child, USER_VIRT + (COW_PAGES - 1) * PAGE_SIZE, flags));
+    check_unmapped(parent, USER_VIRT + (COW_PAGES - 1) * PAGE_SIZE);
+
+    // 区域外的地址
+    HOST_CHECK(!vmm_fault(child, USER_VIRT + COW_PAGES * PAGE_SIZE, flags));
+
+    // 子先销毁，共享的页只放掉一个引用
+    mm_destroy(child);
+
+    for (uint32_t i = 1; i < COW_PAGES / 2; i++) {
+        uint64_t virt = USER_VIRT + i * PAGE_SIZE;
+        uint64_t pfn = page_phys(parent, virt) / PAGE_SIZE;
+
+        HOST_CHECK(pmm_page_ref(pfn) == 1 && pmm_page_mapcount(pfn) == 1);
+        HOST_CHECK(*page_data(parent, virt) == i);
+    }
+    HOST_CHECK(free_pages_now() == populated);
+
+    mm_destroy(parent);
+    HOST_CHECK(free_pages_now() == before);
+}
+
+// 同一个地址空间中复制区域
+static void test_dup_area(void) {
+    mm_t *mm = mm_create();
+    HOST_CHECK(mm != NULL);
+
+    uint64_t before = free_pages_now();
+    uint64_t copy = USER_VIRT + GB;
+
+    HOST_CHECK(vmm_reserve(mm, USER_VIRT, COW_PAGES * PAGE_SIZE, VM_WRITE));
+
+    for (uint32_t i = 0; i < 4; i++) {
+        HOST_CHECK(vmm_fault(mm, USER_VIRT + i * PAGE_SIZE, VM_WRITE));
+        *page_data(mm, USER_VIRT + i * PAGE_SIZE) = i + 1;
+    }
+
+    // 源不在一个区域中，和已有区域重叠
+    HOST_CHECK(!vmm_dup_area(mm, USER_VIRT, (COW_PAGES + 1) * PAGE_SIZE, copy));
+    HOST_CHECK(!vmm_dup_area(mm, USER_VIRT, 4 * PAGE_SIZE, USER_VIRT + 2 * PAGE_SIZE));
+    HOST_CHECK(!vmm_dup_area(mm, USER_VIRT + PAGE_SIZE, 4 * PAGE_SIZE, copy + 1));
+
+    HOST_CHECK(vmm_dup_area(mm, USER_VIRT + PAGE_SIZE, 4 * PAGE_SIZE, copy));
+    HOST_CHECK(vma_find(mm, copy + 3 * PAGE_SIZE)->flags == VM_WRITE);
+    HOST_CHECK(vma_find(mm, copy + 4 * PAGE_SIZE) == NULL);
+    HOST_CHECK(page_phys(mm, copy) == page_phys(mm, USER_VIRT + PAGE_SIZE));
+    HOST_CHECK(page_prot(mm, USER_VIRT + PAGE_SIZE) == 0);
+    HOST_CHECK(page_prot(mm, USER_VIRT) == VM_WRITE);
+    check_unmapped(mm, copy + 3 * PAGE_SIZE);
+
+    HOST_CHECK(vmm_fault(mm, copy, VM_WRITE));
+    HOST_CHECK(page_phys(mm, copy) != page_phys(mm, USER_VIRT + PAGE_SIZE));
+    *page_data(mm, copy) = 50;
+    HOST_CHECK(*page_data(mm, USER_VIRT + PAGE_SIZE) == 2);
+
+    // 释放源之后副本独占剩下的页
+    HOST_CHECK(vmm_release(mm, USER_VIRT, COW_PAGES * PAGE_SIZE));
+    HOST_CHECK(*page_data(mm, copy + PAGE_SIZE) == 3);
+    HOST_CHECK(pmm_page_ref(page_phys(mm, copy + PAGE_SIZE) / PAGE_SIZE) == 1);
+
+    HOST_CHECK(vmm_release(mm, copy, 4 * PAGE_SIZE));
+    HOST_CHECK(mm->vma_root == NULL);
+    HOST_CHECK(free_pages_now() == before);
+
+    mm_destroy(mm);
+}
+
+/*
+ * 多个核心同时写同一批共享页
+ * 每页只复制一次，输掉的核心放掉自己的副本
+ */
+static void *cow_worker(void *arg) {
+    worker_t *worker = arg;
+
+    host_set_cpu(worker->cpu);
+
+    for (uint32_t i = 0; i < FAULT_PAGES; i++) {
+        uint32_t index = (i * 7 + worker->cpu * 131) % FAULT_PAGES;
+
+        HOST_CHECK(vmm_fault(worker->mm, USER_VIRT + index * PAGE_SIZE, VM_WRITE));
+    }
+
+    pmm_drain_local_pages();
+    return NULL;
+}
+
+static void test_cow_concurrent(void) {
+    pthread_t threads[TEST_CPUS];
+    worker_t workers[TEST_CPUS];
+
+    mm_t *parent = mm_create();
+    HOST_CHECK(parent != NULL);
+    HOST_CHECK(vmm_reserve(parent, USER_VIRT, FAULT_PAGES * PAGE_SIZE, VM_WRITE));
+
+    for (uint32_t i = 0; i < FAULT_PAGES; i++) {
+        HOST_CHECK(vmm_fault(parent, USER_VIRT + i * PAGE_SIZE, VM_WRITE));
+        *page_data(parent, USER_VIRT + i * PAGE_SIZE) = i;
+    }
+
+    mm_t *child = mm_fork(parent);
+    HOST_CHECK(child != NULL);
+
+    uint64_t forked = free_pages_now();
+
+    for (uint32_t cpu = 0; cpu < TEST_CPUS; cpu++) {
+        workers[cpu] = (worker_t){ child, cpu };
+        HOST_CHECK(pthread_create(&threads[cpu], NULL, cow_worker, &workers[cpu]) == 0);
+    }
+
+    for (uint32_t cpu = 0; cpu < TEST_CPUS; cpu++) {
+        pthread_join(threads[cpu], NULL);
+    }
+
+    HOST_CHECK(forked - free_pages_now() == FAULT_PAGES);
+
+    for (uint32_t i = 0; i < FAULT_PAGES; i++) {
+        uint64_t virt = USER_VIRT + i * PAGE_SIZE;
+        uint64_t pfn = page_phys(parent, virt) / PAGE_SIZE;
+
+        HOST_CHECK(page_phys(child, virt) != pfn * PAGE_SIZE);
+        HOST_CHECK(*page_data(child, virt) == i);
+        HOST_CHECK(pmm_page_ref(pfn) == 1 && pmm_page_mapcount(pfn) == 1);
+    }
+
+    // 父中的页都只剩一个映射，写入不再分配
+    uint64_t copied = free_pages_now();
+
+    for (uint32_t i = 0; i < FAULT_PAGES; i++) {
+        HOST_CHECK(vmm_fault(parent, USER_VIRT + i * PAGE_SIZE, VM_WRITE));
+    }
+    HOST_CHECK(free_pages_now() == copied);
+
+    mm_destroy(child);
+    mm_destroy(parent);
+}
+
+// 2MB页中第i个4KB页的内容
+static uint64_t *huge_data(mm_t *mm, uint64_t huge, uint32_t i) {
+    uint64_t phys;
+
+    HOST_CHECK(vmm_translate(mm, huge, &phys, NULL, NULL));
+    return host_page(phys / PAGE_SIZE + i);
+}
+
+static uint64_t page_size_of(mm_t *mm, uint64_t virt) {
+    uint64_t size;
+
+    HOST_CHECK(vmm_translate(mm, virt, NULL, &size, NULL));
+    return size;
+}
+
+/*
+ * 2MB对齐的范围直接分配2MB页
+ * 部分释放或修改属性时拆成4KB页，填满后再合并回来
+ */
+static void test_thp(void) {
+    const uint32_t flags = VM_WRITE | VM_USER;
+    uint64_t huge = USER_VIRT;
+
+    mm_t *mm = mm_create();
+    HOST_CHECK(mm != NULL);
+
+    uint64_t before = free_pages_now();
+
+    HOST_CHECK(vmm_reserve(mm, huge, 2 * HUGE_PAGE_SIZE, flags));
+    HOST_CHECK(vmm_reserve(mm, huge + GB + PAGE_SIZE, HUGE_PAGE_SIZE, flags));
+
+    // 一个2MB页，PDPT和PD
+    HOST_CHECK(vmm_fault(mm, huge + 3 * PAGE_SIZE + 8, flags));
+    HOST_CHECK(page_size_of(mm, huge) == HUGE_PAGE_SIZE);
+    HOST_CHECK(before - free_pages_now() == 512 + 2);
+
+    uint64_t head = page_phys(mm, huge) / PAGE_SIZE;
+
+    HOST_CHECK((head & 511) == 0);
+    HOST_CHECK(pmm_page_ref(head) == 1 && pmm_page_mapcount(head) == 1);
+
+    for (uint32_t i = 0; i < 512; i++) {
+        HOST_CHECK(*huge_data(mm, huge, i) == 0);
+        *huge_data(mm, huge, i) = i;
+    }
+
+    // 不完全在区域内的2MB范围只用4KB页
+    HOST_CHECK(vmm_fault(mm, huge + GB + HUGE_PAGE_SIZE, flags));
+    HOST_CHECK(page_size_of(mm, huge + GB + HUGE_PAGE_SIZE) == PAGE_SIZE);
+
+    // 释放一页，大页拆开，其他页各自持有引用
+    uint64_t populated = free_pages_now();
+
+    HOST_CHECK(vmm_release(mm, huge + 10 * PAGE_SIZE, PAGE_SIZE));
+    HOST_CHECK(page_size_of(mm, huge) == PAGE_SIZE);
+    check_unmapped(mm, huge + 10 * PAGE_SIZE);
+    HOST_CHECK(free_pages_now() == populated);
+    HOST_CHECK(*page_data(mm, huge + 11 * PAGE_SIZE) == 11);
+    HOST_CHECK(pmm_page_ref(head + 11) == 1 && pmm_page_mapcount(head + 11) == 1);
+
+    // 区域被截短，重新预留那一页
+    HOST_CHECK(vmm_reserve(mm, huge + 10 * PAGE_SIZE, PAGE_SIZE, flags));
+
+    // 修改一页的属性同样拆分
+    uint64_t second = huge + HUGE_PAGE_SIZE;
+
+    HOST_CHECK(vmm_fault(mm, second, flags));
+    HOST_CHECK(page_size_of(mm, second) == HUGE_PAGE_SIZE);
+    HOST_CHECK(vmm_protect(mm, second + PAGE_SIZE, PAGE_SIZE, VM_USER));
+    HOST_CHECK(page_size_of(mm, second) == PAGE_SIZE);
+    HOST_CHECK(page_prot(mm, second + PAGE_SIZE) == VM_USER);
+    HOST_CHECK(page_prot(mm, second) == flags);
+
+    /*
+     * 第二个2MB填满了，合并后按区域的属性映射
+     * 第一个2MB缺一页，补上后区域已经被拆成三段，也不合并
+     */
+    HOST_CHECK(vmm_fault(mm, huge + 10 * PAGE_SIZE, flags));
+
+    uint64_t split = free_pages_now();
+
+    HOST_CHECK(vma_collapse_scan(mm, 0, 8) == 0);
+    HOST_CHECK(page_size_of(mm, second) == HUGE_PAGE_SIZE);
+    HOST_CHECK(page_prot(mm, second + PAGE_SIZE) == flags);
+    HOST_CHECK(page_size_of(mm, huge) == PAGE_SIZE);
+    HOST_CHECK(free_pages_now() == split + 1);
+
+    // 区域不用大页
+    HOST_CHECK(vmm_release(mm, huge, HUGE_PAGE_SIZE));
+    HOST_CHECK(vmm_reserve(mm, huge, HUGE_PAGE_SIZE, flags | VM_NOHUGE));
+
+    for (uint32_t i = 0; i < 512; i++) {
+        HOST_CHECK(vmm_fault(mm, huge + i * PAGE_SIZE, flags));
+    }
+    HOST_CHECK(page_size_of(mm, huge) == PAGE_SIZE);
+    HOST_CHECK(vma_collapse_scan(mm, 0, 8) == 0);
+    HOST_CHECK(page_size_of(mm, huge) == PAGE_SIZE);
+
+    // 复制地址空间后页被共享，不合并
+    HOST_CHECK(vmm_release(mm, huge, HUGE_PAGE_SIZE));
+    HOST_CHECK(vmm_reserve(mm, huge, HUGE_PAGE_SIZE, flags));
+    HOST_CHECK(vmm_fault(mm, huge, flags));
+    HOST_CHECK(page_size_of(mm, huge) == HUGE_PAGE_SIZE);
+
+    for (uint32_t i = 0; i < 512; i++) {
+        *huge_data(mm, huge, i) = i;
+    }
+
+    mm_t *child = mm_fork(mm);
+    HOST_CHECK(child != NULL);
+    HOST_CHECK(page_size_of(mm, huge) == PAGE_SIZE);
+    HOST_CHECK(page_phys(child, huge + 5 * PAGE_SIZE) == page_phys(mm, huge + 5 * PAGE_SIZE));
+    HOST_CHECK(vma_collapse_scan(mm, 0, 8) == 0);
+    HOST_CHECK(page_size_of(mm, huge) == PAGE_SIZE);
+
+    /*
+     * 子地址空间销毁后页只有一个映射，由后台合并
+     * 复制时两个2MB页都被拆开了，合并后各自释放一个页表
+     */
+    mm_destroy(child);
+    split = free_pages_now();
+
+    for (uint32_t i = 0; i < 16 && page_size_of(mm, huge) != HUGE_PAGE_SIZE; i++) {
+        mm_collapse_work();
+    }
+
+    HOST_CHECK(page_size_of(mm, huge) == HUGE_PAGE_SIZE);
+    HOST_CHECK(page_size_of(mm, second) == HUGE_PAGE_SIZE);
+    HOST_CHECK(page_prot(mm, huge) == flags);
+    HOST_CHECK(free_pages_now() == split + 2);
+
+    head = page_phys(mm, huge) / PAGE_SIZE;
+    HOST_CHECK(pmm_page_ref(head) == 1 && pmm_page_mapcount(head) == 1);
+
+    for (uint32_t i = 0; i < 512; i++) {
+        HOST_CHECK(*huge_data(mm, huge, i) == i);
+    }
+
+    HOST_CHECK(vmm_release(mm, huge, 2 * HUGE_PAGE_SIZE));
+    HOST_CHECK(vmm_release(mm, huge + GB, 2 * HUGE_PAGE_SIZE));
+    HOST_CHECK(free_pages_now() == before);
+
+    mm_destroy(mm);
+}
+
+// zone中order不小于min_order的空闲块数
+static uint64_t free_blocks_from(uint8_t zone, uint8_t min_order) {
+    zone_info_t info;
+    uint64_t count = 0;
+
+    HOST_CHECK(pmm_zone_info(zone, &info));
+    for (uint8_t order = min_order; order < MAX_ORDER; order++) {
+        count += info.nr_free[order];
+    }
+    return count;
+}
+
+// 压缩后每页还在原来的虚拟地址，内容不变
+static void check_compacted(mm_t *mm, uint64_t count, uint64_t pfn, uint64_t pages) {
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t virt = USER_VIRT + i * PAGE_SIZE;
+        uint64_t phys;
+
+        if (!vmm_translate(mm, virt, &phys, NULL, NULL)) {
+            continue;
+        }
+        HOST_CHECK(phys / PAGE_SIZE < pfn || phys / PAGE_SIZE >= pfn + pages);
+        HOST_CHECK(*(uint64_t *)host_page(phys / PAGE_SIZE) == i);
+        HOST_CHECK(pmm_page_ref(phys / PAGE_SIZE) == 1 && pmm_page_mapcount(phys / PAGE_SIZE) == 1);
+    }
+}
+
+/*
+ * 压缩
+ * DMA zone的空闲页全部映射到用户地址空间，再释放奇数页，没有两个空闲页能合并
+ * 不可移动的高order分配直接压缩，可移动的由后台压缩
+ */
+static void test_compact(void) {
+    const uint32_t flags = VM_WRITE | VM_USER;
+
+    mm_t *mm = mm_create();
+    HOST_CHECK(mm != NULL);
+
+    uint64_t before = free_pages_now();
+    zone_info_t info;
+
+    HOST_CHECK(pmm_zone_info(ZONE_DMA, &info));
+
+    uint64_t count = info.free_pages;
+
+    HOST_CHECK(vmm_reserve(mm, USER_VIRT, count * PAGE_SIZE, flags | VM_NOHUGE));
+
+    // 和缺页处理一样按可移动类型分配并映射
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t pfn = pmm_alloc_pages_type(0, ZONE_DMA, MIGRATE_MOVABLE);
+
+        HOST_CHECK(pfn != 0);
+        HOST_CHECK(pmm_pageblock_type(pfn) == MIGRATE_MOVABLE);
+        *(uint64_t *)host_page(pfn) = i;
+        pmm_page_map(pfn);
+        HOST_CHECK(vmm_map_absent(mm, USER_VIRT + i * PAGE_SIZE, pfn * PAGE_SIZE, PAGE_SIZE, flags));
+    }
+    HOST_CHECK(pmm_alloc_pages_type(0, ZONE_DMA, MIGRATE_MOVABLE) == 0);
+
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t virt = USER_VIRT + i * PAGE_SIZE;
+
+        if (page_phys(mm, virt) / PAGE_SIZE & 1) {
+            HOST_CHECK(vmm_free_pages(mm, virt, PAGE_SIZE));
+        }
+    }
+    pmm_drain_local_pages();
+    HOST_CHECK(free_blocks_from(ZONE_DMA, 1) == 0);
+    HOST_CHECK(free_blocks_from(ZONE_DMA, 0) > (1 << COMPACT_MIN_ORDER));
+
+    // 有退路的分配不直接压缩
+    HOST_CHECK(pmm_try_alloc_pages(COMPACT_MIN_ORDER, ZONE_DMA, MIGRATE_UNMOVABLE) == 0);
+    HOST_CHECK(free_blocks_from(ZONE_DMA, 1) == 0);
+
+    // 直接压缩腾出一个块，其中的页换到其他zone
+    uint64_t block = pmm_alloc_pages(COMPACT_MIN_ORDER, ZONE_DMA);
+
+    HOST_CHECK(block != 0);
+    HOST_CHECK((block & ((1 << COMPACT_MIN_ORDER) - 1)) == 0);
+    HOST_CHECK(pmm_pageblock_type(block) == MIGRATE_MOVABLE);
+    check_compacted(mm, count, block, 1 << COMPACT_MIN_ORDER);
+
+    // 可移动的分配失败只请求后台压缩
+    HOST_CHECK(pmm_alloc_pages_type(PAGEBLOCK_ORDER, ZONE_DMA, MIGRATE_MOVABLE) == 0);
+
+    for (uint32_t i = 0; i < 64 && free_blocks_from(ZONE_DMA, PAGEBLOCK_ORDER) == 0; i++) {
+        compact_work();
+    }
+
+    uint64_t huge = pmm_alloc_pages_type(PAGEBLOCK_ORDER, ZONE_DMA, MIGRATE_MOVABLE);
+
+    HOST_CHECK(huge != 0);
+    check_compacted(mm, count, huge, PAGEBLOCK_PAGES);
+
+    // 请求已经满足，后台不再迁移
+    uint64_t idle = free_pages_now();
+
+    compact_work();
+    HOST_CHECK(free_pages_now() == idle);
+
+    pmm_free_pages(block);
+    pmm_free_pages(huge);
+    HOST_CHECK(vmm_release(mm, USER_VIRT, count * PAGE_SIZE));
+    HOST_CHECK(free_pages_now() == before);
+
+    mm_destroy(mm);
+}
+
+int main(void) {
+    host_pmm_init(TEST_MEMORY, TEST_CPUS);
+    host_set_cpu(0);
+    kmem_cache_init();
+    vma_init();
+    mm_init();
+
+    // 新地址空间从kernel_mm复制高半部分
+    mm_setup(&kernel_mm);
+
+    pmm_drain_local_pages();
+    baseline_free = host_free_pages();
+
+    test_leaf_sizes();
+    test_split();
+    test_invalid();
+    test_model();
+    test_concurrent();
+    test_vma_tree();
+    test_demand();
+    test_fault_concurrent();
+    test_fork();
+    test_dup_area();
+    test_cow_concurrent();
+    test_thp();
+    test_compact();
+
+    printf("vmm_test: all tests passed\n");
+    return 0;
+}
@@ -0,0 +1,52 @@
+#!/bin/sh
+# SPDX-License-Identifier: Apache-2.0
+#
+# 在QEMU中以bench模式启动内核，把串口输出写到文件
+#
+# 用法：tools/bench.sh <kernel.elf> <核心数> <串口输出文件>
+# 在项目根目录执行，由CMake的bench目标调用
+
+set -e
+
+KERNEL=$1
+SMP=${2:-4}
+OUTPUT=${3:-bench_output.txt}
+TIMEOUT=${BENCH_TIMEOUT:-600}
+
+if [ -z "$KERNEL" ]; then
+    echo "usage: $0 <kernel.elf> [cores] [output]" >&2
+    exit 2
+fi
+
+# 配置与config/CONFIG相同，另外选择bench模式
+mkdir -p bench_root/sys
+cp "$KERNEL" bench_root/sys/core
+{ cat config/CONFIG; printf '\nmode=bench\n'; } > bench_root/sys/config
+
+disk/mkbootimg config/ShiziOS-bench.json disk/shizios-bench.img
+
+# 内核结束后写isa-debug-exit端口，QEMU以(0 << 1) | 1退出
+set +e
+timeout "$TIMEOUT" qemu-system-x86_64 \
+    -bios /usr/share/ovmf/OVMF.fd \
+    -drive file=disk/shizios-bench.img,format=raw,if=virtio \
+    -m 2G \
+    -cpu qemu64,+rdtscp \
+    -smp "$SMP" \
+    -display none \
+    -net none \
+    -no-reboot \
+    -device isa-debug-exit,iobase=0xf4,iosize=0x04 \
+    -serial file:"$OUTPUT"
+status=$?
+set -e
+
+if [ $status -eq 124 ]; then
+    echo "bench: QEMU timed out after ${TIMEOUT}s" >&2
+    exit 1
+fi
+
+if [ $status -ne 1 ]; then
+    echo "bench: QEMU exited with status $status" >&2
+    exit 1
+fi
@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: Apache-2.0
+#
+# 收集bench模式的输出，可选和基线比较
+#
+# 用法：
+#   tools/bench_collect.py bench_output.txt
+#   tools/bench_collect.py bench_output.txt --json results.json
+#   tools/bench_collect.py bench_output.txt --baseline results.json --threshold 10
+#
+# 输出格式见kernel/include/bench.h
+# 和基线比较时，p50比基线慢threshold%以上的项算作回退，返回1
+
+import argparse
+import json
+import sys
+
+STATS = ("min", "p50", "p90", "p99", "max", "mean")
+
+
+def parse(path):
+    """返回(开始行的字段, {项名: 字段}, 错误列表, 是否完整)"""
+    header = {}
+    results = {}
+    errors = []
+    complete = False
+
+    with open(path, "rb") as f:
+        text = f.read().decode("utf-8", errors="replace")
+
+    for line in text.splitlines():
+        line = line.strip()
+
+        if line.startswith("BENCH_BEGIN"):
+            header = fields(line)
+            results = {}
+            errors = []
+            complete = False
+        elif line.startswith("BENCH_ERROR"):
+            errors.append(line)
+        elif line.startswith("BENCH_END"):
+            complete = True
+        elif line.startswith("BENCH "):
+            item = fields(line)
+            name = item.pop("name", "?")
+            params = [k for k in item if k not in STATS and k != "n"]
+            key = name + "".join(" %s=%s" % (k, item[k]) for k in params)
+            results[key] = {k: int(v) for k, v in item.items() if v.isdigit()}
+
+    return header, results, errors, complete
+
+
+def fields(line):
+    out = {}
+    for token in line.split()[1:]:
+        if "=" in token:
+            k, v = token.split("=", 1)
+            out[k] = v
+    return out
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Collect ShiziOS in-kernel benchmark results")
+    parser.add_argument("log", help="serial output of a bench boot")
+    parser.add_argument("--json", help="write the results to this file")
+    parser.add_argument("--baseline", help="results file from an earlier run to compare against")
+    parser.add_argument("--threshold", type=float, default=10.0,
+                        help="p50 slowdown in percent counted as a regression (default 10)")
+    args = parser.parse_args()
+
+    header, results, errors, complete = parse(args.log)
+
+    if not results:
+        sys.stderr.write("bench: no results in %s\n" % args.log)
+        return 1
+
+    baseline = {}
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)["results"]
+
+    print("cpus=%s overhead=%s cycles" % (header.get("cpus", "?"), header.get("overhead", "?")))
+    print("%-36s %8s %8s %8s %8s %8s" % ("benchmark", "p50", "p90", "p99", "mean", "vs base"))
+
+    regressions = []
+    for key, r in results.items():
+        line = "%-36s %8s %8s %8s %8s" % (key, r.get("p50", "-"), r.get("p90", "-"),
+                                          r.get("p99", "-"), r.get("mean", "-"))
+        base = baseline.get(key)
+        if base and base.get("p50") and "p50" in r:
+            change = (r["p50"] - base["p50"]) * 100.0 / base["p50"]
+            line += " %+7.1f%%" % change
+            if change > args.threshold:
+                regressions.append((key, base["p50"], r["p50"], change))
+        print(line)
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump({"header": header, "results": results}, f, indent=2, sort_keys=True)
+
+    status = 0
+
+    for error in errors:
+        sys.stderr.write("bench: %s\n" % error)
+        status = 1
+
+    if not complete:
+        sys.stderr.write("bench: output ended before BENCH_END\n")
+        status = 1
+
+    for key, old, new, change in regressions:
+        sys.stderr.write("bench: regression %s p50 %d -> %d (%+.1f%%)\n" % (key, old, new, change))
+        status = 1
+
+    return status
+
+
+if __name__ == "__main__":
+    sys.exit(main())
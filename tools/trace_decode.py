@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: Apache-2.0
+#
+# 解码trace_dump输出的跟踪帧
+#
+# 用法：
+#   qemu ... -serial file:serial.log
+#   tools/trace_decode.py serial.log            按时间顺序输出所有事件
+#   tools/trace_decode.py --summary serial.log  按事件和order统计
+#
+# 帧格式见kernel/include/trace.h
+
+import argparse
+import struct
+import sys
+from collections import Counter
+
+MAGIC = b"STRC"
+VERSION = 1
+
+# trace_frame_t
+FRAME = struct.Struct("<4sBBHIIQ")
+# trace_record_t
+RECORD = struct.Struct("<QQIBBBB")
+
+EVENTS = ["pmm_alloc", "pmm_free", "buddy_split", "buddy_merge", "kheap_alloc"]
+ZONES = ["DMA", "DMA32", "NORMAL"]
+
+
+def parse_frames(data):
+    """在串口输出中查找帧，返回(cpu, seq, tsc, event, pfn, arg, order, zone)列表和丢失的记录数"""
+    records = []
+    next_seq = {}
+    lost = 0
+    pos = data.find(MAGIC)
+
+    while pos >= 0:
+        if pos + FRAME.size > len(data):
+            break
+
+        _, version, record_size, cpu, count, _, seq = FRAME.unpack_from(data, pos)
+        body = pos + FRAME.size
+        end = body + count * record_size
+
+        if version != VERSION or record_size != RECORD.size or end > len(data):
+            pos = data.find(MAGIC, pos + 1)
+            continue
+
+        # 序号不连续说明缓冲区被覆盖过
+        if cpu in next_seq and seq > next_seq[cpu]:
+            lost += seq - next_seq[cpu]
+        elif cpu not in next_seq and seq > 0:
+            lost += seq
+        next_seq[cpu] = seq + count
+
+        for i in range(count):
+            tsc, pfn, arg, event, order, zone, _ = RECORD.unpack_from(data, body + i * record_size)
+            records.append((cpu, seq + i, tsc, event, pfn, arg, order, zone))
+
+        pos = data.find(MAGIC, end)
+
+    return records, lost
+
+
+def event_name(event):
+    return EVENTS[event] if event < len(EVENTS) else "event%d" % event
+
+
+def zone_name(zone):
+    return ZONES[zone] if zone < len(ZONES) else "zone%d" % zone
+
+
+def print_events(records, out):
+    base = records[0][2] if records else 0
+
+    for cpu, seq, tsc, event, pfn, arg, order, zone in records:
+        line = "%14d cpu%-3d %-12s pfn=%#-12x order=%-2d %-6s" % (
+            tsc - base, cpu, event_name(event), pfn, order, zone_name(zone))
+        if event == 4:
+            line += " size=%d" % arg
+        out.write(line.rstrip() + "\n")
+
+
+def print_summary(records, out):
+    events = Counter()
+    orders = Counter()
+    failed = Counter()
+
+    for _, _, _, event, pfn, _, order, _ in records:
+        events[event] += 1
+        orders[(event, order)] += 1
+        if event in (0, 4) and pfn == 0:
+            failed[event] += 1
+
+    for event in sorted(events):
+        out.write("%-12s %10d" % (event_name(event), events[event]))
+        if failed[event]:
+            out.write("  failed %d" % failed[event])
+        out.write("\n")
+
+        for (e, order), n in sorted(orders.items()):
+            if e == event:
+                out.write("    order %-2d %10d\n" % (order, n))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode ShiziOS trace frames from a serial log")
+    parser.add_argument("log", help="serial output captured from QEMU")
+    parser.add_argument("--summary", action="store_true", help="print counts per event and order")
+    args = parser.parse_args()
+
+    with open(args.log, "rb") as f:
+        data = f.read()
+
+    records, lost = parse_frames(data)
+    # 各核心的TSC是同步的，可以直接合并排序
+    records.sort(key=lambda r: r[2])
+
+    if args.summary:
+        print_summary(records, sys.stdout)
+    else:
+        print_events(records, sys.stdout)
+
+    if lost:
+        sys.stderr.write("%d records overwritten before dump\n" % lost)
+
+
+if __name__ == "__main__":
+    main()